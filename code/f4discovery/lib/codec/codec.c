@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+
+#include <codec/codec.h>
+
+/* static declarations */
+static int8_t codec_put_bits(codec_enc_t* enc, uint32_t value, uint8_t n);
+static int8_t codec_get_bits(codec_dec_t* dec, uint8_t n, uint32_t* value);
+static int32_t codec_sign_extend(uint32_t value, uint8_t n);
+static int8_t codec_put_time(codec_enc_t* enc, int32_t dod);
+static int8_t codec_put_value(codec_enc_t* enc, int16_t value, int32_t delta);
+static int8_t codec_get_prefix(codec_dec_t* dec, uint8_t* prefix);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Start a block
+ * \param[out] enc encoder
+ * \param[out] buf block buffer, at least CODEC_HEADER_SIZE(channels) bytes
+ * \param[in] size size of buf
+ * \param[in] channels values per sample, 1..CODEC_CHANNELS_MAX
+ */
+void codec_enc_init(codec_enc_t* enc, uint8_t* buf, uint16_t size, uint8_t channels)
+{
+    if (channels > CODEC_CHANNELS_MAX)
+    {
+        channels = CODEC_CHANNELS_MAX;
+    }
+
+    enc->buf = buf;
+    enc->size = size;
+    enc->bits = 0;
+    enc->count = 0;
+    enc->channels = channels;
+    enc->last_time = 0;
+    enc->last_delta = 0;
+}
+
+/*!
+ * \brief Add a sample to the block
+ * \param[in,out] enc encoder
+ * \param[in] time timestamp, any unit
+ * \param[in] values channels values
+ * \retval 0  - OK
+ * \retval -1 - block full, sample not added
+ */
+int8_t codec_enc_put(codec_enc_t* enc, uint32_t time, const int16_t* values)
+{
+    uint32_t bits = enc->bits;
+    int32_t delta;
+    uint8_t i;
+
+    if (enc->count == 0)
+    {
+        /* keyframe, the count is filled in by codec_enc_finish() */
+        if (enc->size < CODEC_HEADER_SIZE(enc->channels))
+        {
+            return (-1);
+        }
+        (void)codec_put_bits(enc, 0, 16);
+        (void)codec_put_bits(enc, enc->channels, 8);
+        (void)codec_put_bits(enc, time, 32);
+        for (i = 0; i < enc->channels; i++)
+        {
+            (void)codec_put_bits(enc, (uint16_t)values[i], 16);
+        }
+        enc->last_delta = 0;
+    }
+    else
+    {
+        delta = (int32_t)(time - enc->last_time);
+
+        if (codec_put_time(enc, delta - enc->last_delta) != 0)
+        {
+            enc->bits = bits;
+            return (-1);
+        }
+        for (i = 0; i < enc->channels; i++)
+        {
+            if (codec_put_value(enc, values[i], (int32_t)values[i] - enc->last[i]) != 0)
+            {
+                enc->bits = bits;
+                return (-1);
+            }
+        }
+        enc->last_delta = delta;
+    }
+
+    enc->last_time = time;
+    for (i = 0; i < enc->channels; i++)
+    {
+        enc->last[i] = values[i];
+    }
+    enc->count++;
+
+    return (0);
+}
+
+/*!
+ * \brief Complete the block
+ * \param[in,out] enc encoder
+ * \returns block length in bytes, 0 for an empty block
+ */
+uint16_t codec_enc_finish(codec_enc_t* enc)
+{
+    uint16_t len = (uint16_t)((enc->bits + 7) / 8);
+
+    if (enc->count == 0)
+    {
+        return (0);
+    }
+
+    /* zero padding to the byte boundary */
+    if (enc->bits % 8)
+    {
+        enc->buf[enc->bits / 8] &= (uint8_t)(0xFF << (8 - enc->bits % 8));
+    }
+
+    enc->buf[0] = (uint8_t)(enc->count >> 8);
+    enc->buf[1] = (uint8_t)enc->count;
+
+    return (len);
+}
+
+/*!
+ * \brief Start reading a block
+ * \param[out] dec decoder
+ * \param[in] buf block
+ * \param[in] len length of the block
+ * \retval 0  - OK
+ * \retval -1 - not a valid block
+ */
+int8_t codec_dec_init(codec_dec_t* dec, const uint8_t* buf, uint16_t len)
+{
+    dec->buf = buf;
+    dec->len = len;
+    dec->bits = 0;
+    dec->keyframe = 1;
+
+    if (len < 3)
+    {
+        return (-1);
+    }
+
+    dec->count = (uint16_t)((buf[0] << 8) | buf[1]);
+    dec->channels = buf[2];
+
+    if (dec->count == 0 || dec->channels == 0 || dec->channels > CODEC_CHANNELS_MAX ||
+        len < CODEC_HEADER_SIZE(dec->channels))
+    {
+        return (-1);
+    }
+
+    dec->bits = 24;
+
+    return (0);
+}
+
+/*!
+ * \brief Read the next sample
+ * \param[in,out] dec decoder
+ * \param[out] time timestamp
+ * \param[out] values dec->channels values
+ * \retval 0  - OK
+ * \retval -1 - end of the block or block truncated, further calls fail as well
+ */
+int8_t codec_dec_get(codec_dec_t* dec, uint32_t* time, int16_t* values)
+{
+    static const uint8_t time_bits[] = { 0, 7, 12, 32 };
+    static const uint8_t value_bits[] = { 0, 3, 7, 16 };
+    uint32_t raw;
+    uint8_t prefix;
+    uint8_t i;
+    int32_t dod;
+
+    if (dec->count == 0)
+    {
+        return (-1);
+    }
+
+    if (dec->keyframe)
+    {
+        dec->keyframe = 0;
+        if (codec_get_bits(dec, 32, &raw) != 0)
+        {
+            dec->count = 0;
+            return (-1);
+        }
+        dec->last_time = raw;
+        dec->last_delta = 0;
+        for (i = 0; i < dec->channels; i++)
+        {
+            if (codec_get_bits(dec, 16, &raw) != 0)
+            {
+                dec->count = 0;
+                return (-1);
+            }
+            dec->last[i] = (int16_t)raw;
+        }
+    }
+    else
+    {
+        if (codec_get_prefix(dec, &prefix) != 0 || codec_get_bits(dec, time_bits[prefix], &raw) != 0)
+        {
+            dec->count = 0;
+            return (-1);
+        }
+        dod = (prefix == 3) ? (int32_t)raw : codec_sign_extend(raw, time_bits[prefix]);
+        dec->last_delta += dod;
+        dec->last_time += (uint32_t)dec->last_delta;
+
+        for (i = 0; i < dec->channels; i++)
+        {
+            if (codec_get_prefix(dec, &prefix) != 0 || codec_get_bits(dec, value_bits[prefix], &raw) != 0)
+            {
+                dec->count = 0;
+                return (-1);
+            }
+            if (prefix == 3)
+            {
+                dec->last[i] = (int16_t)raw;
+            }
+            else
+            {
+                dec->last[i] = (int16_t)(dec->last[i] + codec_sign_extend(raw, value_bits[prefix]));
+            }
+        }
+    }
+
+    *time = dec->last_time;
+    for (i = 0; i < dec->channels; i++)
+    {
+        values[i] = dec->last[i];
+    }
+    dec->count--;
+
+    return (0);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Append the n low bits of value, MSB first
+ */
+static int8_t codec_put_bits(codec_enc_t* enc, uint32_t value, uint8_t n)
+{
+    uint8_t bit;
+
+    if (enc->bits + n > (uint32_t)enc->size * 8)
+    {
+        return (-1);
+    }
+
+    while (n--)
+    {
+        bit = (value >> n) & 0x01;
+        if (bit)
+        {
+            enc->buf[enc->bits / 8] |= (uint8_t)(0x80 >> (enc->bits % 8));
+        }
+        else
+        {
+            enc->buf[enc->bits / 8] &= (uint8_t)~(0x80 >> (enc->bits % 8));
+        }
+        enc->bits++;
+    }
+
+    return (0);
+}
+
+/*!
+ * \brief Read n bits, MSB first
+ */
+static int8_t codec_get_bits(codec_dec_t* dec, uint8_t n, uint32_t* value)
+{
+    uint32_t result = 0;
+
+    if (dec->bits + n > (uint32_t)dec->len * 8)
+    {
+        return (-1);
+    }
+
+    while (n--)
+    {
+        result = (result << 1) | ((dec->buf[dec->bits / 8] >> (7 - dec->bits % 8)) & 0x01);
+        dec->bits++;
+    }
+
+    *value = result;
+
+    return (0);
+}
+
+/*!
+ * \brief Two's complement field of n bits to int32
+ */
+static int32_t codec_sign_extend(uint32_t value, uint8_t n)
+{
+    if (n == 0)
+    {
+        return (0);
+    }
+
+    return ((int32_t)(value << (32 - n)) >> (32 - n));
+}
+
+/*!
+ * \brief Timestamp delta of delta with its prefix
+ */
+static int8_t codec_put_time(codec_enc_t* enc, int32_t dod)
+{
+    if (dod == 0)
+    {
+        return (codec_put_bits(enc, 0x0, 1));
+    }
+    if (dod >= -64 && dod <= 63)
+    {
+        return (codec_put_bits(enc, (0x2u << 7) | ((uint32_t)dod & 0x7F), 9));
+    }
+    if (dod >= -2048 && dod <= 2047)
+    {
+        return (codec_put_bits(enc, (0x6u << 12) | ((uint32_t)dod & 0xFFF), 15));
+    }
+    if (codec_put_bits(enc, 0x7, 3) != 0)
+    {
+        return (-1);
+    }
+
+    return (codec_put_bits(enc, (uint32_t)dod, 32));
+}
+
+/*!
+ * \brief Value delta with its prefix, the value itself if the delta is large
+ */
+static int8_t codec_put_value(codec_enc_t* enc, int16_t value, int32_t delta)
+{
+    if (delta == 0)
+    {
+        return (codec_put_bits(enc, 0x0, 1));
+    }
+    if (delta >= -4 && delta <= 3)
+    {
+        return (codec_put_bits(enc, (0x2u << 3) | ((uint32_t)delta & 0x7), 5));
+    }
+    if (delta >= -64 && delta <= 63)
+    {
+        return (codec_put_bits(enc, (0x6u << 7) | ((uint32_t)delta & 0x7F), 10));
+    }
+
+    return (codec_put_bits(enc, (0x7u << 16) | (uint16_t)value, 19));
+}
+
+/*!
+ * \brief Read a 0 / 10 / 110 / 111 prefix
+ * \param[out] prefix 0..3
+ * \retval 0  - OK
+ * \retval -1 - block truncated
+ */
+static int8_t codec_get_prefix(codec_dec_t* dec, uint8_t* prefix)
+{
+    uint32_t bit;
+
+    for (*prefix = 0; *prefix < 3; (*prefix)++)
+    {
+        if (codec_get_bits(dec, 1, &bit) != 0)
+        {
+            return (-1);
+        }
+        if (bit == 0)
+        {
+            break;
+        }
+    }
+
+    return (0);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stdint.h>
+
+/*!
+ * \file codec.h
+ * \brief Compact encoding of sample streams (timestamp and int16 values)
+ * \details Samples are packed into self-contained blocks. A block starts
+ *          with a keyframe:
+ *
+ *              count   16 bit  samples in the block, keyframe included
+ *              n        8 bit  values per sample
+ *              time    32 bit
+ *              value   16 bit  n times
+ *
+ *          followed by bit-packed samples, MSB first:
+ *
+ *              time, delta of the delta to the previous sample
+ *                  0                   0
+ *                  10   + 7 bit        -64..63
+ *                  110  + 12 bit       -2048..2047
+ *                  111  + 32 bit       any
+ *              each value, delta to the previous sample
+ *                  0                   0
+ *                  10   + 3 bit        -4..3
+ *                  110  + 7 bit        -64..63
+ *                  111  + 16 bit       the value itself
+ *
+ *          A periodic sample with readings that change by a few LSBs costs
+ *          1 bit for the time and 1..5 bits per value instead of 32 + 16 n.
+ *          Blocks are independent, a damaged block does not affect others.
+ *
+ *          Plain C without hardware access, the host tools build it as well.
+ */
+
+#define CODEC_CHANNELS_MAX      32
+#define CODEC_HEADER_SIZE(n)    (7 + 2 * (n))   /* keyframe bytes */
+
+/*!
+ * \brief Encoder, fills one block
+ */
+typedef struct {
+    uint8_t* buf;
+    uint16_t size;              /*!< bytes available in buf */
+    uint32_t bits;              /*!< bits used in buf */
+    uint16_t count;             /*!< samples in the block */
+    uint8_t channels;
+    uint32_t last_time;
+    int32_t last_delta;         /*!< time delta of the last sample */
+    int16_t last[CODEC_CHANNELS_MAX];
+} codec_enc_t;
+
+/*!
+ * \brief Decoder, reads one block
+ */
+typedef struct {
+    const uint8_t* buf;
+    uint16_t len;
+    uint32_t bits;              /*!< bits read */
+    uint16_t count;             /*!< samples left */
+    uint8_t channels;
+    uint32_t last_time;
+    int32_t last_delta;
+    int16_t last[CODEC_CHANNELS_MAX];
+    uint8_t keyframe;           /*!< next sample is the keyframe */
+} codec_dec_t;
+
+/*!
+ * \brief Start a block
+ * \param[out] enc encoder
+ * \param[out] buf block buffer, at least CODEC_HEADER_SIZE(channels) bytes
+ * \param[in] size size of buf
+ * \param[in] channels values per sample, 1..CODEC_CHANNELS_MAX
+ */
+void codec_enc_init(codec_enc_t* enc, uint8_t* buf, uint16_t size, uint8_t channels);
+
+/*!
+ * \brief Add a sample to the block
+ * \param[in,out] enc encoder
+ * \param[in] time timestamp, any unit
+ * \param[in] values channels values
+ * \retval 0  - OK
+ * \retval -1 - block full, sample not added
+ */
+int8_t codec_enc_put(codec_enc_t* enc, uint32_t time, const int16_t* values);
+
+/*!
+ * \brief Complete the block
+ * \param[in,out] enc encoder
+ * \returns block length in bytes, 0 for an empty block
+ */
+uint16_t codec_enc_finish(codec_enc_t* enc);
+
+/*!
+ * \brief Start reading a block
+ * \param[out] dec decoder
+ * \param[in] buf block
+ * \param[in] len length of the block
+ * \retval 0  - OK
+ * \retval -1 - not a valid block
+ */
+int8_t codec_dec_init(codec_dec_t* dec, const uint8_t* buf, uint16_t len);
+
+/*!
+ * \brief Read the next sample
+ * \param[in,out] dec decoder
+ * \param[out] time timestamp
+ * \param[out] values dec->channels values
+ * \retval 0  - OK
+ * \retval -1 - end of the block or block truncated, further calls fail as well
+ */
+int8_t codec_dec_get(codec_dec_t* dec, uint32_t* time, int16_t* values);
+
+#endif
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include <sched/sched.h>
+#include <console/console.h>
+
+#define CONSOLE_USART           USART1
+#define CONSOLE_USART_CLK       RCC_USART1
+#define CONSOLE_USART_IRQ       NVIC_USART1_IRQ
+#define CONSOLE_GPIO_PORT       GPIOA
+#define CONSOLE_GPIO_CLK        RCC_GPIOA
+#define CONSOLE_GPIO_TX         GPIO9
+#define CONSOLE_GPIO_RX         GPIO10
+#define CONSOLE_DMA             DMA2
+#define CONSOLE_DMA_CLK         RCC_DMA2
+#define CONSOLE_DMA_RX_STREAM   DMA_STREAM5
+#define CONSOLE_DMA_RX_IRQ      NVIC_DMA2_STREAM5_IRQ
+#define CONSOLE_DMA_TX_STREAM   DMA_STREAM7
+#define CONSOLE_DMA_TX_IRQ      NVIC_DMA2_STREAM7_IRQ
+#define CONSOLE_DMA_CHANNEL     DMA_SxCR_CHSEL_4    /* USART1_RX / USART1_TX */
+
+#define CONSOLE_RX_MASK         (CONSOLE_RX_SIZE - 1)
+#define CONSOLE_TX_MASK         (CONSOLE_TX_SIZE - 1)
+#define CONSOLE_PRINTF_MAX      128
+
+/* the DMA writes the first CONSOLE_RX_SIZE bytes circularly, the rest takes
+   the wrapped part of a line and its terminator */
+static char rx_buf[CONSOLE_RX_SIZE + CONSOLE_LINE_MAX + 1];
+static uint16_t rx_scan = 0;            /* next byte to look at */
+static uint16_t line_start = 0;         /* first byte of the line being received */
+static uint16_t line_len = 0;           /* bytes of it after editing */
+static uint8_t line_discard = 0;        /* line too long, skip to its end */
+static char last_eol = 0;               /* \r\n counts as one line end */
+
+static char tx_buf[CONSOLE_TX_SIZE];
+static volatile uint16_t tx_head = 0;
+static volatile uint16_t tx_tail = 0;
+static volatile uint16_t tx_dma_len = 0;
+
+static const console_cmd_t* cmd_table;
+static uint8_t cmd_count;
+static uint32_t rx_event;
+static console_stats_t stats;
+
+/* static declarations */
+static void console_line(void);
+static const console_cmd_t* console_find(const char* name);
+static void console_write(const char* data, uint16_t len);
+static void console_dma_start(void);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up USART1, its DMA streams and the GPIOs
+ * \param[in] cmds command table sorted by name, stays in use
+ * \param[in] count number of commands
+ * \param[in] event scheduler event set when bytes came in, run console_poll() on it
+ * \retval 0  - OK
+ * \retval -1 - table not sorted
+ */
+int8_t console_init(const console_cmd_t* cmds, uint8_t count, uint32_t event)
+{
+    uint8_t i;
+
+    for (i = 1; i < count; i++)
+    {
+        if (strcmp(cmds[i - 1].name, cmds[i].name) >= 0)
+        {
+            return (-1);
+        }
+    }
+
+    cmd_table = cmds;
+    cmd_count = count;
+    rx_event = event;
+
+    rcc_periph_clock_enable(CONSOLE_GPIO_CLK);
+    rcc_periph_clock_enable(CONSOLE_USART_CLK);
+    rcc_periph_clock_enable(CONSOLE_DMA_CLK);
+
+    gpio_mode_setup(CONSOLE_GPIO_PORT, GPIO_MODE_AF, GPIO_PUPD_PULLUP, CONSOLE_GPIO_TX | CONSOLE_GPIO_RX);
+    gpio_set_output_options(CONSOLE_GPIO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ, CONSOLE_GPIO_TX);
+    gpio_set_af(CONSOLE_GPIO_PORT, GPIO_AF7, CONSOLE_GPIO_TX | CONSOLE_GPIO_RX);
+
+    usart_set_baudrate(CONSOLE_USART, CONSOLE_BAUDRATE);
+    usart_set_databits(CONSOLE_USART, 8);
+    usart_set_stopbits(CONSOLE_USART, USART_STOPBITS_1);
+    usart_set_mode(CONSOLE_USART, USART_MODE_TX_RX);
+    usart_set_parity(CONSOLE_USART, USART_PARITY_NONE);
+    usart_set_flow_control(CONSOLE_USART, USART_FLOWCONTROL_NONE);
+    usart_enable_rx_dma(CONSOLE_USART);
+    usart_enable_tx_dma(CONSOLE_USART);
+
+    /* idle line: a pause in typing or the end of a pasted block */
+    USART_CR1(CONSOLE_USART) |= USART_CR1_IDLEIE;
+
+    /* receive forever, circular */
+    dma_stream_reset(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM);
+    dma_channel_select(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, CONSOLE_DMA_CHANNEL);
+    dma_set_transfer_mode(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, (uint32_t)&USART_DR(CONSOLE_USART));
+    dma_set_memory_address(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, (uint32_t)rx_buf);
+    dma_set_number_of_data(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, CONSOLE_RX_SIZE);
+    dma_enable_memory_increment_mode(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM);
+    dma_enable_circular_mode(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM);
+    dma_set_peripheral_size(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, DMA_SxCR_MSIZE_8BIT);
+    dma_set_priority(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, DMA_SxCR_PL_LOW);
+    dma_enable_half_transfer_interrupt(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM);
+    dma_enable_transfer_complete_interrupt(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM);
+    dma_enable_stream(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM);
+
+    /* nothing time critical here, lowest priority */
+    nvic_set_priority(CONSOLE_USART_IRQ, 15 << 4);
+    nvic_set_priority(CONSOLE_DMA_RX_IRQ, 15 << 4);
+    nvic_set_priority(CONSOLE_DMA_TX_IRQ, 15 << 4);
+    nvic_enable_irq(CONSOLE_USART_IRQ);
+    nvic_enable_irq(CONSOLE_DMA_RX_IRQ);
+    nvic_enable_irq(CONSOLE_DMA_TX_IRQ);
+
+    usart_enable(CONSOLE_USART);
+
+    return (0);
+}
+
+/*!
+ * \brief Handle the received bytes, run complete lines, from the main loop
+ */
+void console_poll(void)
+{
+    uint16_t head = (CONSOLE_RX_SIZE - dma_get_number_of_data(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM)) & CONSOLE_RX_MASK;
+    uint16_t pending = (head - rx_scan) & CONSOLE_RX_MASK;
+    char c;
+
+    /* so close to full that the DMA may have lapped the line, start over */
+    if (pending + line_len > CONSOLE_RX_SIZE - 16)
+    {
+        stats.overruns++;
+        rx_scan = head;
+        line_start = head;
+        line_len = 0;
+        line_discard = 1;
+        return;
+    }
+
+    while (rx_scan != head)
+    {
+        c = rx_buf[rx_scan];
+        rx_scan = (rx_scan + 1) & CONSOLE_RX_MASK;
+
+        if (c == '\r' || c == '\n')
+        {
+            if (!(c == '\n' && last_eol == '\r'))
+            {
+                console_write("\r\n", 2);
+                console_line();
+            }
+            last_eol = c;
+            line_start = rx_scan;
+            line_len = 0;
+            line_discard = 0;
+            continue;
+        }
+        last_eol = 0;
+
+        if (c == '\b' || c == 0x7F)
+        {
+            if (line_len > 0 && !line_discard)
+            {
+                line_len--;
+                console_write("\b \b", 3);
+            }
+            continue;
+        }
+
+        if (line_len >= CONSOLE_LINE_MAX)
+        {
+            line_discard = 1;
+        }
+        if (line_discard)
+        {
+            continue;
+        }
+
+        /* compacted in place: the write position never passes rx_scan */
+        rx_buf[(line_start + line_len) & CONSOLE_RX_MASK] = c;
+        line_len++;
+        console_write(&c, 1);
+    }
+}
+
+/*!
+ * \brief Queue text for output
+ * \param[in] str zero terminated text
+ */
+void console_print(const char* str)
+{
+    console_write(str, (uint16_t)strlen(str));
+}
+
+/*!
+ * \brief Queue formatted text for output
+ * \param[in] fmt printf format, at most 128 characters result
+ */
+void console_printf(const char* fmt, ...)
+{
+    char buf[CONSOLE_PRINTF_MAX];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len > 0)
+    {
+        console_write(buf, (len < (int)sizeof(buf)) ? (uint16_t)len : sizeof(buf) - 1);
+    }
+}
+
+/*!
+ * \brief Print the command table with the usage of each command
+ */
+void console_help(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < cmd_count; i++)
+    {
+        console_printf("%-10s %s\r\n", cmd_table[i].name, cmd_table[i].usage);
+    }
+}
+
+/*!
+ * \brief Get the counters
+ * \param[out] result filled with the counters
+ */
+void console_get_stats(console_stats_t* result)
+{
+    *result = stats;
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Split the received line into arguments in place and run it
+ */
+static void console_line(void)
+{
+    char* argv[CONSOLE_ARGS_MAX];
+    const console_cmd_t* cmd;
+    uint16_t first;
+    uint8_t argc = 0;
+    char* p;
+    char* end;
+
+    if (line_discard)
+    {
+        stats.too_long++;
+        console_print("line too long\r\n");
+        return;
+    }
+
+    /* wrapped: the part at the start of the buffer moves behind its end */
+    first = CONSOLE_RX_SIZE - line_start;
+    if (line_len > first)
+    {
+        memmove(&rx_buf[CONSOLE_RX_SIZE], rx_buf, line_len - first);
+    }
+    p = &rx_buf[line_start];
+    end = p + line_len;
+    *end = '\0';
+
+    while (p < end)
+    {
+        while (*p == ' ' || *p == '\t')
+        {
+            *p++ = '\0';
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        if (argc == CONSOLE_ARGS_MAX)
+        {
+            console_print("too many arguments\r\n");
+            return;
+        }
+        argv[argc++] = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+    }
+
+    if (argc == 0)
+    {
+        return;
+    }
+
+    stats.lines++;
+
+    cmd = console_find(argv[0]);
+    if (cmd == NULL)
+    {
+        stats.unknown++;
+        console_printf("unknown command '%s', try help\r\n", argv[0]);
+        return;
+    }
+
+    if (cmd->fn(argc, argv) != 0)
+    {
+        console_printf("usage: %s %s\r\n", cmd->name, cmd->usage);
+    }
+}
+
+/*!
+ * \brief Binary search in the command table
+ * \returns command, NULL if there is none of that name
+ */
+static const console_cmd_t* console_find(const char* name)
+{
+    int16_t lo = 0;
+    int16_t hi = (int16_t)cmd_count - 1;
+    int16_t mid;
+    int cmp;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        cmp = strcmp(name, cmd_table[mid].name);
+        if (cmp == 0)
+        {
+            return (&cmd_table[mid]);
+        }
+        if (cmp < 0)
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    return (NULL);
+}
+
+/*!
+ * \brief Copy output into the TX ring and start the DMA if it is idle
+ */
+static void console_write(const char* data, uint16_t len)
+{
+    uint16_t head = tx_head;
+    uint16_t used = (uint16_t)(head - tx_tail);
+    uint16_t first;
+
+    if (len > CONSOLE_TX_SIZE - used)
+    {
+        stats.tx_dropped += len;
+        return;
+    }
+
+    first = CONSOLE_TX_SIZE - (head & CONSOLE_TX_MASK);
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(&tx_buf[head & CONSOLE_TX_MASK], data, first);
+    memcpy(tx_buf, &data[first], len - first);
+
+    tx_head = head + len;
+
+    cm_disable_interrupts();
+    if (tx_dma_len == 0)
+    {
+        console_dma_start();
+    }
+    cm_enable_interrupts();
+}
+
+/*!
+ * \brief Send the queued bytes up to the end of the ring, or nothing if none
+ * \details Called with the DMA interrupt unable to run.
+ */
+static void console_dma_start(void)
+{
+    uint16_t tail = tx_tail & CONSOLE_TX_MASK;
+    uint16_t len = (uint16_t)(tx_head - tx_tail);
+
+    if (len > CONSOLE_TX_SIZE - tail)
+    {
+        len = CONSOLE_TX_SIZE - tail;
+    }
+
+    tx_dma_len = len;
+    if (len == 0)
+    {
+        return;
+    }
+
+    dma_stream_reset(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM);
+    dma_channel_select(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, CONSOLE_DMA_CHANNEL);
+    dma_set_transfer_mode(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, (uint32_t)&USART_DR(CONSOLE_USART));
+    dma_set_memory_address(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, (uint32_t)&tx_buf[tail]);
+    dma_set_number_of_data(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, len);
+    dma_enable_memory_increment_mode(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM);
+    dma_set_peripheral_size(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, DMA_SxCR_MSIZE_8BIT);
+    dma_set_priority(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, DMA_SxCR_PL_LOW);
+    dma_enable_transfer_complete_interrupt(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM);
+    dma_enable_stream(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief USART1 idle line: bytes are waiting
+ */
+void usart1_isr(void)
+{
+    if (usart_get_flag(CONSOLE_USART, USART_SR_IDLE))
+    {
+        /* SR then DR clears IDLE */
+        (void)USART_SR(CONSOLE_USART);
+        (void)USART_DR(CONSOLE_USART);
+        sched_event_set(rx_event);
+    }
+}
+
+/*!
+ * \brief RX DMA half / full: bytes are waiting, a long paste has no idle line
+ */
+void dma2_stream5_isr(void)
+{
+    dma_clear_interrupt_flags(CONSOLE_DMA, CONSOLE_DMA_RX_STREAM, DMA_HTIF | DMA_TCIF);
+    sched_event_set(rx_event);
+}
+
+/*!
+ * \brief TX DMA complete: free the sent bytes, send what came in meanwhile
+ */
+void dma2_stream7_isr(void)
+{
+    if (dma_get_interrupt_flag(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(CONSOLE_DMA, CONSOLE_DMA_TX_STREAM, DMA_TCIF);
+
+        tx_tail = tx_tail + tx_dma_len;
+        console_dma_start();
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONSOLE_H_
+#define CONSOLE_H_
+
+#include <stdint.h>
+
+/*!
+ * \file console.h
+ * \brief Line oriented command console on USART1 (TX PA9, RX PA10)
+ * \details Received bytes go by DMA (DMA2 stream 5, channel 4) into a
+ *          circular buffer; the idle line and the half / full buffer
+ *          interrupts only set a scheduler event. console_poll(), run by a
+ *          task on that event, echoes the new bytes, edits the line in
+ *          place (backspace) and at the end of a line splits it into
+ *          arguments in place and calls the command. Commands therefore run
+ *          in the main loop, never in an interrupt, and nothing is copied:
+ *          the arguments point into the receive buffer. Only a line that
+ *          wraps around the end of the buffer has its wrapped part moved
+ *          behind the end, so that it is contiguous.
+ *
+ *          The command table is sorted by name (strcmp order) and searched
+ *          binary. Output goes through a TX ring drained by DMA (DMA2
+ *          stream 7, channel 4), text that does not fit is dropped.
+ */
+
+#define CONSOLE_BAUDRATE        115200
+#define CONSOLE_RX_SIZE         256     /* power of two */
+#define CONSOLE_TX_SIZE         1024    /* power of two */
+#define CONSOLE_LINE_MAX        80      /* longer lines are discarded */
+#define CONSOLE_ARGS_MAX        8
+
+/*!
+ * \brief Command handler
+ * \param[in] argc number of arguments, the command name included
+ * \param[in] argv arguments, argv[0] is the command name
+ * \returns 0 if OK, -1 to print the usage
+ */
+typedef int8_t (*console_fn_t)(uint8_t argc, char** argv);
+
+/*!
+ * \brief Entry of the command table
+ */
+typedef struct {
+    const char* name;
+    console_fn_t fn;
+    const char* usage;          /*!< arguments and purpose, shown by console_help() */
+} console_cmd_t;
+
+/*!
+ * \brief Console counters
+ */
+typedef struct {
+    uint32_t lines;             /*!< lines executed or rejected */
+    uint32_t unknown;           /*!< unknown commands */
+    uint32_t too_long;          /*!< lines longer than CONSOLE_LINE_MAX */
+    uint32_t overruns;          /*!< input lost, the buffer was not read in time */
+    uint32_t tx_dropped;        /*!< output bytes dropped, TX buffer full */
+} console_stats_t;
+
+/*!
+ * \brief Set up USART1, its DMA streams and the GPIOs
+ * \param[in] cmds command table sorted by name, stays in use
+ * \param[in] count number of commands
+ * \param[in] event scheduler event set when bytes came in, run console_poll() on it
+ * \retval 0  - OK
+ * \retval -1 - table not sorted
+ */
+int8_t console_init(const console_cmd_t* cmds, uint8_t count, uint32_t event);
+
+/*!
+ * \brief Handle the received bytes, run complete lines, from the main loop
+ */
+void console_poll(void);
+
+/*!
+ * \brief Queue text for output
+ * \param[in] str zero terminated text
+ */
+void console_print(const char* str);
+
+/*!
+ * \brief Queue formatted text for output
+ * \param[in] fmt printf format, at most 128 characters result
+ */
+void console_printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*!
+ * \brief Print the command table with the usage of each command
+ */
+void console_help(void);
+
+/*!
+ * \brief Get the counters
+ * \param[out] result filled with the counters
+ */
+void console_get_stats(console_stats_t* result);
+
+#endif
@@ -18,6 +18,8 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
+
 #include <ds18b20/ds18b20.h>
 #include <onewire/onewire.h>
 
@@ -42,6 +44,7 @@
 
 /* static declarations */
 static void ds18b20_send_command(uint8_t cmd);
+static void ds18b20_send_command_rom(const onewire_rom_t* rom, uint8_t cmd);
 static void ds18b20_scratchpad_write(uint8_t alert_l, uint8_t alert_h, uint8_t config);
 static void ds18b20_scratchpad_read(uint8_t* buffer, uint8_t len);
 
@@ -163,6 +166,55 @@ float ds18b20_get_temperature(void)
 
 }
 
+/*!
+ * \brief Start temperature conversion on one of several sensors
+ * \param[in] rom ROM code of the sensor (see onewire_search()), all zero for the only sensor
+ */
+void ds18b20_start_conversion_rom(const onewire_rom_t* rom)
+{
+    ds18b20_send_command_rom(rom, DS18B20_CMD_CONVERT);
+}
+
+/*!
+ * \brief Read the temperature of one of several sensors
+ * \param[in] rom ROM code of the sensor, all zero for the only sensor
+ * \param[out] centi temperature in 1/100 degC
+ * \retval 0  - OK
+ * \retval -1 - CRC error, sensor missing
+ */
+int8_t ds18b20_read_temperature_rom(const onewire_rom_t* rom, int32_t* centi)
+{
+    uint8_t scratchpad_buffer[DS18B20_SCRATCHPAD_IDX_CRC+1];
+    int16_t temp_raw_value;
+    uint8_t resolution_bits;
+    uint8_t i;
+
+    ds18b20_send_command_rom(rom, DS18B20_CMD_SCRATCHPAD_READ);
+
+    for(i = 0; i < sizeof(scratchpad_buffer); i++)
+    {
+        scratchpad_buffer[i] = onewire_receive_byte();
+    }
+
+    /* a missing sensor reads as all ones, which fails the CRC as well */
+    if(onewire_crc8(scratchpad_buffer, sizeof(scratchpad_buffer)) != 0)
+    {
+        return (-1);
+    }
+
+    temp_raw_value = (int16_t)(((uint16_t)scratchpad_buffer[DS18B20_SCRATCHPAD_IDX_TEMP_H] << 8) |
+            scratchpad_buffer[DS18B20_SCRATCHPAD_IDX_TEMP_L]);
+
+    /* undefined low bits at lower resolutions, see ds18b20_get_temperature() */
+    resolution_bits = (scratchpad_buffer[DS18B20_SCRATCHPAD_IDX_CONFIG] & 0x60) >> 5;
+    temp_raw_value &= ~((1 << (3 - resolution_bits)) - 1);
+
+    /* 1/16 degC steps */
+    *centi = ((int32_t)temp_raw_value * 100) / 16;
+
+    return (0);
+}
+
 
 /******************************************************************
 * BEGIN OF STATIC FUNCTIONS
@@ -173,9 +225,15 @@ float ds18b20_get_temperature(void)
  */
 static void ds18b20_send_command(uint8_t cmd)
 {
-    onewire_reset();
+    ds18b20_send_command_rom(NULL, cmd);
+}
 
-    onewire_send_byte(DS18B20_CMD_ROM_SKIP);
+/*!
+ * \brief Send command byte to one device, NULL or an all zero ROM code for all devices
+ */
+static void ds18b20_send_command_rom(const onewire_rom_t* rom, uint8_t cmd)
+{
+    onewire_select(rom);
     onewire_send_byte(cmd);
 }
 
@@ -22,6 +22,7 @@
 #define DS18B20_H_
 
 #include <stdint.h>
+#include <onewire/onewire.h>
 
 
 /*!
@@ -80,6 +81,21 @@ void ds18b20_start_conversion(void);
  */
 float ds18b20_get_temperature(void);
 
+/*!
+ * \brief Start temperature conversion on one of several sensors
+ * \param[in] rom ROM code of the sensor (see onewire_search()), all zero for the only sensor
+ */
+void ds18b20_start_conversion_rom(const onewire_rom_t* rom);
+
+/*!
+ * \brief Read the temperature of one of several sensors
+ * \param[in] rom ROM code of the sensor, all zero for the only sensor
+ * \param[out] centi temperature in 1/100 degC
+ * \retval 0  - OK
+ * \retval -1 - CRC error, sensor missing
+ */
+int8_t ds18b20_read_temperature_rom(const onewire_rom_t* rom, int32_t* centi);
+
 
 
 
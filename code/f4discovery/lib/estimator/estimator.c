@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+
+#include <estimator/estimator.h>
+
+#define EST_Q                   16
+#define EST_ONE                 ((int64_t)1 << EST_Q)
+#define EST_P00_MAX             (((int64_t)10000 * 10000) << EST_Q)     /* 100 degC standard deviation */
+
+/* static declarations */
+static void estimator_predict(estimator_t* est, uint32_t now_ms);
+static int64_t estimator_mul(int64_t a, int64_t b);
+static int64_t estimator_ms_to_s(uint32_t ms);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up an estimator
+ * \param[out] est estimator
+ * \param[in] config model parameters, copied
+ */
+void estimator_init(estimator_t* est, const estimator_config_t* config)
+{
+    est->config = *config;
+    est->primed = 0;
+}
+
+/*!
+ * \brief Change the age of the readings, e.g. after a resolution change
+ * \param[in,out] est estimator
+ * \param[in] delay_ms age of a reading when it is passed in
+ */
+void estimator_set_delay(estimator_t* est, uint32_t delay_ms)
+{
+    est->config.delay_ms = delay_ms;
+}
+
+/*!
+ * \brief Correct with a new reading
+ * \param[in,out] est estimator
+ * \param[in] now_ms time the reading arrived
+ * \param[in] value reading
+ */
+void estimator_correct(estimator_t* est, uint32_t now_ms, int32_t value)
+{
+    int64_t z = (int64_t)value << EST_Q;
+    int64_t noise = est->config.noise;
+    int64_t d = estimator_ms_to_s(est->config.delay_ms);
+    int64_t ph0, ph1, s, k0, k1, y;
+
+    if (est->primed && (now_ms - est->time_ms) > est->config.stale_ms)
+    {
+        est->primed = 0;
+    }
+
+    if (est->primed == 0)
+    {
+        est->t = z;
+        est->r = 0;
+        est->p00 = (noise * noise) << EST_Q;
+        est->p01 = 0;
+        est->p11 = ((int64_t)est->config.rate_init * est->config.rate_init) << EST_Q;
+        est->time_ms = now_ms;
+        est->primed = 1;
+        return;
+    }
+
+    estimator_predict(est, now_ms);
+
+    /* innovation of the reading, which saw the temperature d ago */
+    y = z - (est->t - estimator_mul(d, est->r));
+
+    /* P * H' and H * P * H' + R */
+    ph0 = est->p00 - estimator_mul(d, est->p01);
+    ph1 = est->p01 - estimator_mul(d, est->p11);
+    s = ph0 - estimator_mul(d, ph1) + ((noise * noise) << EST_Q);
+    if (s <= 0)
+    {
+        est->primed = 0;
+        return;
+    }
+
+    k0 = (ph0 << EST_Q) / s;
+    k1 = (ph1 << EST_Q) / s;
+
+    est->t += estimator_mul(k0, y);
+    est->r += estimator_mul(k1, y);
+
+    est->p00 -= estimator_mul(k0, ph0);
+    est->p01 -= estimator_mul(k0, ph1);
+    est->p11 -= estimator_mul(k1, ph1);
+
+    /* rounding can push a variance just below zero */
+    if (est->p00 < 1)
+    {
+        est->p00 = 1;
+    }
+    if (est->p11 < 1)
+    {
+        est->p11 = 1;
+    }
+}
+
+/*!
+ * \brief Estimate for a time after the last reading
+ * \param[in] est estimator
+ * \param[in] now_ms time of the estimate
+ * \param[out] value temperature
+ * \param[out] rate rate per minute, may be NULL
+ * \retval 0  - OK
+ * \retval -1 - no estimate, no reading yet or the last one is stale
+ */
+int8_t estimator_get(const estimator_t* est, uint32_t now_ms, int32_t* value, int32_t* rate)
+{
+    uint32_t age = now_ms - est->time_ms;
+    int64_t t;
+
+    if (est->primed == 0 || age > est->config.stale_ms)
+    {
+        return (-1);
+    }
+
+    t = est->t + estimator_mul(estimator_ms_to_s(age), est->r);
+    *value = (int32_t)((t + EST_ONE / 2) >> EST_Q);
+
+    if (rate != NULL)
+    {
+        *rate = (int32_t)((est->r * 60 + EST_ONE / 2) >> EST_Q);
+    }
+
+    return (0);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Advance state and covariance to now_ms
+ * \details Constant rate over dt, the rate does a random walk of
+ *          rate_noise per s:  Q = q * [dt^3/3  dt^2/2; dt^2/2  dt].
+ */
+static void estimator_predict(estimator_t* est, uint32_t now_ms)
+{
+    int64_t dt = estimator_ms_to_s(now_ms - est->time_ms);
+    int64_t q = ((int64_t)est->config.rate_noise * est->config.rate_noise) << EST_Q;
+    int64_t q_dt = estimator_mul(q, dt);
+    int64_t q_dt2 = estimator_mul(q_dt, dt);
+    int64_t p11_dt = estimator_mul(est->p11, dt);
+
+    est->t += estimator_mul(est->r, dt);
+
+    est->p00 += 2 * estimator_mul(est->p01, dt) + estimator_mul(p11_dt, dt) + estimator_mul(q_dt2, dt) / 3;
+    est->p01 += p11_dt + q_dt2 / 2;
+    est->p11 += q_dt;
+    est->time_ms = now_ms;
+
+    /* no useful reading for too long, the next one starts over */
+    if (est->p00 > EST_P00_MAX)
+    {
+        est->primed = 0;
+    }
+}
+
+/*!
+ * \brief Product of two Q16.16 values
+ */
+static int64_t estimator_mul(int64_t a, int64_t b)
+{
+    return ((a * b) >> EST_Q);
+}
+
+/*!
+ * \brief Milliseconds to seconds, Q16.16
+ */
+static int64_t estimator_ms_to_s(uint32_t ms)
+{
+    return (((int64_t)ms << EST_Q) / 1000);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
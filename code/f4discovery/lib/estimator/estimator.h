@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ESTIMATOR_H_
+#define ESTIMATOR_H_
+
+#include <stdint.h>
+
+/*!
+ * \file estimator.h
+ * \brief Current temperature and rate from late readings, fixed point Kalman filter
+ * \details A reading describes the temperature some time before it arrives:
+ *          the conversion (about half of it, the sensor averages) plus the
+ *          wait for the read slot plus the thermal lag of the sensor, which
+ *          for a steady ramp shows as a delay of its time constant. The
+ *          filter tracks temperature T and rate r (constant rate model, the
+ *          rate changes as a random walk) at the present and sees a reading
+ *          of age D as
+ *
+ *              z = T(now - D) = T - D * r          H = [1  -D]
+ *
+ *          so each correction updates both, and estimator_get() predicts to
+ *          any time between readings. Temperatures are in the unit of the
+ *          readings (1/100 degC), time in ms, internal state Q16.16 with
+ *          rates per second.
+ *
+ *          Plain C without hardware access, tools/estimator_check runs it on the host.
+ */
+
+/*!
+ * \brief Model parameters
+ */
+typedef struct {
+    uint32_t delay_ms;          /*!< age of a reading when it is passed in */
+    int32_t noise;              /*!< reading noise, standard deviation */
+    int32_t rate_noise;         /*!< rate change per s, standard deviation over 1 s */
+    int32_t rate_init;          /*!< rate uncertainty at the first reading, per s */
+    uint32_t stale_ms;          /*!< without readings for this long, start over */
+} estimator_config_t;
+
+/*!
+ * \brief Estimator state, one per sensor
+ */
+typedef struct {
+    estimator_config_t config;
+    int64_t t;                  /*!< temperature at time_ms, Q16.16 */
+    int64_t r;                  /*!< rate per s, Q16.16 */
+    int64_t p00;                /*!< covariance, Q16.16 */
+    int64_t p01;
+    int64_t p11;
+    uint32_t time_ms;           /*!< time of the state */
+    uint8_t primed;             /*!< a reading came in */
+} estimator_t;
+
+/*!
+ * \brief Set up an estimator
+ * \param[out] est estimator
+ * \param[in] config model parameters, copied
+ */
+void estimator_init(estimator_t* est, const estimator_config_t* config);
+
+/*!
+ * \brief Change the age of the readings, e.g. after a resolution change
+ * \param[in,out] est estimator
+ * \param[in] delay_ms age of a reading when it is passed in
+ */
+void estimator_set_delay(estimator_t* est, uint32_t delay_ms);
+
+/*!
+ * \brief Correct with a new reading
+ * \param[in,out] est estimator
+ * \param[in] now_ms time the reading arrived
+ * \param[in] value reading
+ */
+void estimator_correct(estimator_t* est, uint32_t now_ms, int32_t value);
+
+/*!
+ * \brief Estimate for a time after the last reading
+ * \param[in] est estimator
+ * \param[in] now_ms time of the estimate
+ * \param[out] value temperature
+ * \param[out] rate rate per minute, may be NULL
+ * \retval 0  - OK
+ * \retval -1 - no estimate, no reading yet or the last one is stale
+ */
+int8_t estimator_get(const estimator_t* est, uint32_t now_ms, int32_t* value, int32_t* rate);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+
+#include <filter/filter.h>
+
+#define FILTER_Q                16
+#define FILTER_ONE              (1 << FILTER_Q)
+#define FILTER_QUEUE_MASK       (FILTER_WINDOW_MAX - 1)
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up an EMA
+ * \param[out] ema filter
+ * \param[in] tau_ms time constant
+ * \param[in] sample_ms time between samples
+ * \details alpha = dt / (tau + dt), the exact weight 1 - exp(-dt / tau)
+ *          without the exponential. Close for tau >> dt and stable for any tau.
+ */
+void filter_ema_init(filter_ema_t* ema, uint32_t tau_ms, uint32_t sample_ms)
+{
+    uint64_t sum = (uint64_t)tau_ms + sample_ms;
+
+    ema->alpha = (sum == 0) ? FILTER_ONE :
+                 (int32_t)((((uint64_t)sample_ms << FILTER_Q) + sum / 2) / sum);
+    ema->state = 0;
+    ema->primed = 0;
+}
+
+/*!
+ * \brief Add a sample to an EMA, the first one sets the state
+ * \param[in,out] ema filter
+ * \param[in] value sample
+ * \returns filtered value
+ */
+int32_t filter_ema_update(filter_ema_t* ema, int32_t value)
+{
+    int64_t x = (int64_t)value * FILTER_ONE;
+
+    if (ema->primed == 0)
+    {
+        ema->state = x;
+        ema->primed = 1;
+    }
+    else
+    {
+        ema->state += ((x - ema->state) * ema->alpha) / FILTER_ONE;
+    }
+
+    return ((int32_t)((ema->state + FILTER_ONE / 2) >> FILTER_Q));
+}
+
+/*!
+ * \brief Clear running statistics
+ * \param[out] stats statistics
+ */
+void filter_stats_init(filter_stats_t* stats)
+{
+    stats->count = 0;
+    stats->mean = 0;
+    stats->m2 = 0;
+}
+
+/*!
+ * \brief Add a sample to running statistics
+ * \param[in,out] stats statistics
+ * \param[in] value sample, |value| <= 16384 keeps the products in 64 bit
+ */
+void filter_stats_update(filter_stats_t* stats, int32_t value)
+{
+    int64_t x = (int64_t)value * FILTER_ONE;
+    int64_t delta = x - stats->mean;
+
+    stats->count++;
+    stats->mean += delta / stats->count;
+
+    /* deviation from the old mean times deviation from the new one */
+    stats->m2 += (delta * (x - stats->mean)) / FILTER_ONE;
+}
+
+/*!
+ * \brief Mean of the samples so far
+ * \param[in] stats statistics
+ * \returns mean, rounded
+ */
+int32_t filter_stats_mean(const filter_stats_t* stats)
+{
+    return ((int32_t)((stats->mean + FILTER_ONE / 2) >> FILTER_Q));
+}
+
+/*!
+ * \brief Sample variance of the samples so far
+ * \param[in] stats statistics
+ * \returns variance in value units squared, 0 with less than two samples
+ */
+uint32_t filter_stats_variance(const filter_stats_t* stats)
+{
+    if (stats->count < 2 || stats->m2 <= 0)
+    {
+        return (0);
+    }
+
+    return ((uint32_t)(((uint64_t)stats->m2 / (stats->count - 1) + FILTER_ONE / 2) >> FILTER_Q));
+}
+
+/*!
+ * \brief Set up a sliding minimum / maximum
+ * \param[out] mm filter
+ * \param[in] window samples, 1..FILTER_WINDOW_MAX
+ */
+void filter_minmax_init(filter_minmax_t* mm, uint8_t window)
+{
+    if (window == 0)
+    {
+        window = 1;
+    }
+    if (window > FILTER_WINDOW_MAX)
+    {
+        window = FILTER_WINDOW_MAX;
+    }
+
+    mm->window = window;
+    mm->pos = 0;
+    mm->count = 0;
+    mm->min_head = 0;
+    mm->min_len = 0;
+    mm->max_head = 0;
+    mm->max_len = 0;
+}
+
+/*!
+ * \brief Add a sample to a sliding minimum / maximum
+ * \param[in,out] mm filter
+ * \param[in] value sample
+ * \details Each sample enters and leaves each deque once.
+ */
+void filter_minmax_update(filter_minmax_t* mm, int32_t value)
+{
+    /* the sample at pos leaves the window, its deque entries with it */
+    if (mm->count == mm->window)
+    {
+        if (mm->min_len > 0 && mm->min_q[mm->min_head] == mm->pos)
+        {
+            mm->min_head = (mm->min_head + 1) & FILTER_QUEUE_MASK;
+            mm->min_len--;
+        }
+        if (mm->max_len > 0 && mm->max_q[mm->max_head] == mm->pos)
+        {
+            mm->max_head = (mm->max_head + 1) & FILTER_QUEUE_MASK;
+            mm->max_len--;
+        }
+    }
+    else
+    {
+        mm->count++;
+    }
+
+    mm->values[mm->pos] = value;
+
+    /* samples that can not be the extreme any more, the new one outlives them */
+    while (mm->min_len > 0 &&
+           mm->values[mm->min_q[(mm->min_head + mm->min_len - 1) & FILTER_QUEUE_MASK]] >= value)
+    {
+        mm->min_len--;
+    }
+    mm->min_q[(mm->min_head + mm->min_len) & FILTER_QUEUE_MASK] = mm->pos;
+    mm->min_len++;
+
+    while (mm->max_len > 0 &&
+           mm->values[mm->max_q[(mm->max_head + mm->max_len - 1) & FILTER_QUEUE_MASK]] <= value)
+    {
+        mm->max_len--;
+    }
+    mm->max_q[(mm->max_head + mm->max_len) & FILTER_QUEUE_MASK] = mm->pos;
+    mm->max_len++;
+
+    mm->pos = (mm->pos + 1 == mm->window) ? 0 : mm->pos + 1;
+}
+
+/*!
+ * \brief Minimum of the window
+ * \param[in] mm filter with at least one sample
+ * \returns minimum
+ */
+int32_t filter_minmax_min(const filter_minmax_t* mm)
+{
+    return (mm->values[mm->min_q[mm->min_head]]);
+}
+
+/*!
+ * \brief Maximum of the window
+ * \param[in] mm filter with at least one sample
+ * \returns maximum
+ */
+int32_t filter_minmax_max(const filter_minmax_t* mm)
+{
+    return (mm->values[mm->max_q[mm->max_head]]);
+}
+
+/*!
+ * \brief Set up a sliding median
+ * \param[out] med filter
+ * \param[in] window samples, odd, 1..FILTER_MEDIAN_MAX
+ */
+void filter_median_init(filter_median_t* med, uint8_t window)
+{
+    if (window == 0)
+    {
+        window = 1;
+    }
+    if (window > FILTER_MEDIAN_MAX)
+    {
+        window = FILTER_MEDIAN_MAX;
+    }
+
+    med->window = window;
+    med->pos = 0;
+    med->count = 0;
+}
+
+/*!
+ * \brief Add a sample to a sliding median
+ * \param[in,out] med filter
+ * \param[in] value sample
+ * \returns median of the window, of the samples so far while it fills
+ * \details The oldest sample is taken out of the sorted copy and the new one
+ *          inserted, at most FILTER_MEDIAN_MAX moves each.
+ */
+int32_t filter_median_update(filter_median_t* med, int32_t value)
+{
+    uint8_t i;
+
+    if (med->count == med->window)
+    {
+        for (i = 0; med->sorted[i] != med->history[med->pos]; i++);
+        for (; i + 1 < med->count; i++)
+        {
+            med->sorted[i] = med->sorted[i + 1];
+        }
+        med->count--;
+    }
+
+    for (i = med->count; i > 0 && med->sorted[i - 1] > value; i--)
+    {
+        med->sorted[i] = med->sorted[i - 1];
+    }
+    med->sorted[i] = value;
+    med->count++;
+
+    med->history[med->pos] = value;
+    med->pos = (med->pos + 1 == med->window) ? 0 : med->pos + 1;
+
+    return (med->sorted[med->count / 2]);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+
+/*!
+ * \file filter.h
+ * \brief Streaming filters and statistics for readings, fixed point
+ * \details Every kernel keeps only its own small state, each sample costs a
+ *          fixed amount of work:
+ *
+ *          - filter_ema: exponential moving average with a time constant
+ *          - filter_stats: running mean and variance (Welford)
+ *          - filter_minmax: minimum and maximum of the last n samples,
+ *            two monotonic deques (amortized O(1))
+ *          - filter_median: median of the last n samples (n <= 7), for
+ *            spike rejection
+ *
+ *          Values are int32 in any unit (1/100 degC here), internal state is
+ *          Q16.16 where fractions matter. One state per sensor.
+ *
+ *          Plain C without hardware access, the host tools build it as well.
+ */
+
+#define FILTER_WINDOW_MAX       64      /* filter_minmax */
+#define FILTER_MEDIAN_MAX       7       /* filter_median, odd */
+
+/*!
+ * \brief Exponential moving average
+ */
+typedef struct {
+    int64_t state;              /*!< Q16.16 */
+    int32_t alpha;              /*!< Q16.16 weight of a new sample */
+    uint8_t primed;             /*!< a sample came in */
+} filter_ema_t;
+
+/*!
+ * \brief Running mean and variance
+ */
+typedef struct {
+    uint32_t count;
+    int64_t mean;               /*!< Q16.16 */
+    int64_t m2;                 /*!< Q16.16, sum of squared deviations */
+} filter_stats_t;
+
+/*!
+ * \brief Sliding window minimum and maximum
+ * \details Each deque holds sample numbers with values that may still become
+ *          the extreme: ascending values for the minimum, descending for the
+ *          maximum, oldest first.
+ */
+typedef struct {
+    int32_t values[FILTER_WINDOW_MAX];  /*!< ring, indexed by sample number */
+    uint8_t min_q[FILTER_WINDOW_MAX];   /*!< ring of positions in values */
+    uint8_t max_q[FILTER_WINDOW_MAX];
+    uint8_t min_head, min_len;
+    uint8_t max_head, max_len;
+    uint8_t window;
+    uint8_t pos;                /*!< position of the next sample in values */
+    uint8_t count;              /*!< samples in the window */
+} filter_minmax_t;
+
+/*!
+ * \brief Sliding window median
+ */
+typedef struct {
+    int32_t history[FILTER_MEDIAN_MAX];     /*!< ring, oldest at pos */
+    int32_t sorted[FILTER_MEDIAN_MAX];
+    uint8_t window;
+    uint8_t pos;
+    uint8_t count;
+} filter_median_t;
+
+/*!
+ * \brief Set up an EMA
+ * \param[out] ema filter
+ * \param[in] tau_ms time constant
+ * \param[in] sample_ms time between samples
+ */
+void filter_ema_init(filter_ema_t* ema, uint32_t tau_ms, uint32_t sample_ms);
+
+/*!
+ * \brief Add a sample to an EMA, the first one sets the state
+ * \param[in,out] ema filter
+ * \param[in] value sample
+ * \returns filtered value
+ */
+int32_t filter_ema_update(filter_ema_t* ema, int32_t value);
+
+/*!
+ * \brief Clear running statistics
+ * \param[out] stats statistics
+ */
+void filter_stats_init(filter_stats_t* stats);
+
+/*!
+ * \brief Add a sample to running statistics
+ * \param[in,out] stats statistics
+ * \param[in] value sample
+ */
+void filter_stats_update(filter_stats_t* stats, int32_t value);
+
+/*!
+ * \brief Mean of the samples so far
+ * \param[in] stats statistics
+ * \returns mean, rounded
+ */
+int32_t filter_stats_mean(const filter_stats_t* stats);
+
+/*!
+ * \brief Sample variance of the samples so far
+ * \param[in] stats statistics
+ * \returns variance in value units squared, 0 with less than two samples
+ */
+uint32_t filter_stats_variance(const filter_stats_t* stats);
+
+/*!
+ * \brief Set up a sliding minimum / maximum
+ * \param[out] mm filter
+ * \param[in] window samples, 1..FILTER_WINDOW_MAX
+ */
+void filter_minmax_init(filter_minmax_t* mm, uint8_t window);
+
+/*!
+ * \brief Add a sample to a sliding minimum / maximum
+ * \param[in,out] mm filter
+ * \param[in] value sample
+ */
+void filter_minmax_update(filter_minmax_t* mm, int32_t value);
+
+/*!
+ * \brief Minimum of the window
+ * \param[in] mm filter with at least one sample
+ * \returns minimum
+ */
+int32_t filter_minmax_min(const filter_minmax_t* mm);
+
+/*!
+ * \brief Maximum of the window
+ * \param[in] mm filter with at least one sample
+ * \returns maximum
+ */
+int32_t filter_minmax_max(const filter_minmax_t* mm);
+
+/*!
+ * \brief Set up a sliding median
+ * \param[out] med filter
+ * \param[in] window samples, odd, 1..FILTER_MEDIAN_MAX
+ */
+void filter_median_init(filter_median_t* med, uint8_t window);
+
+/*!
+ * \brief Add a sample to a sliding median
+ * \param[in,out] med filter
+ * \param[in] value sample
+ * \returns median of the window, of the samples so far while it fills
+ */
+int32_t filter_median_update(filter_median_t* med, int32_t value);
+
+#endif
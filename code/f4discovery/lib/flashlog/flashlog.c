@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <libopencm3/stm32/flash.h>
+
+#include <timebase/timebase.h>
+#include <flashlog/flashlog.h>
+
+#define FLASHLOG_BASE           0x08080000u
+#define FLASHLOG_FIRST_SECTOR   8
+#define FLASHLOG_SECTORS        4
+#define FLASHLOG_SECTOR_SIZE    0x20000u
+#define FLASHLOG_PAGES          (FLASHLOG_SECTOR_SIZE / FLASHLOG_PAGE_SIZE)     /* page 0: sector header */
+#define FLASHLOG_SECTOR_MAGIC   0x474F4C46u     /* "FLOG" */
+#define FLASHLOG_PAGE_MAGIC     0xA55Au
+#define FLASHLOG_ERASED         0xFFFFFFFFu
+
+/*!
+ * \brief Sector header, start of page 0
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;               /* increases with every new head sector */
+    uint32_t erase_count;
+    uint32_t crc;               /* CRC-8 over the fields above */
+} flashlog_sector_header_t;
+
+/*!
+ * \brief Page as written, records are length, data, CRC-8 over both
+ */
+typedef struct {
+    uint16_t magic;
+    uint16_t used;              /* bytes of data in use */
+    uint8_t data[FLASHLOG_PAGE_SIZE - 4];
+} flashlog_page_t;
+
+static flashlog_page_t page_buf[2];
+static uint8_t fill_buf = 0;            /* buffer records are appended to */
+static uint8_t program_pending = 0;     /* the other buffer is written */
+static uint16_t program_word = 0;       /* next word of it */
+static uint8_t sync_pending = 0;
+
+static uint8_t head = 0;                /* sector written to */
+static uint16_t head_page = 0;          /* next free page in it */
+static uint32_t head_seq = 0;
+static uint32_t head_erase_count = 0;
+static uint8_t erase_pending = 0;       /* the sector after the head must be erased */
+static uint32_t spare_erase_count = 0;  /* erase count of the sector after the head */
+
+static flashlog_stats_t stats;
+
+/* static declarations */
+static uint32_t flashlog_sector_addr(uint8_t sector);
+static uint8_t flashlog_header_read(uint8_t sector, flashlog_sector_header_t* header);
+static void flashlog_header_write(uint8_t sector, uint32_t seq, uint32_t erase_count);
+static uint8_t flashlog_page_used(uint8_t sector, uint16_t page);
+static uint8_t flashlog_sector_blank(uint8_t sector);
+static void flashlog_erase(uint8_t sector);
+static void flashlog_new_head(void);
+static int8_t flashlog_close_page(void);
+static uint8_t flashlog_crc8(uint8_t crc, const uint8_t* data, uint16_t len);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Find the head of the log, set up an empty log if there is none
+ * \retval 0  - OK, log found
+ * \retval 1  - OK, new log (may block for a sector erase)
+ */
+int8_t flashlog_mount(void)
+{
+    flashlog_sector_header_t header;
+    uint32_t ref_seq;
+    uint8_t lo, hi, mid;
+    uint16_t page_lo, page_hi, page_mid;
+    int8_t result = 0;
+
+    memset(&stats, 0, sizeof(stats));
+    page_buf[0].magic = FLASHLOG_PAGE_MAGIC;
+    page_buf[0].used = 0;
+    fill_buf = 0;
+    program_pending = 0;
+    sync_pending = 0;
+
+    /* only the sector after the head is ever erased, so sector 0 or 1 holds data */
+    lo = 0;
+    if (flashlog_header_read(0, &header) == 0)
+    {
+        lo = 1;
+        if (flashlog_header_read(1, &header) == 0)
+        {
+            /* empty: start in sector 0 */
+            flashlog_erase(0);
+            flashlog_header_write(0, 1, spare_erase_count);
+            (void)flashlog_header_read(0, &header);
+            lo = 0;
+            result = 1;
+        }
+    }
+    ref_seq = header.seq;
+
+    /* in ring order the sequence numbers rise up to the head and drop after
+       it: binary search for the last sector at or above the reference */
+    hi = FLASHLOG_SECTORS - 1;
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if (flashlog_header_read(mid, &header) && header.seq >= ref_seq)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    head = lo;
+    (void)flashlog_header_read(head, &header);
+    head_seq = header.seq;
+    head_erase_count = header.erase_count;
+
+    /* pages are written in order: binary search for the first free one */
+    page_lo = 1;
+    page_hi = FLASHLOG_PAGES;
+    while (page_lo < page_hi)
+    {
+        page_mid = (page_lo + page_hi) / 2;
+        if (flashlog_page_used(head, page_mid))
+        {
+            page_lo = page_mid + 1;
+        }
+        else
+        {
+            page_hi = page_mid;
+        }
+    }
+    head_page = page_lo;
+
+    /* power loss before the erase after the last head change */
+    erase_pending = !flashlog_sector_blank((head + 1) % FLASHLOG_SECTORS);
+    spare_erase_count = head_erase_count;
+
+    return (result);
+}
+
+/*!
+ * \brief Append a record
+ * \param[in] data record
+ * \param[in] len length of data, 1..FLASHLOG_RECORD_MAX
+ * \retval 0  - OK
+ * \retval -1 - invalid length
+ * \retval -2 - buffers full, record dropped
+ * \note call flashlog_service() until it returns 0 afterwards
+ */
+int8_t flashlog_append(const uint8_t* data, uint8_t len)
+{
+    flashlog_page_t* page = &page_buf[fill_buf];
+    uint8_t* dst;
+
+    if (len == 0 || len > FLASHLOG_RECORD_MAX)
+    {
+        return (-1);
+    }
+
+    if ((size_t)page->used + len + 2 > sizeof(page->data))
+    {
+        if (flashlog_close_page() != 0)
+        {
+            stats.dropped++;
+            return (-2);
+        }
+        page = &page_buf[fill_buf];
+    }
+
+    dst = &page->data[page->used];
+    dst[0] = len;
+    memcpy(&dst[1], data, len);
+    dst[len + 1] = flashlog_crc8(0, dst, len + 1);
+    page->used += len + 2;
+
+    stats.records++;
+
+    return (0);
+}
+
+/*!
+ * \brief Close the RAM page, write it even if not full
+ * \details For a planned power down, costs the rest of the page.
+ */
+void flashlog_sync(void)
+{
+    if (flashlog_close_page() != 0)
+    {
+        /* after the page being written */
+        sync_pending = 1;
+    }
+}
+
+/*!
+ * \brief Do one step of flash work
+ * \returns 1 if more work is pending, otherwise 0
+ */
+uint8_t flashlog_service(void)
+{
+    const uint32_t* words;
+    uint32_t addr;
+    uint16_t total;
+    uint16_t end;
+    uint32_t start = timebase_cycles();
+    uint32_t us;
+
+    if (erase_pending)
+    {
+        /* the one long step: the CPU stalls until the sector is erased */
+        flashlog_erase((head + 1) % FLASHLOG_SECTORS);
+        erase_pending = 0;
+        stats.erase_us_last = timebase_elapsed_us(start);
+
+        return (program_pending);
+    }
+
+    if (program_pending)
+    {
+        if (program_word == 0 && head_page >= FLASHLOG_PAGES)
+        {
+            flashlog_new_head();
+        }
+
+        words = (const uint32_t*)&page_buf[fill_buf ^ 1];
+        addr = flashlog_sector_addr(head) + head_page * FLASHLOG_PAGE_SIZE;
+        total = (4 + page_buf[fill_buf ^ 1].used + 3) / 4;
+        end = program_word + FLASHLOG_PROGRAM_WORDS;
+        if (end > total)
+        {
+            end = total;
+        }
+
+        /* the page header goes first, a page cut short by a power loss is
+           recognized as used and its damaged records by their CRC */
+        flash_unlock();
+        for (; program_word < end; program_word++)
+        {
+            flash_program_word(addr + program_word * 4, words[program_word]);
+        }
+        flash_lock();
+
+        if (program_word >= total)
+        {
+            program_pending = 0;
+            program_word = 0;
+            head_page++;
+            stats.pages++;
+
+            if (sync_pending)
+            {
+                sync_pending = 0;
+                (void)flashlog_close_page();
+            }
+        }
+
+        us = timebase_elapsed_us(start);
+        if (us > stats.step_us_max)
+        {
+            stats.step_us_max = us;
+        }
+    }
+
+    return (erase_pending || program_pending);
+}
+
+/*!
+ * \brief Start reading at the oldest record
+ * \param[out] iter read position
+ */
+void flashlog_iter_init(flashlog_iter_t* iter)
+{
+    /* the sector after the head is erased, the one after that is the oldest */
+    iter->sector = (head + 2) % FLASHLOG_SECTORS;
+    iter->sectors_left = FLASHLOG_SECTORS - 1;
+    iter->page = 1;
+    iter->offset = 0;
+}
+
+/*!
+ * \brief Read the next record
+ * \param[in,out] iter read position
+ * \param[out] data buffer for the record
+ * \param[in] max size of data
+ * \returns length of the record, -1 at the end of the log
+ * \details Records with a wrong CRC and records longer than max are skipped,
+ *          the rest of a page after a damaged length is skipped. Records
+ *          still in RAM are not returned.
+ */
+int16_t flashlog_iter_next(flashlog_iter_t* iter, uint8_t* data, uint8_t max)
+{
+    flashlog_sector_header_t header;
+    const flashlog_page_t* page;
+    const uint8_t* record;
+    uint16_t pages;
+    uint8_t len;
+
+    while (iter->sectors_left > 0)
+    {
+        pages = (iter->sector == head) ? head_page : FLASHLOG_PAGES;
+
+        if (flashlog_header_read(iter->sector, &header) == 0 || iter->page >= pages)
+        {
+            iter->sector = (iter->sector + 1) % FLASHLOG_SECTORS;
+            iter->sectors_left--;
+            iter->page = 1;
+            iter->offset = 0;
+            continue;
+        }
+
+        page = (const flashlog_page_t*)(flashlog_sector_addr(iter->sector) + iter->page * FLASHLOG_PAGE_SIZE);
+        record = &page->data[iter->offset];
+        len = record[0];
+
+        if (page->magic != FLASHLOG_PAGE_MAGIC || page->used > sizeof(page->data) ||
+            iter->offset + 2 > page->used || len == 0 || iter->offset + len + 2 > page->used)
+        {
+            iter->page++;
+            iter->offset = 0;
+            continue;
+        }
+
+        iter->offset += len + 2;
+
+        if (record[len + 1] != flashlog_crc8(0, record, len + 1) || len > max)
+        {
+            continue;
+        }
+
+        memcpy(data, &record[1], len);
+
+        return (len);
+    }
+
+    return (-1);
+}
+
+/*!
+ * \brief Get the log statistics
+ * \param[out] result filled with the statistics
+ */
+void flashlog_get_stats(flashlog_stats_t* result)
+{
+    stats.head_sector = head;
+    stats.head_page = head_page;
+    stats.head_erase_count = head_erase_count;
+
+    *result = stats;
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Start address of a log sector
+ */
+static uint32_t flashlog_sector_addr(uint8_t sector)
+{
+    return (FLASHLOG_BASE + sector * FLASHLOG_SECTOR_SIZE);
+}
+
+/*!
+ * \brief Read and check a sector header
+ * \returns 1 if valid, otherwise 0
+ */
+static uint8_t flashlog_header_read(uint8_t sector, flashlog_sector_header_t* header)
+{
+    *header = *(const flashlog_sector_header_t*)flashlog_sector_addr(sector);
+
+    return (header->magic == FLASHLOG_SECTOR_MAGIC &&
+            header->crc == flashlog_crc8(0, (const uint8_t*)header, offsetof(flashlog_sector_header_t, crc)));
+}
+
+/*!
+ * \brief Write the header of an erased sector
+ */
+static void flashlog_header_write(uint8_t sector, uint32_t seq, uint32_t erase_count)
+{
+    flashlog_sector_header_t header;
+    const uint32_t* words = (const uint32_t*)&header;
+    uint8_t i;
+
+    header.magic = FLASHLOG_SECTOR_MAGIC;
+    header.seq = seq;
+    header.erase_count = erase_count;
+    header.crc = flashlog_crc8(0, (const uint8_t*)&header, offsetof(flashlog_sector_header_t, crc));
+
+    flash_unlock();
+    for (i = 0; i < sizeof(header) / 4; i++)
+    {
+        flash_program_word(flashlog_sector_addr(sector) + i * 4, words[i]);
+    }
+    flash_lock();
+}
+
+/*!
+ * \brief Check if a page has been written
+ */
+static uint8_t flashlog_page_used(uint8_t sector, uint16_t page)
+{
+    return (*(const uint32_t*)(flashlog_sector_addr(sector) + page * FLASHLOG_PAGE_SIZE) != FLASHLOG_ERASED);
+}
+
+/*!
+ * \brief Check if a sector is completely erased
+ */
+static uint8_t flashlog_sector_blank(uint8_t sector)
+{
+    const uint32_t* word = (const uint32_t*)flashlog_sector_addr(sector);
+    uint32_t i;
+
+    for (i = 0; i < FLASHLOG_SECTOR_SIZE / 4; i++)
+    {
+        if (word[i] != FLASHLOG_ERASED)
+        {
+            return (0);
+        }
+    }
+
+    return (1);
+}
+
+/*!
+ * \brief Erase a sector, blocks for 1..2 s
+ * \details Remembers the erase count for the header written when the
+ *          sector becomes the head. A sector without a valid header is
+ *          assumed as worn as the head.
+ */
+static void flashlog_erase(uint8_t sector)
+{
+    flashlog_sector_header_t header;
+
+    if (flashlog_header_read(sector, &header))
+    {
+        spare_erase_count = header.erase_count + 1;
+    }
+    else
+    {
+        spare_erase_count = head_erase_count + 1;
+    }
+
+    flash_unlock();
+    flash_erase_sector(FLASHLOG_FIRST_SECTOR + sector, FLASH_CR_PROGRAM_X32);
+    flash_lock();
+
+    stats.erases++;
+}
+
+/*!
+ * \brief Move the head to the erased sector after it
+ * \details Sector wear is levelled by the round robin order, all sectors
+ *          see the same number of erases.
+ */
+static void flashlog_new_head(void)
+{
+    head = (head + 1) % FLASHLOG_SECTORS;
+    head_seq++;
+    head_erase_count = spare_erase_count;
+    head_page = 1;
+
+    flashlog_header_write(head, head_seq, head_erase_count);
+
+    /* keep the next one erased, this drops the oldest sector */
+    erase_pending = 1;
+}
+
+/*!
+ * \brief Hand the RAM page over for writing
+ * \retval 0  - OK, or nothing to write
+ * \retval -1 - the other page is still being written
+ */
+static int8_t flashlog_close_page(void)
+{
+    if (page_buf[fill_buf].used == 0)
+    {
+        return (0);
+    }
+    if (program_pending)
+    {
+        return (-1);
+    }
+
+    program_pending = 1;
+    program_word = 0;
+    fill_buf ^= 1;
+    page_buf[fill_buf].magic = FLASHLOG_PAGE_MAGIC;
+    page_buf[fill_buf].used = 0;
+
+    return (0);
+}
+
+/*!
+ * \brief CRC-8, polynomial 0x07
+ */
+static uint8_t flashlog_crc8(uint8_t crc, const uint8_t* data, uint16_t len)
+{
+    uint8_t i;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+
+    return (crc);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
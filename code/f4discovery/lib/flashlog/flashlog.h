@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLASHLOG_H_
+#define FLASHLOG_H_
+
+#include <stdint.h>
+
+/*!
+ * \file flashlog.h
+ * \brief Append-only record log in flash sectors 8..11 (0x08080000, 4 x 128 kB)
+ * \details Records of 1..FLASHLOG_RECORD_MAX bytes are collected in a RAM
+ *          page and written page by page. Each record carries a CRC-8,
+ *          each page a header with its fill level, each sector a header
+ *          with a sequence number and its erase count.
+ *
+ *          The sectors are used round robin, which levels the wear: one
+ *          sector is always kept erased as the next one to write, the
+ *          oldest sector is erased when the head moves on. Mounting finds
+ *          the head sector by a binary search over the sector sequence
+ *          numbers and the first free page in it by a binary search over
+ *          the page headers.
+ *
+ *          flashlog_append() only copies to RAM. The flash work is done in
+ *          flashlog_service(), in steps of FLASHLOG_PROGRAM_WORDS words
+ *          (about 16 us each, the CPU stalls while the flash is busy). The
+ *          exception is the erase of the oldest sector, one step of about
+ *          1..2 s once per sector (128 kB of records).
+ *
+ *          A power loss costs the records in the RAM page, at most one page.
+ *
+ * \note The program image must stay below 0x08060000 (see params.h), the
+ *       rom region of stm32f407vg.ld ends there.
+ */
+
+#define FLASHLOG_PAGE_SIZE      256     /* bytes written at once */
+#define FLASHLOG_RECORD_MAX     (FLASHLOG_PAGE_SIZE - 4 - 2)   /* page header, length and CRC */
+#define FLASHLOG_PROGRAM_WORDS  16      /* flash words per service step */
+
+/*!
+ * \brief Log statistics
+ */
+typedef struct {
+    uint32_t records;           /*!< appended since mount */
+    uint32_t dropped;           /*!< lost because both page buffers were busy */
+    uint32_t pages;             /*!< written since mount */
+    uint32_t erases;            /*!< sector erases since mount */
+    uint8_t head_sector;        /*!< 0..3 = sector 8..11 */
+    uint16_t head_page;         /*!< next page to write in the head sector */
+    uint32_t head_erase_count;  /*!< wear of the head sector */
+    uint32_t step_us_max;       /*!< longest program step */
+    uint32_t erase_us_last;     /*!< last sector erase */
+} flashlog_stats_t;
+
+/*!
+ * \brief Read position, see flashlog_iter_init()
+ */
+typedef struct {
+    uint8_t sector;
+    uint8_t sectors_left;
+    uint16_t page;
+    uint16_t offset;
+} flashlog_iter_t;
+
+/*!
+ * \brief Find the head of the log, set up an empty log if there is none
+ * \retval 0  - OK, log found
+ * \retval 1  - OK, new log (may block for a sector erase)
+ */
+int8_t flashlog_mount(void);
+
+/*!
+ * \brief Append a record
+ * \param[in] data record
+ * \param[in] len length of data, 1..FLASHLOG_RECORD_MAX
+ * \retval 0  - OK
+ * \retval -1 - invalid length
+ * \retval -2 - buffers full, record dropped
+ * \note call flashlog_service() until it returns 0 afterwards
+ */
+int8_t flashlog_append(const uint8_t* data, uint8_t len);
+
+/*!
+ * \brief Close the RAM page, write it even if not full
+ * \details For a planned power down, costs the rest of the page.
+ */
+void flashlog_sync(void);
+
+/*!
+ * \brief Do one step of flash work
+ * \returns 1 if more work is pending, otherwise 0
+ */
+uint8_t flashlog_service(void);
+
+/*!
+ * \brief Start reading at the oldest record
+ * \param[out] iter read position
+ */
+void flashlog_iter_init(flashlog_iter_t* iter);
+
+/*!
+ * \brief Read the next record
+ * \param[in,out] iter read position
+ * \param[out] data buffer for the record
+ * \param[in] max size of data
+ * \returns length of the record, -1 at the end of the log
+ * \details Records with a wrong CRC and records longer than max are skipped,
+ *          the rest of a page after a damaged length is skipped. Records
+ *          still in RAM are not returned.
+ */
+int16_t flashlog_iter_next(flashlog_iter_t* iter, uint8_t* data, uint8_t max);
+
+/*!
+ * \brief Get the log statistics
+ * \param[out] result filled with the statistics
+ */
+void flashlog_get_stats(flashlog_stats_t* result);
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+
+#include <heater/heater.h>
+
+#define HEATER_TICK_HZ          2000    /* TIM4 counter clock */
+#define HEATER_TICKS_PER_MS     (HEATER_TICK_HZ / 1000)
+
+/*!
+ * \brief Timer channel and pin of an output
+ */
+typedef struct {
+    enum tim_oc_id oc;
+    uint16_t pin;
+} heater_channel_t;
+
+static const heater_channel_t heater_channels[HEATER_CHANNELS] = {
+    { TIM_OC2, GPIO13 },
+    { TIM_OC3, GPIO14 },
+    { TIM_OC4, GPIO15 },
+    { TIM_OC1, GPIO12 },
+};
+
+static uint8_t channel_count;
+static uint16_t period_ticks;
+static uint16_t min_on_ticks;
+static uint16_t min_off_ticks;
+static uint16_t applied_permille[HEATER_CHANNELS];
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Configure TIM4 and the output pins, all outputs start off
+ * \param[in] channels number of outputs used, 1..HEATER_CHANNELS, the
+ *            remaining pins are left alone
+ * \param[in] period_ms PWM period, up to HEATER_MAX_PERIOD_MS
+ * \param[in] min_on_ms shortest on time
+ * \param[in] min_off_ms shortest off time
+ */
+void heater_init(uint8_t channels, uint16_t period_ms, uint16_t min_on_ms, uint16_t min_off_ms)
+{
+    uint8_t i;
+
+    if (channels > HEATER_CHANNELS)
+    {
+        channels = HEATER_CHANNELS;
+    }
+    if (period_ms > HEATER_MAX_PERIOD_MS)
+    {
+        period_ms = HEATER_MAX_PERIOD_MS;
+    }
+    /* rounding to the one minimum must not break the other, both share the period */
+    if ((uint32_t)min_on_ms + min_off_ms > period_ms)
+    {
+        min_on_ms = (uint16_t)(((uint32_t)period_ms * min_on_ms) / ((uint32_t)min_on_ms + min_off_ms));
+        min_off_ms = period_ms - min_on_ms;
+    }
+
+    channel_count = channels;
+    period_ticks = period_ms * HEATER_TICKS_PER_MS;
+    min_on_ticks = min_on_ms * HEATER_TICKS_PER_MS;
+    min_off_ticks = min_off_ms * HEATER_TICKS_PER_MS;
+
+    rcc_periph_clock_enable(RCC_GPIOD);
+    rcc_periph_clock_enable(RCC_TIM4);
+
+    /* APB1 timers run at twice the APB1 clock */
+    timer_set_mode(TIM4, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_set_prescaler(TIM4, (2 * rcc_apb1_frequency) / HEATER_TICK_HZ - 1);
+    timer_set_period(TIM4, period_ticks - 1);
+    timer_enable_preload(TIM4);
+
+    for (i = 0; i < channel_count; i++)
+    {
+        applied_permille[i] = 0;
+
+        gpio_mode_setup(GPIOD, GPIO_MODE_AF, GPIO_PUPD_NONE, heater_channels[i].pin);
+        gpio_set_af(GPIOD, GPIO_AF2, heater_channels[i].pin);
+
+        /* output high while the counter is below the compare value */
+        timer_set_oc_mode(TIM4, heater_channels[i].oc, TIM_OCM_PWM1);
+        timer_enable_oc_preload(TIM4, heater_channels[i].oc);
+        timer_set_oc_value(TIM4, heater_channels[i].oc, 0);
+        timer_enable_oc_output(TIM4, heater_channels[i].oc);
+    }
+
+    timer_generate_event(TIM4, TIM_EGR_UG);
+    timer_enable_counter(TIM4);
+}
+
+/*!
+ * \brief Set the duty cycle of an output for the next PWM periods
+ * \param[in] channel output, ignored if not configured
+ * \param[in] permille duty cycle, 0..1000
+ * \returns duty cycle actually applied after the minimum on/off times, 1/1000
+ */
+uint16_t heater_set(uint8_t channel, uint16_t permille)
+{
+    uint32_t on;
+
+    if (channel >= channel_count)
+    {
+        return (0);
+    }
+    if (permille > 1000)
+    {
+        permille = 1000;
+    }
+
+    on = ((uint32_t)period_ticks * permille + 500) / 1000;
+
+    /* too short pulses or gaps round to the nearer of the two choices */
+    if (on > 0 && on < min_on_ticks)
+    {
+        on = (2 * on >= min_on_ticks) ? min_on_ticks : 0;
+    }
+    if (on < period_ticks && period_ticks - on < min_off_ticks)
+    {
+        on = (2 * (period_ticks - on) >= min_off_ticks) ? (uint32_t)(period_ticks - min_off_ticks) : period_ticks;
+    }
+
+    /* a compare value of period_ticks keeps the output on for the whole period */
+    timer_set_oc_value(TIM4, heater_channels[channel].oc, on);
+
+    applied_permille[channel] = (uint16_t)((on * 1000 + period_ticks / 2) / period_ticks);
+
+    return (applied_permille[channel]);
+}
+
+/*!
+ * \brief Duty cycle currently applied
+ * \param[in] channel output
+ * \returns duty cycle, 1/1000
+ */
+uint16_t heater_get(uint8_t channel)
+{
+    if (channel >= channel_count)
+    {
+        return (0);
+    }
+
+    return (applied_permille[channel]);
+}
+
+/*!
+ * \brief Check for an active output
+ * \returns 1 if any output has a duty cycle above 0, otherwise 0
+ */
+uint8_t heater_any_on(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < channel_count; i++)
+    {
+        if (applied_permille[i] != 0)
+        {
+            return (1);
+        }
+    }
+
+    return (0);
+}
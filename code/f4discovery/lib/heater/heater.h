@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEATER_H_
+#define HEATER_H_
+
+#include <stdint.h>
+
+/*!
+ * \file heater.h
+ * \brief Heater / relay outputs, slow PWM on the four TIM4 channels
+ * \details Channel 0 is PD13 (TIM4 CH2), 1 PD14 (CH3), 2 PD15 (CH4) and
+ *          3 PD12 (CH1); on the discovery board these drive the orange,
+ *          red, blue and green LEDs, which show the outputs during
+ *          bring-up. All channels share one PWM period. A new duty cycle
+ *          is taken over at the start of a PWM period only (preload), so
+ *          no period is ever cut short. On and off times are 0 or at least
+ *          the configured minimum, a relay never switches faster than that.
+ */
+
+#define HEATER_CHANNELS         4
+#define HEATER_MAX_PERIOD_MS    32000   /* TIM4 counts 2 kHz ticks, 16 bit */
+
+/*!
+ * \brief Configure TIM4 and the output pins, all outputs start off
+ * \param[in] channels number of outputs used, 1..HEATER_CHANNELS, the
+ *            remaining pins are left alone
+ * \param[in] period_ms PWM period, up to HEATER_MAX_PERIOD_MS
+ * \param[in] min_on_ms shortest on time
+ * \param[in] min_off_ms shortest off time
+ * \note Both minimums hold only if min_on_ms + min_off_ms <= period_ms,
+ *       larger values are scaled down to fill the period, keeping their
+ *       ratio (period 1000, 600 / 600 gives 500 / 500).
+ */
+void heater_init(uint8_t channels, uint16_t period_ms, uint16_t min_on_ms, uint16_t min_off_ms);
+
+/*!
+ * \brief Set the duty cycle of an output for the next PWM periods
+ * \param[in] channel output, ignored if not configured
+ * \param[in] permille duty cycle, 0..1000
+ * \returns duty cycle actually applied after the minimum on/off times, 1/1000
+ */
+uint16_t heater_set(uint8_t channel, uint16_t permille);
+
+/*!
+ * \brief Duty cycle currently applied
+ * \param[in] channel output
+ * \returns duty cycle, 1/1000
+ */
+uint16_t heater_get(uint8_t channel);
+
+/*!
+ * \brief Check for an active output
+ * \returns 1 if any output has a duty cycle above 0, otherwise 0
+ */
+uint8_t heater_any_on(void);
+
+#endif
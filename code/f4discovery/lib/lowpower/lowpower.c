@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/rtc.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include <lowpower/lowpower.h>
+
+#define LOWPOWER_RTC_PREDIV_A   31      /* LSI 32 kHz / 32 = 1 kHz sub-second counter */
+#define LOWPOWER_RTC_PREDIV_S   999     /* 1 kHz / 1000 = 1 Hz calendar */
+#define LOWPOWER_WAKEUP_HZ      2000    /* wakeup timer clock: LSI 32 kHz / 16 */
+#define LOWPOWER_HSI_MHZ        16      /* system clock right after STOP */
+#define LOWPOWER_DAY_MS         86400000u
+
+static const struct rcc_clock_scale* run_clock = NULL;
+static lowpower_stats_t stats;
+static uint32_t awake_since_ms;         /* RTC time of the last wakeup */
+static uint32_t restored_cycles;        /* cycle counter when the clocks were back */
+static uint8_t latency_pending;         /* waiting for lowpower_result_ready() */
+
+/* static declarations */
+static uint32_t lowpower_rtc_ms(void);
+static void lowpower_wakeup_timer(uint32_t ms);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Start the RTC and set up the wakeup timer interrupt
+ * \param[in] clock system clock setup to restore after a STOP
+ */
+void lowpower_init(const struct rcc_clock_scale* clock)
+{
+    run_clock = clock;
+
+    rcc_periph_clock_enable(RCC_PWR);
+    pwr_disable_backup_domain_write_protect();
+
+    rcc_osc_on(RCC_LSI);
+    rcc_wait_for_osc_ready(RCC_LSI);
+
+    RCC_BDCR = (RCC_BDCR & ~(RCC_BDCR_RTCSEL_MASK << RCC_BDCR_RTCSEL_SHIFT)) |
+            (RCC_BDCR_RTCSEL_LSI << RCC_BDCR_RTCSEL_SHIFT) | RCC_BDCR_RTCEN;
+
+    rtc_unlock();
+
+    /* prescalers can only be written in init mode */
+    RTC_ISR |= RTC_ISR_INIT;
+    while ((RTC_ISR & RTC_ISR_INITF) == 0);
+    RTC_PRER = (LOWPOWER_RTC_PREDIV_A << RTC_PRER_PREDIV_A_SHIFT) |
+            (LOWPOWER_RTC_PREDIV_S << RTC_PRER_PREDIV_S_SHIFT);
+    RTC_ISR &= ~RTC_ISR_INIT;
+
+    /* read the counters directly, the shadow registers are stale after STOP */
+    RTC_CR |= RTC_CR_BYPSHAD;
+
+    rtc_lock();
+
+    /* the wakeup timer reaches the NVIC through EXTI line 22 */
+    exti_set_trigger(EXTI22, EXTI_TRIGGER_RISING);
+    exti_enable_request(EXTI22);
+    nvic_enable_irq(NVIC_RTC_WKUP_IRQ);
+
+    dwt_enable_cycle_counter();
+
+    awake_since_ms = lowpower_rtc_ms();
+}
+
+/*!
+ * \brief Enter STOP mode
+ * \param[in] max_ms wake up after this many milliseconds at the latest
+ * \returns milliseconds spent in STOP (measured by the RTC), other
+ *          interrupts (EXTI) end the STOP early
+ * \note call with interrupts masked, a pending interrupt runs once they are enabled
+ */
+uint32_t lowpower_stop(uint32_t max_ms)
+{
+    uint32_t start;
+    uint32_t wake_cycles;
+    uint32_t slept;
+
+    if (max_ms > LOWPOWER_MAX_STOP_MS)
+    {
+        max_ms = LOWPOWER_MAX_STOP_MS;
+    }
+
+    start = lowpower_rtc_ms();
+    stats.run_ms += (start - awake_since_ms + LOWPOWER_DAY_MS) % LOWPOWER_DAY_MS;
+
+    lowpower_wakeup_timer(max_ms);
+
+    /* STOP with the regulator in low power mode */
+    PWR_CR = (PWR_CR & ~PWR_CR_PDDS) | PWR_CR_LPDS | PWR_CR_CWUF;
+    SCB_SCR |= SCB_SCR_SLEEPDEEP;
+
+    __asm__ volatile ("wfi");
+
+    SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+    wake_cycles = dwt_read_cycle_counter();
+
+    /* running from HSI now, back to the full clock setup */
+    rcc_clock_setup_hse_3v3(run_clock);
+    restored_cycles = dwt_read_cycle_counter();
+    stats.restore_us = (restored_cycles - wake_cycles) / LOWPOWER_HSI_MHZ;
+
+    lowpower_wakeup_timer(0);
+
+    awake_since_ms = lowpower_rtc_ms();
+    slept = (awake_since_ms - start + LOWPOWER_DAY_MS) % LOWPOWER_DAY_MS;
+
+    stats.stops++;
+    stats.stop_ms += slept;
+    latency_pending = 1;
+
+    return (slept);
+}
+
+/*!
+ * \brief Mark the result the last wakeup was for as available
+ * \details Closes the wakeup latency measurement, further calls until the
+ *          next STOP are ignored.
+ */
+void lowpower_result_ready(void)
+{
+    if (latency_pending == 0)
+    {
+        return;
+    }
+
+    latency_pending = 0;
+    stats.latency_us = stats.restore_us +
+            (dwt_read_cycle_counter() - restored_cycles) / (rcc_ahb_frequency / 1000000);
+
+    if (stats.latency_us > stats.latency_worst_us)
+    {
+        stats.latency_worst_us = stats.latency_us;
+    }
+}
+
+/*!
+ * \brief Get the low power statistics
+ * \param[out] result filled with the statistics
+ */
+void lowpower_get_stats(lowpower_stats_t* result)
+{
+    uint64_t total = (uint64_t)stats.run_ms + stats.stop_ms;
+
+    stats.duty_permille = (total == 0) ? 1000 : (uint16_t)((uint64_t)stats.run_ms * 1000 / total);
+    *result = stats;
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Millisecond of the day from the RTC
+ */
+static uint32_t lowpower_rtc_ms(void)
+{
+    uint32_t ssr;
+    uint32_t tr;
+    uint32_t seconds;
+
+    /* no shadow registers: read again if the second changed in between */
+    do
+    {
+        ssr = RTC_SSR;
+        tr = RTC_TR;
+    } while (RTC_SSR > ssr);
+
+    seconds = (((tr >> 20) & 0x3) * 10 + ((tr >> 16) & 0xF)) * 3600 +
+              (((tr >> 12) & 0x7) * 10 + ((tr >> 8) & 0xF)) * 60 +
+              (((tr >> 4) & 0x7) * 10 + (tr & 0xF));
+
+    /* the sub-second counter counts down */
+    return (seconds * 1000 + (LOWPOWER_RTC_PREDIV_S - (ssr & 0xFFFF)));
+}
+
+/*!
+ * \brief Arm or stop the RTC wakeup timer
+ * \param[in] ms time until the wakeup, 0 to stop the timer
+ */
+static void lowpower_wakeup_timer(uint32_t ms)
+{
+    rtc_unlock();
+
+    RTC_CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    RTC_ISR &= ~RTC_ISR_WUTF;
+
+    if (ms > 0)
+    {
+        /* the reload value can only be written while the timer is stopped */
+        while ((RTC_ISR & RTC_ISR_WUTWF) == 0);
+
+        RTC_WUTR = ms * (LOWPOWER_WAKEUP_HZ / 1000) - 1;
+        RTC_CR = (RTC_CR & ~RTC_CR_WUCLKSEL_MASK) | RTC_CR_WUCLKSEL_RTC_DIV16;
+        RTC_CR |= RTC_CR_WUTE | RTC_CR_WUTIE;
+    }
+
+    rtc_lock();
+
+    exti_reset_request(EXTI22);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief RTC wakeup interrupt, only ends the STOP
+ */
+void rtc_wkup_isr(void)
+{
+    RTC_ISR &= ~RTC_ISR_WUTF;
+    exti_reset_request(EXTI22);
+}
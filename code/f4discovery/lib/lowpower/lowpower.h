@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOWPOWER_H_
+#define LOWPOWER_H_
+
+#include <stdint.h>
+#include <libopencm3/stm32/rcc.h>
+
+/*!
+ * \file lowpower.h
+ * \brief STOP mode with RTC wakeup
+ * \details The RTC runs from the LSI (about 32 kHz, +-50 %) and keeps a
+ *          millisecond time across STOP mode, its wakeup timer ends the
+ *          sleep. In STOP the core, SysTick and all high speed clocks halt,
+ *          SRAM and peripheral registers are kept. After wakeup the system
+ *          clock is restored to the setup passed to lowpower_init(), the same
+ *          bus clocks as before, so USART and I2C setups stay valid and need
+ *          no re-initialization.
+ *
+ *          Peripherals must be idle (no DMA or bus transfer running) when
+ *          entering STOP, their clocks stop as well.
+ */
+
+#define LOWPOWER_MAX_STOP_MS    30000   /* longest single STOP, limit of the wakeup timer */
+
+/*!
+ * \brief Low power statistics
+ */
+typedef struct {
+    uint32_t stops;             /*!< STOP mode entries */
+    uint32_t stop_ms;           /*!< time spent in STOP */
+    uint32_t run_ms;            /*!< time spent awake between the STOPs */
+    uint16_t duty_permille;     /*!< run_ms / (run_ms + stop_ms) */
+    uint32_t restore_us;        /*!< last wakeup to clocks restored */
+    uint32_t latency_us;        /*!< last wakeup to lowpower_result_ready() */
+    uint32_t latency_worst_us;
+} lowpower_stats_t;
+
+/*!
+ * \brief Start the RTC and set up the wakeup timer interrupt
+ * \param[in] clock system clock setup to restore after a STOP
+ */
+void lowpower_init(const struct rcc_clock_scale* clock);
+
+/*!
+ * \brief Enter STOP mode
+ * \param[in] max_ms wake up after this many milliseconds at the latest
+ * \returns milliseconds spent in STOP (measured by the RTC), other
+ *          interrupts (EXTI) end the STOP early
+ * \note call with interrupts masked, a pending interrupt runs once they are enabled
+ */
+uint32_t lowpower_stop(uint32_t max_ms);
+
+/*!
+ * \brief Mark the result the last wakeup was for as available
+ * \details Closes the wakeup latency measurement, further calls until the
+ *          next STOP are ignored.
+ */
+void lowpower_result_ready(void);
+
+/*!
+ * \brief Get the low power statistics
+ * \param[out] result filled with the statistics
+ */
+void lowpower_get_stats(lowpower_stats_t* result);
+
+#endif
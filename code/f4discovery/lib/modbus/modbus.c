@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include <sched/sched.h>
+#include <timebase/timebase.h>
+#include <modbus/modbus.h>
+
+#define MODBUS_USART            USART6
+#define MODBUS_USART_CLK        RCC_USART6
+#define MODBUS_USART_IRQ        NVIC_USART6_IRQ
+#define MODBUS_GPIO_PORT        GPIOC
+#define MODBUS_GPIO_CLK         RCC_GPIOC
+#define MODBUS_GPIO_TX          GPIO6
+#define MODBUS_GPIO_RX          GPIO7
+#define MODBUS_GPIO_DE          GPIO8
+#define MODBUS_DMA              DMA2
+#define MODBUS_DMA_CLK          RCC_DMA2
+#define MODBUS_DMA_RX_STREAM    DMA_STREAM1
+#define MODBUS_DMA_TX_STREAM    DMA_STREAM6
+#define MODBUS_DMA_CHANNEL      DMA_SxCR_CHSEL_5    /* USART6_RX / USART6_TX */
+
+#define MODBUS_ADDR_BROADCAST   0
+#define MODBUS_READ_MAX         125     /* registers per read request */
+#define MODBUS_WRITE_MAX        123     /* registers per write request */
+
+/* function codes */
+#define MODBUS_FC_READ_HOLDING  0x03
+#define MODBUS_FC_READ_INPUT    0x04
+#define MODBUS_FC_WRITE_SINGLE  0x06
+#define MODBUS_FC_WRITE_MULTIPLE 0x10
+
+/* exception codes */
+#define MODBUS_EX_FUNCTION      0x01
+#define MODBUS_EX_ADDRESS       0x02
+#define MODBUS_EX_VALUE         0x03
+
+/* CRC-16/MODBUS, reflected polynomial 0xA001 */
+static const uint16_t crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+static uint8_t rx_buf[MODBUS_FRAME_MAX];
+static uint8_t tx_buf[MODBUS_FRAME_MAX];
+static uint16_t input_image[2][MODBUS_INPUT_REGS];
+static uint16_t* volatile input_front = input_image[0];    /* read by the master */
+static uint16_t holding[MODBUS_HOLDING_REGS];
+static const modbus_limits_t* limits;
+static uint8_t slave_address;
+static uint32_t write_event;
+static volatile uint8_t tx_busy = 0;
+static modbus_stats_t stats;
+
+/* static declarations */
+static void modbus_rx_start(void);
+static void modbus_tx_start(uint16_t len);
+static uint16_t modbus_process(const uint8_t* req, uint16_t len, uint8_t* rsp);
+static uint16_t modbus_read(const uint8_t* req, uint8_t* rsp, const uint16_t* regs, uint16_t count);
+static uint16_t modbus_write(const uint8_t* req, uint16_t len, uint8_t* rsp);
+static uint16_t modbus_exception(const uint8_t* req, uint8_t* rsp, uint8_t code);
+static uint16_t modbus_crc16(const uint8_t* data, uint16_t len);
+static uint16_t modbus_get16(const uint8_t* p);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up USART6, its DMA streams and the GPIOs
+ * \param[in] address slave address, 1..247
+ * \param[in] holding_limits MODBUS_HOLDING_REGS limits, stays in use
+ * \param[in] event scheduler event set after a master wrote holding registers
+ */
+void modbus_init(uint8_t address, const modbus_limits_t* holding_limits, uint32_t event)
+{
+    slave_address = address;
+    limits = holding_limits;
+    write_event = event;
+
+    rcc_periph_clock_enable(MODBUS_GPIO_CLK);
+    rcc_periph_clock_enable(MODBUS_USART_CLK);
+    rcc_periph_clock_enable(MODBUS_DMA_CLK);
+
+    gpio_mode_setup(MODBUS_GPIO_PORT, GPIO_MODE_AF, GPIO_PUPD_PULLUP, MODBUS_GPIO_TX | MODBUS_GPIO_RX);
+    gpio_set_output_options(MODBUS_GPIO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ, MODBUS_GPIO_TX);
+    gpio_set_af(MODBUS_GPIO_PORT, GPIO_AF8, MODBUS_GPIO_TX | MODBUS_GPIO_RX);
+
+    /* driver enable, receiving */
+    gpio_clear(MODBUS_GPIO_PORT, MODBUS_GPIO_DE);
+    gpio_mode_setup(MODBUS_GPIO_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, MODBUS_GPIO_DE);
+
+    usart_set_baudrate(MODBUS_USART, MODBUS_BAUDRATE);
+    usart_set_databits(MODBUS_USART, 8);
+    usart_set_stopbits(MODBUS_USART, USART_STOPBITS_1);
+    usart_set_mode(MODBUS_USART, USART_MODE_TX_RX);
+    usart_set_parity(MODBUS_USART, USART_PARITY_NONE);
+    usart_set_flow_control(MODBUS_USART, USART_FLOWCONTROL_NONE);
+    usart_enable_rx_dma(MODBUS_USART);
+    usart_enable_tx_dma(MODBUS_USART);
+
+    /* the idle line ends a frame, raw register access like the 1-Wire HAL */
+    USART_CR1(MODBUS_USART) |= USART_CR1_IDLEIE;
+
+    /* below the 1-Wire UART (priority 0) */
+    nvic_set_priority(MODBUS_USART_IRQ, 2 << 4);
+    nvic_enable_irq(MODBUS_USART_IRQ);
+
+    modbus_rx_start();
+    usart_enable(MODBUS_USART);
+}
+
+/*!
+ * \brief Start an update of the input registers
+ * \returns register image to write, holds the current values
+ */
+uint16_t* modbus_input_begin(void)
+{
+    uint16_t* back = (input_front == input_image[0]) ? input_image[1] : input_image[0];
+
+    memcpy(back, input_front, sizeof(input_image[0]));
+
+    return (back);
+}
+
+/*!
+ * \brief Make the updated input registers visible to the master
+ */
+void modbus_input_commit(void)
+{
+    /* one pointer store, the interrupt sees the old or the new image */
+    input_front = (input_front == input_image[0]) ? input_image[1] : input_image[0];
+}
+
+/*!
+ * \brief Read a holding register
+ * \param[in] reg register number
+ * \returns value
+ */
+uint16_t modbus_holding_get(uint16_t reg)
+{
+    return ((reg < MODBUS_HOLDING_REGS) ? holding[reg] : 0);
+}
+
+/*!
+ * \brief Set a holding register from the application
+ * \param[in] reg register number
+ * \param[in] value value
+ */
+void modbus_holding_set(uint16_t reg, uint16_t value)
+{
+    if (reg < MODBUS_HOLDING_REGS)
+    {
+        holding[reg] = value;
+    }
+}
+
+/*!
+ * \brief Get the bus counters
+ * \param[out] result filled with the counters
+ */
+void modbus_get_stats(modbus_stats_t* result)
+{
+    *result = stats;
+}
+
+/*!
+ * \brief Check for a running reply
+ * \returns 1 while a reply is sent, otherwise 0
+ */
+uint8_t modbus_busy(void)
+{
+    return (tx_busy);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Receive the next frame into rx_buf
+ */
+static void modbus_rx_start(void)
+{
+    dma_stream_reset(MODBUS_DMA, MODBUS_DMA_RX_STREAM);
+    dma_channel_select(MODBUS_DMA, MODBUS_DMA_RX_STREAM, MODBUS_DMA_CHANNEL);
+    dma_set_transfer_mode(MODBUS_DMA, MODBUS_DMA_RX_STREAM, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(MODBUS_DMA, MODBUS_DMA_RX_STREAM, (uint32_t)&USART_DR(MODBUS_USART));
+    dma_set_memory_address(MODBUS_DMA, MODBUS_DMA_RX_STREAM, (uint32_t)rx_buf);
+    dma_set_number_of_data(MODBUS_DMA, MODBUS_DMA_RX_STREAM, sizeof(rx_buf));
+    dma_enable_memory_increment_mode(MODBUS_DMA, MODBUS_DMA_RX_STREAM);
+    dma_set_peripheral_size(MODBUS_DMA, MODBUS_DMA_RX_STREAM, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(MODBUS_DMA, MODBUS_DMA_RX_STREAM, DMA_SxCR_MSIZE_8BIT);
+    dma_set_priority(MODBUS_DMA, MODBUS_DMA_RX_STREAM, DMA_SxCR_PL_HIGH);
+    dma_enable_stream(MODBUS_DMA, MODBUS_DMA_RX_STREAM);
+}
+
+/*!
+ * \brief Send tx_buf, the driver is enabled until transmission complete
+ * \param[in] len bytes to send
+ */
+static void modbus_tx_start(uint16_t len)
+{
+    tx_busy = 1;
+    gpio_set(MODBUS_GPIO_PORT, MODBUS_GPIO_DE);
+
+    dma_stream_reset(MODBUS_DMA, MODBUS_DMA_TX_STREAM);
+    dma_channel_select(MODBUS_DMA, MODBUS_DMA_TX_STREAM, MODBUS_DMA_CHANNEL);
+    dma_set_transfer_mode(MODBUS_DMA, MODBUS_DMA_TX_STREAM, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(MODBUS_DMA, MODBUS_DMA_TX_STREAM, (uint32_t)&USART_DR(MODBUS_USART));
+    dma_set_memory_address(MODBUS_DMA, MODBUS_DMA_TX_STREAM, (uint32_t)tx_buf);
+    dma_set_number_of_data(MODBUS_DMA, MODBUS_DMA_TX_STREAM, len);
+    dma_enable_memory_increment_mode(MODBUS_DMA, MODBUS_DMA_TX_STREAM);
+    dma_set_peripheral_size(MODBUS_DMA, MODBUS_DMA_TX_STREAM, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(MODBUS_DMA, MODBUS_DMA_TX_STREAM, DMA_SxCR_MSIZE_8BIT);
+    dma_set_priority(MODBUS_DMA, MODBUS_DMA_TX_STREAM, DMA_SxCR_PL_MEDIUM);
+
+    /* TC is set from the last frame, clear it by writing 0, the 1s keep
+       the other flags (a read-modify-write could clear RXNE set meanwhile) */
+    USART_SR(MODBUS_USART) = ~USART_SR_TC;
+    dma_enable_stream(MODBUS_DMA, MODBUS_DMA_TX_STREAM);
+    USART_CR1(MODBUS_USART) |= USART_CR1_TCIE;
+}
+
+/*!
+ * \brief Handle a complete request
+ * \param[in] req request, CRC checked
+ * \param[in] len request length without CRC
+ * \param[out] rsp reply without CRC
+ * \returns reply length, 0 for no reply
+ */
+static uint16_t modbus_process(const uint8_t* req, uint16_t len, uint8_t* rsp)
+{
+    uint16_t start;
+    uint16_t count;
+
+    if (len < 2)
+    {
+        return (0);
+    }
+
+    switch (req[1])
+    {
+        case MODBUS_FC_READ_HOLDING:
+        case MODBUS_FC_READ_INPUT:
+            if (len != 6)
+            {
+                return (modbus_exception(req, rsp, MODBUS_EX_VALUE));
+            }
+            start = modbus_get16(&req[2]);
+            count = modbus_get16(&req[4]);
+            if (count == 0 || count > MODBUS_READ_MAX)
+            {
+                return (modbus_exception(req, rsp, MODBUS_EX_VALUE));
+            }
+            if (req[1] == MODBUS_FC_READ_HOLDING)
+            {
+                if ((uint32_t)start + count > MODBUS_HOLDING_REGS)
+                {
+                    return (modbus_exception(req, rsp, MODBUS_EX_ADDRESS));
+                }
+                return (modbus_read(req, rsp, &holding[start], count));
+            }
+            if ((uint32_t)start + count > MODBUS_INPUT_REGS)
+            {
+                return (modbus_exception(req, rsp, MODBUS_EX_ADDRESS));
+            }
+            return (modbus_read(req, rsp, &input_front[start], count));
+
+        case MODBUS_FC_WRITE_SINGLE:
+        case MODBUS_FC_WRITE_MULTIPLE:
+            return (modbus_write(req, len, rsp));
+
+        default:
+            return (modbus_exception(req, rsp, MODBUS_EX_FUNCTION));
+    }
+}
+
+/*!
+ * \brief Reply to a read request
+ */
+static uint16_t modbus_read(const uint8_t* req, uint8_t* rsp, const uint16_t* regs, uint16_t count)
+{
+    uint16_t i;
+
+    rsp[0] = req[0];
+    rsp[1] = req[1];
+    rsp[2] = (uint8_t)(2 * count);
+    for (i = 0; i < count; i++)
+    {
+        rsp[3 + 2 * i] = (uint8_t)(regs[i] >> 8);
+        rsp[4 + 2 * i] = (uint8_t)regs[i];
+    }
+
+    return (3 + 2 * count);
+}
+
+/*!
+ * \brief Check and apply a write request, all registers or none
+ */
+static uint16_t modbus_write(const uint8_t* req, uint16_t len, uint8_t* rsp)
+{
+    const uint8_t* values;
+    uint16_t start = modbus_get16(&req[2]);
+    uint16_t count;
+    uint16_t value;
+    uint16_t i;
+    int32_t check;
+
+    if (req[1] == MODBUS_FC_WRITE_SINGLE)
+    {
+        if (len != 6)
+        {
+            return (modbus_exception(req, rsp, MODBUS_EX_VALUE));
+        }
+        count = 1;
+        values = &req[4];
+    }
+    else
+    {
+        count = modbus_get16(&req[4]);
+        if (len < 7 || count == 0 || count > MODBUS_WRITE_MAX || req[6] != 2 * count || len != 7 + 2 * count)
+        {
+            return (modbus_exception(req, rsp, MODBUS_EX_VALUE));
+        }
+        values = &req[7];
+    }
+
+    if ((uint32_t)start + count > MODBUS_HOLDING_REGS)
+    {
+        return (modbus_exception(req, rsp, MODBUS_EX_ADDRESS));
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        value = modbus_get16(&values[2 * i]);
+        /* a negative lower limit makes the register signed */
+        check = (limits[start + i].min < 0) ? (int16_t)value : value;
+        if (check < limits[start + i].min || check > limits[start + i].max)
+        {
+            return (modbus_exception(req, rsp, MODBUS_EX_VALUE));
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        holding[start + i] = modbus_get16(&values[2 * i]);
+    }
+    sched_event_set(write_event);
+
+    /* both replies echo address and count or value */
+    memcpy(rsp, req, 6);
+
+    return (6);
+}
+
+/*!
+ * \brief Exception reply
+ */
+static uint16_t modbus_exception(const uint8_t* req, uint8_t* rsp, uint8_t code)
+{
+    rsp[0] = req[0];
+    rsp[1] = req[1] | 0x80;
+    rsp[2] = code;
+    stats.exceptions++;
+
+    return (3);
+}
+
+/*!
+ * \brief CRC-16/MODBUS, one table lookup per byte
+ */
+static uint16_t modbus_crc16(const uint8_t* data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+    {
+        crc = (crc >> 8) ^ crc_table[(crc ^ *data++) & 0xFF];
+    }
+
+    return (crc);
+}
+
+/*!
+ * \brief Big endian register value
+ */
+static uint16_t modbus_get16(const uint8_t* p)
+{
+    return ((uint16_t)((p[0] << 8) | p[1]));
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief USART6: idle line ends a request, transmission complete ends a reply
+ */
+void usart6_isr(void)
+{
+    uint32_t start = timebase_cycles();
+    uint32_t us;
+    uint16_t len;
+    uint16_t crc;
+
+    if ((USART_CR1(MODBUS_USART) & USART_CR1_TCIE) && usart_get_flag(MODBUS_USART, USART_SR_TC))
+    {
+        /* last stop bit is out: release the bus, listen again */
+        USART_CR1(MODBUS_USART) &= ~USART_CR1_TCIE;
+        gpio_clear(MODBUS_GPIO_PORT, MODBUS_GPIO_DE);
+        dma_disable_stream(MODBUS_DMA, MODBUS_DMA_TX_STREAM);
+        tx_busy = 0;
+
+        /* drop what the transceiver echoed meanwhile */
+        (void)USART_SR(MODBUS_USART);
+        (void)USART_DR(MODBUS_USART);
+        modbus_rx_start();
+        return;
+    }
+
+    if (usart_get_flag(MODBUS_USART, USART_SR_IDLE) == 0)
+    {
+        return;
+    }
+
+    /* SR then DR clears IDLE (and ORE) */
+    (void)USART_SR(MODBUS_USART);
+    (void)USART_DR(MODBUS_USART);
+
+    dma_disable_stream(MODBUS_DMA, MODBUS_DMA_RX_STREAM);
+    len = sizeof(rx_buf) - dma_get_number_of_data(MODBUS_DMA, MODBUS_DMA_RX_STREAM);
+
+    if (len == 0 || tx_busy)
+    {
+        /* echo of the own reply or noise */
+        if (!tx_busy)
+        {
+            modbus_rx_start();
+        }
+        return;
+    }
+
+    stats.frames++;
+
+    if (len >= sizeof(rx_buf))
+    {
+        stats.overruns++;
+        modbus_rx_start();
+        return;
+    }
+
+    crc = (len >= 4) ? modbus_crc16(rx_buf, len - 2) : 0;
+    if (len < 4 || rx_buf[len - 2] != (uint8_t)crc || rx_buf[len - 1] != (uint8_t)(crc >> 8))
+    {
+        stats.crc_errors++;
+        modbus_rx_start();
+        return;
+    }
+
+    if (rx_buf[0] != slave_address && rx_buf[0] != MODBUS_ADDR_BROADCAST)
+    {
+        modbus_rx_start();
+        return;
+    }
+
+    len = modbus_process(rx_buf, len - 2, tx_buf);
+    if (len == 0 || rx_buf[0] == MODBUS_ADDR_BROADCAST)
+    {
+        modbus_rx_start();
+        return;
+    }
+
+    crc = modbus_crc16(tx_buf, len);
+    tx_buf[len++] = (uint8_t)crc;
+    tx_buf[len++] = (uint8_t)(crc >> 8);
+
+    modbus_tx_start(len);
+    stats.replies++;
+
+    us = timebase_elapsed_us(start);
+    if (us > stats.reply_us_max)
+    {
+        stats.reply_us_max = us;
+    }
+}
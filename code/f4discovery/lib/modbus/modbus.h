@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MODBUS_H_
+#define MODBUS_H_
+
+#include <stdint.h>
+
+/*!
+ * \file modbus.h
+ * \brief Modbus RTU slave on USART6 (TX PC6, RX PC7, RS-485 driver enable PC8)
+ * \details A request is received by DMA (DMA2 stream 1, channel 5); the end
+ *          of the frame is the idle line interrupt, so there is one interrupt
+ *          per frame instead of one per byte. The reply is built right in
+ *          that interrupt from the register image and sent by DMA (DMA2
+ *          stream 6, channel 5), the driver enable drops with transmission
+ *          complete. Reply latency is one character of idle line (87 us at
+ *          115200 baud), the CRC over the frame (table driven) and a copy from
+ *          the image, some microseconds.
+ *
+ *          The main loop keeps the image current: input registers are
+ *          written between modbus_input_begin() and modbus_input_commit()
+ *          and become visible to the master all at once, so multi-register
+ *          values never tear. Holding registers are written by the master
+ *          within their limits (otherwise exception 3) and read by the main
+ *          loop after the write event.
+ *
+ *          Functions 03 (read holding), 04 (read input), 06 (write single)
+ *          and 16 (write multiple). Address 0 is broadcast: writes without
+ *          reply.
+ *
+ *          The interrupts run below the 1-Wire UART, which generates the
+ *          1-Wire slots in hardware; a Modbus frame can only add a pause
+ *          between two slots, which the bus allows.
+ */
+
+#define MODBUS_BAUDRATE         115200
+#define MODBUS_INPUT_REGS       32
+#define MODBUS_HOLDING_REGS     16
+#define MODBUS_FRAME_MAX        256
+
+/*!
+ * \brief Value range of a holding register, signed or unsigned as the master sees it
+ */
+typedef struct {
+    int32_t min;
+    int32_t max;
+} modbus_limits_t;
+
+/*!
+ * \brief Bus counters
+ */
+typedef struct {
+    uint32_t frames;            /*!< frames received, any address */
+    uint32_t crc_errors;        /*!< frames with a wrong CRC or too short */
+    uint32_t replies;
+    uint32_t exceptions;        /*!< replies with an exception code */
+    uint32_t overruns;          /*!< frames longer than MODBUS_FRAME_MAX */
+    uint32_t reply_us_max;      /*!< idle line interrupt to start of reply */
+} modbus_stats_t;
+
+/*!
+ * \brief Set up USART6, its DMA streams and the GPIOs
+ * \param[in] address slave address, 1..247
+ * \param[in] holding_limits MODBUS_HOLDING_REGS limits, stays in use
+ * \param[in] event scheduler event set after a master wrote holding registers
+ */
+void modbus_init(uint8_t address, const modbus_limits_t* holding_limits, uint32_t event);
+
+/*!
+ * \brief Start an update of the input registers
+ * \returns register image to write, holds the current values
+ */
+uint16_t* modbus_input_begin(void);
+
+/*!
+ * \brief Make the updated input registers visible to the master
+ */
+void modbus_input_commit(void);
+
+/*!
+ * \brief Read a holding register
+ * \param[in] reg register number
+ * \returns value
+ */
+uint16_t modbus_holding_get(uint16_t reg);
+
+/*!
+ * \brief Set a holding register from the application
+ * \param[in] reg register number
+ * \param[in] value value
+ */
+void modbus_holding_set(uint16_t reg, uint16_t value);
+
+/*!
+ * \brief Get the bus counters
+ * \param[out] result filled with the counters
+ */
+void modbus_get_stats(modbus_stats_t* result);
+
+/*!
+ * \brief Check for a running reply
+ * \returns 1 while a reply is sent, otherwise 0
+ */
+uint8_t modbus_busy(void);
+
+#endif
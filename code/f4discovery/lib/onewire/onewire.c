@@ -18,11 +18,12 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
+
 #include <onewire/onewire.h>
 #include <onewire/onewire_hal_usart.h>
 
-void onewire_write_bit(uint8_t tx_bit);
-uint8_t onewire_read_bit(void);
+static uint8_t onewire_rom_is_zero(const onewire_rom_t* rom);
 
 
 /*!
@@ -82,6 +83,154 @@ uint8_t onewire_receive_byte(void)
     return (rx_byte);
 }
 
+/*!
+ * \brief Reset the bus and address one device
+ * \param[in] rom ROM code, NULL or all zero addresses all devices (skip ROM)
+ * \returns presence: 1 if device(s) present on the bus, otherwise 0
+ */
+uint8_t onewire_select(const onewire_rom_t* rom)
+{
+    uint8_t presence;
+    uint8_t i;
+
+    presence = onewire_reset();
+
+    if (rom == NULL || onewire_rom_is_zero(rom))
+    {
+        onewire_send_byte(ONEWIRE_ROM_SKIP);
+    }
+    else
+    {
+        onewire_send_byte(ONEWIRE_ROM_MATCH);
+        for (i = 0; i < sizeof(rom->code); i++)
+        {
+            onewire_send_byte(rom->code[i]);
+        }
+    }
+
+    return (presence);
+}
+
+/*!
+ * \brief Find the devices on the bus (search ROM)
+ * \param[out] roms ROM codes found, CRC checked
+ * \param[in] max size of roms
+ * \returns number of devices found, at most max
+ * \details Walks the ROM code tree, one bus pass per device: at the last
+ *          discrepancy of the previous pass the 1 branch is taken, below it
+ *          the previous path is repeated, above it the 0 branch.
+ */
+uint8_t onewire_search(onewire_rom_t* roms, uint8_t max)
+{
+    onewire_rom_t rom = { { 0 } };
+    uint8_t found = 0;
+    int8_t last_discrepancy = -1;
+    int8_t discrepancy;
+    uint8_t bit;
+    uint8_t id_bit;
+    uint8_t cmp_bit;
+    uint8_t direction;
+
+    while (found < max)
+    {
+        if (onewire_reset() == 0)
+        {
+            break;
+        }
+
+        onewire_send_byte(ONEWIRE_ROM_SEARCH);
+        discrepancy = -1;
+
+        for (bit = 0; bit < 64; bit++)
+        {
+            id_bit = onewire_read_bit();
+            cmp_bit = onewire_read_bit();
+
+            if (id_bit && cmp_bit)
+            {
+                /* nobody answered */
+                return (found);
+            }
+
+            if (id_bit != cmp_bit)
+            {
+                /* all remaining devices agree */
+                direction = id_bit;
+            }
+            else
+            {
+                if (bit == last_discrepancy)
+                {
+                    direction = 1;
+                }
+                else if (bit > last_discrepancy)
+                {
+                    direction = 0;
+                }
+                else
+                {
+                    direction = (rom.code[bit / 8] >> (bit % 8)) & 0x01;
+                }
+
+                if (direction == 0)
+                {
+                    discrepancy = bit;
+                }
+            }
+
+            if (direction)
+            {
+                rom.code[bit / 8] |= (1 << (bit % 8));
+            }
+            else
+            {
+                rom.code[bit / 8] &= ~(1 << (bit % 8));
+            }
+
+            onewire_write_bit(direction);
+        }
+
+        if (onewire_crc8(rom.code, sizeof(rom.code)) == 0)
+        {
+            roms[found++] = rom;
+        }
+
+        if (discrepancy < 0)
+        {
+            /* that was the last branch */
+            break;
+        }
+        last_discrepancy = discrepancy;
+    }
+
+    return (found);
+}
+
+/*!
+ * \brief Dallas/Maxim CRC-8 (x^8 + x^5 + x^4 + 1)
+ * \param[in] data data
+ * \param[in] len length of data
+ * \returns CRC, 0 over data including its CRC byte if that is correct
+ */
+uint8_t onewire_crc8(const uint8_t* data, uint8_t len)
+{
+    uint8_t crc = 0;
+    uint8_t byte;
+    uint8_t i;
+
+    while (len--)
+    {
+        byte = *data++;
+        for (i = 0; i < 8; i++)
+        {
+            crc = ((crc ^ byte) & 0x01) ? (crc >> 1) ^ 0x8C : (crc >> 1);
+            byte >>= 1;
+        }
+    }
+
+    return (crc);
+}
+
 
 
 
@@ -107,3 +256,21 @@ uint8_t onewire_read_bit(void)
 {
     return (onewire_hal_usart_read_slot());
 }
+
+/*!
+ * \brief Check for the all zero ROM code
+ */
+static uint8_t onewire_rom_is_zero(const onewire_rom_t* rom)
+{
+    uint8_t i;
+
+    for (i = 0; i < sizeof(rom->code); i++)
+    {
+        if (rom->code[i] != 0)
+        {
+            return (0);
+        }
+    }
+
+    return (1);
+}
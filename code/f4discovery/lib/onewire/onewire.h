@@ -24,6 +24,17 @@
 
 #include <stdint.h>
 
+#define ONEWIRE_ROM_SEARCH      0xF0    /* enumerate the devices on the bus */
+#define ONEWIRE_ROM_MATCH       0x55    /* address one device by its ROM code */
+#define ONEWIRE_ROM_SKIP        0xCC    /* address all devices */
+
+/*!
+ * \brief 64 bit ROM code: family code, serial number, CRC
+ * \note an all zero code stands for "the only device on the bus" (skip ROM)
+ */
+typedef struct {
+    uint8_t code[8];
+} onewire_rom_t;
 
 /*!
  * \brief Init 1-Wire bus master 
@@ -49,6 +60,41 @@ void onewire_send_byte(uint8_t tx_byte);
  */
 uint8_t onewire_receive_byte(void);
 
+/*!
+ * \brief Issue a 1-Wire Write slot (1 | 0) on the bus
+ * \param[in] tx_bit: The bit to send (1 or 0)
+ */
+void onewire_write_bit(uint8_t tx_bit);
+
+/*!
+ * \brief Issue a 1-Wire Read slot on the bus and return the answer bit
+ * \returns answer bit (1 or 0)
+ */
+uint8_t onewire_read_bit(void);
+
+/*!
+ * \brief Reset the bus and address one device
+ * \param[in] rom ROM code, NULL or all zero addresses all devices (skip ROM)
+ * \returns presence: 1 if device(s) present on the bus, otherwise 0
+ */
+uint8_t onewire_select(const onewire_rom_t* rom);
+
+/*!
+ * \brief Find the devices on the bus (search ROM)
+ * \param[out] roms ROM codes found, CRC checked
+ * \param[in] max size of roms
+ * \returns number of devices found, at most max
+ */
+uint8_t onewire_search(onewire_rom_t* roms, uint8_t max);
+
+/*!
+ * \brief Dallas/Maxim CRC-8 (x^8 + x^5 + x^4 + 1)
+ * \param[in] data data
+ * \param[in] len length of data
+ * \returns CRC, 0 over data including its CRC byte if that is correct
+ */
+uint8_t onewire_crc8(const uint8_t* data, uint8_t len);
+
 
 
 #endif
\ No newline at end of file
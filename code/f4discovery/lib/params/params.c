@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <libopencm3/stm32/flash.h>
+
+#include <params/params.h>
+
+#define PARAMS_SECTOR           7
+#define PARAMS_ADDRESS          0x08060000u
+#define PARAMS_MAGIC            0x50415231u     /* "PAR1" */
+
+/*!
+ * \brief Record as stored in flash
+ */
+typedef struct {
+    uint32_t magic;
+    params_t params;
+    uint32_t crc;
+} params_record_t;
+
+/* static declarations */
+static uint32_t params_crc32(const void* data, size_t len);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Read the stored parameters
+ * \param[out] params filled if a valid record exists
+ * \retval 0  - OK
+ * \retval -1 - no valid record
+ */
+int8_t params_load(params_t* params)
+{
+    const params_record_t* record = (const params_record_t*)PARAMS_ADDRESS;
+
+    if (record->magic != PARAMS_MAGIC ||
+        record->crc != params_crc32(&record->params, sizeof(record->params)))
+    {
+        return (-1);
+    }
+
+    *params = record->params;
+
+    return (0);
+}
+
+/*!
+ * \brief Store the parameters
+ * \param[in] params parameters
+ * \retval 0  - OK
+ * \retval -1 - flash error, read back differs
+ */
+int8_t params_save(const params_t* params)
+{
+    params_record_t record;
+    const uint32_t* word = (const uint32_t*)&record;
+    uint32_t i;
+    params_t check;
+
+    record.magic = PARAMS_MAGIC;
+    record.params = *params;
+    record.crc = params_crc32(&record.params, sizeof(record.params));
+
+    flash_unlock();
+    flash_erase_sector(PARAMS_SECTOR, FLASH_CR_PROGRAM_X32);
+
+    for (i = 0; i < sizeof(record) / sizeof(uint32_t); i++)
+    {
+        flash_program_word(PARAMS_ADDRESS + i * sizeof(uint32_t), word[i]);
+    }
+
+    flash_lock();
+
+    return (params_load(&check));
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief CRC-32 (IEEE 802.3), bitwise, the records are small
+ */
+static uint32_t params_crc32(const void* data, size_t len)
+{
+    const uint8_t* byte = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    uint8_t bit;
+
+    while (len--)
+    {
+        crc ^= *byte++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+
+    return (~crc);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
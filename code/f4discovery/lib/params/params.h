@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARAMS_H_
+#define PARAMS_H_
+
+#include <stdint.h>
+
+/*!
+ * \file params.h
+ * \brief Persistent parameters in flash sector 7 (0x08060000, 128 kB)
+ * \details One record with a checksum, a missing or damaged record is
+ *          reported by params_load(). The linker script ends the program
+ *          image below the sector.
+ *
+ * \note params_save() erases the sector, the CPU stalls for up to 2 s
+ *       (flash busy); save rarely, e.g. after an auto-tune.
+ */
+
+/*!
+ * \brief Stored parameters
+ */
+typedef struct {
+    int32_t kp;                 /*!< controller gains, Q16.16 (see pid_ctrl_t) */
+    int32_t ki;
+    int32_t kd;
+} params_t;
+
+/*!
+ * \brief Read the stored parameters
+ * \param[out] params filled if a valid record exists
+ * \retval 0  - OK
+ * \retval -1 - no valid record
+ */
+int8_t params_load(params_t* params);
+
+/*!
+ * \brief Store the parameters
+ * \param[in] params parameters
+ * \retval 0  - OK
+ * \retval -1 - flash error, read back differs
+ */
+int8_t params_save(const params_t* params);
+
+#endif
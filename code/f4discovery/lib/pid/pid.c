@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pid/pid.h>
+
+/* static declarations */
+static int64_t pid_clamp(int64_t value, int64_t min, int64_t max);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Initialize a controller
+ * \param[out] pid controller
+ * \param[in] kp proportional gain, Q16.16
+ * \param[in] ki integral gain per sample, Q16.16
+ * \param[in] kd derivative gain per sample, Q16.16
+ * \param[in] out_min lower output limit
+ * \param[in] out_max upper output limit
+ */
+void pid_ctrl_init(pid_ctrl_t* pid, int32_t kp, int32_t ki, int32_t kd, int32_t out_min, int32_t out_max)
+{
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+    pid->out_min = out_min;
+    pid->out_max = out_max;
+    pid->setpoint = 0;
+    pid->output = out_min;
+
+    pid_ctrl_reset(pid);
+}
+
+/*!
+ * \brief Set the setpoint
+ * \param[in,out] pid controller
+ * \param[in] setpoint in input units
+ */
+void pid_ctrl_set_setpoint(pid_ctrl_t* pid, int32_t setpoint)
+{
+    pid->setpoint = setpoint;
+}
+
+/*!
+ * \brief Clear the integral and derivative history
+ * \param[in,out] pid controller
+ */
+void pid_ctrl_reset(pid_ctrl_t* pid)
+{
+    pid->integral = 0;
+    pid->last_input = 0;
+    pid->primed = 0;
+}
+
+/*!
+ * \brief Run one controller step, call once per sample period
+ * \param[in,out] pid controller
+ * \param[in] input measurement
+ * \returns output, within [out_min, out_max]
+ */
+int32_t pid_ctrl_update(pid_ctrl_t* pid, int32_t input)
+{
+    int64_t min = (int64_t)pid->out_min << 16;
+    int64_t max = (int64_t)pid->out_max << 16;
+    int32_t error = pid->setpoint - input;
+    int64_t p;
+    int64_t d = 0;
+    int64_t integral;
+    int64_t out;
+
+    p = (int64_t)pid->kp * error;
+
+    /* derivative on measurement: no kick on setpoint changes */
+    if (pid->primed)
+    {
+        d = (int64_t)pid->kd * (input - pid->last_input);
+    }
+    pid->last_input = input;
+    pid->primed = 1;
+
+    integral = pid_clamp(pid->integral + (int64_t)pid->ki * error, min, max);
+    out = p + integral - d;
+
+    /* conditional integration: keep the old integral if it would push a
+       saturated output further out */
+    if ((out > max && integral > pid->integral) || (out < min && integral < pid->integral))
+    {
+        integral = pid->integral;
+        out = p + integral - d;
+    }
+    pid->integral = integral;
+
+    pid->output = (int32_t)(pid_clamp(out, min, max) >> 16);
+
+    return (pid->output);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Limit a value to [min, max]
+ */
+static int64_t pid_clamp(int64_t value, int64_t min, int64_t max)
+{
+    if (value < min)
+    {
+        return (min);
+    }
+    if (value > max)
+    {
+        return (max);
+    }
+
+    return (value);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
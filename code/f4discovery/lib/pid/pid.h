@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PID_H_
+#define PID_H_
+
+#include <stdint.h>
+
+/*!
+ * \file pid.h
+ * \brief Fixed-point PID controller
+ * \details Integer only, one update per sample period. Gains are Q16.16
+ *          (see PID_Q16()), input and setpoint share one integer unit
+ *          (e.g. 1/100 degC), the output is clamped to [out_min, out_max].
+ *
+ *          - the derivative acts on the measurement, a setpoint change
+ *            does not kick the output
+ *          - anti-windup: the integral is clamped to the output range and
+ *            stops growing while the output saturates in the same direction
+ *
+ *          The update has no loops and no divisions, its run time is constant.
+ */
+
+#define PID_Q16(x)      ((int32_t)((x) * 65536.0))  /* gain constant to Q16.16 */
+
+/*!
+ * \brief Controller state
+ */
+typedef struct {
+    int32_t kp;                 /*!< Q16.16, output per input unit */
+    int32_t ki;                 /*!< Q16.16, output per input unit and sample */
+    int32_t kd;                 /*!< Q16.16, output per input unit change per sample */
+    int32_t out_min;
+    int32_t out_max;
+    int32_t setpoint;
+    int64_t integral;           /*!< Q16.16, output units */
+    int32_t last_input;
+    uint8_t primed;             /*!< last_input is valid */
+    int32_t output;             /*!< last output */
+} pid_ctrl_t;
+
+/*!
+ * \brief Initialize a controller
+ * \param[out] pid controller
+ * \param[in] kp proportional gain, Q16.16
+ * \param[in] ki integral gain per sample, Q16.16
+ * \param[in] kd derivative gain per sample, Q16.16
+ * \param[in] out_min lower output limit
+ * \param[in] out_max upper output limit
+ */
+void pid_ctrl_init(pid_ctrl_t* pid, int32_t kp, int32_t ki, int32_t kd, int32_t out_min, int32_t out_max);
+
+/*!
+ * \brief Set the setpoint
+ * \param[in,out] pid controller
+ * \param[in] setpoint in input units
+ */
+void pid_ctrl_set_setpoint(pid_ctrl_t* pid, int32_t setpoint);
+
+/*!
+ * \brief Clear the integral and derivative history
+ * \param[in,out] pid controller
+ */
+void pid_ctrl_reset(pid_ctrl_t* pid);
+
+/*!
+ * \brief Run one controller step, call once per sample period
+ * \param[in,out] pid controller
+ * \param[in] input measurement
+ * \returns output, within [out_min, out_max]
+ */
+int32_t pid_ctrl_update(pid_ctrl_t* pid, int32_t input);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pid/pid_autotune.h>
+
+#define PID_TUNE_4_OVER_PI      83443   /* 4 / pi, Q16.16 */
+
+/* static declarations */
+static void pid_tune_finish(pid_tune_t* tune);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Start an experiment
+ * \param[out] tune experiment
+ * \param[in] config setup, copied
+ */
+void pid_tune_init(pid_tune_t* tune, const pid_tune_config_t* config)
+{
+    tune->config = *config;
+    tune->state = PID_TUNE_RUNNING;
+    tune->output = config->out_high;
+    tune->samples = 0;
+    tune->cycle_start = 0;
+    tune->cycles = -1;
+    tune->peak_max = config->input_min;
+    tune->peak_min = config->input_max;
+    tune->period_sum = 0;
+    tune->amplitude_sum = 0;
+    tune->tu = 0;
+    tune->ku = 0;
+    tune->kp = 0;
+    tune->ki = 0;
+    tune->kd = 0;
+}
+
+/*!
+ * \brief Process one sample
+ * \param[in,out] tune experiment
+ * \param[in] input measurement
+ * \returns state, apply tune->output while PID_TUNE_RUNNING, out_low after an abort
+ */
+pid_tune_state_t pid_tune_update(pid_tune_t* tune, int32_t input)
+{
+    const pid_tune_config_t* config = &tune->config;
+
+    if (tune->state != PID_TUNE_RUNNING)
+    {
+        return (tune->state);
+    }
+
+    tune->samples++;
+
+    if (input < config->input_min || input > config->input_max)
+    {
+        tune->state = PID_TUNE_ABORT_LIMIT;
+        tune->output = config->out_low;
+        return (tune->state);
+    }
+    if (tune->samples > config->timeout_samples)
+    {
+        tune->state = PID_TUNE_ABORT_TIMEOUT;
+        tune->output = config->out_low;
+        return (tune->state);
+    }
+
+    if (input > tune->peak_max)
+    {
+        tune->peak_max = input;
+    }
+    if (input < tune->peak_min)
+    {
+        tune->peak_min = input;
+    }
+
+    if (tune->output == config->out_high && input > config->setpoint + config->hysteresis)
+    {
+        tune->output = config->out_low;
+    }
+    else if (tune->output == config->out_low && input < config->setpoint - config->hysteresis)
+    {
+        /* a switch to out_high closes a cycle */
+        tune->output = config->out_high;
+
+        /* the first complete cycle is the transient */
+        if (tune->cycles >= 1)
+        {
+            tune->period_sum += tune->samples - tune->cycle_start;
+            tune->amplitude_sum += (tune->peak_max - tune->peak_min) / 2;
+        }
+        tune->cycles++;
+        tune->cycle_start = tune->samples;
+        tune->peak_max = input;
+        tune->peak_min = input;
+
+        if (tune->cycles > PID_TUNE_CYCLES)
+        {
+            pid_tune_finish(tune);
+        }
+    }
+
+    return (tune->state);
+}
+
+/*!
+ * \brief Take over the tuned gains
+ * \param[in] tune finished experiment (PID_TUNE_DONE)
+ * \param[in,out] pid controller, its history is reset
+ */
+void pid_tune_apply(const pid_tune_t* tune, pid_ctrl_t* pid)
+{
+    pid->kp = tune->kp;
+    pid->ki = tune->ki;
+    pid->kd = tune->kd;
+
+    pid_ctrl_reset(pid);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Compute the gains from the measured cycles
+ */
+static void pid_tune_finish(pid_tune_t* tune)
+{
+    int64_t d = (tune->config.out_high - tune->config.out_low) / 2;
+    int64_t a = tune->amplitude_sum / PID_TUNE_CYCLES;
+    int64_t tu = tune->period_sum / PID_TUNE_CYCLES;
+    int64_t kp;
+
+    if (a <= 0 || tu <= 0)
+    {
+        tune->state = PID_TUNE_ABORT_TIMEOUT;
+        tune->output = tune->config.out_low;
+        return;
+    }
+
+    tune->tu = (uint32_t)tu;
+    tune->ku = (int32_t)(PID_TUNE_4_OVER_PI * d / a);
+
+    if (tune->config.rule == PID_TUNE_TYREUS_LUYBEN)
+    {
+        kp = (int64_t)tune->ku * 10 / 22;
+        tune->ki = (int32_t)(kp * 10 / (22 * tu));
+        tune->kd = (int32_t)(kp * tu * 10 / 63);
+    }
+    else
+    {
+        kp = (int64_t)tune->ku * 6 / 10;
+        tune->ki = (int32_t)(kp * 2 / tu);
+        tune->kd = (int32_t)(kp * tu / 8);
+    }
+    tune->kp = (int32_t)kp;
+
+    tune->state = PID_TUNE_DONE;
+    tune->output = tune->config.out_low;
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
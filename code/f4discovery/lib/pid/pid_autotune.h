@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PID_AUTOTUNE_H_
+#define PID_AUTOTUNE_H_
+
+#include <stdint.h>
+#include <pid/pid.h>
+
+/*!
+ * \file pid_autotune.h
+ * \brief PID auto-tuning by relay feedback
+ * \details The output is switched between two levels around the setpoint
+ *          (with hysteresis), the process settles into a limit cycle. From
+ *          its period Tu and amplitude a the ultimate gain is
+ *          Ku = 4 d / (pi a), d being half the relay step, and the gains
+ *          follow from a tuning rule. Units are the same as for pid_ctrl_t,
+ *          times are counted in samples, so the gains are per sample.
+ *
+ *          The first cycle is discarded as transient, the result averages
+ *          the following PID_TUNE_CYCLES cycles.
+ */
+
+#define PID_TUNE_CYCLES         3   /* measured oscillation cycles */
+
+/*!
+ * \brief Gain rule
+ */
+typedef enum {
+    PID_TUNE_ZIEGLER_NICHOLS,   /*!< Kp = 0.6 Ku, Ti = Tu / 2, Td = Tu / 8, fast, overshoots */
+    PID_TUNE_TYREUS_LUYBEN,     /*!< Kp = Ku / 2.2, Ti = 2.2 Tu, Td = Tu / 6.3, damped */
+} pid_tune_rule_t;
+
+/*!
+ * \brief Auto-tune state
+ */
+typedef enum {
+    PID_TUNE_RUNNING,
+    PID_TUNE_DONE,              /*!< gains available */
+    PID_TUNE_ABORT_LIMIT,       /*!< input left [input_min, input_max] */
+    PID_TUNE_ABORT_TIMEOUT,     /*!< no stable oscillation within timeout_samples */
+} pid_tune_state_t;
+
+/*!
+ * \brief Experiment setup
+ */
+typedef struct {
+    int32_t setpoint;
+    int32_t hysteresis;         /*!< relay switches at setpoint +- hysteresis */
+    int32_t out_low;
+    int32_t out_high;
+    int32_t input_min;          /*!< abort below */
+    int32_t input_max;          /*!< abort above */
+    uint32_t timeout_samples;
+    pid_tune_rule_t rule;
+} pid_tune_config_t;
+
+/*!
+ * \brief Auto-tune experiment
+ */
+typedef struct {
+    pid_tune_config_t config;
+    pid_tune_state_t state;
+    int32_t output;             /*!< output for the current sample */
+    uint32_t samples;
+    uint32_t cycle_start;       /*!< sample of the last switch to out_high */
+    int8_t cycles;              /*!< completed cycles, -1 until the first switch to out_high */
+    int32_t peak_max;           /*!< extremes of the running cycle */
+    int32_t peak_min;
+    uint32_t period_sum;        /*!< sums over the measured cycles */
+    int32_t amplitude_sum;
+    uint32_t tu;                /*!< result: period in samples */
+    int32_t ku;                 /*!< result: ultimate gain, Q16.16 */
+    int32_t kp;                 /*!< result: gains, Q16.16 per sample */
+    int32_t ki;
+    int32_t kd;
+} pid_tune_t;
+
+/*!
+ * \brief Start an experiment
+ * \param[out] tune experiment
+ * \param[in] config setup, copied
+ */
+void pid_tune_init(pid_tune_t* tune, const pid_tune_config_t* config);
+
+/*!
+ * \brief Process one sample
+ * \param[in,out] tune experiment
+ * \param[in] input measurement
+ * \returns state, apply tune->output while PID_TUNE_RUNNING, out_low after an abort
+ */
+pid_tune_state_t pid_tune_update(pid_tune_t* tune, int32_t input);
+
+/*!
+ * \brief Take over the tuned gains
+ * \param[in] tune finished experiment (PID_TUNE_DONE)
+ * \param[in,out] pid controller, its history is reset
+ */
+void pid_tune_apply(const pid_tune_t* tune, pid_ctrl_t* pid);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include <prof/prof.h>
+
+static prof_stage_t* stage_list = NULL;
+static uint32_t scope_cycles = 0;   /* cost of PROF_BEGIN() / PROF_END() alone */
+
+/* static declarations */
+static void prof_clear(prof_stage_t* stage);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Measure the cost of an empty scope, subtracted from every pass
+ * \details Call once after the cycle counter is enabled (sched_init()).
+ */
+void prof_init(void)
+{
+    PROF_STAGE(calibrate);
+    uint8_t i;
+
+    for (i = 0; i < 8; i++)
+    {
+        PROF_BEGIN(calibrate);
+        PROF_END(calibrate);
+    }
+
+    /* the calibration runs with nothing subtracted, it is not kept in the list */
+    scope_cycles = prof_calibrate.min;
+    stage_list = prof_calibrate.next;
+}
+
+/*!
+ * \brief Add a pass to a stage, through PROF_END()
+ * \param[in,out] stage stage
+ * \param[in] cycles cycles of the pass, scope included
+ */
+void prof_record(prof_stage_t* stage, uint32_t cycles)
+{
+    if (stage->linked == 0)
+    {
+        prof_clear(stage);
+        stage->linked = 1;
+        stage->next = stage_list;
+        stage_list = stage;
+    }
+
+    cycles = (cycles > scope_cycles) ? cycles - scope_cycles : 0;
+
+    if (cycles < stage->min)
+    {
+        stage->min = cycles;
+    }
+    if (cycles > stage->max)
+    {
+        stage->max = cycles;
+    }
+    stage->count++;
+    stage->total += cycles;
+    stage->hist[prof_bin(cycles)]++;
+}
+
+/*!
+ * \brief First stage of the list
+ * \returns stage, NULL if none has run yet; stage->next is the next one
+ */
+const prof_stage_t* prof_first(void)
+{
+    return (stage_list);
+}
+
+/*!
+ * \brief Histogram bin of a cycle count
+ * \param[in] cycles cycles
+ * \returns bin, 0..PROF_HIST_BINS - 1
+ */
+uint8_t prof_bin(uint32_t cycles)
+{
+    /* CLZ, a single instruction */
+    return ((cycles == 0) ? 0 : (uint8_t)(31 - __builtin_clz(cycles)));
+}
+
+/*!
+ * \brief Clear the statistics of all stages
+ */
+void prof_reset(void)
+{
+    prof_stage_t* stage;
+
+    for (stage = stage_list; stage != NULL; stage = stage->next)
+    {
+        prof_clear(stage);
+    }
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Clear the statistics of a stage, the list link stays
+ */
+static void prof_clear(prof_stage_t* stage)
+{
+    stage->count = 0;
+    stage->min = UINT32_MAX;
+    stage->max = 0;
+    stage->total = 0;
+    memset(stage->hist, 0, sizeof(stage->hist));
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdint.h>
+
+/*!
+ * \file prof.h
+ * \brief Cycle counter profiling of code stages
+ * \details A stage is a piece of code between PROF_BEGIN() and PROF_END().
+ *          Every pass adds its DWT cycle count (minus the cost of the scope
+ *          itself, measured by prof_init()) to count, min, max, total and a
+ *          histogram with one bin per power of two. Stages link themselves
+ *          into a list on their first pass, prof_first() walks it.
+ *
+ *          Define PROFILING (Makefile: PROFILING=1) to use it. Without it the
+ *          macros are empty, no stage takes RAM and prof.c is not built.
+ *
+ *              PROF_STAGE(sensor_read);            file scope
+ *              ...
+ *              PROF_BEGIN(sensor_read);
+ *              ds18b20_read_temperature_rom(...);
+ *              PROF_END(sensor_read);
+ *
+ *          Stages are recorded from task context, not from interrupts.
+ *          Time spent in interrupts during a pass counts for the stage.
+ */
+
+#define PROF_NAME_MAX           12      /* with the terminating 0 */
+#define PROF_HIST_BINS          32      /* bin n: 2^n <= cycles < 2^(n+1), bin 0 also 0 */
+
+/*!
+ * \brief Statistics of one stage
+ */
+typedef struct prof_stage {
+    const char* name;
+    uint32_t count;
+    uint32_t min;               /*!< cycles */
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[PROF_HIST_BINS];
+    uint8_t linked;
+    struct prof_stage* next;
+} prof_stage_t;
+
+#ifdef PROFILING
+
+#include <libopencm3/cm3/dwt.h>
+
+#define PROF_STAGE(stage)       static prof_stage_t prof_##stage = { .name = #stage }
+#define PROF_BEGIN(stage)       uint32_t prof_##stage##_start = DWT_CYCCNT
+#define PROF_END(stage)         prof_record(&prof_##stage, DWT_CYCCNT - prof_##stage##_start)
+
+/*!
+ * \brief Measure the cost of an empty scope, subtracted from every pass
+ * \details Call once after the cycle counter is enabled (sched_init()).
+ */
+void prof_init(void);
+
+/*!
+ * \brief Add a pass to a stage, through PROF_END()
+ * \param[in,out] stage stage
+ * \param[in] cycles cycles of the pass, scope included
+ */
+void prof_record(prof_stage_t* stage, uint32_t cycles);
+
+/*!
+ * \brief First stage of the list
+ * \returns stage, NULL if none has run yet; stage->next is the next one
+ */
+const prof_stage_t* prof_first(void);
+
+/*!
+ * \brief Histogram bin of a cycle count
+ * \param[in] cycles cycles
+ * \returns bin, 0..PROF_HIST_BINS - 1
+ */
+uint8_t prof_bin(uint32_t cycles);
+
+/*!
+ * \brief Clear the statistics of all stages
+ */
+void prof_reset(void);
+
+#else
+
+/* declares nothing that is used, the ; after the macro stays valid */
+#define PROF_STAGE(stage)       struct prof_unused_##stage
+#define PROF_BEGIN(stage)       do { } while (0)
+#define PROF_END(stage)         do { } while (0)
+
+#endif
+
+#endif
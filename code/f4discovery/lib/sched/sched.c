@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include <sched/sched.h>
+#include <timebase/timebase.h>
+
+static sched_task_t* task_list = NULL;
+static volatile uint32_t pending_events = 0;
+static sched_sleep_fn_t sleep_hook = NULL;
+
+/* CPU load measurement */
+static uint32_t load_window_tick;       /* tick at the start of the window */
+static uint32_t load_window_cycles;     /* cycle counter at the start of the window */
+static uint32_t load_sleep_cycles;      /* cycles counted while sleeping in the window */
+static uint16_t load_permille;
+
+/* static declarations */
+static uint8_t sched_dispatch(void);
+static uint32_t sched_next_timer_ms(void);
+static void sched_idle(void);
+static void sched_load_update(void);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up the timebase (1 ms SysTick and cycle counter, see timebase.h)
+ * \details Call after the system clock is configured.
+ */
+void sched_init(void)
+{
+    timebase_init();
+
+    load_window_tick = timebase_ms32();
+    load_window_cycles = timebase_cycles();
+    load_sleep_cycles = 0;
+}
+
+/*!
+ * \brief Add a task
+ * \param[in] task task object, must stay valid forever
+ * \param[in] fn task function
+ * \param[in] ctx passed to fn
+ * \param[in] events event flags that make the task run, 0 for timer only tasks
+ */
+void sched_task_add(sched_task_t* task, sched_task_fn_t fn, void* ctx, uint32_t events)
+{
+    task->fn = fn;
+    task->ctx = ctx;
+    task->events = events & ~SCHED_EVENT_TIMER;
+    task->timer_active = 0;
+    task->runs = 0;
+
+    task->next = task_list;
+    task_list = task;
+}
+
+/*!
+ * \brief (Re)start the timer of a task
+ * \param[in] task task
+ * \param[in] delay_ms time until the first expiry
+ * \param[in] period_ms time between further expiries, 0 for a one-shot timer
+ */
+void sched_timer_start(sched_task_t* task, uint32_t delay_ms, uint32_t period_ms)
+{
+    task->due = timebase_ms32() + delay_ms;
+    task->period_ms = period_ms;
+    task->timer_active = 1;
+}
+
+/*!
+ * \brief Stop the timer of a task
+ * \param[in] task task
+ */
+void sched_timer_stop(sched_task_t* task)
+{
+    task->timer_active = 0;
+}
+
+/*!
+ * \brief Set event flags, may be called from interrupt context
+ * \param[in] events flags to set, each task sees the ones it waits for once
+ */
+void sched_event_set(uint32_t events)
+{
+    /* LDREX/STREX, safe against the main loop taking the flags */
+    __atomic_fetch_or(&pending_events, events & ~SCHED_EVENT_TIMER, __ATOMIC_RELAXED);
+}
+
+/*!
+ * \brief Milliseconds since sched_init(), wraps after 49 days
+ */
+uint32_t sched_now(void)
+{
+    return (timebase_ms32());
+}
+
+/*!
+ * \brief Blocking delay, sleeping in WFI
+ * \param[in] delay_ms milliseconds to wait
+ * \details For start-up code before sched_run(), tasks use timers instead.
+ */
+void sched_delay_ms(uint32_t delay_ms)
+{
+    uint32_t start = timebase_ms32();
+
+    /* + 1: the first tick may come right away */
+    while ((timebase_ms32() - start) < delay_ms + 1)
+    {
+        __asm__ volatile ("wfi");
+    }
+}
+
+/*!
+ * \brief Run tasks forever
+ */
+void sched_run(void)
+{
+    while (1)
+    {
+        if (sched_dispatch() == 0)
+        {
+            sched_idle();
+        }
+
+        sched_load_update();
+    }
+}
+
+/*!
+ * \brief Install a hook that replaces WFI when the scheduler is idle
+ * \param[in] fn hook, NULL for plain WFI
+ * \details For sleep modes that stop the SysTick (STOP mode). The time the hook
+ *          reports is added to the tick, so timers keep their schedule.
+ */
+void sched_set_sleep_hook(sched_sleep_fn_t fn)
+{
+    sleep_hook = fn;
+}
+
+/*!
+ * \brief CPU load of the last SCHED_LOAD_WINDOW_MS
+ * \returns time not spent sleeping, in 1/1000
+ */
+uint16_t sched_load_permille(void)
+{
+    return (load_permille);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Run every task that has a pending event or an expired timer once
+ * \returns 1 if a task ran, otherwise 0
+ */
+static uint8_t sched_dispatch(void)
+{
+    uint32_t events = __atomic_exchange_n(&pending_events, 0, __ATOMIC_RELAXED);
+    uint32_t now = timebase_ms32();
+    uint32_t run;
+    uint8_t ran = 0;
+    sched_task_t* task;
+
+    for (task = task_list; task != NULL; task = task->next)
+    {
+        run = events & task->events;
+
+        if (task->timer_active == 1 && (int32_t)(now - task->due) >= 0)
+        {
+            run |= SCHED_EVENT_TIMER;
+
+            if (task->period_ms == 0)
+            {
+                task->timer_active = 0;
+            }
+            else
+            {
+                task->due += task->period_ms;
+                if ((int32_t)(now - task->due) >= 0)
+                {
+                    /* overran by more than a period, skip the missed ones */
+                    task->due = now + task->period_ms;
+                }
+            }
+        }
+
+        if (run != 0)
+        {
+            task->fn(task->ctx, run);
+            task->runs++;
+            ran = 1;
+        }
+    }
+
+    return (ran);
+}
+
+/*!
+ * \brief Time until the next task timer expires
+ * \returns milliseconds, 0 if a timer has expired, SCHED_NO_TIMER if none runs
+ */
+static uint32_t sched_next_timer_ms(void)
+{
+    uint32_t now = timebase_ms32();
+    uint32_t next = SCHED_NO_TIMER;
+    int32_t left;
+    sched_task_t* task;
+
+    for (task = task_list; task != NULL; task = task->next)
+    {
+        if (task->timer_active == 0)
+        {
+            continue;
+        }
+
+        left = (int32_t)(task->due - now);
+        if (left <= 0)
+        {
+            return (0);
+        }
+        if ((uint32_t)left < next)
+        {
+            next = (uint32_t)left;
+        }
+    }
+
+    return (next);
+}
+
+/*!
+ * \brief Sleep until the next interrupt unless something became runnable
+ * \details Interrupts are masked while checking, so an event set right before
+ *          WFI is not lost: a pending interrupt ends WFI even while masked and
+ *          its handler runs once interrupts are enabled again.
+ */
+static void sched_idle(void)
+{
+    uint32_t before;
+    uint32_t next;
+    uint32_t slept = 0;
+
+    cm_disable_interrupts();
+
+    next = sched_next_timer_ms();
+
+    if (pending_events == 0 && next != 0)
+    {
+        if (sleep_hook != NULL)
+        {
+            /* the SysTick does not run during deep sleep, catch up */
+            slept = sleep_hook(next);
+            timebase_advance_ms(slept);
+        }
+
+        if (slept == 0)
+        {
+            before = timebase_cycles();
+            __asm__ volatile ("wfi");
+            load_sleep_cycles += timebase_cycles() - before;
+        }
+    }
+
+    cm_enable_interrupts();
+}
+
+/*!
+ * \brief Close the load measurement window once it is complete
+ * \details Busy time is the cycle counter difference minus the cycles counted
+ *          in WFI, measured against wall time from the tick. This is right
+ *          whether or not the cycle counter runs while the core sleeps (it
+ *          does with a debugger attached).
+ */
+static void sched_load_update(void)
+{
+    uint32_t ticks = timebase_ms32() - load_window_tick;
+    uint32_t cycles;
+    uint64_t busy;
+    uint64_t wall;
+
+    if (ticks < SCHED_LOAD_WINDOW_MS)
+    {
+        return;
+    }
+
+    cycles = timebase_cycles();
+    busy = (uint32_t)(cycles - load_window_cycles) - load_sleep_cycles;
+    wall = (uint64_t)ticks * (rcc_ahb_frequency / 1000);
+
+    load_permille = (busy >= wall) ? 1000 : (uint16_t)(busy * 1000 / wall);
+
+    load_window_tick += ticks;
+    load_window_cycles = cycles;
+    load_sleep_cycles = 0;
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
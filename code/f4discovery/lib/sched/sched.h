@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+
+/*!
+ * \file sched.h
+ * \brief Cooperative run-to-completion scheduler
+ * \details Tasks are functions that run when one of their event flags was set
+ *          (from an ISR with sched_event_set()) or when their timer expired.
+ *          Every task runs to completion, there is no preemption. With nothing
+ *          to run the core sleeps in WFI until the next interrupt.
+ *
+ *          The timebase is the 1 ms SysTick of timebase.h, timers have 1 ms
+ *          resolution. The tick interrupt does nothing but count, so an idle
+ *          system spends a few hundred cycles per millisecond awake.
+ */
+
+#define SCHED_EVENT_TIMER       (1u << 31)  /* reserved: the task timer expired */
+#define SCHED_LOAD_WINDOW_MS    1000        /* CPU load is averaged over this */
+#define SCHED_NO_TIMER          0xFFFFFFFFu /* no task timer running */
+
+/*!
+ * \brief Task function
+ * \param[in] ctx context pointer passed to sched_task_add()
+ * \param[in] events events that made the task run, SCHED_EVENT_TIMER for the timer
+ */
+typedef void (*sched_task_fn_t)(void* ctx, uint32_t events);
+
+/*!
+ * \brief Deep sleep hook, see sched_set_sleep_hook()
+ * \param[in] max_ms time until the next task timer expires, SCHED_NO_TIMER if none runs
+ * \returns milliseconds slept, 0 if the hook did not sleep
+ * \note called with interrupts masked
+ */
+typedef uint32_t (*sched_sleep_fn_t)(uint32_t max_ms);
+
+/*!
+ * \brief Task, owned by the application and linked in by sched_task_add()
+ */
+typedef struct sched_task {
+    sched_task_fn_t fn;
+    void* ctx;
+    uint32_t events;            /*!< event flags the task waits for */
+    uint8_t timer_active;
+    uint32_t due;               /*!< tick the timer expires at */
+    uint32_t period_ms;         /*!< 0 for a one-shot timer */
+    uint32_t runs;              /*!< number of calls */
+    struct sched_task* next;
+} sched_task_t;
+
+/*!
+ * \brief Set up the timebase (1 ms SysTick and cycle counter, see timebase.h)
+ * \details Call after the system clock is configured.
+ */
+void sched_init(void);
+
+/*!
+ * \brief Add a task
+ * \param[in] task task object, must stay valid forever
+ * \param[in] fn task function
+ * \param[in] ctx passed to fn
+ * \param[in] events event flags that make the task run, 0 for timer only tasks
+ */
+void sched_task_add(sched_task_t* task, sched_task_fn_t fn, void* ctx, uint32_t events);
+
+/*!
+ * \brief (Re)start the timer of a task
+ * \param[in] task task
+ * \param[in] delay_ms time until the first expiry
+ * \param[in] period_ms time between further expiries, 0 for a one-shot timer
+ */
+void sched_timer_start(sched_task_t* task, uint32_t delay_ms, uint32_t period_ms);
+
+/*!
+ * \brief Stop the timer of a task
+ * \param[in] task task
+ */
+void sched_timer_stop(sched_task_t* task);
+
+/*!
+ * \brief Set event flags, may be called from interrupt context
+ * \param[in] events flags to set, each task sees the ones it waits for once
+ */
+void sched_event_set(uint32_t events);
+
+/*!
+ * \brief Milliseconds since sched_init(), wraps after 49 days
+ */
+uint32_t sched_now(void);
+
+/*!
+ * \brief Blocking delay, sleeping in WFI
+ * \param[in] delay_ms milliseconds to wait
+ * \details For start-up code before sched_run(), tasks use timers instead.
+ */
+void sched_delay_ms(uint32_t delay_ms);
+
+/*!
+ * \brief Run tasks forever
+ */
+void sched_run(void);
+
+/*!
+ * \brief Install a hook that replaces WFI when the scheduler is idle
+ * \param[in] fn hook, NULL for plain WFI
+ * \details For sleep modes that stop the SysTick (STOP mode). The time the hook
+ *          reports is added to the tick, so timers keep their schedule.
+ */
+void sched_set_sleep_hook(sched_sleep_fn_t fn);
+
+/*!
+ * \brief CPU load of the last SCHED_LOAD_WINDOW_MS
+ * \returns time not spent sleeping, in 1/1000
+ */
+uint16_t sched_load_permille(void);
+
+#endif
@@ -18,199 +18,541 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include <ssd1306/ssd1306.h>
 #include <ssd1306/ssd1306_hal.h>
 
 
-/* display buffer */
-static uint8_t framebuffer[SSD1306_WIDTH * SSD1306_HEIGHT / 8];
+/* controller setup, sent as one command stream */
+static const uint8_t init_sequence[] = {
+	0xAE,		//display off
+	0x20, 0x02,	//Set Memory Addressing Mode: 00,Horizontal Addressing Mode;01,Vertical Addressing Mode;10,Page Addressing Mode (RESET);11,Invalid
+	0xB0,		//Set Page Start Address for Page Addressing Mode,0-7
+	0xC8,		//Set COM Output Scan Direction
+	0x00 | (SSD1306_COLUMN_OFFSET & 0x0F),	//---set low column address
+	0x10 | (SSD1306_COLUMN_OFFSET >> 4),	//---set high column address
+	0x40,		//--set start line address
+	0x81, SSD1306_CONTRAST_FULL,	//--set contrast control register
+	0xA1,		//--set segment re-map 0 to 127
+	0xA6,		//--set normal display
+	0xA8, SSD1306_HEIGHT - 1,	//--set multiplex ratio(1 to 64)
+	0xA4,		//0xa4,Output follows RAM content;0xa5,Output ignores RAM content
+	0xD3, 0x00,	//-set display offset: not offset
+	0xD5, 0xF0,	//--set display clock divide ratio/oscillator frequency
+	0xD9, 0x22,	//--set pre-charge period
+	0xDA, SSD1306_COM_PINS,	//--set com pins hardware configuration
+	0xDB, 0x20,	//--set vcomh: 0x20,0.77xVcc
+	0x8D, 0x14,	//--set DC-DC enable
+#ifdef SSD1306_INTERNAL_IREF
+	0xAD, 0x30,	//--select internal current reference
+#endif
+	0xAF		//--turn on SSD1306 panel
+};
 
-/* display object */
-static ssd1306_t display;
+/* column address commands, shifted to the controller columns wired to the panel */
+#define SSD1306_CMD_COLUMN_LOW(x)	(0x00 | (((x) + SSD1306_COLUMN_OFFSET) & 0x0F))
+#define SSD1306_CMD_COLUMN_HIGH(x)	(0x10 | (((x) + SSD1306_COLUMN_OFFSET) >> 4))
 
+#ifndef SSD1306_PAGE_MODE
+static int8_t ssd1306_update_pages(ssd1306_t* dev, uint8_t start_page, uint8_t end_page);
+static void ssd1306_clean_pages(ssd1306_t* dev, uint8_t start_page, uint8_t end_page);
+static void ssd1306_rotate_page(uint8_t *line, ssd1306_scroll_dir_t dir);
+#endif
+#ifndef SSD1306_PAGE_MODE
+static uint8_t ssd1306_drop_frame(ssd1306_t* dev);
+#endif
+static uint32_t ssd1306_bus_bytes(ssd1306_t* dev);
+static void ssd1306_update_done(ssd1306_t* dev, uint32_t start, uint32_t bytes_before);
+static void ssd1306_put_uint(ssd1306_t* dev, uint32_t value, ssd1306_font_t font);
+#ifdef SSD1306_DOUBLE_BUFFER
+static void ssd1306_flush_next(void* ctx, int8_t result);
+static void ssd1306_flush_wait(ssd1306_t* dev);
+#endif
 
-//
-//	Initialize the oled screen
-//
-void ssd1306_init(void)
+
+/*!
+ * \brief Initialize a display
+ * \param[in] dev - display handle
+ * \param[in] hal - interface the display is connected to
+ * \returns 0 if OK, -1 if the display does not respond
+ */
+int8_t ssd1306_init(ssd1306_t* dev, ssd1306_hal_t* hal)
 {
-	ssd1306_hal_init();
+	int8_t result;
+
+	dev->hal = hal;
+	dev->scroll_active = 0;
+	dev->power = SSD1306_POWER_FULL;
+	dev->power_stale = 0;
+	ssd1306_reset_stats(dev);
+#ifndef SSD1306_PAGE_MODE
+	ssd1306_clean_pages(dev, 0, SSD1306_PAGES - 1);
+#endif
+#ifdef SSD1306_DOUBLE_BUFFER
+	dev->flush_busy = 0;
+	dev->flush_resync = 1;	/* panel RAM content is unknown after reset */
+#endif
+
+	ssd1306_hal_init(dev->hal);
 	/* Init LCD */
 
-	ssd1306_hal_send_command(0xAE); //display off
-	ssd1306_hal_send_command(0x20); //Set Memory Addressing Mode
-	ssd1306_hal_send_command(0x10); //00,Horizontal Addressing Mode;01,Vertical Addressing Mode;10,Page Addressing Mode (RESET);11,Invalid
-	ssd1306_hal_send_command(0xB0); //Set Page Start Address for Page Addressing Mode,0-7
-	ssd1306_hal_send_command(0xC8); //Set COM Output Scan Direction
-	ssd1306_hal_send_command(0x00); //---set low column address
-	ssd1306_hal_send_command(0x10); //---set high column address
-	ssd1306_hal_send_command(0x40); //--set start line address
-	ssd1306_hal_send_command(0x81); //--set contrast control register
-	ssd1306_hal_send_command(0xFF);
-	ssd1306_hal_send_command(0xA1); //--set segment re-map 0 to 127
-	ssd1306_hal_send_command(0xA6); //--set normal display
-	ssd1306_hal_send_command(0xA8); //--set multiplex ratio(1 to 64)
-	ssd1306_hal_send_command(0x3F); //
-	ssd1306_hal_send_command(0xA4); //0xa4,Output follows RAM content;0xa5,Output ignores RAM content
-	ssd1306_hal_send_command(0xD3); //-set display offset
-	ssd1306_hal_send_command(0x00); //-not offset
-	ssd1306_hal_send_command(0xD5); //--set display clock divide ratio/oscillator frequency
-	ssd1306_hal_send_command(0xF0); //--set divide ratio
-	ssd1306_hal_send_command(0xD9); //--set pre-charge period
-	ssd1306_hal_send_command(0x22); //
-	ssd1306_hal_send_command(0xDA); //--set com pins hardware configuration
-	ssd1306_hal_send_command(0x12);
-	ssd1306_hal_send_command(0xDB); //--set vcomh
-	ssd1306_hal_send_command(0x20); //0x20,0.77xVcc
-	ssd1306_hal_send_command(0x8D); //--set DC-DC enable
-	ssd1306_hal_send_command(0x14); //
-	ssd1306_hal_send_command(0xAF); //--turn on SSD1306 panel
+	result = ssd1306_hal_send_commands(dev->hal, init_sequence, sizeof(init_sequence));
 
 	/* default color: black background, white foreground */
-	display.background = SSD1306_COLOR_BLACK;
-	display.foreground = SSD1306_COLOR_WHITE;
-
-	/* Clear screen */
-	ssd1306_clear();
+	dev->background = SSD1306_COLOR_BLACK;
+	dev->foreground = SSD1306_COLOR_WHITE;
 
-	/* send framebuffer to screen */
-	ssd1306_update();
+	/* Clear screen and send it */
+	if (result == 0)
+	{
+		result = ssd1306_render(dev, NULL, NULL);
+	}
 
 	// Set default values for screen object
-	display.current_x = 0;
-	display.current_y = 0;
+	dev->current_x = 0;
+	dev->current_y = 0;
+
+	return (result);
 }
 
 /*!
  * \brief Set foreground color
+ * \param[in] dev - display handle
  */
-void ssd1306_set_foreground(ssd1306_color_t color)
+void ssd1306_set_foreground(ssd1306_t* dev, ssd1306_color_t color)
 {
-	display.foreground = color;
+	dev->foreground = color;
 }
 
 /*!
  * \brief Set background color
+ * \param[in] dev - display handle
  */
-void ssd1306_set_background(ssd1306_color_t color)
+void ssd1306_set_background(ssd1306_t* dev, ssd1306_color_t color)
 {
-	display.background = color;
+	dev->background = color;
 }
 
 /*!
  * \brief Fill screen with specific color
+ * \param[in] dev - display handle
  * \param[in] color  - color to fill screen with
  */
-void ssd1306_fill(ssd1306_color_t color)
+void ssd1306_fill(ssd1306_t* dev, ssd1306_color_t color)
 {
 	/* Set memory */
 	uint32_t i;
 
-	for(i = 0; i < sizeof(framebuffer); i++)
+	for(i = 0; i < sizeof(dev->framebuffer); i++)
 	{
 		if(color == SSD1306_COLOR_BLACK)
 		{
-			framebuffer[i] = 0x00;
+			dev->framebuffer[i] = 0x00;
 		}
 		else
 		{
-			framebuffer[i] = 0xFF;
+			dev->framebuffer[i] = 0xFF;
 		}
 	}
 }
 
+/*!
+ * \brief Draw a complete frame and send it to the device
+ * \param[in] dev - display handle
+ * \param[in] draw - draws the frame, NULL for an empty frame
+ * \param[in] ctx - passed to draw
+ * \details The frame starts out filled with the background color. In page mode
+ *          draw is called once for every page and everything outside that page
+ *          is clipped, so it has to draw the whole frame on every call (starting
+ *          with ssd1306_set_cursor()). Each page is sent as soon as it is drawn.
+ *          Without page mode draw is called once and the frame is sent with
+ *          ssd1306_update(). While the panel is off nothing is drawn or sent.
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_render(ssd1306_t* dev, ssd1306_draw_cb_t draw, void* ctx)
+{
+#ifdef SSD1306_PAGE_MODE
+	uint8_t page;
+	uint8_t cmds[3];
+	uint32_t start = ssd1306_hal_timestamp();
+	uint32_t bytes_before = ssd1306_bus_bytes(dev);
+	int8_t result = 0;
+
+	if (dev->power == SSD1306_POWER_OFF)
+	{
+		/* the panel RAM still shows the last frame, nothing to resend on wake */
+		return (0);
+	}
+
+	for (page = 0; page < SSD1306_PAGES; page++)
+	{
+		dev->render_page = page;
+		ssd1306_clear(dev);
+
+		if (draw != NULL)
+		{
+			draw(dev, ctx);
+		}
+
+		cmds[0] = 0xB0 + page;
+		cmds[1] = SSD1306_CMD_COLUMN_LOW(0);
+		cmds[2] = SSD1306_CMD_COLUMN_HIGH(0);
+
+		if (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)) != 0 ||
+			ssd1306_hal_send_data(dev->hal, dev->framebuffer, SSD1306_WIDTH) != 0)
+		{
+			/* no point in drawing the remaining pages */
+			result = -1;
+			break;
+		}
+	}
+
+	ssd1306_update_done(dev, start, bytes_before);
+
+	return (result);
+#else
+	if (dev->power == SSD1306_POWER_OFF)
+	{
+		/* framebuffer left as it is, nothing to resend on wake */
+		return (0);
+	}
+
+	ssd1306_clear(dev);
+
+	if (draw != NULL)
+	{
+		draw(dev, ctx);
+	}
+
+	return (ssd1306_update(dev));
+#endif
+}
+
+#ifndef SSD1306_PAGE_MODE
 /*!
  * \brief Write screenbuffer to device
+ * \param[in] dev - display handle
+ * \returns 0 if OK, -1 on IO error
+ * \details Skipped while the panel is off, ssd1306_set_power() sends the
+ *          frame when it is switched on again.
  */
-void ssd1306_update(void)
+int8_t ssd1306_update(ssd1306_t* dev)
 {
-	uint8_t i;
+	uint32_t start = ssd1306_hal_timestamp();
+	uint32_t bytes_before = ssd1306_bus_bytes(dev);
+	int8_t result;
+
+	if (ssd1306_drop_frame(dev) == 1)
+	{
+		return (0);
+	}
+
+#ifdef SSD1306_DOUBLE_BUFFER
+	ssd1306_flush_wait(dev);
+	ssd1306_flush(dev);
+	ssd1306_flush_wait(dev);
+
+	/* a failed flush leaves the panel content unknown */
+	result = (dev->flush_resync == 1) ? -1 : 0;
+	ssd1306_clean_pages(dev, 0, SSD1306_PAGES - 1);
+#else
+	result = ssd1306_update_pages(dev, 0, SSD1306_PAGES - 1);
+#endif
+
+	ssd1306_update_done(dev, start, bytes_before);
+
+	return (result);
+}
+
+/*!
+ * \brief Mark a rectangle of the framebuffer as changed
+ * \param[in] dev - display handle
+ * \param[in] x - left column
+ * \param[in] y - top row
+ * \param[in] width - width in pixels
+ * \param[in] height - height in pixels
+ * \details Collected per page as one column span (a clean page has
+ *          first > last), which ssd1306_update_dirty() sends. Parts outside
+ *          the display are ignored.
+ */
+void ssd1306_mark_dirty(ssd1306_t* dev, uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+	uint8_t page;
+	uint8_t last_x;
+	uint8_t last_page;
+
+	if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT || width == 0 || height == 0)
+	{
+		return;
+	}
+
+	last_x = (width > SSD1306_WIDTH - x) ? (SSD1306_WIDTH - 1) : (x + width - 1);
+	last_page = (height > SSD1306_HEIGHT - y) ? (SSD1306_PAGES - 1) : ((y + height - 1) / 8);
+
+	for (page = y / 8; page <= last_page; page++)
+	{
+		if (x < dev->dirty_first[page])
+		{
+			dev->dirty_first[page] = x;
+		}
+		if (last_x > dev->dirty_last[page])
+		{
+			dev->dirty_last[page] = last_x;
+		}
+	}
+}
+
+/*!
+ * \brief Write the parts of the framebuffer marked with ssd1306_mark_dirty() to the device
+ * \param[in] dev - display handle
+ * \returns 0 if OK, -1 on IO error
+ * \details In double buffered mode the flush finds the changes by itself, so
+ *          this is the same as ssd1306_update().
+ */
+int8_t ssd1306_update_dirty(ssd1306_t* dev)
+{
+#ifdef SSD1306_DOUBLE_BUFFER
+	return (ssd1306_update(dev));
+#else
+	uint32_t start = ssd1306_hal_timestamp();
+	uint32_t bytes_before = ssd1306_bus_bytes(dev);
+	uint8_t page;
+	uint8_t first;
+	uint8_t cmds[3];
+	int8_t result = 0;
+
+	if (ssd1306_drop_frame(dev) == 1)
+	{
+		return (0);
+	}
+
+	for (page = 0; page < SSD1306_PAGES; page++)
+	{
+		first = dev->dirty_first[page];
+
+		if (first > dev->dirty_last[page])
+		{
+			continue;
+		}
+
+		cmds[0] = 0xB0 + page;
+		cmds[1] = SSD1306_CMD_COLUMN_LOW(first);
+		cmds[2] = SSD1306_CMD_COLUMN_HIGH(first);
+
+		if (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)) != 0 ||
+			ssd1306_hal_send_data(dev->hal, &dev->framebuffer[SSD1306_WIDTH * page + first],
+					dev->dirty_last[page] - first + 1) != 0)
+		{
+			/* keep the remaining marks, the next update sends them again */
+			result = -1;
+			break;
+		}
+
+		ssd1306_clean_pages(dev, page, page);
+	}
+
+	ssd1306_update_done(dev, start, bytes_before);
+
+	return (result);
+#endif
+}
+#endif
+
+#ifdef SSD1306_DOUBLE_BUFFER
+/*!
+ * \brief Start sending the changes of the back buffer to the device
+ * \param[in] dev - display handle
+ * \retval 0 - flush started, or nothing changed since the last flush
+ * \retval 1 - previous flush still running, try again later
+ * \details The changed column span of every page is copied from the back buffer
+ *          to the front buffer and sent from there by DMA. Drawing into the back
+ *          buffer can go on while the transfer runs, and the panel only ever
+ *          receives frames that were complete when this function was called.
+ */
+int8_t ssd1306_flush(ssd1306_t* dev)
+{
+	uint8_t page;
+	uint8_t first;
+	uint8_t last;
+	uint8_t *back;
+	uint8_t *front;
+	uint8_t changed = 0;
 
-	for (i = 0; i < 8; i++) {
-		ssd1306_hal_send_command(0xB0 + i);
-		ssd1306_hal_send_command(0x00);
-		ssd1306_hal_send_command(0x10);
+	if (dev->flush_busy == 1)
+	{
+		return (1);
+	}
 
-		ssd1306_hal_send_data(&framebuffer[SSD1306_WIDTH * i],SSD1306_WIDTH);
+	if (ssd1306_drop_frame(dev) == 1)
+	{
+		return (0);
 	}
+
+	for (page = 0; page < SSD1306_PAGES; page++)
+	{
+		back = &dev->framebuffer[SSD1306_WIDTH * page];
+		front = &dev->frontbuffer[SSD1306_WIDTH * page];
+
+		if (dev->flush_resync == 1)
+		{
+			first = 0;
+			last = SSD1306_WIDTH - 1;
+		}
+		else
+		{
+			for (first = 0; first < SSD1306_WIDTH && back[first] == front[first]; first++);
+
+			if (first == SSD1306_WIDTH)
+			{
+				/* page unchanged */
+				dev->flush_first[page] = SSD1306_WIDTH;
+				dev->flush_last[page] = 0;
+				continue;
+			}
+
+			for (last = SSD1306_WIDTH - 1; back[last] == front[last]; last--);
+		}
+
+		memcpy(&front[first], &back[first], last - first + 1);
+		dev->flush_first[page] = first;
+		dev->flush_last[page] = last;
+		changed = 1;
+	}
+
+	dev->flush_resync = 0;
+
+	if (changed == 1)
+	{
+		dev->flush_busy = 1;
+		dev->flush_page = 0;
+		dev->flush_data_phase = 0;
+		ssd1306_flush_next(dev, 0);
+	}
+
+	return (0);
 }
 
+/*!
+ * \brief Check for a running flush
+ * \param[in] dev - display handle
+ * \returns 1 if a flush is running, otherwise 0
+ */
+uint8_t ssd1306_flush_busy(ssd1306_t* dev)
+{
+	return (dev->flush_busy);
+}
+#endif
+
 /*!
  * \brief Draw one single pixel
+ * \param[in] dev - display handle
  * \param[in] x - x coordinate
  * \param[in] y - y coordinate
  */
-void ssd1306_draw_pixel(uint8_t x, uint8_t y, ssd1306_color_t color)
+void ssd1306_draw_pixel(ssd1306_t* dev, uint8_t x, uint8_t y, ssd1306_color_t color)
 {
+	uint8_t *cell;
+
 	if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT)
 	{
 		/* out of range */
 		return;
 	}
 
+#ifdef SSD1306_PAGE_MODE
+	if ((y / 8) != dev->render_page)
+	{
+		/* clipped, not on the page being rendered */
+		return;
+	}
+	cell = &dev->framebuffer[x];
+#else
+	cell = &dev->framebuffer[x + (y / 8) * SSD1306_WIDTH];
+#endif
+
 	if (color == SSD1306_COLOR_WHITE)
 	{
-		framebuffer[x + (y / 8) * SSD1306_WIDTH] |= 1 << (y % 8);
+		*cell |= 1 << (y % 8);
 	}
 	else
 	{
-		framebuffer[x + (y / 8) * SSD1306_WIDTH] &= ~(1 << (y % 8));
+		*cell &= ~(1 << (y % 8));
 	}
 }
 
 /*!
  * \brief Draw one character at the current cursor position
+ * \param[in] dev - display handle
  * \param[in] ch - character
  * \param[in] font - font type to use
  * \details The character will be drawn in the foreground color
  */
-void ssd1306_put_char(char ch, ssd1306_font_t font)
+void ssd1306_put_char(ssd1306_t* dev, char ch, ssd1306_font_t font)
 {
 	uint32_t i, b, j;
+	uint32_t first_row = 0;
+	uint32_t end_row = font.height;
+#ifdef SSD1306_PAGE_MODE
+	uint32_t page_top;
+#endif
 	ssd1306_color_t color;
 
 	// Check remaining space on current line
-	if (SSD1306_WIDTH <= (display.current_x + font.width) ||
-		SSD1306_HEIGHT <= (display.current_y + font.height))
+	if (SSD1306_WIDTH <= (dev->current_x + font.width) ||
+		SSD1306_HEIGHT <= (dev->current_y + font.height))
 	{
 		/* Not enough space on current line */
 		return;
 	}
 
+#ifdef SSD1306_PAGE_MODE
+	/* only the rows of the character that fall into the page being rendered */
+	page_top = dev->render_page * 8u;
+	if (dev->current_y < page_top)
+	{
+		first_row = page_top - dev->current_y;
+	}
+	if (dev->current_y + end_row > page_top + 8)
+	{
+		end_row = (page_top + 8 > dev->current_y) ? (page_top + 8 - dev->current_y) : 0;
+	}
+#endif
+
 	// Use the font to write
-	for (i = 0; i < font.height; i++)
+	for (i = first_row; i < end_row; i++)
 	{
 		b = font.data[(ch - 32) * font.height + i];
 		for (j = 0; j < font.width; j++)
 		{
 			if ((b << j) & 0x8000)
 			{
-				color = display.foreground;
+				color = dev->foreground;
 			}
 			else
 			{
-				color = display.background;
+				color = dev->background;
 			}
-			ssd1306_draw_pixel(display.current_x + j, (display.current_y + i), color);
+			ssd1306_draw_pixel(dev, dev->current_x + j, (dev->current_y + i), color);
 		}
 	}
 
-	display.current_x += font.width;
+	dev->current_x += font.width;
 
 }
 
 /*!
  * \brief Draw a string at the current cursor position
+ * \param[in] dev - display handle
  * \param[in] str - character array
  * \param[in] font - font type to use
  * \details The character will be drawn in the foreground color
  */
-void ssd1306_put_str(char* str, ssd1306_font_t font)
+void ssd1306_put_str(ssd1306_t* dev, char* str, ssd1306_font_t font)
 {
 	// Write until null-byte
 	while (*str)
 	{
-		ssd1306_put_char(*str, font);
+		ssd1306_put_char(dev, *str, font);
 
 		str++;
 	}
@@ -220,32 +562,683 @@ void ssd1306_put_str(char* str, ssd1306_font_t font)
 //
 //	Position the cursor
 //
-void ssd1306_set_cursor(uint8_t x, uint8_t y)
+void ssd1306_set_cursor(ssd1306_t* dev, uint8_t x, uint8_t y)
 {
-	display.current_x = x;
-	display.current_y = y;
+	dev->current_x = x;
+	dev->current_y = y;
 }
 
 /*!
  * \brief clears the sdreen by filling with the background color
+ * \param[in] dev - display handle
  */
-void ssd1306_clear(void)
+void ssd1306_clear(ssd1306_t* dev)
 {
-	ssd1306_fill(display.background);
+	ssd1306_fill(dev, dev->background);
 }
 
 /*!
  * \brief Invert display
+ * \param[in] dev - display handle
  * \param[in] invert - 1=inverted ; 0=normal
  */
-void ssd1306_invert(uint8_t invert)
+void ssd1306_invert(ssd1306_t* dev, uint8_t invert)
 {
   if (invert == 1) {
-	  ssd1306_hal_send_command(0xA7);	/* inverted mode */
+	  ssd1306_hal_send_command(dev->hal, 0xA7);	/* inverted mode */
   } else {
-	  ssd1306_hal_send_command(0xA6);	/* normal mode */
+	  ssd1306_hal_send_command(dev->hal, 0xA6);	/* normal mode */
   }
 }
 
+/*!
+ * \brief Switch the power state of the panel
+ * \param[in] dev - display handle
+ * \param[in] power - new power state
+ * \returns 0 if OK, -1 on IO error
+ * \details Off is the controller sleep mode with the charge pump disabled, the
+ *          panel RAM is kept. Frames are not sent while the panel is off. If
+ *          any were dropped, switching on sends the current framebuffer (in
+ *          page mode the application renders a new frame instead). The
+ *          state only changes once the commands are sent, so after an
+ *          error the same call tries again.
+ */
+int8_t ssd1306_set_power(ssd1306_t* dev, ssd1306_power_t power)
+{
+	static const uint8_t off_cmds[] = {
+		0xAE,		/* display off */
+		0x8D, 0x10	/* charge pump off */
+	};
+	uint8_t on_cmds[5];
+	uint8_t was_off = (dev->power == SSD1306_POWER_OFF);
+	int8_t result;
+
+	if (power == dev->power)
+	{
+		return (0);
+	}
+
+	if (power == SSD1306_POWER_OFF)
+	{
+#ifdef SSD1306_DOUBLE_BUFFER
+		ssd1306_flush_wait(dev);
+#endif
+		result = ssd1306_hal_send_commands(dev->hal, off_cmds, sizeof(off_cmds));
+		if (result == 0)
+		{
+			dev->power = power;
+		}
+
+		return (result);
+	}
+
+	on_cmds[0] = 0x81;		/* contrast */
+	on_cmds[1] = (power == SSD1306_POWER_DIMMED) ? SSD1306_CONTRAST_DIMMED : SSD1306_CONTRAST_FULL;
+	on_cmds[2] = 0x8D;		/* charge pump on */
+	on_cmds[3] = 0x14;
+	on_cmds[4] = 0xAF;		/* display on */
+
+	/* only the contrast changes between full and dimmed */
+	result = ssd1306_hal_send_commands(dev->hal, on_cmds, (was_off == 1) ? sizeof(on_cmds) : 2);
+	if (result != 0)
+	{
+		return (result);
+	}
+	dev->power = power;
+
+	if (was_off == 1 && dev->power_stale == 1)
+	{
+		dev->power_stale = 0;
+#ifdef SSD1306_DOUBLE_BUFFER
+		dev->flush_resync = 1;
+#endif
+#ifndef SSD1306_PAGE_MODE
+		result = ssd1306_update(dev);
+#endif
+	}
+
+	return (result);
+}
+
+/*!
+ * \brief Get the power state of the panel
+ * \param[in] dev - display handle
+ */
+ssd1306_power_t ssd1306_get_power(ssd1306_t* dev)
+{
+	return (dev->power);
+}
+
+/*!
+ * \brief Get bus traffic and frame cost of a display
+ * \param[in] dev - display handle
+ * \param[out] stats - filled with the counters
+ * \details An update is a call of ssd1306_update(), in page mode a call of
+ *          ssd1306_render() (drawing included).
+ */
+void ssd1306_get_stats(ssd1306_t* dev, ssd1306_stats_t* stats)
+{
+	stats->bus = *ssd1306_hal_get_stats(dev->hal);
+	stats->updates = dev->updates;
+	stats->update_last_us = dev->update_last_us;
+	stats->update_worst_us = dev->update_worst_us;
+	stats->update_last_bytes = dev->update_last_bytes;
+}
+
+/*!
+ * \brief Reset bus traffic and frame cost counters
+ * \param[in] dev - display handle
+ */
+void ssd1306_reset_stats(ssd1306_t* dev)
+{
+	ssd1306_hal_stats_t* bus = ssd1306_hal_get_stats(dev->hal);
+
+	bus->transactions = 0;
+	bus->cmd_bytes = 0;
+	bus->data_bytes = 0;
+	bus->errors = 0;
+	bus->blocked_us = 0;
+
+	dev->updates = 0;
+	dev->update_last_us = 0;
+	dev->update_worst_us = 0;
+	dev->update_last_bytes = 0;
+}
+
+/*!
+ * \brief Draw the frame cost as a debug overlay
+ * \param[in] dev - display handle
+ * \param[in] y - top row of the overlay line (font_7x10)
+ * \details Shows duration of the last and the worst update in ms and the bus
+ *          bytes of the last update, e.g. "12.4/20.1ms 1080B". Called from the
+ *          draw code, the values are those of the previous update.
+ */
+void ssd1306_draw_stats(ssd1306_t* dev, uint8_t y)
+{
+	ssd1306_set_cursor(dev, 0, y);
+
+	ssd1306_put_uint(dev, dev->update_last_us / 1000, font_7x10);
+	ssd1306_put_char(dev, '.', font_7x10);
+	ssd1306_put_uint(dev, (dev->update_last_us % 1000) / 100, font_7x10);
+	ssd1306_put_char(dev, '/', font_7x10);
+	ssd1306_put_uint(dev, dev->update_worst_us / 1000, font_7x10);
+	ssd1306_put_char(dev, '.', font_7x10);
+	ssd1306_put_uint(dev, (dev->update_worst_us % 1000) / 100, font_7x10);
+	ssd1306_put_str(dev, "ms ", font_7x10);
+	ssd1306_put_uint(dev, dev->update_last_bytes, font_7x10);
+	ssd1306_put_char(dev, 'B', font_7x10);
+}
+
+/*!
+ * \brief Start a continuous hardware horizontal scroll
+ * \param[in] dev - display handle
+ * \param[in] dir - scroll direction
+ * \param[in] start_page - first page of the scroll window
+ * \param[in] end_page - last page of the scroll window, must be >= start_page
+ * \param[in] interval - number of frames between two scroll steps
+ * \returns 0 if OK, -1 on IO error or invalid arguments
+ * \details The controller rotates the content of the window on its own, no data
+ *          is sent over the bus while scrolling. The panel RAM can not be tracked
+ *          during a continuous scroll, so the framebuffer must not be flushed
+ *          before \ref ssd1306_scroll_stop is called.
+ */
+int8_t ssd1306_scroll_start(ssd1306_t* dev, ssd1306_scroll_dir_t dir, uint8_t start_page,
+		uint8_t end_page, ssd1306_scroll_interval_t interval)
+{
+	uint8_t cmds[9];
+
+	if (start_page > end_page || end_page >= SSD1306_PAGES)
+	{
+		return (-1);
+	}
+
+	cmds[0] = 0x2E;		/* deactivate scroll before changing setup */
+	cmds[1] = (dir == SSD1306_SCROLL_RIGHT) ? 0x26 : 0x27;
+	cmds[2] = 0x00;		/* dummy */
+	cmds[3] = start_page;
+	cmds[4] = interval;
+	cmds[5] = end_page;
+	cmds[6] = 0x00;		/* dummy */
+	cmds[7] = 0xFF;		/* dummy */
+	cmds[8] = 0x2F;		/* activate scroll */
+
+	/* also on an error, the scroll may have started */
+	dev->scroll_active = 1;
+	dev->scroll_start_page = start_page;
+	dev->scroll_end_page = end_page;
+
+	return (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)));
+}
+
+/*!
+ * \brief Start a continuous hardware vertical and horizontal scroll
+ * \param[in] dev - display handle
+ * \param[in] dir - horizontal scroll direction
+ * \param[in] start_page - first page of the horizontal scroll window
+ * \param[in] end_page - last page of the horizontal scroll window
+ * \param[in] interval - number of frames between two scroll steps
+ * \param[in] vertical_offset - rows (1 to SSD1306_HEIGHT-1) the content moves up per step
+ * \returns 0 if OK, -1 on IO error or invalid arguments
+ * \details The vertical scroll area is set to the whole display. See
+ *          \ref ssd1306_scroll_start for restrictions while scrolling.
+ */
+int8_t ssd1306_scroll_start_diagonal(ssd1306_t* dev, ssd1306_scroll_dir_t dir, uint8_t start_page,
+		uint8_t end_page, ssd1306_scroll_interval_t interval, uint8_t vertical_offset)
+{
+	uint8_t cmds[11];
+
+	if (start_page > end_page || end_page >= SSD1306_PAGES ||
+		vertical_offset == 0 || vertical_offset >= SSD1306_HEIGHT)
+	{
+		return (-1);
+	}
+
+	cmds[0] = 0x2E;		/* deactivate scroll before changing setup */
+	cmds[1] = 0xA3;		/* set vertical scroll area */
+	cmds[2] = 0x00;		/* no fixed rows on top */
+	cmds[3] = SSD1306_HEIGHT;
+	cmds[4] = (dir == SSD1306_SCROLL_RIGHT) ? 0x29 : 0x2A;
+	cmds[5] = 0x00;		/* dummy */
+	cmds[6] = start_page;
+	cmds[7] = interval;
+	cmds[8] = end_page;
+	cmds[9] = vertical_offset;
+	cmds[10] = 0x2F;	/* activate scroll */
+
+	/* vertical scrolling moves every page, so all of them have to be restored on stop */
+	dev->scroll_active = 1;
+	dev->scroll_start_page = 0;
+	dev->scroll_end_page = SSD1306_PAGES - 1;
+
+	return (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)));
+}
+
+/*!
+ * \brief Stop a continuous hardware scroll
+ * \param[in] dev - display handle
+ * \returns 0 if OK, -1 on IO error
+ * \details The controller leaves the RAM content of the scroll window at an
+ *          arbitrary position, so the affected pages are rewritten from the
+ *          framebuffer to get panel and framebuffer back in step. In page mode
+ *          there is no framebuffer to restore from, the application renders
+ *          a new frame instead. After an error the scroll counts as running,
+ *          so calling this again repeats the whole stop.
+ */
+int8_t ssd1306_scroll_stop(ssd1306_t* dev)
+{
+	/* deactivate scroll, reset start line moved by a diagonal scroll */
+	static const uint8_t cmds[] = { 0x2E, 0x40 };
+	int8_t result;
+
+	result = ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds));
+	if (result != 0 || dev->scroll_active == 0)
+	{
+		return (result);
+	}
+
+#ifndef SSD1306_PAGE_MODE
+	result = ssd1306_update_pages(dev, dev->scroll_start_page, dev->scroll_end_page);
+	if (result != 0)
+	{
+		return (result);
+	}
+#endif
+	dev->scroll_active = 0;
+
+	return (0);
+}
+
+/*!
+ * \brief Scroll a window of pages by exactly one column
+ * \param[in] dev - display handle
+ * \param[in] dir - scroll direction
+ * \param[in] start_page - first page of the scroll window
+ * \param[in] end_page - last page of the scroll window, must be >= start_page
+ * \returns 0 if OK, -1 on IO error or invalid arguments
+ * \details The framebuffer is rotated by one column and the column that is
+ *          rotated into view (x = 0 for right, x = SSD1306_WIDTH-1 for left)
+ *          can then be redrawn and sent with \ref ssd1306_update_column.
+ *          With SSD1306_CONTENT_SCROLL the controller rotates its RAM the same
+ *          way (0x2C/0x2D), which costs 7 command bytes instead of whole pages.
+ *          It then needs at least two frames between two steps, so this must
+ *          not be called faster than every ~20 ms. A plain SSD1306 does not
+ *          know these commands, there the window pages are sent again, and in
+ *          page mode the function is not available without them.
+ *          On an error the framebuffer is left as it was.
+ */
+int8_t ssd1306_scroll_column(ssd1306_t* dev, ssd1306_scroll_dir_t dir, uint8_t start_page,
+		uint8_t end_page)
+{
+#ifndef SSD1306_PAGE_MODE
+	uint8_t page;
+#endif
+#ifdef SSD1306_CONTENT_SCROLL
+	uint8_t cmds[7];
+#endif
+
+	if (start_page > end_page || end_page >= SSD1306_PAGES)
+	{
+		return (-1);
+	}
+
+	if (dev->scroll_active == 1 && ssd1306_scroll_stop(dev) != 0)
+	{
+		return (-1);
+	}
+
+#ifdef SSD1306_CONTENT_SCROLL
+#ifdef SSD1306_DOUBLE_BUFFER
+	/* the front buffer is rotated as well, it must not be in use by a flush */
+	ssd1306_flush_wait(dev);
+#endif
+
+	cmds[0] = (dir == SSD1306_SCROLL_RIGHT) ? 0x2C : 0x2D;
+	cmds[1] = 0x00;		/* dummy */
+	cmds[2] = start_page;
+	cmds[3] = 0x01;		/* dummy */
+	cmds[4] = end_page;
+	cmds[5] = SSD1306_COLUMN_OFFSET;	/* start column */
+	cmds[6] = SSD1306_COLUMN_OFFSET + SSD1306_WIDTH - 1;	/* end column */
+
+	if (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)) != 0)
+	{
+		/* the panel may have scrolled or not, send the window again next time */
+#ifdef SSD1306_DOUBLE_BUFFER
+		dev->flush_resync = 1;
+#elif !defined(SSD1306_PAGE_MODE)
+		ssd1306_mark_dirty(dev, 0, start_page * 8, SSD1306_WIDTH, (end_page - start_page + 1) * 8);
+#endif
+		return (-1);
+	}
+
+#ifndef SSD1306_PAGE_MODE
+	/* rotate the framebuffer the same way the controller rotates its RAM */
+	for (page = start_page; page <= end_page; page++)
+	{
+		ssd1306_rotate_page(&dev->framebuffer[SSD1306_WIDTH * page], dir);
+#ifdef SSD1306_DOUBLE_BUFFER
+		ssd1306_rotate_page(&dev->frontbuffer[SSD1306_WIDTH * page], dir);
+#endif
+	}
+#endif
+
+	return (0);
+#elif defined(SSD1306_PAGE_MODE)
+	(void)dir;
+
+	return (-1);
+#else
+	for (page = start_page; page <= end_page; page++)
+	{
+		ssd1306_rotate_page(&dev->framebuffer[SSD1306_WIDTH * page], dir);
+	}
+
+	if (ssd1306_drop_frame(dev) == 1)
+	{
+		return (0);
+	}
+
+	if (ssd1306_update_pages(dev, start_page, end_page) != 0)
+	{
+		/* the panel keeps part of the old window, send it again next time */
+		for (page = start_page; page <= end_page; page++)
+		{
+			ssd1306_rotate_page(&dev->framebuffer[SSD1306_WIDTH * page],
+					(dir == SSD1306_SCROLL_RIGHT) ? SSD1306_SCROLL_LEFT : SSD1306_SCROLL_RIGHT);
+		}
+		ssd1306_mark_dirty(dev, 0, start_page * 8, SSD1306_WIDTH, (end_page - start_page + 1) * 8);
+		return (-1);
+	}
+
+	return (0);
+#endif
+}
+
+#ifndef SSD1306_PAGE_MODE
+/*!
+ * \brief Write a single column of the framebuffer to the device
+ * \param[in] dev - display handle
+ * \param[in] x - column to send
+ * \param[in] start_page - first page to send
+ * \param[in] end_page - last page to send
+ * \returns 0 if OK, -1 on IO error or invalid arguments
+ */
+int8_t ssd1306_update_column(ssd1306_t* dev, uint8_t x, uint8_t start_page, uint8_t end_page)
+{
+	uint8_t page;
+	uint8_t cmds[3];
+
+	if (x >= SSD1306_WIDTH || start_page > end_page || end_page >= SSD1306_PAGES)
+	{
+		return (-1);
+	}
+
+	if (ssd1306_drop_frame(dev) == 1)
+	{
+		return (0);
+	}
+
+#ifdef SSD1306_DOUBLE_BUFFER
+	ssd1306_flush_wait(dev);
+#endif
+
+	for (page = start_page; page <= end_page; page++)
+	{
+		cmds[0] = 0xB0 + page;
+		cmds[1] = SSD1306_CMD_COLUMN_LOW(x);
+		cmds[2] = SSD1306_CMD_COLUMN_HIGH(x);
+
+		if (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)) != 0 ||
+			ssd1306_hal_send_data(dev->hal, &dev->framebuffer[x + SSD1306_WIDTH * page], 1) != 0)
+		{
+#ifdef SSD1306_DOUBLE_BUFFER
+			dev->flush_resync = 1;
+#endif
+			return (-1);
+		}
+#ifdef SSD1306_DOUBLE_BUFFER
+		dev->frontbuffer[x + SSD1306_WIDTH * page] = dev->framebuffer[x + SSD1306_WIDTH * page];
+#endif
+	}
+
+	return (0);
+}
+
+#endif
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+#ifndef SSD1306_PAGE_MODE
+/*!
+ * \brief Check whether a frame has to be dropped because the panel is off
+ * \param[in] dev - display handle
+ * \returns 1 if the panel is off, otherwise 0
+ */
+static uint8_t ssd1306_drop_frame(ssd1306_t* dev)
+{
+	if (dev->power != SSD1306_POWER_OFF)
+	{
+		return (0);
+	}
+
+	/* the panel misses this frame, it is sent on wake */
+	dev->power_stale = 1;
+
+	return (1);
+}
+#endif
+
+/*!
+ * \brief Command and data bytes sent to a display so far
+ * \param[in] dev - display handle
+ */
+static uint32_t ssd1306_bus_bytes(ssd1306_t* dev)
+{
+	ssd1306_hal_stats_t* bus = ssd1306_hal_get_stats(dev->hal);
+
+	return (bus->cmd_bytes + bus->data_bytes);
+}
+
+/*!
+ * \brief Record the cost of a finished update
+ * \param[in] dev - display handle
+ * \param[in] start - timestamp taken when the update started
+ * \param[in] bytes_before - ssd1306_bus_bytes() when the update started
+ */
+static void ssd1306_update_done(ssd1306_t* dev, uint32_t start, uint32_t bytes_before)
+{
+	dev->update_last_us = ssd1306_hal_elapsed_us(start);
+	dev->update_last_bytes = ssd1306_bus_bytes(dev) - bytes_before;
+	dev->updates++;
 
+	if (dev->update_last_us > dev->update_worst_us)
+	{
+		dev->update_worst_us = dev->update_last_us;
+	}
+}
 
+/*!
+ * \brief Draw an unsigned decimal number at the current cursor position
+ * \param[in] dev - display handle
+ * \param[in] value - number to draw
+ * \param[in] font - font type to use
+ */
+static void ssd1306_put_uint(ssd1306_t* dev, uint32_t value, ssd1306_font_t font)
+{
+	char digits[11];
+	uint8_t i = sizeof(digits) - 1;
+
+	digits[i] = '\0';
+	do
+	{
+		digits[--i] = '0' + (value % 10);
+		value /= 10;
+	} while (value > 0);
+
+	ssd1306_put_str(dev, &digits[i], font);
+}
+
+#ifndef SSD1306_PAGE_MODE
+/*!
+ * \brief Write a range of framebuffer pages to the device
+ * \param[in] dev - display handle
+ * \param[in] start_page - first page to send
+ * \param[in] end_page - last page to send
+ * \returns 0 if OK, -1 on IO error
+ */
+static int8_t ssd1306_update_pages(ssd1306_t* dev, uint8_t start_page, uint8_t end_page)
+{
+	uint8_t i;
+	uint8_t cmds[3];
+
+#ifdef SSD1306_DOUBLE_BUFFER
+	ssd1306_flush_wait(dev);
+#endif
+
+	for (i = start_page; i <= end_page; i++) {
+		cmds[0] = 0xB0 + i;
+		cmds[1] = SSD1306_CMD_COLUMN_LOW(0);
+		cmds[2] = SSD1306_CMD_COLUMN_HIGH(0);
+
+		if (ssd1306_hal_send_commands(dev->hal, cmds, sizeof(cmds)) != 0 ||
+			ssd1306_hal_send_data(dev->hal, &dev->framebuffer[SSD1306_WIDTH * i],SSD1306_WIDTH) != 0)
+		{
+#ifdef SSD1306_DOUBLE_BUFFER
+			dev->flush_resync = 1;
+#endif
+			return (-1);
+		}
+#ifdef SSD1306_DOUBLE_BUFFER
+		memcpy(&dev->frontbuffer[SSD1306_WIDTH * i], &dev->framebuffer[SSD1306_WIDTH * i], SSD1306_WIDTH);
+#endif
+		ssd1306_clean_pages(dev, i, i);
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Clear the dirty marks of a range of pages
+ * \param[in] dev - display handle
+ * \param[in] start_page - first page
+ * \param[in] end_page - last page
+ */
+static void ssd1306_clean_pages(ssd1306_t* dev, uint8_t start_page, uint8_t end_page)
+{
+	uint8_t page;
+
+	for (page = start_page; page <= end_page; page++)
+	{
+		dev->dirty_first[page] = SSD1306_WIDTH;
+		dev->dirty_last[page] = 0;
+	}
+}
+
+/*!
+ * \brief Rotate one page of a buffer by one column
+ * \param[in] line - pointer to the first byte of the page
+ * \param[in] dir - rotation direction
+ */
+static void ssd1306_rotate_page(uint8_t *line, ssd1306_scroll_dir_t dir)
+{
+	uint8_t wrapped;
+
+	if (dir == SSD1306_SCROLL_RIGHT)
+	{
+		wrapped = line[SSD1306_WIDTH - 1];
+		memmove(&line[1], &line[0], SSD1306_WIDTH - 1);
+		line[0] = wrapped;
+	}
+	else
+	{
+		wrapped = line[0];
+		memmove(&line[0], &line[1], SSD1306_WIDTH - 1);
+		line[SSD1306_WIDTH - 1] = wrapped;
+	}
+}
+#endif
+
+#ifdef SSD1306_DOUBLE_BUFFER
+/*!
+ * \brief Advance the running flush by one transfer
+ * \param[in] ctx - display handle
+ * \param[in] result - result of the transfer that just finished
+ * \details Used as completion callback of the asynchronous HAL transfers, so it
+ *          runs in interrupt context. Every changed page costs one command
+ *          transfer (page and column address) and one data transfer.
+ */
+static void ssd1306_flush_next(void* ctx, int8_t result)
+{
+	ssd1306_t* dev = (ssd1306_t*)ctx;
+	uint8_t page;
+	uint8_t first;
+	int8_t started;
+
+	if (result != 0)
+	{
+		/* panel content is unknown now, next flush sends everything */
+		dev->flush_resync = 1;
+		dev->flush_busy = 0;
+		return;
+	}
+
+	while (dev->flush_page < SSD1306_PAGES &&
+			dev->flush_first[dev->flush_page] > dev->flush_last[dev->flush_page])
+	{
+		dev->flush_page++;
+	}
+
+	if (dev->flush_page >= SSD1306_PAGES)
+	{
+		dev->flush_busy = 0;
+		return;
+	}
+
+	page = dev->flush_page;
+	first = dev->flush_first[page];
+
+	if (dev->flush_data_phase == 0)
+	{
+		dev->flush_cmd[0] = 0xB0 + page;
+		dev->flush_cmd[1] = SSD1306_CMD_COLUMN_LOW(first);
+		dev->flush_cmd[2] = SSD1306_CMD_COLUMN_HIGH(first);
+		dev->flush_data_phase = 1;
+
+		started = ssd1306_hal_send_commands_async(dev->hal, dev->flush_cmd, sizeof(dev->flush_cmd),
+				ssd1306_flush_next, dev);
+	}
+	else
+	{
+		dev->flush_data_phase = 0;
+		dev->flush_page++;
+
+		started = ssd1306_hal_send_data_async(dev->hal, &dev->frontbuffer[SSD1306_WIDTH * page + first],
+				dev->flush_last[page] - first + 1, ssd1306_flush_next, dev);
+	}
+
+	if (started != 0)
+	{
+		dev->flush_resync = 1;
+		dev->flush_busy = 0;
+	}
+}
+
+/*!
+ * \brief Wait for a running flush to finish
+ * \param[in] dev - display handle
+ * \details Bounded: the HAL aborts a hanging transfer, which ends the flush.
+ */
+static void ssd1306_flush_wait(ssd1306_t* dev)
+{
+	while (dev->flush_busy == 1)
+	{
+		if (ssd1306_hal_busy(dev->hal) == 0)
+		{
+			continue;	/* between two transfers of the chain */
+		}
+		ssd1306_hal_wait(dev->hal);
+	}
+}
+#endif
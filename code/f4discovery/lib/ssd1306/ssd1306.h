@@ -34,33 +34,195 @@
  * 		- font_16x26
  */
 
+/*
+ * Panel profile, selected with SSD1306_PANEL in the Makefile. The geometry
+ * and the panel dependent controller setup follow from the profile, the size
+ * of the framebuffer and all page and column loops from the geometry.
+ *
+ * SSD1306_COLUMN_OFFSET is the first controller column wired to the panel,
+ * SSD1306_COM_PINS the argument of the COM pins configuration (0xDA).
+ */
+#if defined(SSD1306_PANEL_128X32)
+#define SSD1306_WIDTH           128
+#define SSD1306_HEIGHT          32
+#define SSD1306_COLUMN_OFFSET   0
+#define SSD1306_COM_PINS        0x02	/* sequential COM pins */
+#elif defined(SSD1306_PANEL_72X40)
+#define SSD1306_WIDTH           72
+#define SSD1306_HEIGHT          40
+#define SSD1306_COLUMN_OFFSET   28		/* centered in the 128 controller columns */
+#define SSD1306_COM_PINS        0x12	/* alternative COM pins */
+#define SSD1306_INTERNAL_IREF			/* module needs the internal current reference */
+#else
+/* SSD1306_PANEL_128X64, default */
 #define SSD1306_WIDTH           128
 #define SSD1306_HEIGHT          64
+#define SSD1306_COLUMN_OFFSET   0
+#define SSD1306_COM_PINS        0x12	/* alternative COM pins */
+#endif
+
+#define SSD1306_PAGES           (SSD1306_HEIGHT / 8)
+
+#define SSD1306_CONTRAST_FULL   0xFF
+#define SSD1306_CONTRAST_DIMMED 0x10	/* SSD1306_POWER_DIMMED */
+
+/*
+ * Define SSD1306_DOUBLE_BUFFER to draw into a back buffer while the previous
+ * frame is sent from a front buffer by DMA (see ssd1306_flush()). This costs
+ * a second framebuffer of SSD1306_WIDTH * SSD1306_PAGES bytes.
+ *
+ * Define SSD1306_PAGE_MODE to keep only one page (SSD1306_WIDTH bytes) in RAM.
+ * The frame is then drawn by a callback passed to ssd1306_render(), which is
+ * called once per page with all drawing clipped to that page. Functions that
+ * send from a retained framebuffer (ssd1306_update(), ssd1306_update_column())
+ * are not available in this mode.
+ *
+ * Define SSD1306_CONTENT_SCROLL if the controller is an SSD1306B or SSD1309.
+ * Only these have the one-column content scroll (0x2C/0x2D) used by
+ * ssd1306_scroll_column(), on a plain SSD1306 the window is sent again.
+ */
+
+#if defined(SSD1306_PAGE_MODE) && defined(SSD1306_DOUBLE_BUFFER)
+#error "SSD1306_PAGE_MODE and SSD1306_DOUBLE_BUFFER can not be combined"
+#endif
+
+#ifdef SSD1306_PAGE_MODE
+#define SSD1306_BUFFER_PAGES    1
+#else
+#define SSD1306_BUFFER_PAGES    SSD1306_PAGES
+#endif
 
 typedef enum {
 	SSD1306_COLOR_BLACK = 0x00, /* pixel not lit -> black */
 	SSD1306_COLOR_WHITE = 0x01  /* pixel lit -> white */
 } ssd1306_color_t;
 
+/*!
+ * \brief Power state of a panel, see ssd1306_set_power()
+ */
+typedef enum {
+	SSD1306_POWER_FULL,		/* on, SSD1306_CONTRAST_FULL */
+	SSD1306_POWER_DIMMED,	/* on, SSD1306_CONTRAST_DIMMED */
+	SSD1306_POWER_OFF		/* display and charge pump off, RAM kept */
+} ssd1306_power_t;
+
+/*!
+ * \brief Direction of a hardware horizontal scroll (in column address order)
+ */
+typedef enum {
+	SSD1306_SCROLL_RIGHT = 0x00,	/* content moves towards higher columns */
+	SSD1306_SCROLL_LEFT  = 0x01 	/* content moves towards lower columns */
+} ssd1306_scroll_dir_t;
+
+/*!
+ * \brief Time between two steps of a continuous hardware scroll, in frames
+ */
+typedef enum {
+	SSD1306_SCROLL_FRAMES_2   = 0x07,
+	SSD1306_SCROLL_FRAMES_3   = 0x04,
+	SSD1306_SCROLL_FRAMES_4   = 0x05,
+	SSD1306_SCROLL_FRAMES_5   = 0x00,
+	SSD1306_SCROLL_FRAMES_25  = 0x06,
+	SSD1306_SCROLL_FRAMES_64  = 0x01,
+	SSD1306_SCROLL_FRAMES_128 = 0x02,
+	SSD1306_SCROLL_FRAMES_256 = 0x03
+} ssd1306_scroll_interval_t;
+
+/*!
+ * \brief Display object, one per connected panel
+ * \details Every display has its own framebuffer, cursor, colors and interface
+ *          (bus and address, see ssd1306_hal_i2c.h / ssd1306_hal_spi.h).
+ *          Displays on different buses are flushed in parallel, displays
+ *          sharing a bus take turns.
+ */
 typedef struct {
+	ssd1306_hal_t* hal;			  /* interface the display is connected to */
 	ssd1306_color_t background;   /* background color */
 	ssd1306_color_t foreground;	  /* foreground color (text etc) */
 	uint16_t current_x;
 	uint16_t current_y;
+	uint8_t scroll_active;		  /* continuous hardware scroll running */
+	uint8_t scroll_start_page;	  /* first page of the scroll window */
+	uint8_t scroll_end_page;	  /* last page of the scroll window */
+	ssd1306_power_t power;
+	uint8_t power_stale;		  /* frames were dropped while the panel was off */
+	uint32_t updates;			  /* number of ssd1306_update() calls */
+	uint32_t update_last_us;	  /* duration of the last update */
+	uint32_t update_worst_us;	  /* longest update since the stats were reset */
+	uint32_t update_last_bytes;	  /* command and data bytes of the last update */
+	uint8_t framebuffer[SSD1306_WIDTH * SSD1306_BUFFER_PAGES];	/* back buffer in double buffered mode */
+#ifdef SSD1306_PAGE_MODE
+	uint8_t render_page;		  /* page the framebuffer holds while rendering */
+#else
+	uint8_t dirty_first[SSD1306_PAGES];	/* column span of each page marked with */
+	uint8_t dirty_last[SSD1306_PAGES];	/* ssd1306_mark_dirty() (first > last: clean) */
+#endif
+#ifdef SSD1306_DOUBLE_BUFFER
+	uint8_t frontbuffer[SSD1306_WIDTH * SSD1306_PAGES];	/* mirrors the panel RAM, source of a flush */
+	uint8_t flush_first[SSD1306_PAGES];	/* changed column span of each page in the */
+	uint8_t flush_last[SSD1306_PAGES];	/* running flush (first > last: unchanged) */
+	uint8_t flush_cmd[3];
+	uint8_t flush_page;
+	uint8_t flush_data_phase;
+	volatile uint8_t flush_busy;
+	uint8_t flush_resync;		  /* panel content unknown, send everything */
+#endif
 } ssd1306_t;
 
+/*!
+ * \brief Bus traffic and frame cost of a display, see ssd1306_get_stats()
+ */
+typedef struct {
+	ssd1306_hal_stats_t bus;	  /* traffic counted by the HAL */
+	uint32_t updates;
+	uint32_t update_last_us;
+	uint32_t update_worst_us;
+	uint32_t update_last_bytes;
+} ssd1306_stats_t;
+
+/*!
+ * \brief Draws a complete frame, see ssd1306_render()
+ */
+typedef void (*ssd1306_draw_cb_t)(ssd1306_t* dev, void* ctx);
+
+
+
+int8_t ssd1306_init(ssd1306_t* dev, ssd1306_hal_t* hal);
+void ssd1306_set_foreground(ssd1306_t* dev, ssd1306_color_t color);
+void ssd1306_set_background(ssd1306_t* dev, ssd1306_color_t color);
+void ssd1306_fill(ssd1306_t* dev, ssd1306_color_t color);
+int8_t ssd1306_render(ssd1306_t* dev, ssd1306_draw_cb_t draw, void* ctx);
+#ifndef SSD1306_PAGE_MODE
+int8_t ssd1306_update(ssd1306_t* dev);
+void ssd1306_mark_dirty(ssd1306_t* dev, uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+int8_t ssd1306_update_dirty(ssd1306_t* dev);
+#endif
+#ifdef SSD1306_DOUBLE_BUFFER
+int8_t ssd1306_flush(ssd1306_t* dev);
+uint8_t ssd1306_flush_busy(ssd1306_t* dev);
+#endif
+void ssd1306_draw_pixel(ssd1306_t* dev, uint8_t x, uint8_t y, ssd1306_color_t color);
+void ssd1306_put_char(ssd1306_t* dev, char ch, ssd1306_font_t font);
+void ssd1306_put_str(ssd1306_t* dev, char* str, ssd1306_font_t font);
+void ssd1306_set_cursor(ssd1306_t* dev, uint8_t x, uint8_t y);
 
+void ssd1306_clear(ssd1306_t* dev);
+void ssd1306_invert(ssd1306_t* dev, uint8_t invert);
+int8_t ssd1306_set_power(ssd1306_t* dev, ssd1306_power_t power);
+ssd1306_power_t ssd1306_get_power(ssd1306_t* dev);
 
-void ssd1306_init(void);
-void ssd1306_set_foreground(ssd1306_color_t color);
-void ssd1306_set_background(ssd1306_color_t color);
-void ssd1306_fill(ssd1306_color_t color);
-void ssd1306_update(void);
-void ssd1306_draw_pixel(uint8_t x, uint8_t y, ssd1306_color_t color);
-void ssd1306_put_char(char ch, ssd1306_font_t font);
-void ssd1306_put_str(char* str, ssd1306_font_t font);
-void ssd1306_set_cursor(uint8_t x, uint8_t y);
+void ssd1306_get_stats(ssd1306_t* dev, ssd1306_stats_t* stats);
+void ssd1306_reset_stats(ssd1306_t* dev);
+void ssd1306_draw_stats(ssd1306_t* dev, uint8_t y);
 
-void ssd1306_clear(void);
-void ssd1306_invert(uint8_t invert);
+int8_t ssd1306_scroll_start(ssd1306_t* dev, ssd1306_scroll_dir_t dir, uint8_t start_page,
+		uint8_t end_page, ssd1306_scroll_interval_t interval);
+int8_t ssd1306_scroll_start_diagonal(ssd1306_t* dev, ssd1306_scroll_dir_t dir, uint8_t start_page,
+		uint8_t end_page, ssd1306_scroll_interval_t interval, uint8_t vertical_offset);
+int8_t ssd1306_scroll_stop(ssd1306_t* dev);
+int8_t ssd1306_scroll_column(ssd1306_t* dev, ssd1306_scroll_dir_t dir, uint8_t start_page,
+		uint8_t end_page);
+#ifndef SSD1306_PAGE_MODE
+int8_t ssd1306_update_column(ssd1306_t* dev, uint8_t x, uint8_t start_page, uint8_t end_page);
+#endif
 #endif /* LIB_SSD1306_SSD1306_H__ */
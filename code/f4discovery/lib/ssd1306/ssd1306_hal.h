@@ -26,29 +26,135 @@
 /*!
  * \file ssd1306_hal.h
  * \brief Hardware abstraction layer for the SSD1306 display driver
+ * \details The driver only tells commands from display data, how the two are
+ *          told apart on the wire (I2C control byte, SPI D/C line) is up to
+ *          the HAL implementation. Select one at build time with
+ *          SSD1306_TRANSPORT (ssd1306_hal_i2c.c, ssd1306_hal_spi.c).
+ *
+ *          Every display is addressed through its own ssd1306_hal_t, which is
+ *          defined by the HAL implementation (bus, address, control pins).
+ *
+ *          No call may block for an unbounded time: a missing or hanging
+ *          display has to show up as an error, not as a stalled firmware.
+ */
+
+/*!
+ * \brief Interface of one display, defined by the HAL implementation
  */
+typedef struct ssd1306_hal ssd1306_hal_t;
 
 
+/*!
+ * \brief Completion callback of an asynchronous transfer
+ * \param[in] ctx context pointer passed when the transfer was started
+ * \param[in] result 0 if OK, -1 on IO error
+ * \note called from interrupt context
+ */
+typedef void (*ssd1306_hal_done_cb_t)(void* ctx, int8_t result);
+
+/*!
+ * \brief Bus traffic of one display, counted by the HAL
+ */
+typedef struct {
+	uint32_t transactions;	/*!< bus transactions */
+	uint32_t cmd_bytes;		/*!< command bytes, without framing */
+	uint32_t data_bytes;	/*!< display data bytes, without framing */
+	uint32_t errors;		/*!< failed or refused transfers */
+	uint32_t blocked_us;	/*!< time spent in blocking calls and waits */
+} ssd1306_hal_stats_t;
+
 /*!
  * \brief Initialize display interface
+ * \param[in] hal	display interface
  * \returns 0 if OK, -1 on initialization error
  */
-int8_t ssd1306_hal_init(void);
+int8_t ssd1306_hal_init(ssd1306_hal_t* hal);
 
 /*!
  * \brief Send a command to the display controller
+ * \param[in] hal	display interface
  * \param[in] cmd	byte to send
  * \returns 0 if OK, -1 on IO error
  */
-int8_t ssd1306_hal_send_command(uint8_t cmd);
+int8_t ssd1306_hal_send_command(ssd1306_hal_t* hal, uint8_t cmd);
+
+/*!
+ * \brief Send a stream of commands (including their arguments) to the display controller
+ * \param[in] hal	display interface
+ * \param[in] cmds	pointer to command bytes
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_hal_send_commands(ssd1306_hal_t* hal, const uint8_t* cmds, uint32_t len);
 
 /*!
  * \brief Send data to the display controller
+ * \param[in] hal	display interface
  * \param[in] data	pointer to buffer
  * \param[in] len amount of bytes to send
  * \returns 0 if OK, -1 on IO error
  */
-int8_t ssd1306_hal_send_data(uint8_t* data, uint32_t len);
+int8_t ssd1306_hal_send_data(ssd1306_hal_t* hal, uint8_t* data, uint32_t len);
+
+/*!
+ * \brief Start sending a stream of commands without blocking
+ * \param[in] hal	display interface
+ * \param[in] cmds	pointer to command bytes, must stay valid until done_cb is called
+ * \param[in] len amount of bytes to send
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+int8_t ssd1306_hal_send_commands_async(ssd1306_hal_t* hal, uint8_t* cmds, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx);
+
+/*!
+ * \brief Start sending data without blocking
+ * \param[in] hal	display interface
+ * \param[in] data	pointer to buffer, must stay valid until done_cb is called
+ * \param[in] len amount of bytes to send
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+int8_t ssd1306_hal_send_data_async(ssd1306_hal_t* hal, uint8_t* data, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx);
+
+/*!
+ * \brief Check for a running asynchronous transfer on the bus of a display
+ * \param[in] hal	display interface
+ * \returns 1 if a transfer is running, otherwise 0
+ */
+uint8_t ssd1306_hal_busy(ssd1306_hal_t* hal);
+
+/*!
+ * \brief Wait for a running asynchronous transfer on the bus of a display
+ * \param[in] hal	display interface
+ * \returns 0 if OK, -1 if the transfer had to be aborted
+ * \details The wait is bounded. A transfer that does not finish in time is
+ *          aborted and its done_cb is called with -1.
+ */
+int8_t ssd1306_hal_wait(ssd1306_hal_t* hal);
+
+/*!
+ * \brief Get the traffic counters of a display
+ * \param[in] hal	display interface
+ * \returns pointer to the counters, they may be reset by writing 0
+ */
+ssd1306_hal_stats_t* ssd1306_hal_get_stats(ssd1306_hal_t* hal);
+
+/*!
+ * \brief Free running timestamp for measuring durations
+ * \returns timestamp in HAL specific ticks, see ssd1306_hal_elapsed_us()
+ */
+uint32_t ssd1306_hal_timestamp(void);
+
+/*!
+ * \brief Time since a timestamp
+ * \param[in] since	timestamp from ssd1306_hal_timestamp()
+ * \returns microseconds, correct across one wrap of the tick counter
+ */
+uint32_t ssd1306_hal_elapsed_us(uint32_t since);
 
 /*!
  * \brief Blocking millisecond delay
@@ -19,92 +19,243 @@
 */
 
 /*!
- * \file ssd1306_hal.h
+ * \file ssd1306_hal_i2c.c
  * \brief I2C Hardware abstraction layer for the SSD1306 display driver
  */
 
 #include <ssd1306/ssd1306_hal.h>
+#include <ssd1306/ssd1306_hal_i2c.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/i2c.h>
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
 
-#define SSD1306_I2C_INSTANCE		I2C1
-#define SSD1306_I2C_PERIPH_CLK		RCC_I2C1
-#define SSD1306_I2C_GPIO_CLK		RCC_GPIOB
-#define SSD1306_I2C_GPIO_PORT		GPIOB
-#define SSD1306_I2C_GPIO_SCL_PIN	GPIO6
-#define SSD1306_I2C_GPIO_SDA_PIN	GPIO7
-#define SSD1306_I2C_GPIO_AF			GPIO_AF4
+#define SSD1306_CTRL_COMMAND		0x00	/* control byte: command stream follows */
+#define SSD1306_CTRL_DATA			0x40	/* control byte: display data follows */
 
-#define SSD1306_I2C_ADDR			0x3C  // left shifted: 0xF0  // pcb: 0x78
+#define SSD1306_I2C_TIMEOUT			10000	/* polling loops per bus event, ~0.5 ms */
+#define SSD1306_I2C_IDLE_TIMEOUT	1000000	/* polling loops for an asynchronous transfer,
+											   ~50 ms, more than a whole frame takes */
+#define SSD1306_I2C_RECOVERY_CLOCKS	9
+#define SSD1306_I2C_RECOVERY_DELAY	100		/* loops per half SCL period, below 100 kHz */
+
+#define SSD1306_I2C_ERR_NACK		-1		/* slave did not acknowledge */
+#define SSD1306_I2C_ERR_BUS			-2		/* timeout or bus error, bus needs recovery */
+
+static int8_t ssd1306_hal_send(ssd1306_hal_t* hal, uint8_t control, const uint8_t* buf,
+		uint32_t len);
+static int8_t ssd1306_hal_send_async(ssd1306_hal_t* hal, uint8_t control, uint8_t* buf,
+		uint32_t len, ssd1306_hal_done_cb_t done_cb, void* ctx);
+static void ssd1306_hal_async_finish(ssd1306_i2c_bus_t* bus, int8_t result);
+static int8_t ssd1306_hal_wait_idle(ssd1306_i2c_bus_t* bus);
+static int8_t ssd1306_hal_wait_event(ssd1306_i2c_bus_t* bus, uint32_t flag);
+static int8_t ssd1306_hal_transfer(ssd1306_i2c_bus_t* bus, uint8_t address, uint8_t control,
+		const uint8_t* buf, uint32_t len);
+static void ssd1306_hal_bus_setup(ssd1306_i2c_bus_t* bus);
+static void ssd1306_hal_bus_recover(ssd1306_i2c_bus_t* bus);
+static int8_t ssd1306_hal_backoff(ssd1306_hal_t* hal);
+static int8_t ssd1306_hal_account(ssd1306_hal_t* hal, int8_t result);
+static void ssd1306_hal_count(ssd1306_hal_t* hal, uint8_t control, uint32_t len);
+static void ssd1306_hal_ev_handler(ssd1306_i2c_bus_t* bus);
+static void ssd1306_hal_er_handler(ssd1306_i2c_bus_t* bus);
+
+ssd1306_i2c_bus_t ssd1306_i2c_bus1 = {
+	.i2c = I2C1,
+	.periph_clk = RCC_I2C1,
+	.gpio_port = GPIOB,
+	.gpio_clk = RCC_GPIOB,
+	.scl_pin = GPIO6,
+	.sda_pin = GPIO7,
+	.gpio_af = GPIO_AF4,
+	.ev_irq = NVIC_I2C1_EV_IRQ,
+	.er_irq = NVIC_I2C1_ER_IRQ,
+	.dma = DMA1,
+	.dma_clk = RCC_DMA1,
+	.dma_stream = DMA_STREAM6,			/* I2C1_TX */
+	.dma_channel = DMA_SxCR_CHSEL_1,
+};
+
+ssd1306_i2c_bus_t ssd1306_i2c_bus2 = {
+	.i2c = I2C2,
+	.periph_clk = RCC_I2C2,
+	.gpio_port = GPIOB,
+	.gpio_clk = RCC_GPIOB,
+	.scl_pin = GPIO10,
+	.sda_pin = GPIO11,
+	.gpio_af = GPIO_AF4,
+	.ev_irq = NVIC_I2C2_EV_IRQ,
+	.er_irq = NVIC_I2C2_ER_IRQ,
+	.dma = DMA1,
+	.dma_clk = RCC_DMA1,
+	.dma_stream = DMA_STREAM7,			/* I2C2_TX */
+	.dma_channel = DMA_SxCR_CHSEL_7,
+};
 
 void (*delay_ms_cb)(uint32_t delay_ms);
 /*!
  * \brief Initialize display interface (i2c)
+ * \param[in] hal	display interface
  * \returns 0 if OK, -1 on initialization error
+ * \details The bus is set up by the first display using it
  */
-int8_t ssd1306_hal_init(void)
+int8_t ssd1306_hal_init(ssd1306_hal_t* hal)
 {
-	rcc_periph_clock_enable(SSD1306_I2C_PERIPH_CLK);
-	rcc_periph_clock_enable(SSD1306_I2C_GPIO_CLK);
+	ssd1306_i2c_bus_t* bus = hal->bus;
 
-	i2c_reset(SSD1306_I2C_INSTANCE);
+	if (bus->initialized == 1)
+	{
+		return (0);
+	}
 
-	/* Setup GPIO pins for I2C peripheral */
-	gpio_mode_setup(SSD1306_I2C_GPIO_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE,
-			SSD1306_I2C_GPIO_SCL_PIN | SSD1306_I2C_GPIO_SDA_PIN);
-	gpio_set_af(SSD1306_I2C_GPIO_PORT, SSD1306_I2C_GPIO_AF,
-			SSD1306_I2C_GPIO_SCL_PIN | SSD1306_I2C_GPIO_SDA_PIN);
+	/* cycle counter for ssd1306_hal_timestamp() */
+	dwt_enable_cycle_counter();
+
+	rcc_periph_clock_enable(bus->periph_clk);
+	rcc_periph_clock_enable(bus->gpio_clk);
 
-	i2c_set_speed(SSD1306_I2C_INSTANCE, i2c_speed_fm_400k, rcc_apb1_frequency/1000000);
+	ssd1306_hal_bus_setup(bus);
 
-	i2c_peripheral_enable(SSD1306_I2C_INSTANCE);
+	/* a slave may still hold SDA low from a transfer cut by a reset */
+	if (gpio_get(bus->gpio_port, bus->sda_pin) == 0)
+	{
+		ssd1306_hal_bus_recover(bus);
+	}
 
+	/* DMA and interrupts for asynchronous transfers */
+	rcc_periph_clock_enable(bus->dma_clk);
+	nvic_set_priority(bus->ev_irq, 2 << 4);
+	nvic_set_priority(bus->er_irq, 2 << 4);
+	nvic_enable_irq(bus->ev_irq);
+	nvic_enable_irq(bus->er_irq);
 
+	bus->busy = 0;
+	bus->initialized = 1;
 
 	return (0);
 }
 
 /*!
  * \brief Send a command to the display controller
+ * \param[in] hal	display interface
  * \param[in] cmd	byte to send
  * \returns 0 if OK, -1 on IO error
  */
-int8_t ssd1306_hal_send_command(uint8_t cmd)
+int8_t ssd1306_hal_send_command(ssd1306_hal_t* hal, uint8_t cmd)
 {
-	uint8_t tx_data[2];
-
-	tx_data[0] = 0x00;	/* write to mem Addr 0 */
-	tx_data[1] = cmd;	/* data byte */
-
-	/* send data */
-	i2c_transfer7(SSD1306_I2C_INSTANCE, SSD1306_I2C_ADDR, tx_data, 2, NULL, 0);
-
-	return (0);
+	return (ssd1306_hal_send(hal, SSD1306_CTRL_COMMAND, &cmd, 1));
+}
+/*!
+ * \brief Send a stream of commands (including their arguments) to the display controller
+ * \param[in] hal	display interface
+ * \param[in] cmds	pointer to command bytes
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error
+ * \details One transaction: a single control byte with Co = 0 makes the
+ *          controller treat all following bytes as commands.
+ */
+int8_t ssd1306_hal_send_commands(ssd1306_hal_t* hal, const uint8_t* cmds, uint32_t len)
+{
+	return (ssd1306_hal_send(hal, SSD1306_CTRL_COMMAND, cmds, len));
 }
+
 /*!
  * \brief Send data to the display controller
+ * \param[in] hal	display interface
  * \param[in] data	pointer to buffer
  * \param[in] len amount of bytes to send
  * \returns 0 if OK, -1 on IO error
  */
-int8_t ssd1306_hal_send_data(uint8_t* data, uint32_t len)
+int8_t ssd1306_hal_send_data(ssd1306_hal_t* hal, uint8_t* data, uint32_t len)
 {
-	uint8_t tx_data[len+1];
-	uint32_t i;
+	return (ssd1306_hal_send(hal, SSD1306_CTRL_DATA, data, len));
+}
 
-	tx_data[0] = 0x40;  /* memory address to write to */
+/*!
+ * \brief Start sending a stream of commands without blocking
+ * \param[in] hal	display interface
+ * \param[in] cmds	pointer to command bytes, must stay valid until done_cb is called
+ * \param[in] len amount of bytes to send
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+int8_t ssd1306_hal_send_commands_async(ssd1306_hal_t* hal, uint8_t* cmds, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	return (ssd1306_hal_send_async(hal, SSD1306_CTRL_COMMAND, cmds, len, done_cb, ctx));
+}
 
-	for (i = 0; i < len; i++) {
-		tx_data[i+1] = data[i];
-	}
+/*!
+ * \brief Start sending data without blocking
+ * \param[in] hal	display interface
+ * \param[in] data	pointer to buffer, must stay valid until done_cb is called
+ * \param[in] len amount of bytes to send
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+int8_t ssd1306_hal_send_data_async(ssd1306_hal_t* hal, uint8_t* data, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	return (ssd1306_hal_send_async(hal, SSD1306_CTRL_DATA, data, len, done_cb, ctx));
+}
 
-	/* send data */
-	i2c_transfer7(SSD1306_I2C_INSTANCE, SSD1306_I2C_ADDR, tx_data, len+1, NULL, 0);
+/*!
+ * \brief Check for a running asynchronous transfer on the bus of a display
+ * \param[in] hal	display interface
+ * \returns 1 if a transfer is running, otherwise 0
+ */
+uint8_t ssd1306_hal_busy(ssd1306_hal_t* hal)
+{
+	return (hal->bus->busy);
+}
 
-	return (0);
+/*!
+ * \brief Wait for a running asynchronous transfer on the bus of a display
+ * \param[in] hal	display interface
+ * \returns 0 if OK, -1 if the transfer had to be aborted
+ */
+int8_t ssd1306_hal_wait(ssd1306_hal_t* hal)
+{
+	uint32_t start = ssd1306_hal_timestamp();
+	int8_t result;
+
+	result = ssd1306_hal_wait_idle(hal->bus);
+	hal->stats.blocked_us += ssd1306_hal_elapsed_us(start);
+
+	return (result);
 }
 
+/*!
+ * \brief Get the traffic counters of a display
+ * \param[in] hal	display interface
+ * \returns pointer to the counters
+ */
+ssd1306_hal_stats_t* ssd1306_hal_get_stats(ssd1306_hal_t* hal)
+{
+	return (&hal->stats);
+}
+
+/*!
+ * \brief Free running timestamp for measuring durations
+ * \returns CPU cycles
+ */
+uint32_t ssd1306_hal_timestamp(void)
+{
+	return (dwt_read_cycle_counter());
+}
+
+/*!
+ * \brief Time since a timestamp
+ * \param[in] since	timestamp from ssd1306_hal_timestamp()
+ * \returns microseconds, up to ~25 s at 168 MHz
+ */
+uint32_t ssd1306_hal_elapsed_us(uint32_t since)
+{
+	return ((dwt_read_cycle_counter() - since) / (rcc_ahb_frequency / 1000000));
+}
 
 /*!
  * \brief Blocking millisecond delay
@@ -118,3 +269,474 @@ void ssd1306_hal_delay_ms(uint32_t delay_ms)
 		delay_ms_cb(delay_ms);
 	}
 }
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Blocking transfer of a control byte followed by a buffer
+ * \param[in] hal	display interface
+ * \param[in] control	control byte sent in front of the buffer
+ * \param[in] buf	pointer to buffer
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error or while backing off
+ */
+static int8_t ssd1306_hal_send(ssd1306_hal_t* hal, uint8_t control, const uint8_t* buf,
+		uint32_t len)
+{
+	uint32_t start;
+	int8_t result;
+
+	if (ssd1306_hal_backoff(hal) != 0)
+	{
+		hal->stats.errors++;
+		return (-1);
+	}
+
+	start = ssd1306_hal_timestamp();
+
+	/* blocking transfers must not interleave with an asynchronous one */
+	result = ssd1306_hal_wait_idle(hal->bus);
+	if (result == 0)
+	{
+		ssd1306_hal_count(hal, control, len);
+		result = ssd1306_hal_transfer(hal->bus, hal->address, control, buf, len);
+	}
+	else
+	{
+		result = SSD1306_I2C_ERR_BUS;
+	}
+
+	hal->stats.blocked_us += ssd1306_hal_elapsed_us(start);
+
+	return (ssd1306_hal_account(hal, result));
+}
+
+/*!
+ * \brief Start an interrupt/DMA driven transfer
+ * \param[in] hal	display interface
+ * \param[in] control	control byte sent in front of the buffer
+ * \param[in] buf	pointer to buffer
+ * \param[in] len amount of bytes to send (1-65535)
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ * \details The address phase is handled in the event interrupt, the control
+ *          byte is written by the CPU and the DMA feeds the rest of the buffer.
+ */
+static int8_t ssd1306_hal_send_async(ssd1306_hal_t* hal, uint8_t control, uint8_t* buf,
+		uint32_t len, ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	ssd1306_i2c_bus_t* bus = hal->bus;
+
+	if (bus->busy == 1 || len == 0 || len > 0xFFFF)
+	{
+		return (-1);
+	}
+
+	if (ssd1306_hal_backoff(hal) != 0)
+	{
+		hal->stats.errors++;
+		return (-1);
+	}
+
+	/* a start condition on a busy bus would never complete */
+	if ((I2C_SR2(bus->i2c) & I2C_SR2_BUSY) != 0)
+	{
+		ssd1306_hal_bus_recover(bus);
+		return (ssd1306_hal_account(hal, SSD1306_I2C_ERR_BUS));
+	}
+
+	ssd1306_hal_count(hal, control, len);
+
+	bus->busy = 1;
+	bus->hal = hal;
+	bus->control = control;
+	bus->done_cb = done_cb;
+	bus->done_ctx = ctx;
+
+	dma_stream_reset(bus->dma, bus->dma_stream);
+	dma_channel_select(bus->dma, bus->dma_stream, bus->dma_channel);
+	dma_set_transfer_mode(bus->dma, bus->dma_stream, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+	dma_set_peripheral_address(bus->dma, bus->dma_stream, (uint32_t)&I2C_DR(bus->i2c));
+	dma_set_memory_address(bus->dma, bus->dma_stream, (uint32_t)buf);
+	dma_set_number_of_data(bus->dma, bus->dma_stream, (uint16_t)len);
+	dma_enable_memory_increment_mode(bus->dma, bus->dma_stream);
+	dma_set_peripheral_size(bus->dma, bus->dma_stream, DMA_SxCR_PSIZE_8BIT);
+	dma_set_memory_size(bus->dma, bus->dma_stream, DMA_SxCR_MSIZE_8BIT);
+	dma_set_priority(bus->dma, bus->dma_stream, DMA_SxCR_PL_MEDIUM);
+	dma_enable_stream(bus->dma, bus->dma_stream);
+
+	i2c_enable_interrupt(bus->i2c, I2C_CR2_ITEVTEN | I2C_CR2_ITERREN);
+	i2c_send_start(bus->i2c);
+
+	return (0);
+}
+
+/*!
+ * \brief End the running asynchronous transfer and notify the driver
+ * \param[in] bus	bus the transfer ran on
+ * \param[in] result 0 if OK, -1 on IO error
+ */
+static void ssd1306_hal_async_finish(ssd1306_i2c_bus_t* bus, int8_t result)
+{
+	ssd1306_hal_done_cb_t done_cb = bus->done_cb;
+
+	i2c_disable_interrupt(bus->i2c, I2C_CR2_ITEVTEN | I2C_CR2_ITERREN);
+	i2c_disable_dma(bus->i2c);
+	dma_disable_stream(bus->dma, bus->dma_stream);
+
+	bus->busy = 0;
+
+	(void)ssd1306_hal_account(bus->hal, result);
+
+	if (done_cb != NULL)
+	{
+		done_cb(bus->done_ctx, result);
+	}
+}
+
+/*!
+ * \brief Wait for a running asynchronous transfer to finish
+ * \param[in] bus	bus the transfer runs on
+ * \returns 0 if OK, -1 if the transfer had to be aborted
+ * \details A transfer that does not finish in time is aborted, its done_cb
+ *          gets -1, and the bus is recovered.
+ */
+static int8_t ssd1306_hal_wait_idle(ssd1306_i2c_bus_t* bus)
+{
+	uint32_t timeout = SSD1306_I2C_IDLE_TIMEOUT;
+
+	while ((bus->busy == 1) && (timeout--));
+
+	if (bus->busy == 0)
+	{
+		return (0);
+	}
+
+	ssd1306_hal_async_finish(bus, -1);
+	ssd1306_hal_bus_recover(bus);
+
+	return (-1);
+}
+
+/*!
+ * \brief Wait for a flag in SR1 during a blocking transfer
+ * \param[in] bus	bus the transfer runs on
+ * \param[in] flag	SR1 flag to wait for
+ * \returns 0 if the flag is set, SSD1306_I2C_ERR_NACK or SSD1306_I2C_ERR_BUS
+ */
+static int8_t ssd1306_hal_wait_event(ssd1306_i2c_bus_t* bus, uint32_t flag)
+{
+	uint32_t timeout = SSD1306_I2C_TIMEOUT;
+	uint32_t sr1;
+
+	do
+	{
+		sr1 = I2C_SR1(bus->i2c);
+
+		if ((sr1 & I2C_SR1_AF) != 0)
+		{
+			I2C_SR1(bus->i2c) = sr1 & ~I2C_SR1_AF;
+			return (SSD1306_I2C_ERR_NACK);
+		}
+		if ((sr1 & (I2C_SR1_ARLO | I2C_SR1_BERR)) != 0)
+		{
+			I2C_SR1(bus->i2c) = sr1 & ~(I2C_SR1_ARLO | I2C_SR1_BERR);
+			return (SSD1306_I2C_ERR_BUS);
+		}
+		if ((sr1 & flag) != 0)
+		{
+			return (0);
+		}
+	} while (timeout--);
+
+	return (SSD1306_I2C_ERR_BUS);
+}
+
+/*!
+ * \brief Write a control byte and a buffer to a slave, polling every step
+ * \param[in] bus	bus to use
+ * \param[in] address	7 bit slave address
+ * \param[in] control	control byte sent in front of the buffer
+ * \param[in] buf	pointer to buffer
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, SSD1306_I2C_ERR_NACK or SSD1306_I2C_ERR_BUS
+ * \details Replaces i2c_transfer7(), which waits for every flag forever. The
+ *          buffer is sent in place, no copy with the control byte is needed.
+ */
+static int8_t ssd1306_hal_transfer(ssd1306_i2c_bus_t* bus, uint8_t address, uint8_t control,
+		const uint8_t* buf, uint32_t len)
+{
+	uint32_t timeout = SSD1306_I2C_TIMEOUT;
+	uint32_t i;
+	int8_t result;
+
+	while (((I2C_SR2(bus->i2c) & I2C_SR2_BUSY) != 0) && (timeout--));
+	if ((I2C_SR2(bus->i2c) & I2C_SR2_BUSY) != 0)
+	{
+		ssd1306_hal_bus_recover(bus);
+		return (SSD1306_I2C_ERR_BUS);
+	}
+
+	i2c_send_start(bus->i2c);
+	result = ssd1306_hal_wait_event(bus, I2C_SR1_SB);
+
+	if (result == 0)
+	{
+		i2c_send_7bit_address(bus->i2c, address, I2C_WRITE);
+		result = ssd1306_hal_wait_event(bus, I2C_SR1_ADDR);
+	}
+
+	if (result == 0)
+	{
+		/* reading SR2 after SR1 clears ADDR */
+		(void)I2C_SR2(bus->i2c);
+
+		i2c_send_data(bus->i2c, control);
+
+		for (i = 0; (i < len) && (result == 0); i++)
+		{
+			result = ssd1306_hal_wait_event(bus, I2C_SR1_TxE);
+			if (result == 0)
+			{
+				i2c_send_data(bus->i2c, buf[i]);
+			}
+		}
+	}
+
+	if (result == 0)
+	{
+		result = ssd1306_hal_wait_event(bus, I2C_SR1_BTF);
+	}
+
+	i2c_send_stop(bus->i2c);
+
+	if (result == SSD1306_I2C_ERR_BUS)
+	{
+		ssd1306_hal_bus_recover(bus);
+	}
+
+	return (result);
+}
+
+/*!
+ * \brief Configure pins and peripheral of a bus
+ * \param[in] bus	bus to set up
+ */
+static void ssd1306_hal_bus_setup(ssd1306_i2c_bus_t* bus)
+{
+	i2c_reset(bus->i2c);
+
+	/* Setup GPIO pins for I2C peripheral */
+	gpio_mode_setup(bus->gpio_port, GPIO_MODE_AF, GPIO_PUPD_NONE, bus->scl_pin | bus->sda_pin);
+	gpio_set_output_options(bus->gpio_port, GPIO_OTYPE_OD, GPIO_OSPEED_50MHZ,
+			bus->scl_pin | bus->sda_pin);
+	gpio_set_af(bus->gpio_port, bus->gpio_af, bus->scl_pin | bus->sda_pin);
+
+	i2c_set_speed(bus->i2c, i2c_speed_fm_400k, rcc_apb1_frequency/1000000);
+
+	i2c_peripheral_enable(bus->i2c);
+}
+
+/*!
+ * \brief Free a bus held by a slave and reset the peripheral
+ * \param[in] bus	bus to recover
+ * \details A slave that lost clocks in the middle of a byte keeps SDA low.
+ *          Up to 9 clocks on SCL let it shift out the rest of the byte, a STOP
+ *          condition then resets its state machine. The peripheral is reset
+ *          afterwards, it may still see the bus as busy.
+ */
+static void ssd1306_hal_bus_recover(ssd1306_i2c_bus_t* bus)
+{
+	volatile uint32_t d;
+	uint8_t i;
+
+	i2c_peripheral_disable(bus->i2c);
+
+	/* drive the lines as open drain GPIOs */
+	gpio_set(bus->gpio_port, bus->scl_pin | bus->sda_pin);
+	gpio_mode_setup(bus->gpio_port, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, bus->scl_pin | bus->sda_pin);
+	gpio_set_output_options(bus->gpio_port, GPIO_OTYPE_OD, GPIO_OSPEED_50MHZ,
+			bus->scl_pin | bus->sda_pin);
+
+	for (i = 0; i < SSD1306_I2C_RECOVERY_CLOCKS; i++)
+	{
+		if (gpio_get(bus->gpio_port, bus->sda_pin) != 0)
+		{
+			break;
+		}
+		gpio_clear(bus->gpio_port, bus->scl_pin);
+		for (d = 0; d < SSD1306_I2C_RECOVERY_DELAY; d++);
+		gpio_set(bus->gpio_port, bus->scl_pin);
+		for (d = 0; d < SSD1306_I2C_RECOVERY_DELAY; d++);
+	}
+
+	/* STOP: SDA rises while SCL is high */
+	gpio_clear(bus->gpio_port, bus->scl_pin);
+	for (d = 0; d < SSD1306_I2C_RECOVERY_DELAY; d++);
+	gpio_clear(bus->gpio_port, bus->sda_pin);
+	for (d = 0; d < SSD1306_I2C_RECOVERY_DELAY; d++);
+	gpio_set(bus->gpio_port, bus->scl_pin);
+	for (d = 0; d < SSD1306_I2C_RECOVERY_DELAY; d++);
+	gpio_set(bus->gpio_port, bus->sda_pin);
+	for (d = 0; d < SSD1306_I2C_RECOVERY_DELAY; d++);
+
+	ssd1306_hal_bus_setup(bus);
+}
+
+/*!
+ * \brief Check if a display is backing off after failed transfers
+ * \param[in] hal	display interface
+ * \returns 0 if the transfer may go ahead, -1 if it is refused
+ */
+static int8_t ssd1306_hal_backoff(ssd1306_hal_t* hal)
+{
+	if (hal->backoff > 0)
+	{
+		hal->backoff--;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Track the result of a transfer for the backoff
+ * \param[in] hal	display interface
+ * \param[in] result	result of the transfer
+ * \returns 0 if OK, -1 on error
+ * \details Every failure in a row doubles the number of refused transfers,
+ *          up to SSD1306_I2C_BACKOFF_MAX. One good transfer ends the backoff.
+ */
+static int8_t ssd1306_hal_account(ssd1306_hal_t* hal, int8_t result)
+{
+	if (result == 0)
+	{
+		hal->failures = 0;
+		return (0);
+	}
+
+	hal->stats.errors++;
+
+	if (hal->failures < 16)
+	{
+		hal->failures++;
+	}
+	hal->backoff = (uint16_t)(1u << (hal->failures - 1));
+	if (hal->backoff > SSD1306_I2C_BACKOFF_MAX)
+	{
+		hal->backoff = SSD1306_I2C_BACKOFF_MAX;
+	}
+
+	return (-1);
+}
+
+/*!
+ * \brief I2C event handling of an asynchronous transfer
+ * \details Walks through start condition, address and control byte. BTF is
+ *          only set after the DMA has written the last byte and the shift
+ *          register ran empty, so it marks the end of the transfer.
+ */
+static void ssd1306_hal_ev_handler(ssd1306_i2c_bus_t* bus)
+{
+	uint32_t sr1 = I2C_SR1(bus->i2c);
+
+	if ((sr1 & I2C_SR1_SB) != 0)
+	{
+		i2c_send_7bit_address(bus->i2c, bus->hal->address, I2C_WRITE);
+	}
+	else if ((sr1 & I2C_SR1_ADDR) != 0)
+	{
+		/* reading SR2 after SR1 clears ADDR */
+		(void)I2C_SR2(bus->i2c);
+
+		I2C_DR(bus->i2c) = bus->control;
+		i2c_enable_dma(bus->i2c);
+	}
+	else if ((sr1 & I2C_SR1_BTF) != 0)
+	{
+		if (dma_get_number_of_data(bus->dma, bus->dma_stream) == 0)
+		{
+			i2c_send_stop(bus->i2c);
+			ssd1306_hal_async_finish(bus, 0);
+		}
+	}
+}
+
+/*!
+ * \brief I2C error handling of an asynchronous transfer
+ * \details A NACK, lost arbitration or bus error aborts the transfer
+ */
+static void ssd1306_hal_er_handler(ssd1306_i2c_bus_t* bus)
+{
+	uint32_t sr1 = I2C_SR1(bus->i2c);
+
+	if ((sr1 & (I2C_SR1_AF | I2C_SR1_ARLO | I2C_SR1_BERR)) != 0)
+	{
+		I2C_SR1(bus->i2c) = sr1 & ~(I2C_SR1_AF | I2C_SR1_ARLO | I2C_SR1_BERR);
+
+		if ((sr1 & I2C_SR1_ARLO) == 0)
+		{
+			i2c_send_stop(bus->i2c);
+		}
+		ssd1306_hal_async_finish(bus, -1);
+	}
+}
+
+/*!
+ * \brief Count a transaction in the traffic counters
+ * \param[in] hal	display interface
+ * \param[in] control	control byte of the transaction
+ * \param[in] len amount of bytes following the control byte
+ */
+static void ssd1306_hal_count(ssd1306_hal_t* hal, uint8_t control, uint32_t len)
+{
+	hal->stats.transactions++;
+
+	if (control == SSD1306_CTRL_DATA)
+	{
+		hal->stats.data_bytes += len;
+	}
+	else
+	{
+		hal->stats.cmd_bytes += len;
+	}
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
+
+/*
+ * \brief I2C1 event interrupt service routine
+ */
+void i2c1_ev_isr(void)
+{
+	ssd1306_hal_ev_handler(&ssd1306_i2c_bus1);
+}
+
+/*
+ * \brief I2C1 error interrupt service routine
+ */
+void i2c1_er_isr(void)
+{
+	ssd1306_hal_er_handler(&ssd1306_i2c_bus1);
+}
+
+/*
+ * \brief I2C2 event interrupt service routine
+ */
+void i2c2_ev_isr(void)
+{
+	ssd1306_hal_ev_handler(&ssd1306_i2c_bus2);
+}
+
+/*
+ * \brief I2C2 error interrupt service routine
+ */
+void i2c2_er_isr(void)
+{
+	ssd1306_hal_er_handler(&ssd1306_i2c_bus2);
+}
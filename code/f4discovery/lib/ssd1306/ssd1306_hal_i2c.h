@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIB_SSD1306_SSD1306_HAL_I2C_H_
+#define LIB_SSD1306_SSD1306_HAL_I2C_H_
+
+#include <stdint.h>
+#include <libopencm3/stm32/rcc.h>
+#include <ssd1306/ssd1306_hal.h>
+
+/*!
+ * \file ssd1306_hal_i2c.h
+ * \brief I2C interface description for the SSD1306 display driver
+ * \details A bus object describes one I2C peripheral with its pins and DMA
+ *          stream and holds the state of the transfer running on it. Each
+ *          display gets an ssd1306_hal_t naming its bus and address:
+ *
+ *          static ssd1306_hal_t door_panel_hal = { .bus = &ssd1306_i2c_bus1, .address = SSD1306_I2C_ADDR_SECONDARY };
+ *
+ *          Every bus event is waited for with a timeout. A NACK or timeout
+ *          fails the transfer, a timeout also recovers the bus (9 SCL clocks,
+ *          STOP, peripheral reset). After a failure the display refuses the
+ *          next 1, 2, 4 .. SSD1306_I2C_BACKOFF_MAX transfers without touching
+ *          the bus, so a dead display costs a bounded share of CPU time.
+ */
+
+#define SSD1306_I2C_BACKOFF_MAX		256		/* transfers refused after repeated failures */
+
+#define SSD1306_I2C_ADDR_PRIMARY	0x3C	/* SA0 low,  left shifted: 0x78 */
+#define SSD1306_I2C_ADDR_SECONDARY	0x3D	/* SA0 high, left shifted: 0x7A */
+
+/*!
+ * \brief I2C bus used by one or more displays
+ */
+typedef struct {
+	/* configuration */
+	uint32_t i2c;					/*!< I2C peripheral */
+	enum rcc_periph_clken periph_clk;
+	uint32_t gpio_port;
+	enum rcc_periph_clken gpio_clk;
+	uint16_t scl_pin;
+	uint16_t sda_pin;
+	uint8_t gpio_af;
+	uint8_t ev_irq;
+	uint8_t er_irq;
+	uint32_t dma;					/*!< DMA controller with the I2C TX request */
+	enum rcc_periph_clken dma_clk;
+	uint8_t dma_stream;
+	uint32_t dma_channel;
+	/* state */
+	uint8_t initialized;
+	volatile uint8_t busy;			/*!< asynchronous transfer running */
+	struct ssd1306_hal* hal;		/*!< display of the running transfer */
+	uint8_t control;				/*!< control byte of the running transfer */
+	ssd1306_hal_done_cb_t done_cb;
+	void* done_ctx;
+} ssd1306_i2c_bus_t;
+
+/*!
+ * \brief Interface of one display on an I2C bus
+ */
+struct ssd1306_hal {
+	ssd1306_i2c_bus_t* bus;
+	uint8_t address;				/*!< 7 bit slave address */
+	uint8_t failures;				/*!< consecutive failed transfers */
+	uint16_t backoff;				/*!< transfers still to be refused */
+	ssd1306_hal_stats_t stats;
+};
+
+extern ssd1306_i2c_bus_t ssd1306_i2c_bus1;	/* I2C1, SCL PB6,  SDA PB7,  DMA1 stream 6 */
+extern ssd1306_i2c_bus_t ssd1306_i2c_bus2;	/* I2C2, SCL PB10, SDA PB11, DMA1 stream 7 */
+
+#endif /* LIB_SSD1306_SSD1306_HAL_I2C_H_ */
@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file ssd1306_hal_spi.c
+ * \brief 4-wire SPI Hardware abstraction layer for the SSD1306 display driver
+ * \details Commands and data are told apart by the D/C line (low: command,
+ *          high: data). Data transfers of more than a few bytes go through DMA.
+ */
+
+#include <stddef.h>
+#include <ssd1306/ssd1306_hal.h>
+#include <ssd1306/ssd1306_hal_spi.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
+
+#define SSD1306_SPI_INSTANCE		SPI2
+#define SSD1306_SPI_PERIPH_CLK		RCC_SPI2
+#define SSD1306_SPI_PERIPH_RST		RST_SPI2
+#define SSD1306_SPI_BAUDRATE		SPI_CR1_BAUDRATE_FPCLK_DIV_8	/* 42 MHz / 8 = 5.25 MHz, SSD1306 max. 10 MHz */
+#define SSD1306_SPI_GPIO_CLK		RCC_GPIOB
+#define SSD1306_SPI_GPIO_PORT		GPIOB
+#define SSD1306_SPI_GPIO_SCK_PIN	GPIO13
+#define SSD1306_SPI_GPIO_MOSI_PIN	GPIO15
+#define SSD1306_SPI_GPIO_AF			GPIO_AF5
+
+#define SSD1306_DMA					DMA1
+#define SSD1306_DMA_CLK				RCC_DMA1
+#define SSD1306_DMA_STREAM			DMA_STREAM4			/* SPI2_TX */
+#define SSD1306_DMA_CHANNEL			DMA_SxCR_CHSEL_0
+#define SSD1306_DMA_IRQ				NVIC_DMA1_STREAM4_IRQ
+
+#define SSD1306_DMA_MIN_LEN			8		/* below this, polling is cheaper than DMA setup */
+#define SSD1306_RESET_PULSE_LOOPS	1000	/* reset pulse, needs at least 3 us */
+#define SSD1306_IDLE_TIMEOUT		100000	/* polling loops for a DMA transfer, ~5 ms,
+											   a whole frame takes ~1.6 ms */
+
+static void ssd1306_hal_bus_init(void);
+static void ssd1306_hal_select(ssd1306_hal_t* hal, uint8_t is_data);
+static void ssd1306_hal_deselect(ssd1306_hal_t* hal);
+static void ssd1306_hal_send_polled(const uint8_t* buf, uint32_t len);
+static int8_t ssd1306_hal_send_async(ssd1306_hal_t* hal, uint8_t is_data, uint8_t* buf,
+		uint32_t len, ssd1306_hal_done_cb_t done_cb, void* ctx);
+static int8_t ssd1306_hal_wait_idle(void);
+static void ssd1306_hal_async_finish(int8_t result);
+static void ssd1306_hal_count(ssd1306_hal_t* hal, uint8_t is_data, uint32_t len);
+
+static uint8_t bus_initialized = 0;
+
+/* state of the running asynchronous transfer */
+static volatile uint8_t async_busy = 0;
+static ssd1306_hal_t* async_hal;		/* display selected for the transfer */
+static ssd1306_hal_done_cb_t async_done_cb;
+static void* async_done_ctx;
+
+void (*delay_ms_cb)(uint32_t delay_ms);
+/*!
+ * \brief Initialize display interface (spi)
+ * \param[in] hal	display interface
+ * \returns 0 if OK, -1 on initialization error
+ * \details The SPI bus is set up by the first display, every display gets
+ *          its control lines configured and a hardware reset.
+ */
+int8_t ssd1306_hal_init(ssd1306_hal_t* hal)
+{
+	volatile uint32_t i;
+
+	if (bus_initialized == 0)
+	{
+		/* cycle counter for ssd1306_hal_timestamp() */
+		dwt_enable_cycle_counter();
+		ssd1306_hal_bus_init();
+		bus_initialized = 1;
+	}
+
+	/* D/C, CS and RES are plain outputs */
+	gpio_set(hal->gpio_port, hal->cs_pin | hal->res_pin);
+	gpio_mode_setup(hal->gpio_port, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE,
+			hal->dc_pin | hal->cs_pin | hal->res_pin);
+
+	/* hardware reset of the controller */
+	gpio_clear(hal->gpio_port, hal->res_pin);
+	for (i = 0; i < SSD1306_RESET_PULSE_LOOPS; i++);
+	gpio_set(hal->gpio_port, hal->res_pin);
+	for (i = 0; i < SSD1306_RESET_PULSE_LOOPS; i++);
+
+	return (0);
+}
+
+/*!
+ * \brief Send a command to the display controller
+ * \param[in] hal	display interface
+ * \param[in] cmd	byte to send
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_hal_send_command(ssd1306_hal_t* hal, uint8_t cmd)
+{
+	return (ssd1306_hal_send_commands(hal, &cmd, 1));
+}
+
+/*!
+ * \brief Send a stream of commands (including their arguments) to the display controller
+ * \param[in] hal	display interface
+ * \param[in] cmds	pointer to command bytes
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_hal_send_commands(ssd1306_hal_t* hal, const uint8_t* cmds, uint32_t len)
+{
+	uint32_t start = ssd1306_hal_timestamp();
+
+	if (ssd1306_hal_wait_idle() != 0)
+	{
+		hal->stats.errors++;
+		hal->stats.blocked_us += ssd1306_hal_elapsed_us(start);
+		return (-1);
+	}
+
+	ssd1306_hal_count(hal, 0, len);
+	ssd1306_hal_select(hal, 0);
+	ssd1306_hal_send_polled(cmds, len);
+	ssd1306_hal_deselect(hal);
+
+	hal->stats.blocked_us += ssd1306_hal_elapsed_us(start);
+
+	return (0);
+}
+
+/*!
+ * \brief Send data to the display controller
+ * \param[in] hal	display interface
+ * \param[in] data	pointer to buffer
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error
+ * \details Long transfers (a framebuffer page) use the DMA and wait for it
+ */
+int8_t ssd1306_hal_send_data(ssd1306_hal_t* hal, uint8_t* data, uint32_t len)
+{
+	uint32_t start = ssd1306_hal_timestamp();
+	int8_t result = 0;
+
+	if (ssd1306_hal_wait_idle() != 0)
+	{
+		result = -1;
+	}
+	else if (len < SSD1306_DMA_MIN_LEN)
+	{
+		ssd1306_hal_count(hal, 1, len);
+		ssd1306_hal_select(hal, 1);
+		ssd1306_hal_send_polled(data, len);
+		ssd1306_hal_deselect(hal);
+	}
+	else if (ssd1306_hal_send_async(hal, 1, data, len, NULL, NULL) != 0)
+	{
+		result = -1;
+	}
+	else
+	{
+		result = ssd1306_hal_wait_idle();
+	}
+
+	if (result != 0)
+	{
+		hal->stats.errors++;
+	}
+	hal->stats.blocked_us += ssd1306_hal_elapsed_us(start);
+
+	return (result);
+}
+
+/*!
+ * \brief Start sending a stream of commands without blocking
+ * \param[in] hal	display interface
+ * \param[in] cmds	pointer to command bytes, must stay valid until done_cb is called
+ * \param[in] len amount of bytes to send
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+int8_t ssd1306_hal_send_commands_async(ssd1306_hal_t* hal, uint8_t* cmds, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	return (ssd1306_hal_send_async(hal, 0, cmds, len, done_cb, ctx));
+}
+
+/*!
+ * \brief Start sending data without blocking
+ * \param[in] hal	display interface
+ * \param[in] data	pointer to buffer, must stay valid until done_cb is called
+ * \param[in] len amount of bytes to send
+ * \param[in] done_cb called when the transfer has finished
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+int8_t ssd1306_hal_send_data_async(ssd1306_hal_t* hal, uint8_t* data, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	return (ssd1306_hal_send_async(hal, 1, data, len, done_cb, ctx));
+}
+
+/*!
+ * \brief Check for a running asynchronous transfer on the bus of a display
+ * \param[in] hal	display interface
+ * \returns 1 if a transfer is running, otherwise 0
+ * \details all displays share the SPI bus
+ */
+uint8_t ssd1306_hal_busy(ssd1306_hal_t* hal)
+{
+	(void)hal;
+
+	return (async_busy);
+}
+
+/*!
+ * \brief Wait for a running asynchronous transfer on the bus of a display
+ * \param[in] hal	display interface
+ * \returns 0 if OK, -1 if the transfer had to be aborted
+ */
+int8_t ssd1306_hal_wait(ssd1306_hal_t* hal)
+{
+	uint32_t start = ssd1306_hal_timestamp();
+	int8_t result;
+
+	result = ssd1306_hal_wait_idle();
+	hal->stats.blocked_us += ssd1306_hal_elapsed_us(start);
+
+	return (result);
+}
+
+/*!
+ * \brief Get the traffic counters of a display
+ * \param[in] hal	display interface
+ * \returns pointer to the counters
+ */
+ssd1306_hal_stats_t* ssd1306_hal_get_stats(ssd1306_hal_t* hal)
+{
+	return (&hal->stats);
+}
+
+/*!
+ * \brief Free running timestamp for measuring durations
+ * \returns CPU cycles
+ */
+uint32_t ssd1306_hal_timestamp(void)
+{
+	return (dwt_read_cycle_counter());
+}
+
+/*!
+ * \brief Time since a timestamp
+ * \param[in] since	timestamp from ssd1306_hal_timestamp()
+ * \returns microseconds, up to ~25 s at 168 MHz
+ */
+uint32_t ssd1306_hal_elapsed_us(uint32_t since)
+{
+	return ((dwt_read_cycle_counter() - since) / (rcc_ahb_frequency / 1000000));
+}
+
+/*!
+ * \brief Blocking millisecond delay
+ * \param[in] delay_ms	amount of milliseconds to wait
+ * \returns 0 if OK, -1 on IO error
+ */
+void ssd1306_hal_delay_ms(uint32_t delay_ms)
+{
+	if(delay_ms_cb != NULL)
+	{
+		delay_ms_cb(delay_ms);
+	}
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Setup of the SPI peripheral shared by all displays
+ */
+static void ssd1306_hal_bus_init(void)
+{
+	rcc_periph_clock_enable(SSD1306_SPI_PERIPH_CLK);
+	rcc_periph_clock_enable(SSD1306_SPI_GPIO_CLK);
+	rcc_periph_clock_enable(SSD1306_DMA_CLK);
+
+	rcc_periph_reset_pulse(SSD1306_SPI_PERIPH_RST);
+
+	/* Setup GPIO pins for SPI peripheral */
+	gpio_mode_setup(SSD1306_SPI_GPIO_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE,
+			SSD1306_SPI_GPIO_SCK_PIN | SSD1306_SPI_GPIO_MOSI_PIN);
+	gpio_set_output_options(SSD1306_SPI_GPIO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_50MHZ,
+			SSD1306_SPI_GPIO_SCK_PIN | SSD1306_SPI_GPIO_MOSI_PIN);
+	gpio_set_af(SSD1306_SPI_GPIO_PORT, SSD1306_SPI_GPIO_AF,
+			SSD1306_SPI_GPIO_SCK_PIN | SSD1306_SPI_GPIO_MOSI_PIN);
+
+	/* mode 0, MSB first, transmit only */
+	spi_init_master(SSD1306_SPI_INSTANCE, SSD1306_SPI_BAUDRATE,
+			SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE, SPI_CR1_CPHA_CLK_TRANSITION_1,
+			SPI_CR1_DFF_8BIT, SPI_CR1_MSBFIRST);
+	spi_set_bidirectional_transmit_only_mode(SSD1306_SPI_INSTANCE);
+	spi_enable_software_slave_management(SSD1306_SPI_INSTANCE);
+	spi_set_nss_high(SSD1306_SPI_INSTANCE);
+	spi_enable(SSD1306_SPI_INSTANCE);
+
+	nvic_set_priority(SSD1306_DMA_IRQ, 2 << 4);
+	nvic_enable_irq(SSD1306_DMA_IRQ);
+}
+
+/*!
+ * \brief Select the controller for a command or a data transfer
+ * \param[in] hal	display interface
+ * \param[in] is_data 1: display data, 0: commands
+ */
+static void ssd1306_hal_select(ssd1306_hal_t* hal, uint8_t is_data)
+{
+	if (is_data == 1)
+	{
+		gpio_set(hal->gpio_port, hal->dc_pin);
+	}
+	else
+	{
+		gpio_clear(hal->gpio_port, hal->dc_pin);
+	}
+
+	gpio_clear(hal->gpio_port, hal->cs_pin);
+}
+
+/*!
+ * \brief Release the controller once the last byte has left the shift register
+ * \param[in] hal	display interface
+ */
+static void ssd1306_hal_deselect(ssd1306_hal_t* hal)
+{
+	while ((SPI_SR(SSD1306_SPI_INSTANCE) & SPI_SR_TXE) == 0);
+	while ((SPI_SR(SSD1306_SPI_INSTANCE) & SPI_SR_BSY) != 0);
+
+	gpio_set(hal->gpio_port, hal->cs_pin);
+}
+
+/*!
+ * \brief Send bytes by polling the transmit buffer
+ */
+static void ssd1306_hal_send_polled(const uint8_t* buf, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		spi_send(SSD1306_SPI_INSTANCE, buf[i]);
+	}
+}
+
+/*!
+ * \brief Start a DMA driven transfer
+ * \param[in] hal	display interface
+ * \param[in] is_data 1: display data, 0: commands
+ * \param[in] buf	pointer to buffer
+ * \param[in] len amount of bytes to send (1-65535)
+ * \param[in] done_cb called when the transfer has finished, may be NULL
+ * \param[in] ctx passed to done_cb
+ * \returns 0 if the transfer was started, -1 if the bus is busy
+ */
+static int8_t ssd1306_hal_send_async(ssd1306_hal_t* hal, uint8_t is_data, uint8_t* buf,
+		uint32_t len, ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	if (async_busy == 1 || len == 0 || len > 0xFFFF)
+	{
+		return (-1);
+	}
+
+	ssd1306_hal_count(hal, is_data, len);
+
+	async_busy = 1;
+	async_hal = hal;
+	async_done_cb = done_cb;
+	async_done_ctx = ctx;
+
+	ssd1306_hal_select(hal, is_data);
+
+	dma_stream_reset(SSD1306_DMA, SSD1306_DMA_STREAM);
+	dma_channel_select(SSD1306_DMA, SSD1306_DMA_STREAM, SSD1306_DMA_CHANNEL);
+	dma_set_transfer_mode(SSD1306_DMA, SSD1306_DMA_STREAM, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+	dma_set_peripheral_address(SSD1306_DMA, SSD1306_DMA_STREAM, (uint32_t)&SPI_DR(SSD1306_SPI_INSTANCE));
+	dma_set_memory_address(SSD1306_DMA, SSD1306_DMA_STREAM, (uint32_t)buf);
+	dma_set_number_of_data(SSD1306_DMA, SSD1306_DMA_STREAM, (uint16_t)len);
+	dma_enable_memory_increment_mode(SSD1306_DMA, SSD1306_DMA_STREAM);
+	dma_set_peripheral_size(SSD1306_DMA, SSD1306_DMA_STREAM, DMA_SxCR_PSIZE_8BIT);
+	dma_set_memory_size(SSD1306_DMA, SSD1306_DMA_STREAM, DMA_SxCR_MSIZE_8BIT);
+	dma_set_priority(SSD1306_DMA, SSD1306_DMA_STREAM, DMA_SxCR_PL_MEDIUM);
+	dma_enable_transfer_complete_interrupt(SSD1306_DMA, SSD1306_DMA_STREAM);
+	dma_enable_stream(SSD1306_DMA, SSD1306_DMA_STREAM);
+
+	spi_enable_tx_dma(SSD1306_SPI_INSTANCE);
+
+	return (0);
+}
+
+/*!
+ * \brief Wait for a running asynchronous transfer to finish
+ * \returns 0 if OK, -1 if the transfer had to be aborted
+ * \details SPI has no handshake, a transfer only hangs if the DMA stalls. It is
+ *          aborted after a timeout and its done_cb gets -1.
+ */
+static int8_t ssd1306_hal_wait_idle(void)
+{
+	uint32_t timeout = SSD1306_IDLE_TIMEOUT;
+
+	while ((async_busy == 1) && (timeout--));
+
+	if (async_busy == 0)
+	{
+		return (0);
+	}
+
+	ssd1306_hal_async_finish(-1);
+
+	return (-1);
+}
+
+/*!
+ * \brief End the running asynchronous transfer and notify the driver
+ * \param[in] result 0 if OK, -1 on IO error
+ */
+static void ssd1306_hal_async_finish(int8_t result)
+{
+	ssd1306_hal_done_cb_t done_cb = async_done_cb;
+
+	spi_disable_tx_dma(SSD1306_SPI_INSTANCE);
+	dma_disable_stream(SSD1306_DMA, SSD1306_DMA_STREAM);
+	ssd1306_hal_deselect(async_hal);
+
+	async_busy = 0;
+
+	if (result != 0)
+	{
+		async_hal->stats.errors++;
+	}
+
+	if (done_cb != NULL)
+	{
+		done_cb(async_done_ctx, result);
+	}
+}
+
+/*!
+ * \brief Count a transaction in the traffic counters
+ * \param[in] hal	display interface
+ * \param[in] is_data 1: display data, 0: commands
+ * \param[in] len amount of bytes
+ */
+static void ssd1306_hal_count(ssd1306_hal_t* hal, uint8_t is_data, uint32_t len)
+{
+	hal->stats.transactions++;
+
+	if (is_data == 1)
+	{
+		hal->stats.data_bytes += len;
+	}
+	else
+	{
+		hal->stats.cmd_bytes += len;
+	}
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
+
+/*
+ * \brief DMA interrupt service routine (SPI transmit complete)
+ * \details Transfer complete means the last byte was written to the SPI data
+ *          register, chip select is released once it has been shifted out.
+ */
+void dma1_stream4_isr(void)
+{
+	if (dma_get_interrupt_flag(SSD1306_DMA, SSD1306_DMA_STREAM, DMA_TCIF))
+	{
+		dma_clear_interrupt_flags(SSD1306_DMA, SSD1306_DMA_STREAM, DMA_TCIF);
+
+		ssd1306_hal_async_finish(0);
+	}
+}
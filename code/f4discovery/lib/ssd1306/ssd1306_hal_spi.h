@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIB_SSD1306_SSD1306_HAL_SPI_H_
+#define LIB_SSD1306_SSD1306_HAL_SPI_H_
+
+#include <stdint.h>
+#include <ssd1306/ssd1306_hal.h>
+
+/*!
+ * \file ssd1306_hal_spi.h
+ * \brief 4-wire SPI interface description for the SSD1306 display driver
+ * \details All displays share SCK and MOSI of SPI2 (PB13, PB15). Each one
+ *          has its own chip select, D/C and reset line:
+ *
+ *          static ssd1306_hal_t door_panel_hal = { .gpio_port = GPIOB, .dc_pin = GPIO14, .cs_pin = GPIO10, .res_pin = GPIO9 };
+ */
+
+/*!
+ * \brief Interface of one display on the SPI bus
+ */
+struct ssd1306_hal {
+	uint32_t gpio_port;				/*!< port of the control lines */
+	uint16_t dc_pin;				/*!< D/C: low = command, high = data */
+	uint16_t cs_pin;
+	uint16_t res_pin;
+	ssd1306_hal_stats_t stats;
+};
+
+#endif /* LIB_SSD1306_SSD1306_HAL_SPI_H_ */
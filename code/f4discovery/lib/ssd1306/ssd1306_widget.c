@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <ssd1306/ssd1306_widget.h>
+
+static void ssd1306_widget_setup(ssd1306_widget_t* widget, ssd1306_widget_type_t type,
+		uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+static void ssd1306_widget_format(ssd1306_widget_t* widget, int32_t value);
+static uint8_t ssd1306_widget_draw_text(ssd1306_t* dev, ssd1306_widget_t* widget);
+static uint8_t ssd1306_widget_draw_bar(ssd1306_t* dev, ssd1306_widget_t* widget);
+static uint8_t ssd1306_widget_draw_icon(ssd1306_t* dev, ssd1306_widget_t* widget);
+
+
+/*!
+ * \brief Set up a text label
+ * \param[in] widget - widget to set up
+ * \param[in] x - left column
+ * \param[in] y - top row
+ * \param[in] chars - field width in characters (at most SSD1306_WIDGET_CHARS)
+ * \param[in] font - font type to use
+ */
+void ssd1306_widget_label_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t chars,
+		ssd1306_font_t font)
+{
+	if (chars > SSD1306_WIDGET_CHARS)
+	{
+		chars = SSD1306_WIDGET_CHARS;
+	}
+
+	ssd1306_widget_setup(widget, SSD1306_WIDGET_LABEL, x, y, chars * font.width, font.height);
+	widget->font = font;
+	widget->chars = chars;
+}
+
+/*!
+ * \brief Set up a numeric readout
+ * \param[in] widget - widget to set up
+ * \param[in] x - left column
+ * \param[in] y - top row
+ * \param[in] chars - field width in characters (at most SSD1306_WIDGET_CHARS)
+ * \param[in] decimals - decimal places, the value is fixed point with this many
+ * \param[in] font - font type to use
+ * \details The number is right aligned, so digits that did not change stay in
+ *          place and are not redrawn. A value that does not fit shows as '#'.
+ */
+void ssd1306_widget_readout_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t chars,
+		uint8_t decimals, ssd1306_font_t font)
+{
+	ssd1306_widget_label_init(widget, x, y, chars, font);
+	widget->type = SSD1306_WIDGET_READOUT;
+	widget->decimals = decimals;
+}
+
+/*!
+ * \brief Set up a horizontal bar
+ * \param[in] widget - widget to set up
+ * \param[in] x - left column
+ * \param[in] y - top row
+ * \param[in] width - width including the 1 pixel frame
+ * \param[in] height - height including the 1 pixel frame
+ * \param[in] min - value of an empty bar
+ * \param[in] max - value of a full bar
+ */
+void ssd1306_widget_bar_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t width,
+		uint8_t height, int32_t min, int32_t max)
+{
+	ssd1306_widget_setup(widget, SSD1306_WIDGET_BAR, x, y, (width < 3) ? 3 : width,
+			(height < 3) ? 3 : height);
+	widget->min = min;
+	widget->max = max;
+}
+
+/*!
+ * \brief Set up an icon
+ * \param[in] widget - widget to set up
+ * \param[in] x - left column
+ * \param[in] y - top row
+ * \param[in] width - width of the icon area, larger icons are clipped
+ * \param[in] height - height of the icon area
+ * \details The area stays empty until an icon is set with ssd1306_widget_set_icon().
+ */
+void ssd1306_widget_icon_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t width,
+		uint8_t height)
+{
+	ssd1306_widget_setup(widget, SSD1306_WIDGET_ICON, x, y, width, height);
+}
+
+/*!
+ * \brief Set the text of a label
+ * \param[in] widget - label
+ * \param[in] text - text, cut off at the field width
+ */
+void ssd1306_widget_set_text(ssd1306_widget_t* widget, const char* text)
+{
+	uint8_t i;
+
+	for (i = 0; i < widget->chars; i++)
+	{
+		widget->text[i] = (*text != '\0') ? *text++ : ' ';
+	}
+}
+
+/*!
+ * \brief Set the value of a readout or bar
+ * \param[in] widget - readout or bar
+ * \param[in] value - value, fixed point for a readout (2345 with 2 decimals: 23.45)
+ */
+void ssd1306_widget_set_value(ssd1306_widget_t* widget, int32_t value)
+{
+	uint8_t inner = widget->width - 2;	/* columns inside the frame */
+
+	if (widget->type == SSD1306_WIDGET_READOUT)
+	{
+		ssd1306_widget_format(widget, value);
+	}
+	else if (widget->type == SSD1306_WIDGET_BAR)
+	{
+		if (value <= widget->min || widget->max <= widget->min)
+		{
+			widget->fill = 0;
+		}
+		else if (value >= widget->max)
+		{
+			widget->fill = inner;
+		}
+		else
+		{
+			widget->fill = (uint8_t)(((int64_t)value - widget->min) * inner /
+					((int64_t)widget->max - widget->min));
+		}
+	}
+}
+
+/*!
+ * \brief Set the bitmap of an icon
+ * \param[in] widget - icon
+ * \param[in] icon - bitmap, NULL for an empty area. Must stay valid while set.
+ */
+void ssd1306_widget_set_icon(ssd1306_widget_t* widget, const ssd1306_icon_t* icon)
+{
+	widget->icon = icon;
+}
+
+/*!
+ * \brief Redraw a widget completely on its next ssd1306_widget_draw()
+ * \param[in] widget - widget
+ * \details Needed after something else drew over the widget area, e.g.
+ *          ssd1306_clear().
+ */
+void ssd1306_widget_invalidate(ssd1306_widget_t* widget)
+{
+	widget->valid = 0;
+}
+
+/*!
+ * \brief Draw the changes of a widget into the framebuffer
+ * \param[in] dev - display handle
+ * \param[in] widget - widget
+ * \returns 1 if something was drawn, 0 if the widget is unchanged
+ * \details Only the changed part is drawn and marked with ssd1306_mark_dirty(),
+ *          send it with ssd1306_update_dirty(). Moves the text cursor.
+ */
+uint8_t ssd1306_widget_draw(ssd1306_t* dev, ssd1306_widget_t* widget)
+{
+	uint8_t drawn;
+
+	switch (widget->type)
+	{
+	case SSD1306_WIDGET_LABEL:
+	case SSD1306_WIDGET_READOUT:
+		drawn = ssd1306_widget_draw_text(dev, widget);
+		break;
+	case SSD1306_WIDGET_BAR:
+		drawn = ssd1306_widget_draw_bar(dev, widget);
+		break;
+	case SSD1306_WIDGET_ICON:
+		drawn = ssd1306_widget_draw_icon(dev, widget);
+		break;
+	default:
+		drawn = 0;
+		break;
+	}
+
+	widget->valid = 1;
+
+	return (drawn);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Set the fields common to all widgets
+ * \param[in] widget - widget to set up
+ * \param[in] type - widget type
+ * \param[in] x - left column of the bounding box
+ * \param[in] y - top row of the bounding box
+ * \param[in] width - width of the bounding box
+ * \param[in] height - height of the bounding box
+ */
+static void ssd1306_widget_setup(ssd1306_widget_t* widget, ssd1306_widget_type_t type,
+		uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+	memset(widget, 0, sizeof(*widget));
+	memset(widget->text, ' ', sizeof(widget->text));
+
+	widget->type = type;
+	widget->x = x;
+	widget->y = y;
+	widget->width = width;
+	widget->height = height;
+}
+
+/*!
+ * \brief Format a fixed point value right aligned into the text of a readout
+ * \param[in] widget - readout
+ * \param[in] value - fixed point value
+ */
+static void ssd1306_widget_format(ssd1306_widget_t* widget, int32_t value)
+{
+	char digits[SSD1306_WIDGET_CHARS + 1];	/* last character first, room for the sign */
+	uint32_t magnitude = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+	uint8_t decimals = widget->decimals;
+	uint8_t min_len = (decimals > 0) ? (decimals + 2) : 1;	/* "0.05" */
+	uint8_t len = 0;
+	uint8_t i;
+
+	while (len < SSD1306_WIDGET_CHARS)
+	{
+		if (decimals > 0 && len == decimals)
+		{
+			digits[len++] = '.';
+			continue;
+		}
+
+		digits[len++] = '0' + (magnitude % 10);
+		magnitude /= 10;
+
+		if (magnitude == 0 && len >= min_len)
+		{
+			break;
+		}
+	}
+
+	if (value < 0)
+	{
+		digits[len++] = '-';
+	}
+
+	if (magnitude > 0 || len > widget->chars)
+	{
+		/* does not fit */
+		memset(widget->text, '#', widget->chars);
+		return;
+	}
+
+	for (i = 0; i < widget->chars; i++)
+	{
+		widget->text[widget->chars - 1 - i] = (i < len) ? digits[i] : ' ';
+	}
+}
+
+/*!
+ * \brief Draw the characters of a label or readout that differ from the panel
+ * \param[in] dev - display handle
+ * \param[in] widget - label or readout
+ * \returns 1 if something was drawn, otherwise 0
+ */
+static uint8_t ssd1306_widget_draw_text(ssd1306_t* dev, ssd1306_widget_t* widget)
+{
+	uint8_t i;
+	uint8_t x;
+	uint8_t drawn = 0;
+
+	for (i = 0; i < widget->chars; i++)
+	{
+		if (widget->valid == 1 && widget->text[i] == widget->shown_text[i])
+		{
+			continue;
+		}
+
+		x = widget->x + i * widget->font.width;
+		ssd1306_set_cursor(dev, x, widget->y);
+		ssd1306_put_char(dev, widget->text[i], widget->font);
+		ssd1306_mark_dirty(dev, x, widget->y, widget->font.width, widget->font.height);
+
+		widget->shown_text[i] = widget->text[i];
+		drawn = 1;
+	}
+
+	return (drawn);
+}
+
+/*!
+ * \brief Draw the columns of a bar between the shown and the new fill level
+ * \param[in] dev - display handle
+ * \param[in] widget - bar
+ * \returns 1 if something was drawn, otherwise 0
+ */
+static uint8_t ssd1306_widget_draw_bar(ssd1306_t* dev, ssd1306_widget_t* widget)
+{
+	uint8_t first;
+	uint8_t end;
+	uint8_t col;
+	uint8_t row;
+	uint8_t right = widget->x + widget->width - 1;
+	uint8_t bottom = widget->y + widget->height - 1;
+	ssd1306_color_t color;
+
+	if (widget->valid == 0)
+	{
+		for (col = widget->x; col <= right; col++)
+		{
+			ssd1306_draw_pixel(dev, col, widget->y, dev->foreground);
+			ssd1306_draw_pixel(dev, col, bottom, dev->foreground);
+		}
+		for (row = widget->y; row <= bottom; row++)
+		{
+			ssd1306_draw_pixel(dev, widget->x, row, dev->foreground);
+			ssd1306_draw_pixel(dev, right, row, dev->foreground);
+		}
+		ssd1306_mark_dirty(dev, widget->x, widget->y, widget->width, widget->height);
+
+		first = 0;
+		end = widget->width - 2;
+	}
+	else if (widget->fill == widget->shown_fill)
+	{
+		return (0);
+	}
+	else
+	{
+		first = (widget->fill < widget->shown_fill) ? widget->fill : widget->shown_fill;
+		end = (widget->fill < widget->shown_fill) ? widget->shown_fill : widget->fill;
+		ssd1306_mark_dirty(dev, widget->x + 1 + first, widget->y + 1, end - first, widget->height - 2);
+	}
+
+	for (col = first; col < end; col++)
+	{
+		color = (col < widget->fill) ? dev->foreground : dev->background;
+
+		for (row = widget->y + 1; row < bottom; row++)
+		{
+			ssd1306_draw_pixel(dev, widget->x + 1 + col, row, color);
+		}
+	}
+
+	widget->shown_fill = widget->fill;
+
+	return (1);
+}
+
+/*!
+ * \brief Draw an icon if another bitmap was set
+ * \param[in] dev - display handle
+ * \param[in] widget - icon
+ * \returns 1 if something was drawn, otherwise 0
+ */
+static uint8_t ssd1306_widget_draw_icon(ssd1306_t* dev, ssd1306_widget_t* widget)
+{
+	const ssd1306_icon_t* icon = widget->icon;
+	uint8_t row;
+	uint8_t col;
+	uint8_t set;
+
+	if (widget->valid == 1 && icon == widget->shown_icon)
+	{
+		return (0);
+	}
+
+	for (row = 0; row < widget->height; row++)
+	{
+		for (col = 0; col < widget->width; col++)
+		{
+			set = (icon != NULL && row < icon->height && col < icon->width &&
+					(icon->data[row * ((icon->width + 7) / 8) + col / 8] & (0x80 >> (col % 8))) != 0);
+
+			ssd1306_draw_pixel(dev, widget->x + col, widget->y + row,
+					(set == 1) ? dev->foreground : dev->background);
+		}
+	}
+
+	ssd1306_mark_dirty(dev, widget->x, widget->y, widget->width, widget->height);
+	widget->shown_icon = icon;
+
+	return (1);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIB_SSD1306_SSD1306_WIDGET_H_
+#define LIB_SSD1306_SSD1306_WIDGET_H_
+
+#include <stdint.h>
+#include <ssd1306/ssd1306.h>
+
+/*!
+ * \file ssd1306_widget.h
+ * \brief Retained widgets on top of the SSD1306 framebuffer
+ * \details A widget owns a fixed rectangle of the display and remembers what
+ *          it last drew there. Setting a value only stores it, the next
+ *          ssd1306_widget_draw() redraws what differs from the panel and
+ *          marks just that part dirty:
+ *
+ *          ssd1306_widget_set_value(&temp_readout, 2345);	// 23.45
+ *          ssd1306_widget_draw(&display, &temp_readout);	// only changed digits
+ *          ssd1306_update_dirty(&display);
+ *
+ *          Labels and readouts compare character by character, a bar redraws
+ *          the columns between old and new fill level, an icon is redrawn when
+ *          another bitmap is set. Widgets need the retained framebuffer and are
+ *          not available in SSD1306_PAGE_MODE.
+ */
+
+#ifdef SSD1306_PAGE_MODE
+#error "ssd1306 widgets need the retained framebuffer, not available in SSD1306_PAGE_MODE"
+#endif
+
+#define SSD1306_WIDGET_CHARS	16	/* longest label / readout in characters */
+
+typedef enum {
+	SSD1306_WIDGET_LABEL,
+	SSD1306_WIDGET_READOUT,
+	SSD1306_WIDGET_BAR,
+	SSD1306_WIDGET_ICON
+} ssd1306_widget_type_t;
+
+/*!
+ * \brief Monochrome bitmap for icon widgets
+ * \details Rows from top to bottom, (width + 7) / 8 bytes per row, the MSB of
+ *          each byte is the leftmost pixel. Set pixels use the foreground color.
+ */
+typedef struct {
+	uint8_t width;
+	uint8_t height;
+	const uint8_t* data;
+} ssd1306_icon_t;
+
+/*!
+ * \brief One widget, set up with one of the ssd1306_widget_*_init() functions
+ */
+typedef struct {
+	ssd1306_widget_type_t type;
+	uint8_t x;						/*!< bounding box */
+	uint8_t y;
+	uint8_t width;
+	uint8_t height;
+	uint8_t valid;					/*!< panel shows the shown_* state */
+	/* label, readout */
+	ssd1306_font_t font;
+	uint8_t chars;					/*!< field width in characters */
+	uint8_t decimals;				/*!< readout: fixed point decimals */
+	char text[SSD1306_WIDGET_CHARS];	/*!< padded to chars, not terminated */
+	char shown_text[SSD1306_WIDGET_CHARS];
+	/* bar */
+	int32_t min;
+	int32_t max;
+	uint8_t fill;					/*!< filled columns inside the frame */
+	uint8_t shown_fill;
+	/* icon */
+	const ssd1306_icon_t* icon;
+	const ssd1306_icon_t* shown_icon;
+} ssd1306_widget_t;
+
+
+void ssd1306_widget_label_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t chars,
+		ssd1306_font_t font);
+void ssd1306_widget_readout_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t chars,
+		uint8_t decimals, ssd1306_font_t font);
+void ssd1306_widget_bar_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t width,
+		uint8_t height, int32_t min, int32_t max);
+void ssd1306_widget_icon_init(ssd1306_widget_t* widget, uint8_t x, uint8_t y, uint8_t width,
+		uint8_t height);
+
+void ssd1306_widget_set_text(ssd1306_widget_t* widget, const char* text);
+void ssd1306_widget_set_value(ssd1306_widget_t* widget, int32_t value);
+void ssd1306_widget_set_icon(ssd1306_widget_t* widget, const ssd1306_icon_t* icon);
+void ssd1306_widget_invalidate(ssd1306_widget_t* widget);
+uint8_t ssd1306_widget_draw(ssd1306_t* dev, ssd1306_widget_t* widget);
+
+#endif /* LIB_SSD1306_SSD1306_WIDGET_H_ */
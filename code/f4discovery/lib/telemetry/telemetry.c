@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include <timebase/timebase.h>
+#include <telemetry/telemetry.h>
+
+#define TELEMETRY_USART         USART3
+#define TELEMETRY_USART_CLK     RCC_USART3
+#define TELEMETRY_GPIO_PORT     GPIOD
+#define TELEMETRY_GPIO_CLK      RCC_GPIOD
+#define TELEMETRY_GPIO_TX       GPIO8
+#define TELEMETRY_DMA           DMA1
+#define TELEMETRY_DMA_CLK       RCC_DMA1
+#define TELEMETRY_DMA_STREAM    DMA_STREAM3
+#define TELEMETRY_DMA_CHANNEL   DMA_SxCR_CHSEL_4    /* USART3_TX */
+#define TELEMETRY_DMA_IRQ       NVIC_DMA1_STREAM3_IRQ
+
+#define TELEMETRY_MASK          (TELEMETRY_BUFFER_SIZE - 1)
+
+/* the ring: head is moved by telemetry_send(), tail by the DMA interrupt,
+   both run freely and are masked on access */
+static uint8_t tx_buf[TELEMETRY_BUFFER_SIZE];
+static volatile uint16_t tx_head = 0;
+static volatile uint16_t tx_tail = 0;
+static volatile uint16_t tx_dma_len = 0;    /* bytes of the running transfer, 0 if idle */
+static uint16_t tx_seq = 0;
+static telemetry_stats_t stats;
+
+/* static declarations */
+static void telemetry_dma_start(void);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up USART3, its DMA stream and the GPIO
+ */
+void telemetry_init(void)
+{
+    rcc_periph_clock_enable(TELEMETRY_GPIO_CLK);
+    rcc_periph_clock_enable(TELEMETRY_USART_CLK);
+    rcc_periph_clock_enable(TELEMETRY_DMA_CLK);
+
+    gpio_mode_setup(TELEMETRY_GPIO_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, TELEMETRY_GPIO_TX);
+    gpio_set_output_options(TELEMETRY_GPIO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ, TELEMETRY_GPIO_TX);
+    gpio_set_af(TELEMETRY_GPIO_PORT, GPIO_AF7, TELEMETRY_GPIO_TX);
+
+    usart_set_baudrate(TELEMETRY_USART, TELEMETRY_BAUDRATE);
+    usart_set_databits(TELEMETRY_USART, 8);
+    usart_set_stopbits(TELEMETRY_USART, USART_STOPBITS_1);
+    usart_set_mode(TELEMETRY_USART, USART_MODE_TX);
+    usart_set_parity(TELEMETRY_USART, USART_PARITY_NONE);
+    usart_set_flow_control(TELEMETRY_USART, USART_FLOWCONTROL_NONE);
+    usart_enable_tx_dma(TELEMETRY_USART);
+    usart_enable(TELEMETRY_USART);
+
+    /* below the display bus, above nothing that waits on telemetry */
+    nvic_set_priority(TELEMETRY_DMA_IRQ, 3 << 4);
+    nvic_enable_irq(TELEMETRY_DMA_IRQ);
+}
+
+/*!
+ * \brief Queue a record, from the main loop only
+ * \param[in] type record type, TELEMETRY_REC_...
+ * \param[in] payload payload
+ * \param[in] len payload bytes, at most TELEMETRY_PAYLOAD_MAX
+ * \retval 0  - OK
+ * \retval -1 - dropped, buffer full
+ */
+int8_t telemetry_send(uint8_t type, const void* payload, uint8_t len)
+{
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    uint16_t frame_len;
+    uint16_t head = tx_head;
+    uint16_t used;
+    uint16_t first;
+
+    frame_len = telemetry_frame_encode(frame, type, tx_seq++, timebase_ms(), payload, len);
+
+    used = (uint16_t)(head - tx_tail);
+    if (frame_len > TELEMETRY_BUFFER_SIZE - used)
+    {
+        stats.dropped++;
+        return (-1);
+    }
+
+    /* copy in up to two pieces around the end of the ring */
+    first = TELEMETRY_BUFFER_SIZE - (head & TELEMETRY_MASK);
+    if (first > frame_len)
+    {
+        first = frame_len;
+    }
+    memcpy(&tx_buf[head & TELEMETRY_MASK], frame, first);
+    memcpy(tx_buf, &frame[first], frame_len - first);
+
+    tx_head = head + frame_len;
+
+    stats.records++;
+    stats.bytes += frame_len;
+    if (used + frame_len > stats.buffer_max)
+    {
+        stats.buffer_max = used + frame_len;
+    }
+
+    /* the interrupt starts the next transfer itself while one runs */
+    cm_disable_interrupts();
+    if (tx_dma_len == 0)
+    {
+        telemetry_dma_start();
+    }
+    cm_enable_interrupts();
+
+    return (0);
+}
+
+/*!
+ * \brief Check for queued or running transmission
+ * \returns 1 while bytes are waiting or being sent, otherwise 0
+ */
+uint8_t telemetry_busy(void)
+{
+    /* the last byte leaves the shift register after the DMA is done */
+    return (tx_head != tx_tail || tx_dma_len != 0 ||
+            usart_get_flag(TELEMETRY_USART, USART_SR_TC) == 0);
+}
+
+/*!
+ * \brief Get the counters
+ * \param[out] result filled with the counters
+ */
+void telemetry_get_stats(telemetry_stats_t* result)
+{
+    *result = stats;
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Send the queued bytes up to the end of the ring, or nothing if none
+ * \details Called with the DMA interrupt unable to run.
+ */
+static void telemetry_dma_start(void)
+{
+    uint16_t tail = tx_tail & TELEMETRY_MASK;
+    uint16_t len = (uint16_t)(tx_head - tx_tail);
+
+    if (len > TELEMETRY_BUFFER_SIZE - tail)
+    {
+        len = TELEMETRY_BUFFER_SIZE - tail;
+    }
+
+    tx_dma_len = len;
+    if (len == 0)
+    {
+        return;
+    }
+
+    dma_stream_reset(TELEMETRY_DMA, TELEMETRY_DMA_STREAM);
+    dma_channel_select(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, TELEMETRY_DMA_CHANNEL);
+    dma_set_transfer_mode(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, (uint32_t)&USART_DR(TELEMETRY_USART));
+    dma_set_memory_address(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, (uint32_t)&tx_buf[tail]);
+    dma_set_number_of_data(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, len);
+    dma_enable_memory_increment_mode(TELEMETRY_DMA, TELEMETRY_DMA_STREAM);
+    dma_set_peripheral_size(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, DMA_SxCR_MSIZE_8BIT);
+    dma_set_priority(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, DMA_SxCR_PL_LOW);
+    dma_enable_transfer_complete_interrupt(TELEMETRY_DMA, TELEMETRY_DMA_STREAM);
+    dma_enable_stream(TELEMETRY_DMA, TELEMETRY_DMA_STREAM);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief DMA transfer complete: free the sent bytes, send what came in meanwhile
+ */
+void dma1_stream3_isr(void)
+{
+    if (dma_get_interrupt_flag(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(TELEMETRY_DMA, TELEMETRY_DMA_STREAM, DMA_TCIF);
+
+        tx_tail = tx_tail + tx_dma_len;
+        telemetry_dma_start();
+    }
+}
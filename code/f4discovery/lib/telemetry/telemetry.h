@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include <telemetry/telemetry_frame.h>
+
+/*!
+ * \file telemetry.h
+ * \brief Binary telemetry stream on USART3 (TX on PD8)
+ * \details Records (see telemetry_frame.h) are framed into a TX ring buffer
+ *          and sent from there by DMA (DMA1 stream 3, channel 4), one
+ *          contiguous piece of the ring per transfer. telemetry_send() never
+ *          waits: a record that does not fit is dropped and counted, its
+ *          sequence number is used all the same so the receiver sees the gap.
+ *
+ *          At TELEMETRY_BAUDRATE the line carries about 92 kB/s, some 1600
+ *          zone records per second.
+ */
+
+#define TELEMETRY_BAUDRATE      921600
+#define TELEMETRY_BUFFER_SIZE   2048    /* power of two */
+
+/*!
+ * \brief Telemetry counters
+ */
+typedef struct {
+    uint32_t records;           /*!< records queued */
+    uint32_t dropped;           /*!< records dropped, buffer full */
+    uint32_t bytes;             /*!< frame bytes queued */
+    uint16_t buffer_max;        /*!< highest buffer fill */
+} telemetry_stats_t;
+
+/*!
+ * \brief Set up USART3, its DMA stream and the GPIO
+ */
+void telemetry_init(void);
+
+/*!
+ * \brief Queue a record, from the main loop only
+ * \param[in] type record type, TELEMETRY_REC_...
+ * \param[in] payload payload
+ * \param[in] len payload bytes, at most TELEMETRY_PAYLOAD_MAX
+ * \retval 0  - OK
+ * \retval -1 - dropped, buffer full
+ */
+int8_t telemetry_send(uint8_t type, const void* payload, uint8_t len);
+
+/*!
+ * \brief Check for queued or running transmission
+ * \returns 1 while bytes are waiting or being sent, otherwise 0
+ */
+uint8_t telemetry_busy(void);
+
+/*!
+ * \brief Get the counters
+ * \param[out] result filled with the counters
+ */
+void telemetry_get_stats(telemetry_stats_t* result);
+
+#endif
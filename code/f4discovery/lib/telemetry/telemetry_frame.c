@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include <telemetry/telemetry_frame.h>
+
+/* static declarations */
+static int8_t telemetry_decoder_unstuff(telemetry_decoder_t* dec, telemetry_record_t* record);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Build a frame
+ * \param[out] frame TELEMETRY_FRAME_MAX bytes
+ * \param[in] type record type
+ * \param[in] seq sequence number
+ * \param[in] time timestamp
+ * \param[in] payload payload, may be NULL if len is 0
+ * \param[in] len payload bytes, at most TELEMETRY_PAYLOAD_MAX
+ * \returns frame length including the delimiter
+ */
+uint16_t telemetry_frame_encode(uint8_t* frame, uint8_t type, uint16_t seq, uint64_t time,
+                                const void* payload, uint8_t len)
+{
+    uint8_t record[TELEMETRY_RECORD_MAX];
+    uint16_t record_len;
+    uint16_t crc;
+    uint16_t code_pos = 0;
+    uint16_t out = 1;
+    uint16_t i;
+
+    if (len > TELEMETRY_PAYLOAD_MAX)
+    {
+        len = TELEMETRY_PAYLOAD_MAX;
+    }
+
+    record[0] = type;
+    record[1] = (uint8_t)seq;
+    record[2] = (uint8_t)(seq >> 8);
+    for (i = 0; i < 8; i++)
+    {
+        record[3 + i] = (uint8_t)(time >> (8 * i));
+    }
+    if (len > 0)
+    {
+        memcpy(&record[TELEMETRY_HEADER_SIZE], payload, len);
+    }
+    record_len = TELEMETRY_HEADER_SIZE + len;
+    crc = telemetry_crc16(0xFFFF, record, record_len);
+    record[record_len++] = (uint8_t)crc;
+    record[record_len++] = (uint8_t)(crc >> 8);
+
+    /* COBS: every 0 becomes the distance to the next one, records are shorter
+       than 254 bytes so there is exactly one code byte more */
+    for (i = 0; i < record_len; i++)
+    {
+        if (record[i] == 0)
+        {
+            frame[code_pos] = (uint8_t)(out - code_pos);
+            code_pos = out++;
+        }
+        else
+        {
+            frame[out++] = record[i];
+        }
+    }
+    frame[code_pos] = (uint8_t)(out - code_pos);
+    frame[out++] = 0;
+
+    return (out);
+}
+
+/*!
+ * \brief Reset a stream decoder
+ * \param[out] dec decoder
+ */
+void telemetry_decoder_init(telemetry_decoder_t* dec)
+{
+    dec->len = 0;
+    dec->overflow = 0;
+}
+
+/*!
+ * \brief Feed one received byte
+ * \param[in,out] dec decoder
+ * \param[in] byte received byte
+ * \param[out] record filled when a frame is complete
+ * \retval 1  - record complete
+ * \retval 0  - more bytes needed
+ * \retval -1 - damaged frame dropped (length, COBS or CRC)
+ */
+int8_t telemetry_decoder_feed(telemetry_decoder_t* dec, uint8_t byte, telemetry_record_t* record)
+{
+    int8_t result;
+
+    if (byte != 0)
+    {
+        if (dec->len < sizeof(dec->buf))
+        {
+            dec->buf[dec->len++] = byte;
+        }
+        else
+        {
+            dec->overflow = 1;
+        }
+        return (0);
+    }
+
+    /* delimiter */
+    if (dec->len == 0)
+    {
+        return (0);
+    }
+
+    result = dec->overflow ? -1 : telemetry_decoder_unstuff(dec, record);
+    dec->len = 0;
+    dec->overflow = 0;
+
+    return (result);
+}
+
+/*!
+ * \brief CRC-16/CCITT-FALSE
+ * \param[in] crc start value, 0xFFFF for a new CRC
+ * \param[in] data data
+ * \param[in] len length of data
+ * \returns CRC
+ */
+uint16_t telemetry_crc16(uint16_t crc, const uint8_t* data, uint16_t len)
+{
+    uint8_t i;
+
+    while (len--)
+    {
+        crc ^= (uint16_t)(*data++ << 8);
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+
+    return (crc);
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Undo the COBS encoding of the collected frame in place and check it
+ * \returns 1 if the record is valid, otherwise -1
+ */
+static int8_t telemetry_decoder_unstuff(telemetry_decoder_t* dec, telemetry_record_t* record)
+{
+    uint8_t* buf = dec->buf;
+    uint16_t in = 0;
+    uint16_t out = 0;
+    uint16_t crc;
+    uint8_t code;
+    uint8_t i;
+
+    while (in < dec->len)
+    {
+        code = buf[in++];
+        if (in + code - 1 > dec->len)
+        {
+            return (-1);
+        }
+        while (--code > 0)
+        {
+            buf[out++] = buf[in++];
+        }
+        if (in < dec->len)
+        {
+            buf[out++] = 0;
+        }
+    }
+
+    if (out < TELEMETRY_HEADER_SIZE + 2 || out > TELEMETRY_RECORD_MAX)
+    {
+        return (-1);
+    }
+
+    crc = telemetry_crc16(0xFFFF, buf, out - 2);
+    if ((buf[out - 2] | (buf[out - 1] << 8)) != crc)
+    {
+        return (-1);
+    }
+
+    record->type = buf[0];
+    record->seq = (uint16_t)(buf[1] | (buf[2] << 8));
+    record->time = 0;
+    for (i = 8; i > 0; i--)
+    {
+        record->time = (record->time << 8) | buf[2 + i];
+    }
+    record->len = (uint8_t)(out - 2 - TELEMETRY_HEADER_SIZE);
+    memcpy(record->payload, &buf[TELEMETRY_HEADER_SIZE], record->len);
+
+    return (1);
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
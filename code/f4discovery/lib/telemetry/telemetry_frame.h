@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TELEMETRY_FRAME_H_
+#define TELEMETRY_FRAME_H_
+
+#include <stdint.h>
+
+/*!
+ * \file telemetry_frame.h
+ * \brief Telemetry record framing, shared by the firmware and the host tools
+ * \details A record is
+ *
+ *              type     8 bit  TELEMETRY_REC_...
+ *              seq     16 bit  counts every record produced, sent or dropped
+ *              time    64 bit  ms since start (timebase_ms()), does not wrap
+ *              payload 0..TELEMETRY_PAYLOAD_MAX bytes
+ *              crc     16 bit  CRC-16/CCITT-FALSE over all of the above
+ *
+ *          little endian, COBS encoded and terminated by a 0 byte. A receiver
+ *          that starts in the middle of a stream or loses bytes is back in
+ *          sync at the next 0 byte; a gap in seq counts the records lost on
+ *          the way (dropped in the unit or damaged on the line).
+ *
+ *          Plain C without hardware access, the host tools build it as well.
+ */
+
+#define TELEMETRY_PAYLOAD_MAX   64
+#define TELEMETRY_HEADER_SIZE   11
+#define TELEMETRY_RECORD_MAX    (TELEMETRY_HEADER_SIZE + TELEMETRY_PAYLOAD_MAX + 2)
+#define TELEMETRY_FRAME_MAX     (TELEMETRY_RECORD_MAX + 2)  /* COBS code byte and delimiter */
+
+/* record types */
+#define TELEMETRY_REC_ZONE      0x01    /* telemetry_zone_t, after every zone update */
+#define TELEMETRY_REC_COUNTERS  0x02    /* telemetry_counters_t, periodic */
+#define TELEMETRY_REC_PROFILE   0x03    /* telemetry_profile_t, periodic per stage (PROFILING) */
+
+#define TELEMETRY_PROFILE_BINS  12
+
+/*!
+ * \brief Payload of TELEMETRY_REC_ZONE: reading and controller state
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t zone;
+    uint8_t tune_state;         /*!< 0 controller, else pid_tune_state_t + 1 */
+    int32_t value;              /*!< 1/100 degC, INT32_MIN after a failed read */
+    int32_t setpoint;
+    int32_t output;             /*!< 1/1000 */
+    int32_t integral;           /*!< integral part of the output */
+    uint32_t errors;            /*!< failed reads */
+    int32_t smoothed;           /*!< filtered value, INT32_MIN before the first reading */
+    int32_t estimate;           /*!< estimated present value, INT32_MIN without estimate */
+    int32_t rate;               /*!< estimated rate, 1/100 degC per min */
+    uint64_t read_us;           /*!< time of the reading, us since start (timebase_us()) */
+} telemetry_zone_t;
+
+/*!
+ * \brief Payload of TELEMETRY_REC_COUNTERS: counter snapshot
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t load_permille;     /*!< CPU load */
+    uint32_t tlm_records;       /*!< telemetry records sent */
+    uint32_t tlm_dropped;       /*!< telemetry records dropped, buffer full */
+    uint32_t zone_slot_cycles_max;
+    uint32_t zone_jitter_us_max;
+    uint32_t log_records;       /*!< flash log records appended */
+    uint32_t log_dropped;
+    uint32_t log_encode_cycles_max;
+} telemetry_counters_t;
+
+/*!
+ * \brief Payload of TELEMETRY_REC_PROFILE: statistics of a profiled stage (see prof.h)
+ */
+typedef struct __attribute__((packed)) {
+    char name[12];              /*!< 0 terminated */
+    uint32_t count;
+    uint32_t min;               /*!< cycles */
+    uint32_t max;
+    uint64_t total;
+    uint8_t hist_first;         /*!< power of two of hist[0] */
+    uint16_t hist[TELEMETRY_PROFILE_BINS];  /*!< passes per power of two, the last bin takes the rest */
+} telemetry_profile_t;
+
+/*!
+ * \brief Decoded record
+ */
+typedef struct {
+    uint8_t type;
+    uint16_t seq;
+    uint64_t time;
+    uint8_t len;                /*!< payload bytes */
+    uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+} telemetry_record_t;
+
+/*!
+ * \brief Stream decoder state
+ */
+typedef struct {
+    uint8_t buf[TELEMETRY_FRAME_MAX];
+    uint16_t len;
+    uint8_t overflow;           /*!< frame too long, skip to the next delimiter */
+} telemetry_decoder_t;
+
+/*!
+ * \brief Build a frame
+ * \param[out] frame TELEMETRY_FRAME_MAX bytes
+ * \param[in] type record type
+ * \param[in] seq sequence number
+ * \param[in] time timestamp
+ * \param[in] payload payload, may be NULL if len is 0
+ * \param[in] len payload bytes, at most TELEMETRY_PAYLOAD_MAX
+ * \returns frame length including the delimiter
+ */
+uint16_t telemetry_frame_encode(uint8_t* frame, uint8_t type, uint16_t seq, uint64_t time,
+                                const void* payload, uint8_t len);
+
+/*!
+ * \brief Reset a stream decoder
+ * \param[out] dec decoder
+ */
+void telemetry_decoder_init(telemetry_decoder_t* dec);
+
+/*!
+ * \brief Feed one received byte
+ * \param[in,out] dec decoder
+ * \param[in] byte received byte
+ * \param[out] record filled when a frame is complete
+ * \retval 1  - record complete
+ * \retval 0  - more bytes needed
+ * \retval -1 - damaged frame dropped (length, COBS or CRC)
+ */
+int8_t telemetry_decoder_feed(telemetry_decoder_t* dec, uint8_t byte, telemetry_record_t* record);
+
+/*!
+ * \brief CRC-16/CCITT-FALSE
+ * \param[in] crc start value, 0xFFFF for a new CRC
+ * \param[in] data data
+ * \param[in] len length of data
+ * \returns CRC
+ */
+uint16_t telemetry_crc16(uint16_t crc, const uint8_t* data, uint16_t len);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/systick.h>
+
+#include <timebase/timebase.h>
+
+/* two halves, the reader retries when the high word changed under it */
+static volatile uint32_t ms_low = 0;
+static volatile uint32_t ms_high = 0;
+static uint32_t tick_counts;            /* SysTick counts per ms */
+static uint32_t cycles_per_us;
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up the 1 ms SysTick and the cycle counter
+ * \details Call after the system clock is configured.
+ */
+void timebase_init(void)
+{
+    /* AHB / 8 clocks the SysTick, reload for 1 ms */
+    tick_counts = rcc_ahb_frequency / 8 / 1000;
+    cycles_per_us = rcc_ahb_frequency / 1000000;
+
+    systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+    systick_set_reload(tick_counts - 1);
+    systick_clear();
+    systick_interrupt_enable();
+    systick_counter_enable();
+
+    dwt_enable_cycle_counter();
+}
+
+/*!
+ * \brief Milliseconds since timebase_init()
+ */
+uint64_t timebase_ms(void)
+{
+    uint32_t high;
+    uint32_t low;
+
+    do
+    {
+        high = ms_high;
+        low = ms_low;
+    } while (high != ms_high);
+
+    return (((uint64_t)high << 32) | low);
+}
+
+/*!
+ * \brief Low 32 bits of timebase_ms(), wraps after 49 days
+ * \details For intervals, compared as (int32_t)(a - b).
+ */
+uint32_t timebase_ms32(void)
+{
+    return (ms_low);
+}
+
+/*!
+ * \brief Microseconds since timebase_init()
+ * \details The counter value is only used together with the pending state of
+ *          the tick seen before and after reading it, so a reload in between
+ *          is either counted (pending) or makes the loop read again.
+ */
+uint64_t timebase_us(void)
+{
+    uint64_t ms;
+    uint32_t count;
+    uint32_t pending;
+
+    do
+    {
+        ms = timebase_ms();
+        pending = SCB_ICSR & SCB_ICSR_PENDSTSET;
+        count = STK_CVR;
+    } while (pending != (SCB_ICSR & SCB_ICSR_PENDSTSET) || ms != timebase_ms());
+
+    if (pending)
+    {
+        /* reloaded, the interrupt is blocked by the caller */
+        ms++;
+    }
+
+    /* the counter runs down from tick_counts - 1 */
+    return (ms * 1000 + (uint64_t)(tick_counts - 1 - count) * 1000 / tick_counts);
+}
+
+/*!
+ * \brief Deadline for timebase_expired()
+ * \param[in] timeout_us time from now
+ * \returns deadline, us
+ */
+uint64_t timebase_deadline_us(uint32_t timeout_us)
+{
+    return (timebase_us() + timeout_us);
+}
+
+/*!
+ * \brief Check a deadline
+ * \param[in] deadline_us from timebase_deadline_us()
+ * \returns 1 if it has passed, otherwise 0
+ */
+uint8_t timebase_expired(uint64_t deadline_us)
+{
+    return ((timebase_us() >= deadline_us) ? 1 : 0);
+}
+
+/*!
+ * \brief Cycle counter, start of an interval
+ */
+uint32_t timebase_cycles(void)
+{
+    return (dwt_read_cycle_counter());
+}
+
+/*!
+ * \brief Microseconds since a timebase_cycles() value
+ * \param[in] since start of the interval
+ * \details For intervals up to 25 s at 168 MHz, without sleeping in between.
+ */
+uint32_t timebase_elapsed_us(uint32_t since)
+{
+    return ((dwt_read_cycle_counter() - since) / cycles_per_us);
+}
+
+/*!
+ * \brief Add time the SysTick did not count, e.g. in STOP mode
+ * \param[in] ms milliseconds
+ * \note call with interrupts masked
+ */
+void timebase_advance_ms(uint32_t ms)
+{
+    uint32_t low = ms_low + ms;
+
+    if (low < ms_low)
+    {
+        ms_high++;
+    }
+    ms_low = low;
+}
+
+/*!
+ * \brief SysTick interrupt, the timebase
+ */
+void sys_tick_handler(void)
+{
+    uint32_t low = ms_low + 1;
+
+    if (low == 0)
+    {
+        ms_high++;
+    }
+    ms_low = low;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <stdint.h>
+
+/*!
+ * \file timebase.h
+ * \brief Monotonic 64 bit time in ms and us, cycle counter intervals
+ * \details The SysTick interrupt counts milliseconds in 64 bits, which do not
+ *          wrap. Microseconds add the position of the SysTick down counter
+ *          within the current millisecond (AHB / 8, 21 counts per us at
+ *          168 MHz). The DWT cycle counter, which stops in WFI unless a
+ *          debugger is attached, times short intervals in code that runs.
+ *
+ *          All functions may be called from interrupt handlers, also from ones
+ *          that block the SysTick interrupt: a tick that is pending but not
+ *          yet counted is taken into account by timebase_us().
+ */
+
+/*!
+ * \brief Set up the 1 ms SysTick and the cycle counter
+ * \details Call after the system clock is configured.
+ */
+void timebase_init(void);
+
+/*!
+ * \brief Milliseconds since timebase_init()
+ */
+uint64_t timebase_ms(void);
+
+/*!
+ * \brief Low 32 bits of timebase_ms(), wraps after 49 days
+ * \details For intervals, compared as (int32_t)(a - b).
+ */
+uint32_t timebase_ms32(void);
+
+/*!
+ * \brief Microseconds since timebase_init()
+ */
+uint64_t timebase_us(void);
+
+/*!
+ * \brief Deadline for timebase_expired()
+ * \param[in] timeout_us time from now
+ * \returns deadline, us
+ */
+uint64_t timebase_deadline_us(uint32_t timeout_us);
+
+/*!
+ * \brief Check a deadline
+ * \param[in] deadline_us from timebase_deadline_us()
+ * \returns 1 if it has passed, otherwise 0
+ */
+uint8_t timebase_expired(uint64_t deadline_us);
+
+/*!
+ * \brief Cycle counter, start of an interval
+ */
+uint32_t timebase_cycles(void);
+
+/*!
+ * \brief Microseconds since a timebase_cycles() value
+ * \param[in] since start of the interval
+ * \details For intervals up to 25 s at 168 MHz, without sleeping in between.
+ */
+uint32_t timebase_elapsed_us(uint32_t since);
+
+/*!
+ * \brief Add time the SysTick did not count, e.g. in STOP mode
+ * \param[in] ms milliseconds
+ * \note call with interrupts masked
+ */
+void timebase_advance_ms(uint32_t ms);
+
+#endif
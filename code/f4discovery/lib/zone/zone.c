@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+
+#include <sched/sched.h>
+#include <timebase/timebase.h>
+#include <zone/zone.h>
+
+static zone_t* zone_table = NULL;
+static uint8_t zone_count;
+static const zone_io_t* zone_io;
+static uint32_t slot_ms;
+static uint32_t read_ms;            /* conversion time */
+static uint8_t slot_lag;            /* slots between conversion start and read, 0: in the slot */
+static uint8_t slot_next;
+static uint32_t zone_event;
+
+static sched_task_t zone_task;
+static sched_task_t zone_read_task;
+static zone_stats_t stats;
+static uint64_t last_slot_us;
+
+/* static declarations */
+static void zone_run(void* ctx, uint32_t events);
+static void zone_read_run(void* ctx, uint32_t events);
+static void zone_read(zone_t* zone);
+static void zone_control(zone_t* zone);
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Set up the zone table
+ * \param[in,out] zones table, stays in use
+ * \param[in] count number of zones, 1..ZONE_MAX
+ * \param[in] io sensor and output access, stays in use
+ * \param[in] period_ms each zone is served once per period, at least conversion_ms
+ * \param[in] conversion_ms sensor conversion time
+ * \param[in] event scheduler event set after each zone update, 0 for none
+ */
+void zone_init(zone_t* zones, uint8_t count, const zone_io_t* io, uint32_t period_ms,
+               uint32_t conversion_ms, uint32_t event)
+{
+    uint8_t i;
+
+    if (count > ZONE_MAX)
+    {
+        count = ZONE_MAX;
+    }
+    if (count == 0)
+    {
+        count = 1;
+    }
+
+    zone_table = zones;
+    zone_count = count;
+    zone_io = io;
+    zone_event = event;
+
+    slot_ms = period_ms / count;
+    if (slot_ms == 0)
+    {
+        slot_ms = 1;
+    }
+
+    zone_set_conversion_ms(conversion_ms);
+    slot_next = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        zones[i].tune = NULL;
+        zones[i].value = ZONE_NO_READING;
+        zones[i].out = zones[i].pid.out_min;
+        zones[i].converting = 0;
+        zones[i].errors = 0;
+    }
+
+    zone_reset_stats();
+}
+
+/*!
+ * \brief Change the sensor conversion time, e.g. after a resolution change
+ * \param[in] conversion_ms sensor conversion time, at most the period
+ * \details Conversions started before are not read, their zones miss one
+ *          reading.
+ */
+void zone_set_conversion_ms(uint32_t conversion_ms)
+{
+    uint8_t i;
+
+    read_ms = conversion_ms;
+
+    /* read in the same slot once the conversion is done if it fits, otherwise
+       in the first slot after it */
+    if (conversion_ms < slot_ms)
+    {
+        slot_lag = 0;
+    }
+    else
+    {
+        slot_lag = (conversion_ms + slot_ms - 1) / slot_ms;
+        if (slot_lag > zone_count)
+        {
+            slot_lag = zone_count;
+        }
+    }
+
+    sched_timer_stop(&zone_read_task);
+    for (i = 0; i < zone_count; i++)
+    {
+        zone_table[i].converting = 0;
+    }
+}
+
+/*!
+ * \brief Time from the conversion start to the read of a zone
+ * \returns milliseconds
+ */
+uint32_t zone_read_delay_ms(void)
+{
+    return ((slot_lag == 0) ? read_ms : slot_lag * slot_ms);
+}
+
+/*!
+ * \brief Start serving the zones from a scheduler task
+ */
+void zone_start(void)
+{
+    sched_task_add(&zone_read_task, zone_read_run, NULL, 0);
+    sched_task_add(&zone_task, zone_run, NULL, 0);
+    sched_timer_start(&zone_task, 0, slot_ms);
+}
+
+/*!
+ * \brief Serve the next slot now
+ * \details Called by the zone task, directly only without zone_start() (benchmark)
+ */
+void zone_slot(void)
+{
+    uint32_t start = timebase_cycles();
+    uint64_t now_us = timebase_us();
+    uint32_t interval_us;
+    uint32_t jitter_us;
+    zone_t* zone;
+
+    /* the timebase, the cycle counter stops while the core sleeps in between */
+    if (stats.slots > 0)
+    {
+        interval_us = (uint32_t)(now_us - last_slot_us);
+        jitter_us = (interval_us > slot_ms * 1000) ? interval_us - slot_ms * 1000 : slot_ms * 1000 - interval_us;
+        if (jitter_us > stats.jitter_us_max)
+        {
+            stats.jitter_us_max = jitter_us;
+        }
+    }
+    last_slot_us = now_us;
+
+    /* first the finished conversion, the bus is then free for the next start;
+       read in the slot: the previous zone is only left when the read task
+       does not run (benchmark) */
+    zone = &zone_table[(slot_next + zone_count - ((slot_lag == 0) ? 1 : slot_lag)) % zone_count];
+    zone_read(zone);
+
+    zone = &zone_table[slot_next];
+    zone_io->start(zone);
+    zone->converting = 1;
+
+    if (slot_lag == 0)
+    {
+        sched_timer_start(&zone_read_task, read_ms, 0);
+    }
+
+    slot_next = (slot_next + 1) % zone_count;
+
+    stats.slot_cycles_last = timebase_cycles() - start;
+    if (stats.slot_cycles_last > stats.slot_cycles_max)
+    {
+        stats.slot_cycles_max = stats.slot_cycles_last;
+    }
+    stats.slots++;
+}
+
+/*!
+ * \brief Get the zone timing
+ * \param[out] result filled with the timing
+ */
+void zone_get_stats(zone_stats_t* result)
+{
+    *result = stats;
+}
+
+/*!
+ * \brief Clear the zone timing
+ */
+void zone_reset_stats(void)
+{
+    stats.slots = 0;
+    stats.slot_cycles_last = 0;
+    stats.slot_cycles_max = 0;
+    stats.control_cycles_max = 0;
+    stats.jitter_us_max = 0;
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Zone task, one slot per timer expiry
+ */
+static void zone_run(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    zone_slot();
+}
+
+/*!
+ * \brief Read task, the conversion of the current slot is done
+ */
+static void zone_read_run(void* ctx, uint32_t events)
+{
+    uint32_t start = timebase_cycles();
+    uint32_t cycles;
+
+    (void)ctx;
+    (void)events;
+
+    zone_read(&zone_table[(slot_next + zone_count - 1) % zone_count]);
+
+    cycles = timebase_cycles() - start;
+    if (cycles > stats.slot_cycles_max)
+    {
+        stats.slot_cycles_max = cycles;
+    }
+}
+
+/*!
+ * \brief Read, control and output a zone with a conversion running
+ */
+static void zone_read(zone_t* zone)
+{
+    if (zone->converting == 0)
+    {
+        return;
+    }
+
+    zone->converting = 0;
+    if (zone_io->read(zone, &zone->value) != 0)
+    {
+        zone->value = ZONE_NO_READING;
+        zone->errors++;
+    }
+    zone->time_us = timebase_us();
+
+    zone_control(zone);
+    zone_io->output(zone, zone->out);
+
+    if (zone_event != 0)
+    {
+        sched_event_set(zone_event);
+    }
+}
+
+/*!
+ * \brief Controller or auto-tune step for a new reading
+ */
+static void zone_control(zone_t* zone)
+{
+    uint32_t start = timebase_cycles();
+    uint32_t cycles;
+    pid_tune_state_t state;
+
+    if (zone->tune != NULL)
+    {
+        /* a failed read is below any input_min and aborts the tune */
+        state = pid_tune_update(zone->tune, zone->value);
+        zone->out = zone->tune->output;
+
+        if (state == PID_TUNE_DONE)
+        {
+            pid_tune_apply(zone->tune, &zone->pid);
+        }
+        if (state != PID_TUNE_RUNNING)
+        {
+            pid_ctrl_reset(&zone->pid);
+            zone->tune = NULL;
+        }
+    }
+    else if (zone->value == ZONE_NO_READING)
+    {
+        /* no reading, no heating */
+        zone->out = zone->pid.out_min;
+        pid_ctrl_reset(&zone->pid);
+    }
+    else
+    {
+        zone->out = pid_ctrl_update(&zone->pid, zone->value);
+    }
+
+    cycles = timebase_cycles() - start;
+    if (cycles > stats.control_cycles_max)
+    {
+        stats.control_cycles_max = cycles;
+    }
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZONE_H_
+#define ZONE_H_
+
+#include <stdint.h>
+#include <onewire/onewire.h>
+#include <pid/pid.h>
+#include <pid/pid_autotune.h>
+
+/*!
+ * \file zone.h
+ * \brief Control zones: sensor / output pairs with their own controller
+ * \details The zones are served in equal slots of period / count, one zone
+ *          per slot, so the bus traffic and the computation are spread over
+ *          the period instead of all zones at one instant. In every slot one
+ *          conversion is started. When the conversion is shorter than a
+ *          slot, it is read, controlled and output conversion_ms later in
+ *          the same slot (a one-shot timer, so a STOP mode build wakes when
+ *          the result is due). Otherwise each slot reads the conversion
+ *          started conversion_ms (rounded up to whole slots) earlier:
+ *
+ *              slot    0    1    2    3    0    1
+ *              start   z0   z1   z2   z3   z0   z1
+ *              read              z0   z1   z2   z3      (lag 2 slots)
+ *
+ *          Every zone is read once per period, the reading is at most one
+ *          period old. The sensor bus and the outputs are reached through
+ *          zone_io_t.
+ */
+
+#define ZONE_MAX            32
+#define ZONE_NO_READING     INT32_MIN   /* value after a failed read */
+
+typedef struct zone_s zone_t;
+
+/*!
+ * \brief Hardware behind the zones
+ */
+typedef struct {
+    void (*start)(const zone_t* zone);                      /*!< start a conversion */
+    int8_t (*read)(const zone_t* zone, int32_t* value);     /*!< read it, 0 OK, -1 error */
+    void (*output)(const zone_t* zone, int32_t output);     /*!< apply the controller output */
+} zone_io_t;
+
+/*!
+ * \brief One zone, set up sensor, output and pid before zone_init()
+ */
+struct zone_s {
+    onewire_rom_t sensor;       /*!< sensor ROM code, all zero for the only sensor */
+    uint8_t output;             /*!< output channel */
+    pid_ctrl_t pid;             /*!< controller, setpoint and gains */
+    pid_tune_t* tune;           /*!< running auto-tune, replaces the controller, NULL if none */
+    int32_t value;              /*!< last reading, ZONE_NO_READING after a failed read */
+    uint64_t time_us;           /*!< timebase_us() of the last read */
+    int32_t out;                /*!< last output */
+    uint8_t converting;         /*!< conversion started, not read yet */
+    uint32_t errors;            /*!< failed reads */
+};
+
+/*!
+ * \brief Zone timing, slot cost from the cycle counter, jitter from the timebase
+ */
+typedef struct {
+    uint32_t slots;
+    uint32_t slot_cycles_last;      /*!< read, control, output and conversion start */
+    uint32_t slot_cycles_max;       /*!< also the read alone when it is in the slot */
+    uint32_t control_cycles_max;    /*!< controller or auto-tune step alone */
+    uint32_t jitter_us_max;         /*!< deviation of the slot interval from period / count */
+} zone_stats_t;
+
+/*!
+ * \brief Set up the zone table
+ * \param[in,out] zones table, stays in use
+ * \param[in] count number of zones, 1..ZONE_MAX
+ * \param[in] io sensor and output access, stays in use
+ * \param[in] period_ms each zone is served once per period, at least conversion_ms
+ * \param[in] conversion_ms sensor conversion time
+ * \param[in] event scheduler event set after each zone update, 0 for none
+ */
+void zone_init(zone_t* zones, uint8_t count, const zone_io_t* io, uint32_t period_ms,
+               uint32_t conversion_ms, uint32_t event);
+
+/*!
+ * \brief Change the sensor conversion time, e.g. after a resolution change
+ * \param[in] conversion_ms sensor conversion time, at most the period
+ */
+void zone_set_conversion_ms(uint32_t conversion_ms);
+
+/*!
+ * \brief Time from the conversion start to the read of a zone
+ * \returns milliseconds
+ */
+uint32_t zone_read_delay_ms(void);
+
+/*!
+ * \brief Start serving the zones from a scheduler task
+ */
+void zone_start(void);
+
+/*!
+ * \brief Serve the next slot now
+ * \details Called by the zone task, directly only without zone_start() (benchmark)
+ */
+void zone_slot(void);
+
+/*!
+ * \brief Get the zone timing
+ * \param[out] result filled with the timing
+ */
+void zone_get_stats(zone_stats_t* result);
+
+/*!
+ * \brief Clear the zone timing
+ */
+void zone_reset_stats(void);
+
+#endif
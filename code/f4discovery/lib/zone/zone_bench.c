@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <libopencm3/stm32/rcc.h>
+
+#include <timebase/timebase.h>
+#include <zone/zone.h>
+#include <zone/zone_bench.h>
+
+#define ZONE_BENCH_AMBIENT      2000    /* 1/100 degC */
+#define ZONE_BENCH_SETPOINT     2500
+#define ZONE_BENCH_PERIOD_MS    1000
+#define ZONE_BENCH_CONVERSION_MS 200
+
+static zone_t bench_zones[ZONE_MAX];
+static int32_t bench_temp[ZONE_MAX];    /* simulated chamber temperatures, 1/100 degC */
+
+/* static declarations */
+static void zone_bench_start(const zone_t* zone);
+static int8_t zone_bench_read(const zone_t* zone, int32_t* value);
+static void zone_bench_output(const zone_t* zone, int32_t output);
+
+static const zone_io_t bench_io = {
+    .start = zone_bench_start,
+    .read = zone_bench_read,
+    .output = zone_bench_output,
+};
+
+
+
+/* =================================================================== */
+
+
+/*!
+ * \brief Run the benchmark
+ * \param[out] results one entry per zone count 1..max_zones
+ * \param[in] max_zones largest zone count, up to ZONE_MAX
+ * \param[in] periods periods run per zone count
+ */
+void zone_bench_run(zone_bench_result_t* results, uint8_t max_zones, uint32_t periods)
+{
+    zone_stats_t stats;
+    uint32_t start;
+    uint32_t cycles;
+    uint32_t p;
+    uint8_t count;
+    uint8_t i;
+
+    if (max_zones > ZONE_MAX)
+    {
+        max_zones = ZONE_MAX;
+    }
+
+    for (count = 1; count <= max_zones; count++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            /* chambers at different temperatures, so the controllers disagree */
+            bench_zones[i].output = i;
+            pid_ctrl_init(&bench_zones[i].pid, PID_Q16(0.5), PID_Q16(0.01), PID_Q16(2.0), 0, 1000);
+            pid_ctrl_set_setpoint(&bench_zones[i].pid, ZONE_BENCH_SETPOINT);
+            bench_temp[i] = ZONE_BENCH_AMBIENT + 37 * i;
+        }
+
+        zone_init(bench_zones, count, &bench_io, ZONE_BENCH_PERIOD_MS, ZONE_BENCH_CONVERSION_MS, 0);
+
+        results[count - 1].zones = count;
+        results[count - 1].period_cycles_max = 0;
+
+        for (p = 0; p < periods; p++)
+        {
+            start = timebase_cycles();
+            for (i = 0; i < count; i++)
+            {
+                zone_slot();
+            }
+            cycles = timebase_cycles() - start;
+
+            if (cycles > results[count - 1].period_cycles_max)
+            {
+                results[count - 1].period_cycles_max = cycles;
+            }
+        }
+
+        zone_get_stats(&stats);
+        results[count - 1].slot_cycles_max = stats.slot_cycles_max;
+        results[count - 1].period_us_max = results[count - 1].period_cycles_max / (rcc_ahb_frequency / 1000000);
+    }
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Simulated conversion start, nothing to do
+ */
+static void zone_bench_start(const zone_t* zone)
+{
+    (void)zone;
+}
+
+/*!
+ * \brief Simulated reading
+ */
+static int8_t zone_bench_read(const zone_t* zone, int32_t* value)
+{
+    *value = bench_temp[zone->output];
+
+    return (0);
+}
+
+/*!
+ * \brief Simulated chamber: heating against the loss to ambient
+ */
+static void zone_bench_output(const zone_t* zone, int32_t output)
+{
+    int32_t* temp = &bench_temp[zone->output];
+
+    *temp += output / 20 - (*temp - ZONE_BENCH_AMBIENT) / 100;
+}
+
+/******************************************************************
+* END OF STATIC FUNCTIONS
+******************************************************************/
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ * 
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZONE_BENCH_H_
+#define ZONE_BENCH_H_
+
+#include <stdint.h>
+
+/*!
+ * \file zone_bench.h
+ * \brief Control cycle benchmark for 1..ZONE_MAX zones
+ * \details Runs the zone slots against simulated sensors and outputs (one
+ *          first order thermal model per zone), so only the computation is
+ *          measured. The bus time of a real slot (conversion start and
+ *          scratchpad read, independent of the zone count) adds once per
+ *          slot; it shows in zone_get_stats() during normal operation.
+ *
+ * \note Uses the zone module, run it before the real zones are set up.
+ */
+
+/*!
+ * \brief Worst case for one zone count
+ */
+typedef struct {
+    uint8_t zones;
+    uint32_t slot_cycles_max;       /*!< one slot */
+    uint32_t period_cycles_max;     /*!< all slots of one period */
+    uint32_t period_us_max;         /*!< the same in microseconds */
+} zone_bench_result_t;
+
+/*!
+ * \brief Run the benchmark
+ * \param[out] results one entry per zone count 1..max_zones
+ * \param[in] max_zones largest zone count, up to ZONE_MAX
+ * \param[in] periods periods run per zone count
+ */
+void zone_bench_run(zone_bench_result_t* results, uint8_t max_zones, uint32_t periods);
+
+#endif
@@ -19,43 +19,308 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/cm3/nvic.h>
-#include <libopencm3/cm3/systick.h>
 #include <libopencm3/stm32/exti.h>
 
 #include <ds18b20/ds18b20.h>
+#include <sched/sched.h>
+#include <timebase/timebase.h>
+#include <pid/pid.h>
+#include <pid/pid_autotune.h>
+#include <params/params.h>
+#include <heater/heater.h>
+#include <zone/zone.h>
+#include <filter/filter.h>
+#include <estimator/estimator.h>
+#include <flashlog/flashlog.h>
+#include <codec/codec.h>
+#include <telemetry/telemetry.h>
+#include <prof/prof.h>
+#ifndef LOW_POWER_SAMPLING
+#include <modbus/modbus.h>
+#include <console/console.h>
+#endif
+#ifdef ZONE_BENCHMARK
+#include <zone/zone_bench.h>
+#endif
+#ifdef LOW_POWER_SAMPLING
+#include <lowpower/lowpower.h>
+#endif
 
 #include <ssd1306/ssd1306.h>
+#ifndef SSD1306_PAGE_MODE
+#include <ssd1306/ssd1306_widget.h>
+#endif
+#if defined(SSD1306_TRANSPORT_SPI)
+#include <ssd1306/ssd1306_hal_spi.h>
+#else
+#include <ssd1306/ssd1306_hal_i2c.h>
+#endif
 
-uint32_t tick = 0;
+/* display power: dimmed and then switched off without activity */
+#define DISPLAY_DIM_AFTER_MS    30000
+#define DISPLAY_OFF_AFTER_MS    120000
+/* a temperature at or above this keeps the display on, 1/100 degC */
+#define TEMP_ALARM_CENTI        3500
+
+#ifdef LOW_POWER_SAMPLING
+#define SENSE_PERIOD_MS         10000   /* battery operation, STOP mode in between */
+#define STOP_MIN_MS             5       /* shorter idle times are spent in sleep mode */
+#define DISPLAY_PERIOD_MS       10000   /* estimate refresh, power state check */
+#else
+#define SENSE_PERIOD_MS         1000    /* every zone is measured once per period */
+#define DISPLAY_PERIOD_MS       250     /* estimate refresh, power state check */
+#endif
+#define DISPLAY_RETRY_MS        50      /* power state change failed on the bus */
+#define SENSE_CONVERSION_MS     200     /* 10 bit conversion takes 187.5 ms */
+#define LED_FLASH_MS            300     /* LED flash on button press */
+
+/* one zone per sensor found, up to one per heater output; the controllers run
+   once per measurement, output 1/1000 heater power */
+#define ZONE_COUNT_MAX          HEATER_CHANNELS
+#define CONTROL_SETPOINT_CENTI  2500
+#define CONTROL_KP              PID_Q16(0.5)    /* 50 permille per degC error */
+#define CONTROL_KI              PID_Q16(0.01)   /* per measurement */
+#define CONTROL_KD              PID_Q16(2.0)    /* per measurement */
+#define HEATER_PERIOD_MS        10000
+#define HEATER_MIN_ON_MS        1000    /* relay protection */
+#define HEATER_MIN_OFF_MS       1000
+
+/* per zone filters: a median of 3 rejects single spikes (the 85.00 degC power-on
+   value) before the controller, the EMA smooths display and telemetry */
+#define FILTER_MEDIAN_WINDOW    3
+#define FILTER_EMA_TAU_MS       5000
+#define FILTER_MINMAX_WINDOW    60      /* readings */
+
+/* per zone estimator of the present temperature and rate (see estimator.h). A
+   reading is the mean over its conversion and trails a ramp by the thermal time
+   constant of the sensor, measure it with a step for the probe in use. Build
+   with ESTIMATOR_CONTROL=1 to control on the estimate instead of the reading.
+   tools/estimator_check runs these settings against a simulated zone. */
+#define ESTIMATOR_SENSOR_LAG_MS 3000
+#define ESTIMATOR_NOISE_CENTI   8       /* 10 bit resolution: 25 / sqrt(12) */
+#define ESTIMATOR_RATE_NOISE    1       /* 1/100 degC per s, change per s */
+#define ESTIMATOR_RATE_INIT     10      /* 1/100 degC per s */
+#define ESTIMATOR_STALE_MS      (5 * SENSE_PERIOD_MS)
+
+/* auto-tune of zone 0, started by holding the button during reset, gains are stored in flash */
+#define TUNE_RULE               PID_TUNE_TYREUS_LUYBEN
+#define TUNE_HYSTERESIS_CENTI   20
+#define TUNE_INPUT_MIN_CENTI    0       /* abort limits, also catch a lost sensor */
+#define TUNE_INPUT_MAX_CENTI    4500
+#define TUNE_TIMEOUT_MS         7200000 /* 2 h */
+
+/* history in flash: all zones every period, compressed into one record per block */
+#define LOG_PERIOD_MS           10000
+#define LOG_BLOCK_SAMPLES       30      /* 5 min per block, less if the block fills up */
+#define LOG_STEP_MS             1       /* pause between flash write steps */
+/* besides the blocks, a marker after every mount: block count 0 (no block has
+   that), then the boot number, 32 bit MSB first; times restart with each boot */
+#define LOG_BOOT_MARKER_LEN     6
+
+/* telemetry on USART3: a record per zone update, counters once per period */
+#ifdef LOW_POWER_SAMPLING
+#define TELEMETRY_COUNTERS_MS   SENSE_PERIOD_MS /* no extra wakeups from STOP mode */
+#else
+#define TELEMETRY_COUNTERS_MS   1000
+#endif
+
+/* stage profiling (PROFILING=1, see prof.h): one telemetry record per stage and period */
+#define PROF_EXPORT_MS          10000
+
+/* Modbus RTU slave on USART6, not in battery operation (no reception in STOP mode).
+   Input registers, 32 bit values high word first:
+       0..3    zone temperature, 1/100 degC, 0x8000 without reading
+       4..7    zone output, 1/1000
+       8       zones
+       9       CPU load, 1/1000
+       10..11  uptime, s
+       12..13  zone read errors, all zones
+       14..15  telemetry records dropped
+       16..17  flash log records
+       18..19  Modbus frames received
+       20..21  Modbus CRC errors
+   Holding registers:
+       0..3    zone setpoint, 1/100 degC, signed */
+#define MODBUS_ADDRESS          1
+#define MODBUS_IMAGE_MS         1000    /* counter refresh, readings follow every zone update */
+#define MB_IN_TEMP              0
+#define MB_IN_OUTPUT            4
+#define MB_IN_ZONES             8
+#define MB_IN_LOAD              9
+#define MB_IN_UPTIME            10
+#define MB_IN_ZONE_ERRORS       12
+#define MB_IN_TLM_DROPPED       14
+#define MB_IN_LOG_RECORDS       16
+#define MB_IN_MB_FRAMES         18
+#define MB_IN_MB_CRC_ERRORS     20
+#define MB_HOLD_SETPOINT        0
+#define SETPOINT_MIN_CENTI      -5500   /* DS18B20 range */
+#define SETPOINT_MAX_CENTI      12500
+
+/* command console on USART1 for live changes, not in battery operation either;
+   gains are entered and shown in 1/1000 */
+#define GAIN_MILLI(q16)         ((int32_t)(((int64_t)(q16) * 1000) >> 16))
+#define GAIN_Q16(milli)         ((int32_t)(((int64_t)(milli) << 16) / 1000))
+#define GAIN_MAX_MILLI          32767000    /* Q16.16 in an int32_t */
+
+/* event flags set from interrupts or other tasks */
+#define EVENT_BUTTON            (1u << 0)   /* EXTI0, user button pressed */
+#define EVENT_TEMPERATURE       (1u << 1)   /* new zone reading */
+#define EVENT_MODBUS_WRITE      (1u << 2)   /* master wrote holding registers */
+#define EVENT_CONSOLE           (1u << 3)   /* console input */
+
+/* local panel: D/C PB14, CS PB12, RES PB11 on SPI2 or address 0x3C on I2C1 */
+#if defined(SSD1306_TRANSPORT_SPI)
+static ssd1306_hal_t display_hal = { .gpio_port = GPIOB, .dc_pin = GPIO14, .cs_pin = GPIO12, .res_pin = GPIO11 };
+#else
+static ssd1306_hal_t display_hal = { .bus = &ssd1306_i2c_bus1, .address = SSD1306_I2C_ADDR_PRIMARY };
+#endif
+static ssd1306_t display;
+#ifndef SSD1306_PAGE_MODE
+static ssd1306_widget_t temp_readout;	/* 1/100 degC */
+static ssd1306_widget_t temp_unit;
+static ssd1306_widget_t temp_bar;		/* 0..40 degC */
+#endif
+
+static sched_task_t button_task;
+static sched_task_t display_task;
+static sched_task_t control_task;
+static sched_task_t log_task;
+static sched_task_t log_flash_task;
+static sched_task_t telemetry_task;
+#ifndef LOW_POWER_SAMPLING
+static sched_task_t modbus_task;
+static sched_task_t console_task;
+#endif
+#ifdef PROFILING
+static sched_task_t prof_task;
+#endif
+
+static void zone_sensor_start(const zone_t* zone);
+static int8_t zone_sensor_read(const zone_t* zone, int32_t* value);
+static void zone_heater_output(const zone_t* zone, int32_t output);
+
+static const zone_io_t zone_io = {
+    .start = zone_sensor_start,
+    .read = zone_sensor_read,
+    .output = zone_heater_output,
+};
+
+/*!
+ * \brief Filters and statistics of a zone's readings
+ */
+typedef struct {
+    filter_median_t median;
+    filter_ema_t ema;
+    filter_stats_t stats;       /* since start */
+    filter_minmax_t minmax;     /* last FILTER_MINMAX_WINDOW readings */
+    int32_t smoothed;           /* EMA output, ZONE_NO_READING before the first reading */
+    estimator_t estimator;
+} zone_filter_t;
+
+static zone_t zones[ZONE_COUNT_MAX];
+static zone_filter_t zone_filters[ZONE_COUNT_MAX];
+static uint8_t zone_count = 0;
+static pid_tune_t tuner;
+static uint8_t tuning = 0;
+static codec_enc_t log_enc;
+static uint8_t log_block[FLASHLOG_RECORD_MAX];
+static uint32_t log_encode_cycles_max = 0;  /* inspect with the debugger */
+#ifdef ZONE_BENCHMARK
+static zone_bench_result_t zone_bench[ZONE_MAX];    /* inspect with the debugger */
+#endif
+
+/* profiled stages, empty without PROFILING */
+PROF_STAGE(sens_start);
+PROF_STAGE(sens_read);
+PROF_STAGE(filters);
+PROF_STAGE(tlm_send);
+#ifdef SSD1306_PAGE_MODE
+PROF_STAGE(disp_format);
+PROF_STAGE(disp_render);
+#else
+PROF_STAGE(disp_draw);
+PROF_STAGE(disp_update);
+#endif
 
-/* sleep for delay milliseconds */
-static void delay(uint32_t delay_msec);
 static void discovery_led_setup(void);
 static void discovery_button_setup(void);
+static void button_run(void* ctx, uint32_t events);
+static void display_run(void* ctx, uint32_t events);
+static void control_run(void* ctx, uint32_t events);
+static void zones_setup(void);
+static void log_run(void* ctx, uint32_t events);
+static void log_block_close(void);
+static void log_boot_mark(void);
+static void log_flash_run(void* ctx, uint32_t events);
+static void telemetry_run(void* ctx, uint32_t events);
+#ifdef PROFILING
+static void prof_run(void* ctx, uint32_t events);
+#endif
+#ifndef LOW_POWER_SAMPLING
+static void modbus_setup(void);
+static void modbus_run(void* ctx, uint32_t events);
+static void modbus_put32(uint16_t* regs, uint16_t reg, uint32_t value);
+static void console_setup(void);
+static void console_run(void* ctx, uint32_t events);
+static int8_t cmd_display(uint8_t argc, char** argv);
+static int8_t cmd_gains(uint8_t argc, char** argv);
+static int8_t cmd_help(uint8_t argc, char** argv);
+#ifdef PROFILING
+static int8_t cmd_prof(uint8_t argc, char** argv);
+#endif
+static int8_t cmd_res(uint8_t argc, char** argv);
+static int8_t cmd_save(uint8_t argc, char** argv);
+static int8_t cmd_setpoint(uint8_t argc, char** argv);
+static int8_t cmd_stats(uint8_t argc, char** argv);
+static int8_t cmd_status(uint8_t argc, char** argv);
+static int8_t arg_zone(const char* arg, uint8_t* zone);
+static int8_t arg_long(const char* arg, long min, long max, long* value);
+static void print_centi(int32_t centi);
+#endif
+static void tune_start(void);
+#ifdef SSD1306_PAGE_MODE
+static void draw_temperature(ssd1306_t* dev, void* ctx);
+#else
+static void show_temperature(float temp);
+#endif
+static int8_t display_power_update(float temp);
+static uint32_t reading_age_ms(uint32_t conversion_ms);
+#ifdef LOW_POWER_SAMPLING
+static uint32_t enter_stop(uint32_t max_ms);
+#endif
 
 
-uint32_t button_flag = 0;
+static float last_temp = 1.0;         /* shown temperature, inspect here with the debugger */
+static uint32_t last_activity = 0;    /* sched_now() of the last button press or alarm */
+static int8_t display_forced = -1;    /* ssd1306_power_t set from the console, -1: by activity */
 
 
 
 int main(void)
 {
     int8_t presence = 0;
-    float temp = 1.0;
-    char buf[30];
 
     rcc_clock_setup_hse_3v3(&rcc_hse_8mhz_3v3[RCC_CLOCK_3V3_168MHZ]);
 
-    systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+    /* 1 ms timebase */
+    sched_init();
+#ifdef PROFILING
+    prof_init();
+#endif
+
+#ifdef LOW_POWER_SAMPLING
+    /* idle time is spent in STOP mode, the clock setup is restored on wakeup */
+    lowpower_init(&rcc_hse_8mhz_3v3[RCC_CLOCK_3V3_168MHZ]);
+    sched_set_sleep_hook(enter_stop);
+#endif
 
-    /* set systick for 1ms ticks */
-    systick_set_reload(21000);
-    systick_clear();
-    systick_interrupt_enable();
-    systick_counter_enable();
+    telemetry_init();
 
     /* initi f4 discovery button / leds */
     discovery_led_setup();
@@ -64,64 +329,66 @@ int main(void)
     /* init DS18B20 temoerature sensor */
     presence = ds18b20_init();
 
+    /* all sensors at once */
     ds18b20_set_resolution(DS18B20_RES_10B);
 
-    delay(100);
-    ssd1306_init();
-
-
-    while (1) {
-        if(button_flag == 1)
-        {
-            //button_flag = 0;
+#ifdef ZONE_BENCHMARK
+    zone_bench_run(zone_bench, ZONE_MAX, 100);
+#endif
 
-            /* when button is pressed, turn LED on for a short time (also serves as debouncing) */
-            gpio_set(GPIOD, GPIO12);
-            delay(300);
-            gpio_clear(GPIOD, GPIO12);
+    zones_setup();
 
+    /* may erase a sector the first time */
+    flashlog_mount();
+    log_boot_mark();
+    codec_enc_init(&log_enc, log_block, sizeof(log_block), zone_count);
 
-            /* start a measurement */
-            ds18b20_start_conversion();
+    sched_delay_ms(100);
+    ssd1306_init(&display, &display_hal);
 
-            delay(1000);
-            temp = ds18b20_get_temperature();
+#ifndef SSD1306_PAGE_MODE
+    ssd1306_widget_readout_init(&temp_readout, 0, 0, 7, 2, font_11x18);
+    ssd1306_widget_label_init(&temp_unit, 77, 0, 1, font_11x18);
+    ssd1306_widget_set_text(&temp_unit, "C");
+    ssd1306_widget_bar_init(&temp_bar, 0, 24, 120, 8, 0, 4000);
+#endif
 
-            sprintf(buf, "%i.%i C", (int)temp, (int)((temp-(int)temp)*1000));
+    sched_task_add(&button_task, button_run, NULL, EVENT_BUTTON);
+    sched_task_add(&display_task, display_run, NULL, EVENT_BUTTON | EVENT_TEMPERATURE);
+    sched_timer_start(&display_task, DISPLAY_PERIOD_MS, DISPLAY_PERIOD_MS);
+    sched_task_add(&control_task, control_run, NULL, EVENT_TEMPERATURE);
+    sched_task_add(&log_task, log_run, NULL, 0);
+    sched_timer_start(&log_task, LOG_PERIOD_MS, LOG_PERIOD_MS);
+    sched_task_add(&log_flash_task, log_flash_run, NULL, 0);
+    sched_task_add(&telemetry_task, telemetry_run, NULL, 0);
+    sched_timer_start(&telemetry_task, TELEMETRY_COUNTERS_MS, TELEMETRY_COUNTERS_MS);
+#ifdef PROFILING
+    sched_task_add(&prof_task, prof_run, NULL, 0);
+    sched_timer_start(&prof_task, PROF_EXPORT_MS, PROF_EXPORT_MS);
+#endif
+#ifndef LOW_POWER_SAMPLING
+    modbus_setup();
+    console_setup();
+#endif
+    /* added last: runs first in a pass, the display does not delay the slots */
+    zone_start();
 
-            ssd1306_set_cursor(0,0);
-            ssd1306_put_str((char*)buf, font_7x10);
-            ssd1306_update();
-
-
-            /* place breakpoint here, inspect variable 'temp' */
-
-        }
-    } 
+    if (gpio_get(GPIOA, GPIO0))
+    {
+        tune_start();
+    }
 
+    sched_run();
 
     return 0;
 }
 
-void sys_tick_handler(void)
-{
-    tick++;
-
-}
-
-/* sleep for delay milliseconds */
-static void delay(uint32_t delay_msec)
-{
-    uint32_t wake = tick + delay_msec;
-    while (wake > tick);
-}
-
 static void discovery_led_setup(void)
 {
     /* Enable GPIOD clock. */
     rcc_periph_clock_enable(RCC_GPIOD);
 
-    /* Set GPIO12 (in GPIO port D) to 'output push-pull'. */
+    /* Set GPIO12 (in GPIO port D) to 'output push-pull', heater_init() takes the heater outputs */
     gpio_mode_setup(GPIOD, GPIO_MODE_OUTPUT,
             GPIO_PUPD_NONE, GPIO12 | GPIO13 | GPIO14 | GPIO15);
 }
@@ -143,10 +410,925 @@ static void discovery_button_setup(void)
 
 }
 
+/* button press: flash the LED */
+static void button_run(void* ctx, uint32_t events)
+{
+    (void)ctx;
+
+    if (events & EVENT_BUTTON)
+    {
+        gpio_set(GPIOD, GPIO12);
+        sched_timer_start(&button_task, LED_FLASH_MS, 0);
+    }
+
+    if (events & SCHED_EVENT_TIMER)
+    {
+        gpio_clear(GPIOD, GPIO12);
+    }
+}
+
+/* show new readings, handle display power */
+static void display_run(void* ctx, uint32_t events)
+{
+#ifdef SSD1306_PAGE_MODE
+    static char buf[30];
+#endif
+    int32_t centi;
+
+    (void)ctx;
+
+    if (events & EVENT_BUTTON)
+    {
+        last_activity = sched_now();
+    }
+
+    /* zone 0 predicted to now, between readings as well */
+    if (estimator_get(&zone_filters[0].estimator, sched_now(), &centi, NULL) == 0)
+    {
+        last_temp = centi / 100.0f;
+    }
+    else if (zone_filters[0].smoothed != ZONE_NO_READING)
+    {
+        last_temp = zone_filters[0].smoothed / 100.0f;
+    }
+
+    display_power_update(last_temp);
+
+    if (events & (EVENT_TEMPERATURE | SCHED_EVENT_TIMER))
+    {
+#ifdef SSD1306_PAGE_MODE
+        PROF_BEGIN(disp_format);
+        sprintf(buf, "%i.%i C", (int)last_temp, (int)((last_temp-(int)last_temp)*1000));
+        PROF_END(disp_format);
+
+        PROF_BEGIN(disp_render);
+        ssd1306_render(&display, draw_temperature, buf);
+        PROF_END(disp_render);
+#else
+        show_temperature(last_temp);
+#endif
+    }
+}
+
+/* after zone readings: finish an auto-tune */
+static void control_run(void* ctx, uint32_t events)
+{
+    params_t params;
+
+    (void)ctx;
+    (void)events;
+
+#ifdef LOW_POWER_SAMPLING
+    lowpower_result_ready();
+#endif
+
+    /* the zone drops the tune once it is done or aborted */
+    if (tuning && zones[0].tune == NULL)
+    {
+        tuning = 0;
+        gpio_clear(GPIOD, GPIO15);
+
+        if (tuner.state == PID_TUNE_DONE)
+        {
+            params.kp = zones[0].pid.kp;
+            params.ki = zones[0].pid.ki;
+            params.kd = zones[0].pid.kd;
+            (void)params_save(&params);
+        }
+    }
+}
+
+/* add the zone readings to the log block: uptime in s, then 1/100 degC per zone */
+static void log_run(void* ctx, uint32_t events)
+{
+    int16_t values[ZONE_COUNT_MAX];
+    uint32_t seconds = (uint32_t)(timebase_ms() / 1000);    /* not sched_now(), which wraps after 49 days */
+    uint32_t start;
+    uint8_t i;
+
+    (void)ctx;
+    (void)events;
+
+    for (i = 0; i < zone_count; i++)
+    {
+        values[i] = (zones[i].value == ZONE_NO_READING) ? INT16_MIN : (int16_t)zones[i].value;
+    }
+
+    start = timebase_cycles();
+    if (codec_enc_put(&log_enc, seconds, values) != 0)
+    {
+        /* block full, the sample starts the next one */
+        log_block_close();
+        (void)codec_enc_put(&log_enc, seconds, values);
+    }
+    start = timebase_cycles() - start;
+    if (start > log_encode_cycles_max)
+    {
+        log_encode_cycles_max = start;
+    }
+
+    if (log_enc.count >= LOG_BLOCK_SAMPLES)
+    {
+        log_block_close();
+    }
+}
+
+/* append the log block to the flash log and start a new one */
+static void log_block_close(void)
+{
+    uint16_t len = codec_enc_finish(&log_enc);
+
+    if (len > 0)
+    {
+        (void)flashlog_append(log_block, (uint8_t)len);
+        log_flash_run(NULL, 0);
+    }
+
+    codec_enc_init(&log_enc, log_block, sizeof(log_block), zone_count);
+}
+
+/* boot marker, numbered on from the last one still in the log */
+static void log_boot_mark(void)
+{
+    flashlog_iter_t iter;
+    uint32_t boot = 1;
+    int16_t len;
+
+    flashlog_iter_init(&iter);
+    while ((len = flashlog_iter_next(&iter, log_block, sizeof(log_block))) >= 0)
+    {
+        if (len == LOG_BOOT_MARKER_LEN && log_block[0] == 0 && log_block[1] == 0)
+        {
+            boot = (((uint32_t)log_block[2] << 24) | ((uint32_t)log_block[3] << 16) |
+                    ((uint32_t)log_block[4] << 8) | log_block[5]) + 1;
+        }
+    }
+
+    log_block[0] = 0;
+    log_block[1] = 0;
+    log_block[2] = (uint8_t)(boot >> 24);
+    log_block[3] = (uint8_t)(boot >> 16);
+    log_block[4] = (uint8_t)(boot >> 8);
+    log_block[5] = (uint8_t)boot;
+    /* written with the page, the next block close runs the flash steps */
+    (void)flashlog_append(log_block, LOG_BOOT_MARKER_LEN);
+}
+
+/* flash writes in short steps, so the zone slots are not held up */
+static void log_flash_run(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    if (flashlog_service())
+    {
+        sched_timer_start(&log_flash_task, LOG_STEP_MS, 0);
+    }
+}
+
+/* counter snapshot to the telemetry stream */
+static void telemetry_run(void* ctx, uint32_t events)
+{
+    telemetry_counters_t counters;
+    telemetry_stats_t tlm;
+    zone_stats_t zone;
+    flashlog_stats_t log;
+
+    (void)ctx;
+    (void)events;
+
+    telemetry_get_stats(&tlm);
+    zone_get_stats(&zone);
+    flashlog_get_stats(&log);
+
+    counters.load_permille = sched_load_permille();
+    counters.tlm_records = tlm.records;
+    counters.tlm_dropped = tlm.dropped;
+    counters.zone_slot_cycles_max = zone.slot_cycles_max;
+    counters.zone_jitter_us_max = zone.jitter_us_max;
+    counters.log_records = log.records;
+    counters.log_dropped = log.dropped;
+    counters.log_encode_cycles_max = log_encode_cycles_max;
+
+    (void)telemetry_send(TELEMETRY_REC_COUNTERS, &counters, sizeof(counters));
+}
+
+#ifdef PROFILING
+/* stage statistics to the telemetry stream, the histogram from the bin of the minimum */
+static void prof_run(void* ctx, uint32_t events)
+{
+    telemetry_profile_t record;
+    const prof_stage_t* stage;
+    uint8_t bin;
+    uint8_t i;
+
+    (void)ctx;
+    (void)events;
+
+    for (stage = prof_first(); stage != NULL; stage = stage->next)
+    {
+        if (stage->count == 0)
+        {
+            continue;
+        }
+
+        memset(&record, 0, sizeof(record));
+        strncpy(record.name, stage->name, sizeof(record.name) - 1);
+        record.count = stage->count;
+        record.min = stage->min;
+        record.max = stage->max;
+        record.total = stage->total;
+        record.hist_first = prof_bin(stage->min);
+
+        for (bin = record.hist_first; bin < PROF_HIST_BINS; bin++)
+        {
+            i = bin - record.hist_first;
+            if (i >= TELEMETRY_PROFILE_BINS)
+            {
+                i = TELEMETRY_PROFILE_BINS - 1;
+            }
+            record.hist[i] = (stage->hist[bin] + record.hist[i] > UINT16_MAX) ? UINT16_MAX
+                             : (uint16_t)(stage->hist[bin] + record.hist[i]);
+        }
+
+        (void)telemetry_send(TELEMETRY_REC_PROFILE, &record, sizeof(record));
+    }
+}
+#endif
+
+#ifndef LOW_POWER_SAMPLING
+/* Modbus slave, holding registers start with the setpoints in use */
+static void modbus_setup(void)
+{
+    static modbus_limits_t limits[MODBUS_HOLDING_REGS];
+    uint8_t i;
+
+    for (i = 0; i < ZONE_COUNT_MAX; i++)
+    {
+        limits[MB_HOLD_SETPOINT + i].min = SETPOINT_MIN_CENTI;
+        limits[MB_HOLD_SETPOINT + i].max = SETPOINT_MAX_CENTI;
+    }
+    for (i = 0; i < zone_count; i++)
+    {
+        modbus_holding_set(MB_HOLD_SETPOINT + i, (uint16_t)zones[i].pid.setpoint);
+    }
+
+    modbus_init(MODBUS_ADDRESS, limits, EVENT_MODBUS_WRITE);
+
+    sched_task_add(&modbus_task, modbus_run, NULL, EVENT_TEMPERATURE | EVENT_MODBUS_WRITE);
+    sched_timer_start(&modbus_task, 0, MODBUS_IMAGE_MS);
+}
+
+/* apply setpoints written by the master, refresh the register image */
+static void modbus_run(void* ctx, uint32_t events)
+{
+    uint16_t* regs;
+    modbus_stats_t bus;
+    telemetry_stats_t tlm;
+    flashlog_stats_t log;
+    uint32_t errors = 0;
+    uint8_t i;
+
+    (void)ctx;
+
+    if (events & EVENT_MODBUS_WRITE)
+    {
+        for (i = 0; i < zone_count; i++)
+        {
+            pid_ctrl_set_setpoint(&zones[i].pid, (int16_t)modbus_holding_get(MB_HOLD_SETPOINT + i));
+        }
+    }
+
+    modbus_get_stats(&bus);
+    telemetry_get_stats(&tlm);
+    flashlog_get_stats(&log);
+
+    regs = modbus_input_begin();
+
+    for (i = 0; i < ZONE_COUNT_MAX; i++)
+    {
+        if (i >= zone_count || zones[i].value == ZONE_NO_READING)
+        {
+            regs[MB_IN_TEMP + i] = 0x8000;
+            regs[MB_IN_OUTPUT + i] = 0;
+        }
+        else
+        {
+            regs[MB_IN_TEMP + i] = (uint16_t)zones[i].value;
+            regs[MB_IN_OUTPUT + i] = (uint16_t)zones[i].out;
+        }
+        if (i < zone_count)
+        {
+            errors += zones[i].errors;
+        }
+    }
+    regs[MB_IN_ZONES] = zone_count;
+    regs[MB_IN_LOAD] = sched_load_permille();
+    modbus_put32(regs, MB_IN_UPTIME, (uint32_t)(timebase_ms() / 1000));
+    modbus_put32(regs, MB_IN_ZONE_ERRORS, errors);
+    modbus_put32(regs, MB_IN_TLM_DROPPED, tlm.dropped);
+    modbus_put32(regs, MB_IN_LOG_RECORDS, log.records);
+    modbus_put32(regs, MB_IN_MB_FRAMES, bus.frames);
+    modbus_put32(regs, MB_IN_MB_CRC_ERRORS, bus.crc_errors);
+
+    modbus_input_commit();
+}
+
+/* 32 bit value in two registers, high word first */
+static void modbus_put32(uint16_t* regs, uint16_t reg, uint32_t value)
+{
+    regs[reg] = (uint16_t)(value >> 16);
+    regs[reg + 1] = (uint16_t)value;
+}
+
+/* console commands, sorted by name */
+static const console_cmd_t console_cmds[] = {
+    { "display",  cmd_display,  "auto|full|dim|off  display power, auto: by activity" },
+    { "gains",    cmd_gains,    "<zone> [kp ki kd]  show or set the gains, 1/1000" },
+    { "help",     cmd_help,     "                   this list" },
+#ifdef PROFILING
+    { "prof",     cmd_prof,     "[reset]            stage cycles, reset clears them" },
+#endif
+    { "res",      cmd_res,      "9|10|11|12         sensor resolution, bits" },
+    { "save",     cmd_save,     "                   store the gains of zone 0 in flash" },
+    { "setpoint", cmd_setpoint, "<zone> [centi]     show or set the setpoint, 1/100 degC" },
+    { "stats",    cmd_stats,    "                   counters" },
+    { "status",   cmd_status,   "                   readings and outputs" },
+};
+
+static void console_setup(void)
+{
+    (void)console_init(console_cmds, sizeof(console_cmds) / sizeof(console_cmds[0]), EVENT_CONSOLE);
+    sched_task_add(&console_task, console_run, NULL, EVENT_CONSOLE);
+}
+
+/* received bytes: echo, run complete lines */
+static void console_run(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    console_poll();
+}
+
+static int8_t cmd_display(uint8_t argc, char** argv)
+{
+    if (argc != 2)
+    {
+        return (-1);
+    }
+
+    if (strcmp(argv[1], "auto") == 0)
+    {
+        display_forced = -1;
+        last_activity = sched_now();
+    }
+    else if (strcmp(argv[1], "full") == 0)
+    {
+        display_forced = SSD1306_POWER_FULL;
+    }
+    else if (strcmp(argv[1], "dim") == 0)
+    {
+        display_forced = SSD1306_POWER_DIMMED;
+    }
+    else if (strcmp(argv[1], "off") == 0)
+    {
+        display_forced = SSD1306_POWER_OFF;
+    }
+    else
+    {
+        return (-1);
+    }
+
+    if (display_power_update(last_temp) != 0)
+    {
+        console_printf("display not responding, retrying\r\n");
+    }
+
+    return (0);
+}
+
+static int8_t cmd_gains(uint8_t argc, char** argv)
+{
+    pid_ctrl_t* pid;
+    long kp, ki, kd;
+    uint8_t zone;
+
+    if ((argc != 2 && argc != 5) || arg_zone(argv[1], &zone) != 0)
+    {
+        return (-1);
+    }
+    pid = &zones[zone].pid;
+
+    if (argc == 5)
+    {
+        /* all three or none */
+        if (arg_long(argv[2], 0, GAIN_MAX_MILLI, &kp) != 0 ||
+            arg_long(argv[3], 0, GAIN_MAX_MILLI, &ki) != 0 ||
+            arg_long(argv[4], 0, GAIN_MAX_MILLI, &kd) != 0)
+        {
+            return (-1);
+        }
+        pid->kp = GAIN_Q16(kp);
+        pid->ki = GAIN_Q16(ki);
+        pid->kd = GAIN_Q16(kd);
+    }
+
+    console_printf("zone %u kp %ld ki %ld kd %ld\r\n", zone, (long)GAIN_MILLI(pid->kp),
+                   (long)GAIN_MILLI(pid->ki), (long)GAIN_MILLI(pid->kd));
+
+    return (0);
+}
+
+static int8_t cmd_help(uint8_t argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    console_help();
+
+    return (0);
+}
+
+#ifdef PROFILING
+static int8_t cmd_prof(uint8_t argc, char** argv)
+{
+    const prof_stage_t* stage;
+    uint32_t cycles_per_us = rcc_ahb_frequency / 1000000;
+
+    if (argc == 2 && strcmp(argv[1], "reset") == 0)
+    {
+        prof_reset();
+        return (0);
+    }
+    if (argc != 1)
+    {
+        return (-1);
+    }
+
+    console_print("stage          count      min     mean      max  cycles, max us\r\n");
+    for (stage = prof_first(); stage != NULL; stage = stage->next)
+    {
+        if (stage->count == 0)
+        {
+            continue;
+        }
+        console_printf("%-11s %8lu %8lu %8lu %8lu  %lu\r\n", stage->name, (unsigned long)stage->count,
+                       (unsigned long)stage->min, (unsigned long)(stage->total / stage->count),
+                       (unsigned long)stage->max, (unsigned long)(stage->max / cycles_per_us));
+    }
+
+    return (0);
+}
+#endif
+
+/* all sensors at once, the zone timing follows the conversion time */
+static int8_t cmd_res(uint8_t argc, char** argv)
+{
+    static const struct {
+        ds18b20_resolution_t resolution;
+        uint16_t conversion_ms;
+    } res[] = {
+        { DS18B20_RES_9B,  100 },   /* 93.75 ms */
+        { DS18B20_RES_10B, 200 },   /* 187.5 ms */
+        { DS18B20_RES_11B, 400 },   /* 375 ms */
+        { DS18B20_RES_12B, 760 },   /* 750 ms */
+    };
+    long bits;
+    uint8_t i;
+
+    if (argc != 2)
+    {
+        return (-1);
+    }
+    if (arg_long(argv[1], 9, 12, &bits) != 0)
+    {
+        return (-1);
+    }
+
+    /* written to all sensors, the read back only works with one on the bus */
+    if (ds18b20_set_resolution(res[bits - 9].resolution) != 0)
+    {
+        console_print("read back differs\r\n");
+    }
+    zone_set_conversion_ms(res[bits - 9].conversion_ms);
+    for (i = 0; i < zone_count; i++)
+    {
+        estimator_set_delay(&zone_filters[i].estimator, reading_age_ms(res[bits - 9].conversion_ms));
+    }
+
+    return (0);
+}
+
+static int8_t cmd_save(uint8_t argc, char** argv)
+{
+    params_t params;
+
+    (void)argc;
+    (void)argv;
+
+    params.kp = zones[0].pid.kp;
+    params.ki = zones[0].pid.ki;
+    params.kd = zones[0].pid.kd;
+    console_print((params_save(&params) == 0) ? "saved\r\n" : "flash write failed\r\n");
+
+    return (0);
+}
+
+static int8_t cmd_setpoint(uint8_t argc, char** argv)
+{
+    long centi;
+    uint8_t zone;
+
+    if ((argc != 2 && argc != 3) || arg_zone(argv[1], &zone) != 0)
+    {
+        return (-1);
+    }
+
+    if (argc == 3)
+    {
+        if (arg_long(argv[2], SETPOINT_MIN_CENTI, SETPOINT_MAX_CENTI, &centi) != 0)
+        {
+            return (-1);
+        }
+        pid_ctrl_set_setpoint(&zones[zone].pid, centi);
+        modbus_holding_set(MB_HOLD_SETPOINT + zone, (uint16_t)centi);
+    }
+
+    console_printf("zone %u setpoint %ld\r\n", zone, (long)zones[zone].pid.setpoint);
+
+    return (0);
+}
+
+static int8_t cmd_stats(uint8_t argc, char** argv)
+{
+    telemetry_stats_t tlm;
+    modbus_stats_t bus;
+    flashlog_stats_t log;
+    zone_stats_t zone;
+    console_stats_t con;
+
+    (void)argc;
+    (void)argv;
+
+    telemetry_get_stats(&tlm);
+    modbus_get_stats(&bus);
+    flashlog_get_stats(&log);
+    zone_get_stats(&zone);
+    console_get_stats(&con);
+
+    console_printf("uptime %lu s, load %u/1000\r\n", (unsigned long)(timebase_ms() / 1000), sched_load_permille());
+    console_printf("zone slots %lu, slot max %lu cycles, jitter max %lu us\r\n", (unsigned long)zone.slots,
+                   (unsigned long)zone.slot_cycles_max, (unsigned long)zone.jitter_us_max);
+    console_printf("telemetry %lu records, %lu dropped\r\n", (unsigned long)tlm.records, (unsigned long)tlm.dropped);
+    console_printf("modbus %lu frames, %lu crc errors, %lu replies, reply max %lu us\r\n", (unsigned long)bus.frames,
+                   (unsigned long)bus.crc_errors, (unsigned long)bus.replies, (unsigned long)bus.reply_us_max);
+    console_printf("log %lu records, %lu dropped, %lu erases\r\n", (unsigned long)log.records,
+                   (unsigned long)log.dropped, (unsigned long)log.erases);
+    console_printf("console %lu lines, %lu overruns, %lu tx dropped\r\n", (unsigned long)con.lines,
+                   (unsigned long)con.overruns, (unsigned long)con.tx_dropped);
+
+    return (0);
+}
+
+static int8_t cmd_status(uint8_t argc, char** argv)
+{
+    int32_t estimate;
+    int32_t rate;
+    uint8_t i;
+
+    (void)argc;
+    (void)argv;
+
+    for (i = 0; i < zone_count; i++)
+    {
+        if (zones[i].value == ZONE_NO_READING)
+        {
+            console_printf("zone %u  no reading  ", i);
+        }
+        else
+        {
+            console_printf("zone %u  ", i);
+            print_centi(zones[i].value);
+            console_print(" C  ");
+        }
+        console_printf("setpoint %ld  output %ld/1000  errors %lu%s\r\n", (long)zones[i].pid.setpoint,
+                       (long)zones[i].out, (unsigned long)zones[i].errors, zones[i].tune ? "  tuning" : "");
+        if (zone_filters[i].stats.count > 0)
+        {
+            console_printf("        min %ld  max %ld (last %u)  mean %ld  variance %lu (%lu readings)\r\n",
+                           (long)filter_minmax_min(&zone_filters[i].minmax),
+                           (long)filter_minmax_max(&zone_filters[i].minmax), FILTER_MINMAX_WINDOW,
+                           (long)filter_stats_mean(&zone_filters[i].stats),
+                           (unsigned long)filter_stats_variance(&zone_filters[i].stats),
+                           (unsigned long)zone_filters[i].stats.count);
+        }
+        if (estimator_get(&zone_filters[i].estimator, sched_now(), &estimate, &rate) == 0)
+        {
+            console_print("        estimate ");
+            print_centi(estimate);
+            console_printf(" C  rate %ld/100 C per min\r\n", (long)rate);
+        }
+    }
+
+    return (0);
+}
+
+/* zone number argument */
+static int8_t arg_zone(const char* arg, uint8_t* zone)
+{
+    long value;
+
+    if (arg_long(arg, 0, (long)zone_count - 1, &value) != 0)
+    {
+        return (-1);
+    }
+    *zone = (uint8_t)value;
+
+    return (0);
+}
+
+/* 1/100 degC as degC with two decimals, the sign also for -0.99..-0.01 */
+static void print_centi(int32_t centi)
+{
+    console_printf("%s%ld.%02ld", (centi < 0) ? "-" : "", labs(centi) / 100, labs(centi) % 100);
+}
+
+/* whole decimal number within min..max, nothing else in the argument */
+static int8_t arg_long(const char* arg, long min, long max, long* value)
+{
+    char* end;
+
+    *value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || *value < min || *value > max)
+    {
+        return (-1);
+    }
+
+    return (0);
+}
+#endif
+
+/* one zone per sensor on the bus, the gains of zone 0 may come from flash */
+static void zones_setup(void)
+{
+    onewire_rom_t roms[ZONE_COUNT_MAX];
+    params_t params;
+    estimator_config_t estimator = {
+        .noise = ESTIMATOR_NOISE_CENTI,
+        .rate_noise = ESTIMATOR_RATE_NOISE,
+        .rate_init = ESTIMATOR_RATE_INIT,
+        .stale_ms = ESTIMATOR_STALE_MS,
+    };
+    uint8_t i;
+
+    zone_count = onewire_search(roms, ZONE_COUNT_MAX);
+    if (zone_count == 0)
+    {
+        /* search failed: try the single sensor case */
+        zone_count = 1;
+        roms[0] = (onewire_rom_t){ { 0 } };
+    }
+
+    for (i = 0; i < zone_count; i++)
+    {
+        zones[i].sensor = roms[i];
+        zones[i].output = i;
+        pid_ctrl_init(&zones[i].pid, CONTROL_KP, CONTROL_KI, CONTROL_KD, 0, 1000);
+        pid_ctrl_set_setpoint(&zones[i].pid, CONTROL_SETPOINT_CENTI);
+
+        filter_median_init(&zone_filters[i].median, FILTER_MEDIAN_WINDOW);
+        filter_ema_init(&zone_filters[i].ema, FILTER_EMA_TAU_MS, SENSE_PERIOD_MS);
+        filter_stats_init(&zone_filters[i].stats);
+        filter_minmax_init(&zone_filters[i].minmax, FILTER_MINMAX_WINDOW);
+        zone_filters[i].smoothed = ZONE_NO_READING;
+    }
+
+    if (params_load(&params) == 0)
+    {
+        zones[0].pid.kp = params.kp;
+        zones[0].pid.ki = params.ki;
+        zones[0].pid.kd = params.kd;
+    }
+
+    heater_init(zone_count, HEATER_PERIOD_MS, HEATER_MIN_ON_MS, HEATER_MIN_OFF_MS);
+    zone_init(zones, zone_count, &zone_io, SENSE_PERIOD_MS, SENSE_CONVERSION_MS, EVENT_TEMPERATURE);
+
+    /* the reading age follows from the slot timing */
+    estimator.delay_ms = reading_age_ms(SENSE_CONVERSION_MS);
+    for (i = 0; i < zone_count; i++)
+    {
+        estimator_init(&zone_filters[i].estimator, &estimator);
+    }
+}
+
+/* zone I/O: DS18B20 sensors on the 1-Wire bus */
+static void zone_sensor_start(const zone_t* zone)
+{
+    PROF_BEGIN(sens_start);
+    ds18b20_start_conversion_rom(&zone->sensor);
+    PROF_END(sens_start);
+}
+
+/* the controller gets the median (or its estimate of the present), the other filters follow it */
+static int8_t zone_sensor_read(const zone_t* zone, int32_t* value)
+{
+    zone_filter_t* filter = &zone_filters[zone - zones];
+    int32_t raw;
+    int8_t result;
+
+    PROF_BEGIN(sens_read);
+    result = ds18b20_read_temperature_rom(&zone->sensor, &raw);
+    PROF_END(sens_read);
+    if (result != 0)
+    {
+        return (-1);
+    }
+
+    PROF_BEGIN(filters);
+    *value = filter_median_update(&filter->median, raw);
+    filter->smoothed = filter_ema_update(&filter->ema, *value);
+    filter_stats_update(&filter->stats, *value);
+    filter_minmax_update(&filter->minmax, *value);
+    estimator_correct(&filter->estimator, sched_now(), *value);
+    PROF_END(filters);
+
+#ifdef ESTIMATOR_CONTROL
+    (void)estimator_get(&filter->estimator, sched_now(), value, NULL);
+#endif
+
+    return (0);
+}
+
+/* zone I/O: heater PWM outputs */
+static void zone_heater_output(const zone_t* zone, int32_t output)
+{
+    telemetry_zone_t record;
+    int32_t estimate;
+    int32_t rate;
+
+    heater_set(zone->output, (uint16_t)output);
+
+    record.zone = (uint8_t)(zone - zones);
+    record.tune_state = (zone->tune != NULL) ? (uint8_t)(zone->tune->state + 1) : 0;
+    record.value = zone->value;
+    record.setpoint = zone->pid.setpoint;
+    record.output = output;
+    record.integral = (int32_t)(zone->pid.integral >> 16);
+    record.errors = zone->errors;
+    record.smoothed = zone_filters[zone - zones].smoothed;
+    if (estimator_get(&zone_filters[zone - zones].estimator, sched_now(), &estimate, &rate) != 0)
+    {
+        estimate = INT32_MIN;
+        rate = 0;
+    }
+    record.estimate = estimate;
+    record.rate = rate;
+    record.read_us = zone->time_us;
+
+    PROF_BEGIN(tlm_send);
+    (void)telemetry_send(TELEMETRY_REC_ZONE, &record, sizeof(record));
+    PROF_END(tlm_send);
+}
+
+/* age of the median when it is read: from the middle of the conversion (the
+   sensor averages over it) to the read, plus the thermal lag of the sensor, plus
+   the delay of the median (on a ramp it is the reading of (n - 1) / 2 periods ago;
+   the raw reading would let the 85.00 degC spikes into the estimator) */
+static uint32_t reading_age_ms(uint32_t conversion_ms)
+{
+    return (zone_read_delay_ms() - conversion_ms / 2 + ESTIMATOR_SENSOR_LAG_MS
+            + (FILTER_MEDIAN_WINDOW - 1) / 2 * SENSE_PERIOD_MS);
+}
+
+/* relay experiment on zone 0 instead of its controller, blue LED on while it runs */
+static void tune_start(void)
+{
+    pid_tune_config_t config = {
+        .setpoint = CONTROL_SETPOINT_CENTI,
+        .hysteresis = TUNE_HYSTERESIS_CENTI,
+        .out_low = 0,
+        .out_high = 1000,
+        .input_min = TUNE_INPUT_MIN_CENTI,
+        .input_max = TUNE_INPUT_MAX_CENTI,
+        .timeout_samples = TUNE_TIMEOUT_MS / SENSE_PERIOD_MS,
+        .rule = TUNE_RULE,
+    };
+
+    pid_tune_init(&tuner, &config);
+    zones[0].tune = &tuner;
+    tuning = 1;
+    gpio_set(GPIOD, GPIO15);
+}
+
+#ifdef SSD1306_PAGE_MODE
+/* draw the temperature string in ctx, called by ssd1306_render() */
+static void draw_temperature(ssd1306_t* dev, void* ctx)
+{
+    ssd1306_set_cursor(dev, 0, 0);
+    ssd1306_put_str(dev, (char*)ctx, font_7x10);
+}
+#else
+/* update the temperature widgets, only what changed is sent to the display */
+static void show_temperature(float temp)
+{
+    int32_t centi = (int32_t)(temp * 100);
+
+    ssd1306_widget_set_value(&temp_readout, centi);
+    ssd1306_widget_set_value(&temp_bar, centi);
+
+    if (ssd1306_get_power(&display) == SSD1306_POWER_OFF)
+    {
+        /* nobody sees it, the widgets catch up once the display is on again */
+        return;
+    }
+
+    PROF_BEGIN(disp_draw);
+    ssd1306_widget_draw(&display, &temp_readout);
+    ssd1306_widget_draw(&display, &temp_unit);
+    ssd1306_widget_draw(&display, &temp_bar);
+    PROF_END(disp_draw);
+
+    PROF_BEGIN(disp_update);
+    ssd1306_update_dirty(&display);
+    PROF_END(disp_update);
+}
+#endif
+
+
+/* dim / switch off the display after inactivity, a button press or an alarm wakes it */
+static int8_t display_power_update(float temp)
+{
+    uint32_t idle;
+    ssd1306_power_t power = SSD1306_POWER_FULL;
+
+    if ((int32_t)(temp * 100) >= TEMP_ALARM_CENTI)
+    {
+        last_activity = sched_now();
+    }
+
+    idle = sched_now() - last_activity;
+    if (idle >= DISPLAY_OFF_AFTER_MS)
+    {
+        power = SSD1306_POWER_OFF;
+    }
+    else if (idle >= DISPLAY_DIM_AFTER_MS)
+    {
+        power = SSD1306_POWER_DIMMED;
+    }
+
+    if (display_forced >= 0)
+    {
+        power = (ssd1306_power_t)display_forced;
+    }
+
+    /* no bus traffic unless the state changes, the state is kept on a bus error */
+    if (ssd1306_set_power(&display, power) != 0)
+    {
+        /* try again soon rather than a display period later */
+        sched_timer_start(&display_task, DISPLAY_RETRY_MS, DISPLAY_PERIOD_MS);
+        return (-1);
+    }
+
+    return (0);
+}
+
+#ifdef LOW_POWER_SAMPLING
+/* scheduler sleep hook: STOP mode until the next timer is due */
+static uint32_t enter_stop(uint32_t max_ms)
+{
+    if (max_ms < STOP_MIN_MS)
+    {
+        return (0);
+    }
+
+    /* TIM4 halts in STOP, a PWM period would stretch */
+    if (heater_any_on())
+    {
+        return (0);
+    }
+
+    /* the UART would stop with its clock, the frame would be cut */
+    if (telemetry_busy())
+    {
+        return (0);
+    }
+
+#ifdef SSD1306_DOUBLE_BUFFER
+    /* the DMA transfer would stop with the bus clock */
+    if (ssd1306_flush_busy(&display))
+    {
+        return (0);
+    }
+#endif
+
+    return (lowpower_stop(max_ms));
+}
+#endif
 
 void exti0_isr(void)
 {
     exti_reset_request(EXTI0);
-    button_flag = 1;
+    sched_event_set(EVENT_BUTTON);
 }
 
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file main.c
+ * \brief Checks the estimator against a simulated zone with the firmware timing
+ * \details A chamber holds, ramps up, holds and ramps down. The sensor
+ *          follows it with a first order lag, a conversion averages it
+ *          (sampled in the middle) and returns 10 bit steps; the median of
+ *          3 and the estimator get the reading the way zone_sensor_read()
+ *          does, with the reading age of reading_age_ms() in src/main.c.
+ *          The estimate is taken at every read and every display refresh
+ *          between reads and compared with the chamber temperature, next to
+ *          the error of the median reading itself.
+ *
+ *          Exit code 1 when the estimate is not at least CHECK_GAIN times
+ *          closer than the reading on the ramps, or worse while holding.
+ *
+ *          usage: estimator_check [-l sensor_lag_ms] [-r ramp_centi_per_min]
+ *
+ *          -l and -r change the simulated sensor and chamber only, the
+ *          estimator keeps the firmware settings (a wrong lag or a slow ramp
+ *          against the 1/4 degC steps shows how much is left).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <filter/filter.h>
+#include <estimator/estimator.h>
+
+/* firmware settings, as in src/main.c (single zone, 10 bit) */
+#define SENSE_PERIOD_MS			1000
+#define SENSE_CONVERSION_MS		200
+#define DISPLAY_PERIOD_MS		250
+#define FILTER_MEDIAN_WINDOW	3
+#define ESTIMATOR_SENSOR_LAG_MS	3000
+#define ESTIMATOR_NOISE_CENTI	8
+#define ESTIMATOR_RATE_NOISE	1
+#define ESTIMATOR_RATE_INIT		10
+#define ESTIMATOR_STALE_MS		(5 * SENSE_PERIOD_MS)
+
+#define RESOLUTION_CENTI		25		/* 10 bit: 1/4 degC */
+#define HOLD_MS					300000
+#define RAMP_MS					400000
+#define SETTLE_MS				60000	/* not rated after a change of the ramp */
+#define CHECK_GAIN				3.0
+
+/*!
+ * \brief Error sums of one phase kind
+ */
+typedef struct {
+	double reading;
+	double estimate;
+	double estimate_abs;
+	double reading_abs;
+	uint32_t n;
+	uint32_t n_reading;
+} errors_t;
+
+static double chamber(uint32_t ms, double ramp);
+static void rate(errors_t* e, const char* name);
+
+int main(int argc, char** argv)
+{
+	estimator_config_t config = {
+		.noise = ESTIMATOR_NOISE_CENTI,
+		.rate_noise = ESTIMATOR_RATE_NOISE,
+		.rate_init = ESTIMATOR_RATE_INIT,
+		.stale_ms = ESTIMATOR_STALE_MS,
+	};
+	estimator_t est;
+	filter_median_t median;
+	errors_t hold = { 0 };
+	errors_t up = { 0 };
+	errors_t down = { 0 };
+	errors_t* phase;
+	double lag_ms = ESTIMATOR_SENSOR_LAG_MS;
+	double ramp_rate = 1000;	/* 1/100 degC per min */
+	double sensor;
+	double sampled = 0;
+	double truth;
+	int32_t reading = 0;
+	int32_t value;
+	uint32_t end = 2 * HOLD_MS + 2 * RAMP_MS + HOLD_MS;
+	uint32_t since;
+	uint32_t ms;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:r:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'l': lag_ms = atof(optarg); break;
+			case 'r': ramp_rate = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-l sensor_lag_ms] [-r ramp_centi_per_min]\n", argv[0]);
+				return (2);
+		}
+	}
+
+	/* reading_age_ms() for one zone, read in its slot after the conversion */
+	config.delay_ms = SENSE_CONVERSION_MS - SENSE_CONVERSION_MS / 2 + ESTIMATOR_SENSOR_LAG_MS
+			+ (FILTER_MEDIAN_WINDOW - 1) / 2 * SENSE_PERIOD_MS;
+	estimator_init(&est, &config);
+	filter_median_init(&median, FILTER_MEDIAN_WINDOW);
+
+	sensor = chamber(0, ramp_rate);
+	for (ms = 0; ms < end; ms++)
+	{
+		truth = chamber(ms, ramp_rate);
+		sensor += (truth - sensor) / lag_ms;
+
+		/* conversion started at the period, averaged: sampled in the middle */
+		if (ms % SENSE_PERIOD_MS == SENSE_CONVERSION_MS / 2)
+		{
+			sampled = sensor;
+		}
+		if (ms % SENSE_PERIOD_MS == SENSE_CONVERSION_MS)
+		{
+			value = (int32_t)(floor(sampled / RESOLUTION_CENTI + 0.5) * RESOLUTION_CENTI);
+			reading = filter_median_update(&median, value);
+			estimator_correct(&est, ms, reading);
+		}
+
+		if (ms % DISPLAY_PERIOD_MS != SENSE_CONVERSION_MS % DISPLAY_PERIOD_MS
+				|| estimator_get(&est, ms, &value, NULL) != 0)
+		{
+			continue;
+		}
+
+		/* the phase and the time since its start */
+		since = ms % (HOLD_MS + RAMP_MS);
+		phase = (since < HOLD_MS || ms >= end - HOLD_MS) ? &hold : (ms < HOLD_MS + RAMP_MS) ? &up : &down;
+		since = (since >= HOLD_MS) ? since - HOLD_MS : since;
+		if (since < SETTLE_MS)
+		{
+			continue;
+		}
+
+		phase->estimate += value - truth;
+		phase->estimate_abs += fabs(value - truth);
+		phase->n++;
+		if (ms % SENSE_PERIOD_MS == SENSE_CONVERSION_MS)
+		{
+			phase->reading += reading - truth;
+			phase->reading_abs += fabs(reading - truth);
+			phase->n_reading++;
+		}
+	}
+
+	printf("sensor lag %.0f ms, ramps %.0f/100 C per min, reading age %u ms\n",
+			lag_ms, ramp_rate, config.delay_ms);
+	printf("%-6s %16s %16s %16s %16s\n", "phase", "reading mean", "reading |mean|",
+			"estimate mean", "estimate |mean|");
+	rate(&up, "up");
+	rate(&down, "down");
+	rate(&hold, "hold");
+
+	if (up.estimate_abs / up.n * CHECK_GAIN > up.reading_abs / up.n_reading
+			|| down.estimate_abs / down.n * CHECK_GAIN > down.reading_abs / down.n_reading
+			|| hold.estimate_abs / hold.n > hold.reading_abs / hold.n_reading + RESOLUTION_CENTI / 4.0)
+	{
+		printf("estimate not better than the reading\n");
+		return (1);
+	}
+	printf("estimate at least %.0fx closer on the ramps\n", CHECK_GAIN);
+
+	return (0);
+}
+
+/*!
+ * \brief Chamber temperature: hold, ramp up, hold, ramp down, hold
+ * \param[in] ms time
+ * \param[in] ramp 1/100 degC per min
+ * \returns 1/100 degC
+ */
+static double chamber(uint32_t ms, double ramp)
+{
+	double top = 2000 + ramp * RAMP_MS / 60000.0;
+
+	if (ms < HOLD_MS)
+	{
+		return (2000);
+	}
+	ms -= HOLD_MS;
+	if (ms < RAMP_MS)
+	{
+		return (2000 + ramp * ms / 60000.0);
+	}
+	ms -= RAMP_MS;
+	if (ms < HOLD_MS)
+	{
+		return (top);
+	}
+	ms -= HOLD_MS;
+	if (ms < RAMP_MS)
+	{
+		return (top - ramp * ms / 60000.0);
+	}
+
+	return (2000);
+}
+
+/*!
+ * \brief Print the errors of a phase kind, 1/100 degC
+ */
+static void rate(errors_t* e, const char* name)
+{
+	printf("%-6s %16.1f %16.1f %16.1f %16.1f\n", name, e->reading / e->n_reading,
+			e->reading_abs / e->n_reading, e->estimate / e->n, e->estimate_abs / e->n);
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file main.c
+ * \brief Checks the filter kernels against plain reference code and times them
+ * \details A synthetic DS18B20 series (1/100 degC, 1/16 degC steps, drift,
+ *          noise and single sample spikes) runs through every kernel. The
+ *          window kernels must match a brute force result exactly, EMA and
+ *          statistics a double precision result within rounding. Then each
+ *          kernel is timed alone. Exit code 1 on any mismatch.
+ *
+ *          usage: filter_bench [-n samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <filter/filter.h>
+
+#define SAMPLE_MS		1000
+#define EMA_TAU_MS		10000
+#define MINMAX_WINDOW	60
+#define MEDIAN_WINDOW	5
+
+static int32_t* make_series(uint32_t n);
+static uint32_t check(const int32_t* series, uint32_t n);
+static void bench(const int32_t* series, uint32_t n);
+static int cmp_int32(const void* a, const void* b);
+static double now_ns(void);
+static uint64_t cycles(void);
+
+int main(int argc, char** argv)
+{
+	uint32_t n = 1000000;
+	uint32_t errors;
+	int32_t* series;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': n = (uint32_t)strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+				return (2);
+		}
+	}
+
+	series = make_series(n);
+	errors = check(series, n);
+	bench(series, n);
+	free(series);
+
+	if (errors)
+	{
+		printf("%u mismatches\n", errors);
+		return (1);
+	}
+	printf("all kernels match the reference\n");
+
+	return (0);
+}
+
+/*!
+ * \brief Readings: slow swings, 1/16 degC resolution, noise, now and then a spike
+ */
+static int32_t* make_series(uint32_t n)
+{
+	int32_t* series = malloc(n * sizeof(int32_t));
+	uint32_t i;
+	double t;
+
+	srand(1);
+	for (i = 0; i < n; i++)
+	{
+		t = 2500 + 800 * sin(i / 500.0) + 150 * sin(i / 37.0) + (rand() % 21 - 10);
+		series[i] = (int32_t)(floor(t * 16 / 100) * 100 / 16);
+		if (rand() % 200 == 0)
+		{
+			series[i] += (rand() % 2) ? 8500 : -8500;	/* 85.00 degC power-on value and its mirror */
+		}
+	}
+
+	return (series);
+}
+
+/*!
+ * \brief Run all kernels next to reference code
+ * \returns number of mismatches
+ */
+static uint32_t check(const int32_t* series, uint32_t n)
+{
+	filter_ema_t ema;
+	filter_stats_t stats;
+	filter_minmax_t mm;
+	filter_median_t med;
+	int32_t window[MINMAX_WINDOW];
+	double ema_ref = 0, alpha, mean_ref = 0, m2_ref = 0, delta;
+	double worst_ema = 0, worst_mean = 0, worst_var = 0;
+	int32_t lo, hi, got;
+	uint32_t errors = 0;
+	uint32_t i, k, len;
+
+	filter_ema_init(&ema, EMA_TAU_MS, SAMPLE_MS);
+	filter_stats_init(&stats);
+	filter_minmax_init(&mm, MINMAX_WINDOW);
+	filter_median_init(&med, MEDIAN_WINDOW);
+	alpha = (double)SAMPLE_MS / (EMA_TAU_MS + SAMPLE_MS);
+
+	for (i = 0; i < n; i++)
+	{
+		/* EMA */
+		ema_ref = (i == 0) ? series[i] : ema_ref + alpha * (series[i] - ema_ref);
+		got = filter_ema_update(&ema, series[i]);
+		worst_ema = fmax(worst_ema, fabs(got - ema_ref));
+
+		/* Welford */
+		filter_stats_update(&stats, series[i]);
+		delta = series[i] - mean_ref;
+		mean_ref += delta / (i + 1);
+		m2_ref += delta * (series[i] - mean_ref);
+		worst_mean = fmax(worst_mean, fabs(filter_stats_mean(&stats) - mean_ref));
+		if (i > 0)
+		{
+			/* beyond the rounding to whole units */
+			worst_var = fmax(worst_var, (fabs(filter_stats_variance(&stats) - m2_ref / i) - 0.5) / (m2_ref / i + 1));
+		}
+
+		/* window min / max */
+		filter_minmax_update(&mm, series[i]);
+		len = (i + 1 < MINMAX_WINDOW) ? i + 1 : MINMAX_WINDOW;
+		lo = hi = series[i];
+		for (k = 0; k < len; k++)
+		{
+			lo = (series[i - k] < lo) ? series[i - k] : lo;
+			hi = (series[i - k] > hi) ? series[i - k] : hi;
+		}
+		if (filter_minmax_min(&mm) != lo || filter_minmax_max(&mm) != hi)
+		{
+			errors++;
+		}
+
+		/* median */
+		got = filter_median_update(&med, series[i]);
+		len = (i + 1 < MEDIAN_WINDOW) ? i + 1 : MEDIAN_WINDOW;
+		memcpy(window, &series[i + 1 - len], len * sizeof(int32_t));
+		qsort(window, len, sizeof(int32_t), cmp_int32);
+		if (got != window[len / 2])
+		{
+			errors++;
+		}
+	}
+
+	/* rounding of the result, plus the truncation of Q16 steps */
+	if (worst_ema > 1.0 || worst_mean > 1.0 || worst_var > 0.0001)
+	{
+		errors++;
+	}
+
+	printf("ema max error %.2f, mean max error %.2f, variance max rel. error %.6f\n",
+			worst_ema, worst_mean, worst_var);
+
+	return (errors);
+}
+
+/*!
+ * \brief Time per sample of each kernel alone
+ */
+static void bench(const int32_t* series, uint32_t n)
+{
+	static filter_ema_t ema;
+	static filter_stats_t stats;
+	static filter_minmax_t mm;
+	static filter_median_t med;
+	volatile int32_t sink = 0;
+	double start_ns, ns[4];
+	uint64_t start_cycles, cyc[4];
+	uint32_t i;
+
+	filter_ema_init(&ema, EMA_TAU_MS, SAMPLE_MS);
+	filter_stats_init(&stats);
+	filter_minmax_init(&mm, MINMAX_WINDOW);
+	filter_median_init(&med, MEDIAN_WINDOW);
+
+	start_ns = now_ns(); start_cycles = cycles();
+	for (i = 0; i < n; i++) sink = filter_ema_update(&ema, series[i]);
+	ns[0] = now_ns() - start_ns; cyc[0] = cycles() - start_cycles;
+
+	start_ns = now_ns(); start_cycles = cycles();
+	for (i = 0; i < n; i++) filter_stats_update(&stats, series[i]);
+	ns[1] = now_ns() - start_ns; cyc[1] = cycles() - start_cycles;
+
+	start_ns = now_ns(); start_cycles = cycles();
+	for (i = 0; i < n; i++) filter_minmax_update(&mm, series[i]);
+	ns[2] = now_ns() - start_ns; cyc[2] = cycles() - start_cycles;
+
+	start_ns = now_ns(); start_cycles = cycles();
+	for (i = 0; i < n; i++) sink = filter_median_update(&med, series[i]);
+	ns[3] = now_ns() - start_ns; cyc[3] = cycles() - start_cycles;
+
+	(void)sink;
+
+	printf("%-14s %10s %14s\n", "kernel", "ns/sample", "cycles/sample");
+	printf("%-14s %10.1f %14.1f\n", "ema", ns[0] / n, (double)cyc[0] / n);
+	printf("%-14s %10.1f %14.1f\n", "stats", ns[1] / n, (double)cyc[1] / n);
+	printf("%-14s %10.1f %14.1f  (window %d)\n", "minmax", ns[2] / n, (double)cyc[2] / n, MINMAX_WINDOW);
+	printf("%-14s %10.1f %14.1f  (window %d)\n", "median", ns[3] / n, (double)cyc[3] / n, MEDIAN_WINDOW);
+}
+
+static int cmp_int32(const void* a, const void* b)
+{
+	int32_t x = *(const int32_t*)a;
+	int32_t y = *(const int32_t*)b;
+
+	return ((x > y) - (x < y));
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+/*!
+ * \brief Time stamp counter where there is one, else 0
+ */
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__builtin_ia32_rdtsc());
+#else
+	return (0);
+#endif
+}
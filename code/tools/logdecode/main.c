@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file main.c
+ * \brief Decodes a dump of the flash sample log to CSV, benchmarks the codec
+ * \details The dump covers the four log sectors (0x08080000, 512 kB). The
+ *          sectors are read in log order, every record is a codec block
+ *          (see codec.h) or a boot marker; one CSV line per sample: boot,
+ *          time, then one value per zone in degC. Times are uptime in s and
+ *          restart with every boot, the boot number tells the runs apart
+ *          (0 for samples before the first marker in the dump). Damaged
+ *          records are counted and skipped.
+ *
+ *          usage: logdecode dump.bin
+ *                 logdecode -b [-n samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <codec/codec.h>
+
+/* flash log layout, see flashlog.c */
+#define LOG_SECTORS             4
+#define LOG_SECTOR_SIZE         0x20000
+#define LOG_PAGE_SIZE           256
+#define LOG_SECTOR_MAGIC        0x474F4C46u
+#define LOG_PAGE_MAGIC          0xA55Au
+
+#define NO_READING              INT16_MIN   /* failed sensor read */
+#define BOOT_MARKER_LEN         6           /* block count 0, boot number, see main.c of the firmware */
+
+static int decode_dump(const char* path);
+static void decode_record(const uint8_t* data, uint8_t len);
+static int bench(uint32_t samples);
+static int16_t bench_value(uint32_t channel, uint32_t n);
+static uint32_t le32(const uint8_t* p);
+static uint8_t crc8(uint8_t crc, const uint8_t* data, uint32_t len);
+static double now_us(void);
+
+static uint32_t blocks, samples_total, damaged, boots;
+static uint32_t boot;
+
+int main(int argc, char** argv)
+{
+	uint32_t samples = 100000;
+	int run_bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bn:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'b': run_bench = 1; break;
+			case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s dump.bin | -b [-n samples]\n", argv[0]);
+				return (2);
+		}
+	}
+
+	if (run_bench)
+	{
+		return (bench(samples));
+	}
+
+	if (optind >= argc)
+	{
+		fprintf(stderr, "usage: %s dump.bin | -b [-n samples]\n", argv[0]);
+		return (2);
+	}
+
+	return (decode_dump(argv[optind]));
+}
+
+/*!
+ * \brief Walk the log sectors oldest first and decode every record
+ */
+static int decode_dump(const char* path)
+{
+	static uint8_t flash[LOG_SECTORS * LOG_SECTOR_SIZE];
+	uint32_t seq[LOG_SECTORS];
+	uint8_t order[LOG_SECTORS];
+	uint8_t valid = 0;
+	uint32_t s, i, page, offset, used;
+	const uint8_t* sector;
+	const uint8_t* p;
+	uint8_t len, tmp;
+	FILE* f;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		fprintf(stderr, "%s: can not read\n", path);
+		return (1);
+	}
+	memset(flash, 0xFF, sizeof(flash));
+	(void)fread(flash, 1, sizeof(flash), f);
+	fclose(f);
+
+	/* valid sectors, sorted by sequence number */
+	for (s = 0; s < LOG_SECTORS; s++)
+	{
+		sector = &flash[s * LOG_SECTOR_SIZE];
+		if (le32(sector) == LOG_SECTOR_MAGIC && le32(sector + 12) == crc8(0, sector, 12))
+		{
+			seq[valid] = le32(sector + 4);
+			order[valid] = (uint8_t)s;
+			for (i = valid; i > 0 && seq[i - 1] > seq[i]; i--)
+			{
+				tmp = order[i]; order[i] = order[i - 1]; order[i - 1] = tmp;
+				seq[i] ^= seq[i - 1]; seq[i - 1] ^= seq[i]; seq[i] ^= seq[i - 1];
+			}
+			valid++;
+		}
+	}
+
+	for (s = 0; s < valid; s++)
+	{
+		sector = &flash[order[s] * LOG_SECTOR_SIZE];
+
+		for (page = 1; page < LOG_SECTOR_SIZE / LOG_PAGE_SIZE; page++)
+		{
+			p = &sector[page * LOG_PAGE_SIZE];
+			used = p[2] | (p[3] << 8);
+			if ((p[0] | (p[1] << 8)) != LOG_PAGE_MAGIC || used > LOG_PAGE_SIZE - 4)
+			{
+				continue;
+			}
+			p += 4;
+
+			for (offset = 0; offset + 2 <= used; offset += len + 2)
+			{
+				len = p[offset];
+				if (len == 0 || offset + len + 2 > used)
+				{
+					damaged++;
+					break;
+				}
+				if (crc8(0, &p[offset], len + 1) != p[offset + len + 1])
+				{
+					damaged++;
+					continue;
+				}
+				decode_record(&p[offset + 1], len);
+			}
+		}
+	}
+
+	fprintf(stderr, "%u sectors, %u boots, %u blocks, %u samples, %u damaged records\n",
+			valid, boots, blocks, samples_total, damaged);
+
+	return (0);
+}
+
+/*!
+ * \brief One codec block to CSV lines
+ */
+static void decode_record(const uint8_t* data, uint8_t len)
+{
+	codec_dec_t dec;
+	uint32_t time;
+	int16_t values[CODEC_CHANNELS_MAX];
+	uint16_t left;
+	uint8_t i;
+
+	if (len == BOOT_MARKER_LEN && data[0] == 0 && data[1] == 0)
+	{
+		boot = ((uint32_t)data[2] << 24) | ((uint32_t)data[3] << 16) | ((uint32_t)data[4] << 8) | data[5];
+		boots++;
+		return;
+	}
+
+	if (codec_dec_init(&dec, data, len) != 0)
+	{
+		damaged++;
+		return;
+	}
+	blocks++;
+
+	for (left = dec.count; left > 0; left--)
+	{
+		if (codec_dec_get(&dec, &time, values) != 0)
+		{
+			damaged++;
+			break;
+		}
+		printf("%u,%u", boot, time);
+		for (i = 0; i < dec.channels; i++)
+		{
+			if (values[i] == NO_READING)
+			{
+				printf(",");
+			}
+			else
+			{
+				printf(",%.2f", values[i] / 100.0);
+			}
+		}
+		printf("\n");
+		samples_total++;
+	}
+}
+
+/*!
+ * \brief Compression ratio and encode time for 1, 4 and 32 zones
+ * \details DS18B20-like readings: slow drift quantized to 1/16 degC, a
+ *          little noise, now and then a step. Blocks as in the firmware
+ *          (at most 30 samples, FLASHLOG record size). Every block is
+ *          decoded again and compared.
+ */
+static int bench(uint32_t samples)
+{
+	static const uint8_t zone_counts[] = { 1, 4, 32 };
+	uint8_t block[250];
+	int16_t values[CODEC_CHANNELS_MAX];
+	int16_t decoded[CODEC_CHANNELS_MAX];
+	static int16_t history[30][CODEC_CHANNELS_MAX];
+	static uint32_t history_time[30];
+	codec_enc_t enc;
+	codec_dec_t dec;
+	uint32_t time, n, c, k, z, raw, encoded, put;
+	uint16_t len;
+	double start, elapsed;
+	int failed = 0;
+
+	printf("%-6s %10s %10s %8s %10s\n", "zones", "raw", "encoded", "ratio", "ns/sample");
+
+	for (z = 0; z < sizeof(zone_counts); z++)
+	{
+		raw = 0;
+		encoded = 0;
+		elapsed = 0;
+		put = 0;
+		codec_enc_init(&enc, block, sizeof(block), zone_counts[z]);
+
+		for (n = 0; n <= samples; n++)
+		{
+			time = n * 10;
+			for (c = 0; c < zone_counts[z]; c++)
+			{
+				values[c] = bench_value(c, n);
+			}
+
+			start = now_us();
+			if (n == samples || enc.count >= 30 || codec_enc_put(&enc, time, values) != 0)
+			{
+				len = codec_enc_finish(&enc);
+				elapsed += now_us() - start;
+				encoded += len + 2;     /* record length and CRC in the log */
+
+				/* round trip */
+				if (codec_dec_init(&dec, block, len) != 0)
+				{
+					failed = 1;
+				}
+				for (k = 0; k < put; k++)
+				{
+					if (codec_dec_get(&dec, &time, decoded) != 0 || time != history_time[k] ||
+						memcmp(decoded, history[k], zone_counts[z] * sizeof(int16_t)) != 0)
+					{
+						failed = 1;
+					}
+				}
+				if (n == samples)
+				{
+					break;
+				}
+
+				start = now_us();
+				codec_enc_init(&enc, block, sizeof(block), zone_counts[z]);
+				put = 0;
+				time = n * 10;
+				(void)codec_enc_put(&enc, time, values);
+			}
+			elapsed += now_us() - start;
+
+			history_time[put] = time;
+			memcpy(history[put], values, zone_counts[z] * sizeof(int16_t));
+			put++;
+			raw += 4 + 2 * zone_counts[z];
+		}
+
+		printf("%-6u %10u %10u %7.1fx %10.1f\n", zone_counts[z], raw, encoded,
+				(double)raw / encoded, elapsed * 1000.0 / samples);
+	}
+
+	if (failed)
+	{
+		fprintf(stderr, "round trip failed\n");
+	}
+
+	return (failed);
+}
+
+/*!
+ * \brief Synthetic reading of a zone, 1/100 degC
+ */
+static int16_t bench_value(uint32_t channel, uint32_t n)
+{
+	int32_t centi;
+	uint32_t noise = (n * 2654435761u + channel * 40503u) >> 28;
+
+	/* slow swing around 25 degC, a step every 2000 samples */
+	centi = 2500 + (int32_t)((n + channel * 97) % 600) - 300;
+	centi += ((n / 2000) % 2) ? 150 : 0;
+	if (noise == 0)
+	{
+		centi += 7;
+	}
+
+	/* 1/16 degC resolution */
+	return (int16_t)((centi * 16 / 100) * 100 / 16);
+}
+
+/*!
+ * \brief Little endian word
+ */
+static uint32_t le32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/*!
+ * \brief CRC-8, polynomial 0x07, as flashlog.c
+ */
+static uint8_t crc8(uint8_t crc, const uint8_t* data, uint32_t len)
+{
+	uint8_t i;
+
+	while (len--)
+	{
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+		{
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+		}
+	}
+
+	return (crc);
+}
+
+/*!
+ * \brief Monotonic time in microseconds
+ */
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3);
+}
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file main.c
+ * \brief Runs standard render workloads against the emulated SSD1306
+ * \details For every workload the bus traffic and the host run time are
+ *          reported and the resulting panel image can be written to and
+ *          compared with PBM files.
+ *
+ *          usage: ssd1306_emu [-o out_dir] [-g golden_dir] [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <ssd1306/ssd1306.h>
+#ifndef SSD1306_PAGE_MODE
+#include <ssd1306/ssd1306_widget.h>
+#endif
+#include "ssd1306_emu.h"
+
+#define GRAPH_START_PAGE	2
+#define GRAPH_END_PAGE		(SSD1306_PAGES - 1)
+
+typedef struct {
+	const char* name;
+	void (*run)(void);
+	uint32_t updates;	/* transfers to the panel per run */
+} workload_t;
+
+static void workload_text(void);
+static void workload_readout(void);
+static void workload_fill(void);
+static void workload_invert(void);
+static void workload_graph_full(void);
+#ifndef SSD1306_PAGE_MODE
+static void workload_graph_scroll(void);
+static void workload_widgets(void);
+#endif
+static void draw_text(ssd1306_t* dev, void* ctx);
+static void draw_readout(ssd1306_t* dev, void* ctx);
+static void draw_fill(ssd1306_t* dev, void* ctx);
+static void draw_graph(ssd1306_t* dev, void* ctx);
+static uint8_t graph_value(uint32_t step);
+static void graph_draw_column(ssd1306_t* dev, uint8_t x, uint32_t step);
+static double now_us(void);
+
+static ssd1306_hal_t display_hal;
+static ssd1306_t display;
+
+static const workload_t workloads[] = {
+	{ "text",			workload_text,			1 },
+	{ "readout",		workload_readout,		2 },
+	{ "fill",			workload_fill,			1 },
+	{ "invert",			workload_invert,		1 },
+	{ "graph_full",		workload_graph_full,	SSD1306_WIDTH },
+#ifndef SSD1306_PAGE_MODE
+	{ "graph_scroll",	workload_graph_scroll,	SSD1306_WIDTH },
+	{ "widgets",		workload_widgets,		2 },
+#endif
+};
+
+int main(int argc, char** argv)
+{
+	const char* out_dir = NULL;
+	const char* golden_dir = NULL;
+	uint32_t iterations = 100;
+	uint32_t i, n;
+	int opt;
+	int failed = 0;
+	char path[512];
+	FILE* f;
+	ssd1306_hal_stats_t st;
+	uint32_t bus_bytes;
+	int32_t diff;
+	double start;
+
+	while ((opt = getopt(argc, argv, "o:g:n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'o': out_dir = optarg; break;
+			case 'g': golden_dir = optarg; break;
+			case 'n': iterations = (uint32_t)strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-o out_dir] [-g golden_dir] [-n iterations]\n", argv[0]);
+				return (2);
+		}
+	}
+
+	printf("display object: %u bytes\n", (unsigned int)sizeof(ssd1306_t));
+
+	/* I2C bytes: address and control byte per transaction plus payload */
+	printf("%-14s %8s %8s %8s %8s %10s %10s\n",
+			"workload", "trans", "cmd", "data", "i2c", "i2c/upd", "us/run");
+
+	for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+	{
+		ssd1306_emu_reset(&display_hal);
+		ssd1306_init(&display, &display_hal);
+		(void)ssd1306_emu_take_stats(&display_hal);
+
+		workloads[i].run();
+		st = ssd1306_emu_take_stats(&display_hal);
+		bus_bytes = 2 * st.transactions + st.cmd_bytes + st.data_bytes;
+
+		start = now_us();
+		for (n = 0; n < iterations; n++)
+		{
+			workloads[i].run();
+		}
+
+		printf("%-14s %8u %8u %8u %8u %10u %10.1f\n", workloads[i].name,
+				st.transactions, st.cmd_bytes, st.data_bytes, bus_bytes,
+				bus_bytes / workloads[i].updates,
+				iterations ? (now_us() - start) / iterations : 0.0);
+
+		/* image of the first run */
+		ssd1306_emu_reset(&display_hal);
+		ssd1306_init(&display, &display_hal);
+		workloads[i].run();
+
+		if (out_dir != NULL)
+		{
+			snprintf(path, sizeof(path), "%s/%s.pbm", out_dir, workloads[i].name);
+			f = fopen(path, "wb");
+			if (f == NULL || ssd1306_emu_write_pbm(&display_hal, f) != 0)
+			{
+				fprintf(stderr, "%s: can not write\n", path);
+				failed = 1;
+			}
+			if (f != NULL)
+			{
+				fclose(f);
+			}
+		}
+
+		if (golden_dir != NULL)
+		{
+			snprintf(path, sizeof(path), "%s/%s.pbm", golden_dir, workloads[i].name);
+			f = fopen(path, "rb");
+			diff = (f != NULL) ? ssd1306_emu_compare_pbm(&display_hal, f) : -1;
+			if (f != NULL)
+			{
+				fclose(f);
+			}
+			if (diff != 0)
+			{
+				fprintf(stderr, "%s: %s\n", path, diff < 0 ? "missing or invalid" : "differs");
+				if (diff > 0)
+				{
+					fprintf(stderr, "  %d pixels differ\n", diff);
+				}
+				failed = 1;
+			}
+		}
+	}
+
+	return (failed);
+}
+
+/*!
+ * \brief Text in all three fonts
+ */
+static void workload_text(void)
+{
+	ssd1306_render(&display, draw_text, NULL);
+}
+
+/*!
+ * \brief A temperature readout where only the last digit changes
+ */
+static void workload_readout(void)
+{
+	ssd1306_render(&display, draw_readout, "23.5 C");
+	ssd1306_render(&display, draw_readout, "23.6 C");
+}
+
+/*!
+ * \brief Whole screen lit
+ */
+static void workload_fill(void)
+{
+	ssd1306_render(&display, draw_fill, NULL);
+}
+
+/*!
+ * \brief Text with inverted display
+ */
+static void workload_invert(void)
+{
+	ssd1306_invert(&display, 1);
+	workload_text();
+}
+
+/*!
+ * \brief Rolling graph, redrawn and sent as whole pages
+ */
+static void workload_graph_full(void)
+{
+	uint32_t step;
+
+	for (step = 0; step < SSD1306_WIDTH; step++)
+	{
+		ssd1306_render(&display, draw_graph, &step);
+	}
+}
+
+#ifndef SSD1306_PAGE_MODE
+/*!
+ * \brief Rolling graph, shifted by one column at a time and the new column sent
+ * \details Without SSD1306_CONTENT_SCROLL the driver sends the whole window instead.
+ */
+static void workload_graph_scroll(void)
+{
+	uint32_t step;
+
+	for (step = 0; step < SSD1306_WIDTH; step++)
+	{
+		ssd1306_scroll_column(&display, SSD1306_SCROLL_LEFT, GRAPH_START_PAGE, GRAPH_END_PAGE);
+		graph_draw_column(&display, SSD1306_WIDTH - 1, step + SSD1306_WIDTH);
+		ssd1306_update_column(&display, SSD1306_WIDTH - 1, GRAPH_START_PAGE, GRAPH_END_PAGE);
+	}
+}
+
+/*!
+ * \brief The readout workload with widgets, only changed digits and bar columns are sent
+ */
+static void workload_widgets(void)
+{
+	static ssd1306_widget_t readout;
+	static ssd1306_widget_t unit;
+	static ssd1306_widget_t bar;
+	static const int32_t values[] = { 2350, 2360 };
+	uint32_t i;
+
+	ssd1306_widget_readout_init(&readout, 0, 0, 5, 2, font_16x26);
+	ssd1306_widget_label_init(&unit, 96, 0, 1, font_16x26);
+	ssd1306_widget_set_text(&unit, "C");
+	ssd1306_widget_bar_init(&bar, 0, 32, 120, 8, 0, 4000);
+
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		ssd1306_widget_set_value(&readout, values[i]);
+		ssd1306_widget_set_value(&bar, values[i]);
+		ssd1306_widget_draw(&display, &readout);
+		ssd1306_widget_draw(&display, &unit);
+		ssd1306_widget_draw(&display, &bar);
+		ssd1306_update_dirty(&display);
+	}
+}
+#endif
+
+/*!
+ * \brief Draw callback: text in all three fonts
+ */
+static void draw_text(ssd1306_t* dev, void* ctx)
+{
+	(void)ctx;
+
+	ssd1306_set_cursor(dev, 0, 0);
+	ssd1306_put_str(dev, "temp_control", font_7x10);
+	ssd1306_set_cursor(dev, 0, 12);
+	ssd1306_put_str(dev, "23.50 C", font_11x18);
+	ssd1306_set_cursor(dev, 0, 32);
+	ssd1306_put_str(dev, "-4.2", font_16x26);
+}
+
+/*!
+ * \brief Draw callback: the string in ctx in the large font
+ */
+static void draw_readout(ssd1306_t* dev, void* ctx)
+{
+	ssd1306_set_cursor(dev, 0, 0);
+	ssd1306_put_str(dev, (char*)ctx, font_16x26);
+}
+
+/*!
+ * \brief Draw callback: all pixels lit
+ */
+static void draw_fill(ssd1306_t* dev, void* ctx)
+{
+	(void)ctx;
+
+	ssd1306_fill(dev, SSD1306_COLOR_WHITE);
+}
+
+/*!
+ * \brief Draw callback: the graph area at the step ctx points to
+ */
+static void draw_graph(ssd1306_t* dev, void* ctx)
+{
+	uint32_t step = *(uint32_t*)ctx;
+	uint8_t x;
+
+	for (x = 0; x < SSD1306_WIDTH; x++)
+	{
+		graph_draw_column(dev, x, step + x + 1);
+	}
+}
+
+/*!
+ * \brief Sample value of the rolling graph, a triangle wave within the graph area
+ */
+static uint8_t graph_value(uint32_t step)
+{
+	uint32_t height = (GRAPH_END_PAGE - GRAPH_START_PAGE + 1) * 8;
+	uint32_t phase = step % (2 * (height - 1));
+
+	return (uint8_t)(GRAPH_START_PAGE * 8 + (phase < height ? phase : 2 * (height - 1) - phase));
+}
+
+/*!
+ * \brief Draw one column of the graph area
+ */
+static void graph_draw_column(ssd1306_t* dev, uint8_t x, uint32_t step)
+{
+	uint8_t y;
+	uint8_t value = graph_value(step);
+
+	for (y = GRAPH_START_PAGE * 8; y < (GRAPH_END_PAGE + 1) * 8; y++)
+	{
+		ssd1306_draw_pixel(dev, x, y, (y == value) ? SSD1306_COLOR_WHITE : SSD1306_COLOR_BLACK);
+	}
+}
+
+/*!
+ * \brief Monotonic time in microseconds
+ */
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3);
+}
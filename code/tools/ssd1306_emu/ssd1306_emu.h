@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SSD1306_EMU_H_
+#define SSD1306_EMU_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <ssd1306/ssd1306.h>
+#include <ssd1306/ssd1306_hal.h>
+
+/*!
+ * \file ssd1306_emu.h
+ * \brief Host emulation of the SSD1306 controller behind the display HAL
+ * \details The controller always has 128x64 pixels of RAM, the emulated panel
+ *          shows the window of the profile the driver is built for
+ *          (SSD1306_WIDTH x SSD1306_HEIGHT from SSD1306_COLUMN_OFFSET on).
+ */
+
+#define SSD1306_EMU_COLUMNS		128
+#define SSD1306_EMU_PAGES		8
+#define SSD1306_EMU_ROWS		(SSD1306_EMU_PAGES * 8)
+#define SSD1306_EMU_CMD_MAX_ARGS	6
+
+/*!
+ * \brief State of an emulated controller
+ */
+typedef struct {
+	uint8_t ram[SSD1306_EMU_PAGES][SSD1306_EMU_COLUMNS];
+	uint8_t addr_mode;		/* 0 horizontal, 1 vertical, 2 page */
+	uint8_t page;
+	uint8_t column;
+	uint8_t col_start;
+	uint8_t col_end;
+	uint8_t page_start;
+	uint8_t page_end;
+	uint8_t seg_remap;
+	uint8_t com_remap;
+	uint8_t start_line;
+	uint8_t display_offset;
+	uint8_t mux;
+	uint8_t inverted;
+	uint8_t entire_on;
+	uint8_t display_on;
+	uint8_t contrast;
+	uint8_t charge_pump;
+	/* continuous scroll setup */
+	uint8_t scroll_active;
+	uint8_t scroll_cmd;
+	uint8_t scroll_start_page;
+	uint8_t scroll_end_page;
+	uint8_t scroll_interval;
+	uint8_t scroll_vertical_offset;
+	uint32_t scroll_frame_count;
+	/* command decoder */
+	uint8_t cmd;
+	uint8_t cmd_args[SSD1306_EMU_CMD_MAX_ARGS];
+	uint8_t cmd_arg_count;
+	uint8_t cmd_arg_needed;
+} ssd1306_emu_t;
+
+/*!
+ * \brief Interface of one emulated display, one controller per interface
+ */
+struct ssd1306_hal {
+	ssd1306_emu_t emu;
+	ssd1306_hal_stats_t stats;
+	struct ssd1306_hal* next;	/*!< registered controllers, see ssd1306_hal_init() */
+};
+
+/*!
+ * \brief Reset controller state and RAM to power-on values
+ */
+void ssd1306_emu_reset(ssd1306_hal_t* hal);
+
+/*!
+ * \brief Let the controller run for a number of frames (continuous scrolling)
+ */
+void ssd1306_emu_run_frames(ssd1306_hal_t* hal, uint32_t frames);
+
+/*!
+ * \brief Get and clear the bus traffic counters
+ */
+ssd1306_hal_stats_t ssd1306_emu_take_stats(ssd1306_hal_t* hal);
+
+/*!
+ * \brief Get the pixel the viewer sees at x/y
+ * \returns 1 if the pixel is lit, otherwise 0
+ * \details Takes segment/COM remap, start line, inversion and display on/off into
+ *          account. The reference orientation is the one set by ssd1306_init()
+ *          (segment remap and COM scan remap enabled).
+ */
+uint8_t ssd1306_emu_get_pixel(ssd1306_hal_t* hal, uint8_t x, uint8_t y);
+
+/*!
+ * \brief Write the visible panel content as binary PBM (P4)
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_emu_write_pbm(ssd1306_hal_t* hal, FILE* f);
+
+/*!
+ * \brief Compare the visible panel content with a binary PBM (P4)
+ * \returns number of differing pixels, -1 if the file can not be parsed
+ */
+int32_t ssd1306_emu_compare_pbm(ssd1306_hal_t* hal, FILE* f);
+
+#endif /* SSD1306_EMU_H_ */
@@ -0,0 +1,673 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file ssd1306_hal_emu.c
+ * \brief SSD1306 HAL that feeds an emulated controller instead of a bus
+ * \details Commands and display data are decoded the way the controller does it,
+ *          including multi-byte commands split over several transactions.
+ *          Asynchronous transfers complete immediately.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <ssd1306/ssd1306_hal.h>
+#include "ssd1306_emu.h"
+
+/* emulated controllers, advanced together by ssd1306_hal_delay_ms() */
+static ssd1306_hal_t* emu_list = NULL;
+
+/* frames between two scroll steps, indexed by the interval code */
+static const uint16_t scroll_interval_frames[8] = { 5, 64, 128, 256, 3, 4, 25, 2 };
+
+static uint8_t emu_cmd_arg_count(uint8_t cmd);
+static void emu_command(ssd1306_hal_t* hal, uint8_t byte);
+static void emu_execute(ssd1306_hal_t* hal);
+static void emu_data(ssd1306_hal_t* hal, uint8_t byte);
+static void emu_rotate(ssd1306_hal_t* hal, uint8_t start_page, uint8_t end_page, uint8_t start_col, uint8_t end_col,
+		uint8_t right);
+
+/*!
+ * \brief Reset controller state and RAM to power-on values
+ */
+void ssd1306_emu_reset(ssd1306_hal_t* hal)
+{
+	memset(&hal->emu, 0, sizeof(hal->emu));
+	memset(&hal->stats, 0, sizeof(hal->stats));
+
+	/* RAM content is random after power-on, use a pattern that stands out */
+	memset(hal->emu.ram, 0xA5, sizeof(hal->emu.ram));
+
+	hal->emu.addr_mode = 2;
+	hal->emu.col_end = SSD1306_EMU_COLUMNS - 1;
+	hal->emu.page_end = SSD1306_EMU_PAGES - 1;
+	hal->emu.mux = SSD1306_EMU_ROWS - 1;
+	hal->emu.contrast = 0x7F;
+}
+
+/*!
+ * \brief Let the controller run for a number of frames (continuous scrolling)
+ */
+void ssd1306_emu_run_frames(ssd1306_hal_t* hal, uint32_t frames)
+{
+	uint16_t interval;
+
+	if (hal->emu.scroll_active == 0)
+	{
+		return;
+	}
+
+	interval = scroll_interval_frames[hal->emu.scroll_interval & 0x07];
+
+	while (frames--)
+	{
+		hal->emu.scroll_frame_count++;
+		if (hal->emu.scroll_frame_count % interval != 0)
+		{
+			continue;
+		}
+
+		emu_rotate(hal, hal->emu.scroll_start_page, hal->emu.scroll_end_page, 0, SSD1306_EMU_COLUMNS - 1,
+				hal->emu.scroll_cmd == 0x26 || hal->emu.scroll_cmd == 0x29);
+
+		if (hal->emu.scroll_cmd == 0x29 || hal->emu.scroll_cmd == 0x2A)
+		{
+			hal->emu.start_line = (hal->emu.start_line + hal->emu.scroll_vertical_offset) % SSD1306_EMU_ROWS;
+		}
+	}
+}
+
+/*!
+ * \brief Get and clear the bus traffic counters
+ */
+ssd1306_hal_stats_t ssd1306_emu_take_stats(ssd1306_hal_t* hal)
+{
+	ssd1306_hal_stats_t result = hal->stats;
+
+	memset(&hal->stats, 0, sizeof(hal->stats));
+
+	return (result);
+}
+
+/*!
+ * \brief Get the pixel the viewer sees at x/y
+ * \returns 1 if the pixel is lit, otherwise 0
+ */
+uint8_t ssd1306_emu_get_pixel(ssd1306_hal_t* hal, uint8_t x, uint8_t y)
+{
+	uint8_t column;
+	uint8_t com;
+	uint8_t row;
+	uint8_t pixel;
+
+	if (x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT)
+	{
+		return (0);
+	}
+
+	/* the module is mounted so that remapped segments and COMs appear upright */
+	column = hal->emu.seg_remap ? (SSD1306_COLUMN_OFFSET + x) :
+			(SSD1306_EMU_COLUMNS - 1 - SSD1306_COLUMN_OFFSET - x);
+	com = hal->emu.com_remap ? y : (SSD1306_HEIGHT - 1 - y);
+
+	if (hal->emu.display_on == 0 || com > hal->emu.mux)
+	{
+		return (0);
+	}
+
+	row = (com + hal->emu.start_line + hal->emu.display_offset) % SSD1306_EMU_ROWS;
+
+	if (hal->emu.entire_on)
+	{
+		pixel = 1;
+	}
+	else
+	{
+		pixel = (hal->emu.ram[row / 8][column] >> (row % 8)) & 0x01;
+	}
+
+	return (pixel ^ hal->emu.inverted);
+}
+
+/*!
+ * \brief Write the visible panel content as binary PBM (P4)
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_emu_write_pbm(ssd1306_hal_t* hal, FILE* f)
+{
+	uint8_t x, y;
+	uint8_t line[(SSD1306_WIDTH + 7) / 8];
+
+	fprintf(f, "P4\n%d %d\n", SSD1306_WIDTH, SSD1306_HEIGHT);
+
+	for (y = 0; y < SSD1306_HEIGHT; y++)
+	{
+		memset(line, 0, sizeof(line));
+		for (x = 0; x < SSD1306_WIDTH; x++)
+		{
+			/* PBM: 1 is black, a lit pixel is drawn as black ink */
+			line[x / 8] |= ssd1306_emu_get_pixel(hal, x, y) << (7 - (x % 8));
+		}
+		if (fwrite(line, 1, sizeof(line), f) != sizeof(line))
+		{
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Compare the visible panel content with a binary PBM (P4)
+ * \returns number of differing pixels, -1 if the file can not be parsed
+ */
+int32_t ssd1306_emu_compare_pbm(ssd1306_hal_t* hal, FILE* f)
+{
+	int width, height;
+	uint8_t x, y;
+	uint8_t line[(SSD1306_WIDTH + 7) / 8];
+	uint8_t expected;
+	int32_t diff = 0;
+
+	if (fscanf(f, "P4 %d %d", &width, &height) != 2 ||
+		width != SSD1306_WIDTH || height != SSD1306_HEIGHT ||
+		fgetc(f) == EOF)
+	{
+		return (-1);
+	}
+
+	for (y = 0; y < SSD1306_HEIGHT; y++)
+	{
+		if (fread(line, 1, sizeof(line), f) != sizeof(line))
+		{
+			return (-1);
+		}
+		for (x = 0; x < SSD1306_WIDTH; x++)
+		{
+			expected = (line[x / 8] >> (7 - (x % 8))) & 0x01;
+			if (expected != ssd1306_emu_get_pixel(hal, x, y))
+			{
+				diff++;
+			}
+		}
+	}
+
+	return (diff);
+}
+
+/*!
+ * \brief Initialize display interface
+ * \returns 0 if OK, -1 on initialization error
+ */
+int8_t ssd1306_hal_init(ssd1306_hal_t* hal)
+{
+	ssd1306_hal_t* it;
+
+	for (it = emu_list; it != NULL; it = it->next)
+	{
+		if (it == hal)
+		{
+			return (0);
+		}
+	}
+
+	hal->next = emu_list;
+	emu_list = hal;
+
+	return (0);
+}
+
+/*!
+ * \brief Send a command to the display controller
+ * \param[in] cmd	byte to send
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_hal_send_command(ssd1306_hal_t* hal, uint8_t cmd)
+{
+	hal->stats.transactions++;
+	hal->stats.cmd_bytes++;
+	emu_command(hal, cmd);
+
+	return (0);
+}
+
+/*!
+ * \brief Send a stream of commands (including their arguments) to the display controller
+ * \param[in] cmds	pointer to command bytes
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_hal_send_commands(ssd1306_hal_t* hal, const uint8_t* cmds, uint32_t len)
+{
+	uint32_t i;
+
+	hal->stats.transactions++;
+	hal->stats.cmd_bytes += len;
+
+	for (i = 0; i < len; i++)
+	{
+		emu_command(hal, cmds[i]);
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Send data to the display controller
+ * \param[in] data	pointer to buffer
+ * \param[in] len amount of bytes to send
+ * \returns 0 if OK, -1 on IO error
+ */
+int8_t ssd1306_hal_send_data(ssd1306_hal_t* hal, uint8_t* data, uint32_t len)
+{
+	uint32_t i;
+
+	hal->stats.transactions++;
+	hal->stats.data_bytes += len;
+
+	for (i = 0; i < len; i++)
+	{
+		emu_data(hal, data[i]);
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Start sending a stream of commands without blocking
+ * \returns 0 if the transfer was started, -1 if the interface is busy
+ * \details completes immediately
+ */
+int8_t ssd1306_hal_send_commands_async(ssd1306_hal_t* hal, uint8_t* cmds, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	uint32_t i;
+
+	hal->stats.transactions++;
+	hal->stats.cmd_bytes += len;
+
+	for (i = 0; i < len; i++)
+	{
+		emu_command(hal, cmds[i]);
+	}
+
+	if (done_cb != NULL)
+	{
+		done_cb(ctx, 0);
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Start sending data without blocking
+ * \returns 0 if the transfer was started, -1 if the interface is busy
+ * \details completes immediately
+ */
+int8_t ssd1306_hal_send_data_async(ssd1306_hal_t* hal, uint8_t* data, uint32_t len,
+		ssd1306_hal_done_cb_t done_cb, void* ctx)
+{
+	uint32_t i;
+
+	hal->stats.transactions++;
+	hal->stats.data_bytes += len;
+
+	for (i = 0; i < len; i++)
+	{
+		emu_data(hal, data[i]);
+	}
+
+	if (done_cb != NULL)
+	{
+		done_cb(ctx, 0);
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Check for a running asynchronous transfer
+ * \returns always 0
+ */
+uint8_t ssd1306_hal_busy(ssd1306_hal_t* hal)
+{
+	(void)hal;
+
+	return (0);
+}
+
+/*!
+ * \brief Wait for a running asynchronous transfer
+ * \returns always 0
+ */
+int8_t ssd1306_hal_wait(ssd1306_hal_t* hal)
+{
+	(void)hal;
+
+	return (0);
+}
+
+/*!
+ * \brief Get the traffic counters of a display
+ * \returns pointer to the counters
+ */
+ssd1306_hal_stats_t* ssd1306_hal_get_stats(ssd1306_hal_t* hal)
+{
+	return (&hal->stats);
+}
+
+/*!
+ * \brief Free running timestamp for measuring durations
+ * \returns host monotonic time in microseconds
+ */
+uint32_t ssd1306_hal_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint32_t)((uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u));
+}
+
+/*!
+ * \brief Time since a timestamp
+ * \returns microseconds
+ */
+uint32_t ssd1306_hal_elapsed_us(uint32_t since)
+{
+	return (ssd1306_hal_timestamp() - since);
+}
+
+/*!
+ * \brief Blocking millisecond delay
+ * \details the emulated controller runs at about 100 frames per second
+ */
+void ssd1306_hal_delay_ms(uint32_t delay_ms)
+{
+	ssd1306_hal_t* it;
+
+	for (it = emu_list; it != NULL; it = it->next)
+	{
+		ssd1306_emu_run_frames(it, delay_ms / 10);
+	}
+}
+
+/******************************************************************
+* BEGIN OF STATIC FUNCTIONS
+******************************************************************/
+
+/*!
+ * \brief Number of argument bytes following a command byte
+ */
+static uint8_t emu_cmd_arg_count(uint8_t cmd)
+{
+	switch (cmd)
+	{
+		case 0x26:
+		case 0x27:
+#ifdef SSD1306_CONTENT_SCROLL
+		case 0x2C:	/* SSD1306B / SSD1309 only, unknown to a plain SSD1306 */
+		case 0x2D:
+#endif
+			return (6);
+		case 0x29:
+		case 0x2A:
+			return (5);
+		case 0x21:
+		case 0x22:
+		case 0xA3:
+			return (2);
+		case 0x20:
+		case 0x81:
+		case 0x8D:
+		case 0xA8:
+		case 0xAD:
+		case 0xD3:
+		case 0xD5:
+		case 0xD9:
+		case 0xDA:
+		case 0xDB:
+			return (1);
+		default:
+			return (0);
+	}
+}
+
+/*!
+ * \brief Feed one byte of the command stream into the decoder
+ */
+static void emu_command(ssd1306_hal_t* hal, uint8_t byte)
+{
+	if (hal->emu.cmd_arg_needed > 0)
+	{
+		hal->emu.cmd_args[hal->emu.cmd_arg_count++] = byte;
+		hal->emu.cmd_arg_needed--;
+	}
+	else
+	{
+		hal->emu.cmd = byte;
+		hal->emu.cmd_arg_count = 0;
+		hal->emu.cmd_arg_needed = emu_cmd_arg_count(byte);
+	}
+
+	if (hal->emu.cmd_arg_needed == 0)
+	{
+		emu_execute(hal);
+	}
+}
+
+/*!
+ * \brief Execute a complete command
+ */
+static void emu_execute(ssd1306_hal_t* hal)
+{
+	uint8_t cmd = hal->emu.cmd;
+	uint8_t *arg = hal->emu.cmd_args;
+
+	if (cmd <= 0x1F || (cmd >= 0xB0 && cmd <= 0xB7))
+	{
+		/* column start and page start only exist in page addressing mode */
+		if (hal->emu.addr_mode != 2)
+		{
+			return;
+		}
+		if (cmd <= 0x0F)
+		{
+			hal->emu.column = (hal->emu.column & 0xF0) | cmd;
+		}
+		else if (cmd <= 0x1F)
+		{
+			hal->emu.column = (hal->emu.column & 0x0F) | ((cmd & 0x07) << 4);
+		}
+		else
+		{
+			hal->emu.page = cmd & 0x07;
+		}
+	}
+	else if (cmd >= 0x40 && cmd <= 0x7F)
+	{
+		hal->emu.start_line = cmd & 0x3F;
+	}
+	else
+	{
+		switch (cmd)
+		{
+			case 0x20:
+				hal->emu.addr_mode = arg[0] & 0x03;
+				break;
+			case 0x21:
+				hal->emu.col_start = arg[0] & 0x7F;
+				hal->emu.col_end = arg[1] & 0x7F;
+				hal->emu.column = hal->emu.col_start;
+				break;
+			case 0x22:
+				hal->emu.page_start = arg[0] & 0x07;
+				hal->emu.page_end = arg[1] & 0x07;
+				hal->emu.page = hal->emu.page_start;
+				break;
+			case 0x26:
+			case 0x27:
+				hal->emu.scroll_cmd = cmd;
+				hal->emu.scroll_start_page = arg[1] & 0x07;
+				hal->emu.scroll_interval = arg[2] & 0x07;
+				hal->emu.scroll_end_page = arg[3] & 0x07;
+				hal->emu.scroll_vertical_offset = 0;
+				break;
+			case 0x29:
+			case 0x2A:
+				hal->emu.scroll_cmd = cmd;
+				hal->emu.scroll_start_page = arg[1] & 0x07;
+				hal->emu.scroll_interval = arg[2] & 0x07;
+				hal->emu.scroll_end_page = arg[3] & 0x07;
+				hal->emu.scroll_vertical_offset = arg[4] & 0x3F;
+				break;
+#ifdef SSD1306_CONTENT_SCROLL
+			case 0x2C:
+			case 0x2D:
+				if (hal->emu.scroll_active == 0)
+				{
+					emu_rotate(hal, arg[1] & 0x07, arg[3] & 0x07, arg[4] & 0x7F, arg[5] & 0x7F, cmd == 0x2C);
+				}
+				break;
+#endif
+			case 0x2E:
+				hal->emu.scroll_active = 0;
+				break;
+			case 0x2F:
+				hal->emu.scroll_active = 1;
+				hal->emu.scroll_frame_count = 0;
+				break;
+			case 0x81:
+				hal->emu.contrast = arg[0];
+				break;
+			case 0x8D:
+				hal->emu.charge_pump = (arg[0] & 0x04) ? 1 : 0;
+				break;
+			case 0xA0:
+			case 0xA1:
+				hal->emu.seg_remap = cmd & 0x01;
+				break;
+			case 0xA4:
+			case 0xA5:
+				hal->emu.entire_on = cmd & 0x01;
+				break;
+			case 0xA6:
+			case 0xA7:
+				hal->emu.inverted = cmd & 0x01;
+				break;
+			case 0xA8:
+				if ((arg[0] & 0x3F) >= 15)
+				{
+					hal->emu.mux = arg[0] & 0x3F;
+				}
+				break;
+			case 0xAE:
+			case 0xAF:
+				hal->emu.display_on = cmd & 0x01;
+				break;
+			case 0xC0:
+			case 0xC8:
+				hal->emu.com_remap = (cmd == 0xC8) ? 1 : 0;
+				break;
+			case 0xD3:
+				hal->emu.display_offset = arg[0] & 0x3F;
+				break;
+			default:
+				/* timing and analog settings do not change the image */
+				break;
+		}
+	}
+}
+
+/*!
+ * \brief Write one byte of display data and advance the address pointers
+ */
+static void emu_data(ssd1306_hal_t* hal, uint8_t byte)
+{
+	hal->emu.ram[hal->emu.page & 0x07][hal->emu.column & 0x7F] = byte;
+
+	switch (hal->emu.addr_mode)
+	{
+		case 0:		/* horizontal */
+			if (hal->emu.column >= hal->emu.col_end)
+			{
+				hal->emu.column = hal->emu.col_start;
+				hal->emu.page = (hal->emu.page >= hal->emu.page_end) ? hal->emu.page_start : hal->emu.page + 1;
+			}
+			else
+			{
+				hal->emu.column++;
+			}
+			break;
+		case 1:		/* vertical */
+			if (hal->emu.page >= hal->emu.page_end)
+			{
+				hal->emu.page = hal->emu.page_start;
+				hal->emu.column = (hal->emu.column >= hal->emu.col_end) ? hal->emu.col_start : hal->emu.column + 1;
+			}
+			else
+			{
+				hal->emu.page++;
+			}
+			break;
+		default:	/* page */
+			hal->emu.column = (hal->emu.column >= SSD1306_EMU_COLUMNS - 1) ? 0 : hal->emu.column + 1;
+			break;
+	}
+}
+
+/*!
+ * \brief Rotate a window of the RAM by one column
+ * \param[in] right 1: towards higher columns, 0: towards lower columns
+ */
+static void emu_rotate(ssd1306_hal_t* hal, uint8_t start_page, uint8_t end_page, uint8_t start_col, uint8_t end_col,
+		uint8_t right)
+{
+	uint8_t page;
+	uint8_t len;
+	uint8_t wrapped;
+	uint8_t *line;
+
+	if (start_page > end_page || start_col >= end_col)
+	{
+		return;
+	}
+
+	len = end_col - start_col;
+
+	for (page = start_page; page <= end_page; page++)
+	{
+		line = &hal->emu.ram[page][start_col];
+
+		if (right)
+		{
+			wrapped = line[len];
+			memmove(&line[1], &line[0], len);
+			line[0] = wrapped;
+		}
+		else
+		{
+			wrapped = line[0];
+			memmove(&line[0], &line[1], len);
+			line[len] = wrapped;
+		}
+	}
+}
@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2018 Ricardo Beck.
+ *
+ * This file is part of temp_control
+ * (see https://github.com/Spritkopf/temp_control).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*!
+ * \file main.c
+ * \brief Records the telemetry stream of several units at once
+ * \details Every argument is a unit: a serial port (set to raw 8N1 at the
+ *          telemetry baudrate) or a capture file. All units are read in one
+ *          poll() loop, the records go out as CSV lines tagged with the
+ *          unit number, to stdout or to one file per unit (-o). On exit
+ *          (end of all inputs or Ctrl-C) a summary per unit goes to stderr:
+ *          records, damaged frames and records lost (sequence gaps).
+ *
+ *          usage: tlmrec [-s baud] [-o prefix] port|file ...
+ *                 tlmrec -b [-n records]
+ *
+ *          CSV lines:
+ *          zone,unit,time_ms,seq,zone,tune_state,value,setpoint,output,integral,errors,smoothed,
+ *               estimate,rate,read_us
+ *          counters,unit,time_ms,seq,load_permille,tlm_records,tlm_dropped,
+ *                   zone_slot_cycles_max,zone_jitter_us_max,log_records,log_dropped,
+ *                   log_encode_cycles_max
+ *          profile,unit,time_ms,seq,name,count,min,max,total,hist_first,
+ *                  hist0..hist11      (cycles; hist[i]: 2^(hist_first + i) cycles)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <telemetry/telemetry_frame.h>
+
+#define UNITS_MAX		64
+#define READ_SIZE		4096
+
+/*!
+ * \brief One unit, its input and its counters
+ */
+typedef struct {
+	const char* name;
+	int fd;
+	FILE* out;
+	telemetry_decoder_t dec;
+	uint8_t seq_valid;
+	uint16_t seq_next;
+	uint32_t records;
+	uint32_t damaged;
+	uint32_t lost;			/* sequence gaps, dropped in the unit or on the line */
+} unit_t;
+
+static unit_t units[UNITS_MAX];
+static volatile sig_atomic_t stop = 0;
+
+static int unit_open(unit_t* unit, const char* name, speed_t speed, const char* prefix, uint32_t index);
+static void unit_input(unit_t* unit, uint32_t index, const uint8_t* data, ssize_t len);
+static void record_print(FILE* out, uint32_t index, const telemetry_record_t* record);
+static speed_t baud_to_speed(long baud);
+static int bench(uint32_t count);
+static double now_s(void);
+static void on_signal(int sig);
+
+int main(int argc, char** argv)
+{
+	struct pollfd fds[UNITS_MAX];
+	uint8_t data[READ_SIZE];
+	const char* prefix = NULL;
+	speed_t speed = B921600;
+	uint32_t count = 1000000;
+	uint32_t n = 0;
+	uint32_t open_units;
+	uint32_t i;
+	ssize_t len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:o:bn:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				speed = baud_to_speed(strtol(optarg, NULL, 0));
+				if (speed == B0)
+				{
+					fprintf(stderr, "unsupported baudrate %s\n", optarg);
+					return (2);
+				}
+				break;
+			case 'o': prefix = optarg; break;
+			case 'b': return (bench(count));
+			case 'n': count = (uint32_t)strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-s baud] [-o prefix] port|file ... | -b [-n records]\n", argv[0]);
+				return (2);
+		}
+	}
+
+	if (optind >= argc || argc - optind > UNITS_MAX)
+	{
+		fprintf(stderr, "usage: %s [-s baud] [-o prefix] port|file ... (at most %d)\n", argv[0], UNITS_MAX);
+		return (2);
+	}
+
+	for (; optind < argc; optind++, n++)
+	{
+		if (unit_open(&units[n], argv[optind], speed, prefix, n) != 0)
+		{
+			return (1);
+		}
+		fds[n].fd = units[n].fd;
+		fds[n].events = POLLIN;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	open_units = n;
+	while (!stop && open_units > 0)
+	{
+		if (poll(fds, n, 500) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (fds[i].fd < 0 || (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+			{
+				continue;
+			}
+
+			len = read(fds[i].fd, data, sizeof(data));
+			if (len > 0)
+			{
+				unit_input(&units[i], i, data, len);
+			}
+			else if (len == 0 || errno != EAGAIN)
+			{
+				/* end of a capture file or port gone */
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				open_units--;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		fprintf(stderr, "unit %u %s: %u records, %u damaged frames, %u lost\n", i, units[i].name,
+				units[i].records, units[i].damaged, units[i].lost);
+		if (units[i].out != stdout)
+		{
+			fclose(units[i].out);
+		}
+	}
+	fflush(stdout);
+
+	return (0);
+}
+
+/*!
+ * \brief Open the input of a unit, set up a serial port, open the output
+ */
+static int unit_open(unit_t* unit, const char* name, speed_t speed, const char* prefix, uint32_t index)
+{
+	struct termios tio;
+	char path[1024];
+
+	unit->name = name;
+	unit->out = stdout;
+	telemetry_decoder_init(&unit->dec);
+
+	unit->fd = open(name, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if (unit->fd < 0)
+	{
+		perror(name);
+		return (-1);
+	}
+
+	if (isatty(unit->fd))
+	{
+		if (tcgetattr(unit->fd, &tio) != 0)
+		{
+			perror(name);
+			return (-1);
+		}
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		if (tcsetattr(unit->fd, TCSANOW, &tio) != 0)
+		{
+			perror(name);
+			return (-1);
+		}
+		tcflush(unit->fd, TCIFLUSH);
+	}
+
+	if (prefix != NULL)
+	{
+		snprintf(path, sizeof(path), "%sunit%u.csv", prefix, index);
+		unit->out = fopen(path, "w");
+		if (unit->out == NULL)
+		{
+			perror(path);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*!
+ * \brief Decode received bytes, print the records, count gaps
+ */
+static void unit_input(unit_t* unit, uint32_t index, const uint8_t* data, ssize_t len)
+{
+	telemetry_record_t record;
+	ssize_t i;
+	int8_t result;
+
+	for (i = 0; i < len; i++)
+	{
+		result = telemetry_decoder_feed(&unit->dec, data[i], &record);
+		if (result < 0)
+		{
+			unit->damaged++;
+			continue;
+		}
+		if (result == 0)
+		{
+			continue;
+		}
+
+		if (unit->seq_valid)
+		{
+			/* a unit restart starts at 0 again, that is not a gap */
+			if (record.seq != 0)
+			{
+				unit->lost += (uint16_t)(record.seq - unit->seq_next);
+			}
+		}
+		unit->seq_valid = 1;
+		unit->seq_next = record.seq + 1;
+		unit->records++;
+
+		record_print(unit->out, index, &record);
+	}
+}
+
+/*!
+ * \brief One record as a CSV line
+ */
+static void record_print(FILE* out, uint32_t index, const telemetry_record_t* record)
+{
+	telemetry_zone_t zone;
+	telemetry_counters_t counters;
+	telemetry_profile_t profile;
+	uint8_t i;
+
+	if (record->type == TELEMETRY_REC_ZONE && record->len == sizeof(zone))
+	{
+		memcpy(&zone, record->payload, sizeof(zone));
+		fprintf(out, "zone,%u,%llu,%u,%u,%u,%d,%d,%d,%d,%u,%d,%d,%d,%llu\n", index,
+				(unsigned long long)record->time, record->seq,
+				zone.zone, zone.tune_state, zone.value, zone.setpoint, zone.output,
+				zone.integral, zone.errors, zone.smoothed, zone.estimate, zone.rate,
+				(unsigned long long)zone.read_us);
+	}
+	else if (record->type == TELEMETRY_REC_COUNTERS && record->len == sizeof(counters))
+	{
+		memcpy(&counters, record->payload, sizeof(counters));
+		fprintf(out, "counters,%u,%llu,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", index,
+				(unsigned long long)record->time, record->seq,
+				counters.load_permille, counters.tlm_records, counters.tlm_dropped,
+				counters.zone_slot_cycles_max, counters.zone_jitter_us_max,
+				counters.log_records, counters.log_dropped, counters.log_encode_cycles_max);
+	}
+	else if (record->type == TELEMETRY_REC_PROFILE && record->len == sizeof(profile))
+	{
+		memcpy(&profile, record->payload, sizeof(profile));
+		profile.name[sizeof(profile.name) - 1] = '\0';
+		fprintf(out, "profile,%u,%llu,%u,%s,%u,%u,%u,%llu,%u", index,
+				(unsigned long long)record->time, record->seq,
+				profile.name, profile.count, profile.min, profile.max,
+				(unsigned long long)profile.total, profile.hist_first);
+		for (i = 0; i < TELEMETRY_PROFILE_BINS; i++)
+		{
+			fprintf(out, ",%u", profile.hist[i]);
+		}
+		fprintf(out, "\n");
+	}
+	else
+	{
+		fprintf(out, "unknown,%u,%llu,%u,%u,%u\n", index, (unsigned long long)record->time, record->seq,
+				record->type, record->len);
+	}
+}
+
+static speed_t baud_to_speed(long baud)
+{
+	switch (baud)
+	{
+		case 115200: return (B115200);
+		case 230400: return (B230400);
+		case 460800: return (B460800);
+		case 921600: return (B921600);
+		default: return (B0);
+	}
+}
+
+/*!
+ * \brief Decode rate: frames built with the firmware encoder, fed byte by byte
+ * \details Every 100th frame gets a flipped bit, it must be reported damaged
+ *          (twice if the bit makes a 0, which splits the frame) and show up as
+ *          one lost record in the next one.
+ */
+static int bench(uint32_t count)
+{
+	static uint8_t stream[1 << 20];
+	telemetry_decoder_t dec;
+	telemetry_record_t record;
+	telemetry_zone_t zone;
+	uint32_t produced = 0;
+	uint32_t decoded = 0;
+	uint32_t damaged = 0;
+	uint32_t lost = 0;
+	uint32_t corrupted = 0;
+	uint16_t seq_next = 0;
+	uint64_t bytes = 0;
+	size_t fill, i;
+	uint16_t len;
+	double elapsed = 0;
+	double start;
+	int8_t result;
+
+	telemetry_decoder_init(&dec);
+	memset(&zone, 0, sizeof(zone));
+
+	while (produced < count)
+	{
+		/* a chunk of frames */
+		fill = 0;
+		while (produced < count && fill + TELEMETRY_FRAME_MAX <= sizeof(stream))
+		{
+			zone.zone = (uint8_t)(produced % 4);
+			zone.value = 2500 + (int32_t)(produced % 97);
+			zone.output = (int32_t)(produced % 1000);
+			len = telemetry_frame_encode(&stream[fill], TELEMETRY_REC_ZONE, (uint16_t)produced,
+					produced * 10, &zone, sizeof(zone));
+			if (produced % 100 == 50)
+			{
+				stream[fill + 5] ^= 0x10;
+				corrupted++;
+			}
+			fill += len;
+			produced++;
+		}
+
+		start = now_s();
+		for (i = 0; i < fill; i++)
+		{
+			result = telemetry_decoder_feed(&dec, stream[i], &record);
+			if (result < 0)
+			{
+				damaged++;
+			}
+			else if (result > 0)
+			{
+				lost += (uint16_t)(record.seq - seq_next);
+				seq_next = record.seq + 1;
+				decoded++;
+			}
+		}
+		elapsed += now_s() - start;
+		bytes += fill;
+	}
+
+	printf("%u records, %llu bytes, %u damaged, %u lost\n", decoded, (unsigned long long)bytes, damaged, lost);
+	printf("%.0f records/s, %.1f MB/s (921600 baud carries %.0f records/s)\n",
+			decoded / elapsed, bytes / elapsed / 1e6, 92160.0 * count / bytes);
+
+	return ((damaged >= corrupted && lost == corrupted && decoded + corrupted == count) ? 0 : 1);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}